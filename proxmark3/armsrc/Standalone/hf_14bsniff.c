@@ -72,7 +72,7 @@ void RunMod(void) {
     rdv40_spiffs_lazy_mount();
 #endif
 
-    SniffIso14443b();
+    SniffIso14443b(0);
 
     Dbprintf("Stopped sniffing");
     SpinDelay(200);
@@ -335,7 +335,7 @@ void RunMod(void) {
             SniffIso14443a(0);
             break;
         case HF_UNISNIFF_PROTO_14B:
-            SniffIso14443b();
+            SniffIso14443b(0);
             break;
         case HF_UNISNIFF_PROTO_15:
             SniffIso15693(0, NULL, false);
@@ -68,6 +68,7 @@
 
 // Add by jev
 #include "calypsosim.h"
+#include "lz4.h"           // compressed BigBuf download
 #include "pyclient_handler.h"
 #include "../include/proxmark3_arm.h" // for Led control
 
@@ -451,6 +452,28 @@ static void SendStatus(uint32_t wait) {
     reply_ng(CMD_STATUS, PM3_SUCCESS, NULL, 0);
 }
 
+// Send a BigBuf range as independent LZ4 blocks, each filling one MIX frame.
+// LF samples and trace logs are very repetitive, so this cuts down transfer time on slow links (FPC, BT)
+// arg0 = offset of the block, arg1 = uncompressed length of the block, arg2 = tracelen
+static int DownloadBigBufLZ4(const uint8_t *mem, uint32_t numofbytes, uint32_t tracelen) {
+    uint8_t out[PM3_CMD_DATA_SIZE_MIX];
+    uint32_t i = 0;
+    while (i < numofbytes) {
+        int srclen = numofbytes - i;
+        int complen = LZ4_compress_destSize((const char *)mem + i, (char *)out, &srclen, sizeof(out));
+        if (complen <= 0 || srclen <= 0) {
+            return PM3_ESOFT;
+        }
+
+        int res = reply_mix(CMD_DOWNLOADED_BIGBUF_LZ4, i, srclen, tracelen, out, complen);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+        i += srclen;
+    }
+    return PM3_SUCCESS;
+}
+
 static void SendCapabilities(void) {
     capabilities_t capabilities;
     capabilities.version = CAPABILITIES_VERSION;
@@ -801,6 +824,19 @@ static void PacketReceived(PacketCommandNG *packet) {
         SimulateCalypsoTag(packet->data.asBytes);
         break;
     }
+    case CMD_HF_CALYPSO_EML_MEMSET: {
+        // card profile for SimulateCalypsoTag, see calypso_profile.h
+        FpgaDownloadAndGo(FPGA_BITSTREAM_HF);
+        struct p {
+            uint32_t offset;
+            uint16_t count;
+            uint8_t data[];
+        } PACKED;
+        struct p* payload = (struct p*)packet->data.asBytes;
+        int res = emlSet(payload->data, payload->offset, payload->count);
+        reply_ng(CMD_HF_CALYPSO_EML_MEMSET, res, NULL, 0);
+        break;
+    }
     case CMD_PY_INITCALYPSO: {
         InitCalypso(packet->data.asBytes);
         break;
@@ -1549,12 +1585,27 @@ static void PacketReceived(PacketCommandNG *packet) {
         break;
     }
     case CMD_HF_ISO14443B_SNIFF: {
-        SniffIso14443b();
-        reply_ng(CMD_HF_ISO14443B_SNIFF, PM3_SUCCESS, NULL, 0);
+        int res = SniffIso14443b((packet->length) ? packet->data.asBytes[0] : 0);
+        reply_ng(CMD_HF_ISO14443B_SNIFF, res, NULL, 0);
         break;
     }
     case CMD_HF_ISO14443B_SIMULATE: {
-        SimulateIso14443bTag(packet->data.asBytes);
+        // PUPI alone from older clients
+        iso14b_sim_t* payload = (iso14b_sim_t*)packet->data.asBytes;
+        SimulateIso14443bTag(payload->pupi, (packet->length >= sizeof(iso14b_sim_t)) ? payload->flags : 0);
+        break;
+    }
+    case CMD_HF_ISO14443B_EML_SETMEM: {
+        // ISO7816 file system for SimulateIso14443bTag, see iso7816_fs.h
+        FpgaDownloadAndGo(FPGA_BITSTREAM_HF);
+        struct p {
+            uint32_t offset;
+            uint16_t count;
+            uint8_t data[];
+        } PACKED;
+        struct p* payload = (struct p*)packet->data.asBytes;
+        int res = emlSet(payload->data, payload->offset, payload->count);
+        reply_ng(CMD_HF_ISO14443B_EML_SETMEM, res, NULL, 0);
         break;
     }
     case CMD_HF_ISO14443B_COMMAND: {
@@ -2404,9 +2455,19 @@ static void PacketReceived(PacketCommandNG *packet) {
 
         // arg0 = startindex
         // arg1 = length bytes to transfer
-        // arg2 = BigBuf tracelen
+        // arg2 = flags
         //Dbprintf("transfer to client parameters: %" PRIu32 " | %" PRIu32 " | %" PRIu32, startidx, numofbytes, packet->oldarg[2]);
 
+        if (packet->oldarg[2] & DOWNLOAD_BIGBUF_FLAG_LZ4) {
+            int res = DownloadBigBufLZ4(mem + startidx, numofbytes, BigBuf_get_traceLen());
+            if (res != PM3_SUCCESS)
+                Dbprintf("compressed transfer to client failed :: result: %d", res);
+
+            reply_mix(CMD_ACK, (res == PM3_SUCCESS), 0, BigBuf_get_traceLen(), getSamplingConfig(), sizeof(sample_config));
+            LED_B_OFF();
+            break;
+        }
+
         for (size_t i = 0; i < numofbytes; i += PM3_CMD_DATA_SIZE) {
             size_t len = MIN((numofbytes - i), PM3_CMD_DATA_SIZE);
             int result = reply_old(CMD_DOWNLOADED_BIGBUF, i, len, BigBuf_get_traceLen(), mem + startidx + i, len);
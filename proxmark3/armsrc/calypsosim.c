@@ -28,6 +28,7 @@
 #include "calypsosim.h"    // defines for ISO14443B
 #include <stdio.h>
 #include "pyclient_handler.h"
+#include "calypso_profile.h"
 
 
 
@@ -114,10 +115,6 @@ static void Uart14bInit(uint8_t* data) {
 
 
 
-// Pour la synchronisation
-static int lastState = -1; // Pour suivre l'etat pr�c�dent de la carte
-
-
 static WTXFrame create_WTX_command(uint8_t wtxm) {
     WTXFrame wtx_command;
 
@@ -243,59 +240,225 @@ void add_crc_and_update_trame(CalypsoFrame* entry) {
 
 
 
-static void Send_WTX(uint8_t* encodedData, uint16_t encodedDataLen, uint8_t* logData, uint16_t logDataLen, int state) {
-    uint32_t sof_time = GetCountUS();
-    TransmitFor14443b_AsTag(encodedData, encodedDataLen);
-    uint32_t eof_time = GetCountUS();
-    LogTrace(logData, logDataLen, sof_time, eof_time, NULL, false);
-    lastState = state;
+//-----------------------------------------------------------------------------
+// Pool of pre-encoded tag responses. Frames are encoded when the simulation
+// starts, or when the relayed answer arrives, so that answering the reader
+// is only TransmitFor14443b_AsTag().
+//-----------------------------------------------------------------------------
+bool calypso_pool_init(CalypsoEncPool* pool, uint32_t size) {
+    pool->used = 0;
+    pool->size = 0;
+    pool->base = (size && size <= 0xFFFF) ? BigBuf_malloc(size) : NULL;
+    if (pool->base == NULL) {
+        return false;
+    }
+    pool->size = size;
+    return true;
 }
 
+// room for a frame of up to maxlen bytes, filled by calypso_frame_encode()
+bool calypso_pool_reserve(CalypsoEncPool* pool, uint16_t maxlen, CalypsoEncFrame* out) {
+    memset(out, 0, sizeof(CalypsoEncFrame));
+
+    uint32_t need = CALYPSO_POOL_NEED(maxlen);
+    if (pool->base == NULL || pool->used + need > pool->size) {
+        return false;
+    }
+    out->data = pool->base + pool->used;
+    out->encoded = out->data + CALYPSO_POOL_ALIGN(maxlen);
+    out->capacity = maxlen;
+    pool->used += need;
+    return true;
+}
 
-static void process_and_send_frame(CalypsoFrame* frame, uint8_t* receivedCmd, size_t len) {
-    uint64_t sof_time = GetCountUS();
+bool calypso_frame_encode(CalypsoEncFrame* f, const uint8_t* frame, uint16_t len) {
+    if (f->data == NULL || len > f->capacity) {
+        return false;
+    }
 
-    if (frame->pcb_added == false) {
-        add_pcb(frame, receivedCmd, len);
+    CodeIso14443bAsTag(frame, len);
+    const tosend_t* ts = get_tosend();
+    if (ts->max > CALYPSO_ENC_LEN(f->capacity)) {
+        return false;
     }
 
-    if (frame->crc_added == false) {
+    memmove(f->data, frame, len);
+    memcpy(f->encoded, ts->buf, ts->max);
+    f->dataLen = len;
+    f->encodedLen = ts->max;
+    return true;
+}
+
+bool calypso_pool_encode(CalypsoEncPool* pool, const uint8_t* frame, uint16_t len, CalypsoEncFrame* out) {
+    return calypso_pool_reserve(pool, len, out) && calypso_frame_encode(out, frame, len);
+}
+
 
-        // Ajouter CRC et mettre � jour la trame
-        add_crc_and_update_trame(frame);
+// keep this much BigBuf for the trace when sizing the response pool
+#define CALYPSO_TRACE_RESERVE   4096
+
+// Every answer of the profile, encoded for both block numbers (PCB 02 / 03).
+// Entries answering the same bytes share their frames.
+static struct {
+    CalypsoEncPool pool;
+    CalypsoEncFrame (*resp)[2];
+    uint16_t* entry_resp;           // entry index -> resp index
+    uint16_t cached;                // frames encoded in the pool
+    CalypsoEncFrame sw[CALYPSO_SW_COUNT][2];
+    const CalypsoEncFrame* last;    // last I-block sent, an R(NAK) asks for it again
+} calypso_cache;
+
+// last I-block sent when it was not in the pool (CID / NAD present, or pool full)
+static uint8_t calypso_last_resp[MAX_FRAME_SIZE];
+static uint16_t calypso_last_resp_len = 0;
+
+static const calypso_profile_hdr_t* calypso_profile_get(void) {
+    return calypso_profile_check(BigBuf_get_EM_addr(), CARD_MEMORY_SIZE);
+}
+
+// Encode all the answers of the profile in one BigBuf arena, sized to keep
+// CALYPSO_TRACE_RESERVE for the trace. What does not fit is encoded when answered.
+static void calypso_cache_init(const calypso_profile_hdr_t* hdr) {
+    memset(&calypso_cache, 0, sizeof(calypso_cache));
+
+    const calypso_profile_entry_t* entries = calypso_profile_entries(hdr);
+    uint16_t count = hdr->entry_count;
+
+    calypso_cache.entry_resp = (uint16_t*)BigBuf_malloc(count * sizeof(uint16_t));
+    if (calypso_cache.entry_resp == NULL) {
+        return;
     }
 
-    // Encoder les donn�es selon ISO 14443b
-    CodeIso14443bAsTag(frame->data, frame->dataSize);
+    uint16_t distinct = 0;
+    uint32_t need = CALYPSO_SW_COUNT * 2 * CALYPSO_POOL_NEED(1 + 2 + 2);
+    for (uint16_t i = 0; i < count; i++) {
+        calypso_cache.entry_resp[i] = distinct;
+        for (uint16_t j = 0; j < i; j++) {
+            if (entries[j].resp_offset == entries[i].resp_offset && entries[j].resp_len == entries[i].resp_len) {
+                calypso_cache.entry_resp[i] = calypso_cache.entry_resp[j];
+                break;
+            }
+        }
+        if (calypso_cache.entry_resp[i] == distinct) {
+            distinct++;
+            need += 2 * CALYPSO_POOL_NEED(1 + entries[i].resp_len + 2);
+        }
+    }
 
-    // Allouer de la m�moire pour les donn�es encod�es
-    tosend_t* ts = get_tosend();
-    frame->encodedData = BigBuf_malloc(ts->max);
-    if (frame->encodedData == NULL) {
-        Dbprintf("Erreur : Impossible d'allouer de la m�moire pour les donn�es encod�es.\n");
+    calypso_cache.resp = (CalypsoEncFrame(*)[2])BigBuf_calloc(distinct * sizeof(*calypso_cache.resp));
+    if (calypso_cache.resp == NULL) {
+        calypso_cache.entry_resp = NULL;
         return;
     }
-    frame->encodedDataLen = ts->max;
-    memcpy(frame->encodedData, ts->buf, ts->max);
 
-    // Transmettre les donn�es encod�es
-    TransmitFor14443b_AsTag(frame->encodedData, frame->encodedDataLen);
+    uint32_t avail = BigBuf_max_traceLen();
+    avail = (avail > CALYPSO_TRACE_RESERVE) ? avail - CALYPSO_TRACE_RESERVE : 0;
+    if (calypso_pool_init(&calypso_cache.pool, MIN(need, avail)) == false) {
+        return;
+    }
 
-    // Lib�rer la m�moire allou�e
-    BigBuf_free();
+    uint8_t frame[MAX_FRAME_SIZE];
+
+    for (uint8_t s = 0; s < CALYPSO_SW_COUNT; s++) {
+        for (uint8_t v = 0; v < 2; v++) {
+            frame[0] = 0x02 | v;
+            frame[1] = calypso_profile_sw[s] >> 8;
+            frame[2] = calypso_profile_sw[s] & 0xFF;
+            AddCrc14B(frame, 3);
+            if (calypso_pool_encode(&calypso_cache.pool, frame, 5, &calypso_cache.sw[s][v])) {
+                calypso_cache.cached++;
+            }
+        }
+    }
 
-    uint64_t eof_time = GetCountUS();
+    for (uint16_t i = 0; i < count; i++) {
+        CalypsoEncFrame* r = calypso_cache.resp[calypso_cache.entry_resp[i]];
+        if (r[0].capacity) {
+            continue;
+        }
+        const calypso_profile_entry_t* e = &entries[i];
+        if (e->resp_offset + e->resp_len > hdr->size) {
+            continue;
+        }
+        for (uint8_t v = 0; v < 2; v++) {
+            frame[0] = 0x02 | v;
+            memcpy(frame + 1, (const uint8_t*)hdr + e->resp_offset, e->resp_len);
+            AddCrc14B(frame, 1 + e->resp_len);
+            if (calypso_pool_encode(&calypso_cache.pool, frame, 1 + e->resp_len + 2, &r[v])) {
+                calypso_cache.cached++;
+            }
+        }
+    }
+}
+
+static void calypso_send_frame(const CalypsoEncFrame* f) {
+    uint32_t sof_time = GetCountUS();
+    TransmitFor14443b_AsTag(f->encoded, f->encodedLen);
+    uint32_t eof_time = GetCountUS();
+    LogTrace(f->data, f->dataLen, sof_time, eof_time, NULL, false);
+}
 
-    // Enregistrer la trace du log avec les timestamps
-    LogTrace(frame->data, frame->dataSize, sof_time, eof_time, NULL, false);
+static void calypso_transmit(const uint8_t* resp, uint16_t len) {
+    CodeIso14443bAsTag(resp, len);
+    const tosend_t* ts = get_tosend();
+    uint32_t sof_time = GetCountUS();
+    TransmitFor14443b_AsTag(ts->buf, ts->max);
+    uint32_t eof_time = GetCountUS();
+    LogTrace(resp, len, sof_time, eof_time, NULL, false);
 }
 
+// Answer an I-block (PCB [CID] [NAD] APDU CRC) from the card profile,
+// with the usual status word when the profile has no answer for it.
+static void calypso_answer_apdu(const calypso_profile_hdr_t* hdr, calypso_sel_t* sel, const uint8_t* cmd, uint16_t len) {
 
+    uint8_t hlen = 1 + ((cmd[0] & 0x08) ? 1 : 0) + ((cmd[0] & 0x04) ? 1 : 0);
+    if (len < hlen + 4 + 2) {
+        return;
+    }
 
-void SimulateCalypsoTag(const uint8_t* pupi) {
+    const uint8_t* apdu = cmd + hlen;
+    uint8_t ins = apdu[1];
+    const calypso_profile_entry_t* e = calypso_profile_resolve(hdr, sel, apdu, len - hlen - 2);
+
+    // pre-encoded answer, plain I-block only
+    const CalypsoEncFrame* f = NULL;
+    if (hlen == 1) {
+        uint8_t v = cmd[0] & 0x01;
+        if (e == NULL) {
+            f = &calypso_cache.sw[calypso_profile_sw_index(ins)][v];
+        }
+        else if (calypso_cache.entry_resp) {
+            f = &calypso_cache.resp[calypso_cache.entry_resp[e - calypso_profile_entries(hdr)]][v];
+        }
+        if (f && f->encoded == NULL) {
+            f = NULL;
+        }
+    }
+
+    if (f) {
+        calypso_send_frame(f);
+    }
+    else {
+        calypso_last_resp_len = calypso_profile_build(hdr, e, cmd, hlen, calypso_last_resp);
+        calypso_transmit(calypso_last_resp, calypso_last_resp_len);
+    }
+    calypso_cache.last = f;
+
+    calypso_profile_select(sel, e);
+}
 
-    // uint32_t fwt = 0; // Pour un test sur le temps de r�ponse en vue de trouver la bonne valeur de FWT
 
+void SimulateCalypsoTag(const uint8_t* pupi) {
+
+    // card profile loaded in emulator memory by the client
+    const calypso_profile_hdr_t* profile = calypso_profile_get();
+    if (profile == NULL) {
+        DbpString("No Calypso card profile in emulator memory, load one with " _YELLOW_("scard eload"));
+        return;
+    }
+    if (g_dbglevel >= DBG_INFO) {
+        Dbprintf("Calypso profile, %u entries, %u bytes", profile->entry_count, profile->size);
+    }
 
     LED_A_ON();
     // Initialize Demod and Uart structs
@@ -347,42 +510,6 @@ void SimulateCalypsoTag(const uint8_t* pupi) {
     };
     // response to HLTB and ATTRIB
     uint8_t respOK[] = { 0x00, 0x78,  0xF0 };
-    uint8_t resp_get_data[] = { 0x6B, 0x00 };
-    uint8_t respFILE_NOT_FOUND[] = { 0x6A, 0x82 };
-    // uint8_t respd[] = { 0x6A, 0x82 };
-    uint8_t respe[] = { 0xA3,  0xE9,  0x67 };
-
-    uint8_t resp_rec_mul[] = { 0xA2 };
-
-    //uint8_t resp_select_null[] = { 0x6A,  0x82 };
-
-    uint8_t respNO_MORE_RECORD[] = { 0x6A, 0x83 };
-
-    // reponse aux commandes APDU (Based on Cardpeek)
-    /*
-    uint8_t VOID_REP_02[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x90, 0x00, 0xE9, 0x3A
-
-    };
-    uint8_t VOID_REP_03[] = { 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x90, 0x00, 0x8B, 0x4D
-    };
-    */
-    uint8_t respAID_3F04[] = { 0x33, 0x4D, 0x54, 0x52, 0x2E, 0x49, 0x43, 0x41, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x90, 0x00 };
-    uint8_t respICC_0002[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x71, 0x00, 0x42, 0x00, 0x00, 0x00, 0x00, 0xC3, 0xF7, 0x0B, 0xF7, 0x02, 0x50, 0x14, 0x00, 0x01, 0x2C, 0xA7, 0x3A, 0x00, 0x90, 0x00 };
-    uint8_t respID_0003[] =  { 0x02,  0x69, 0x82 };
-
-
-    // ATS response sans CRC, On le calcule nous meme
-
-    uint8_t ATS_INIT[] =     { 0x85, 0x17, 0x00, 0x02, 0x00, 0x00, 0x00, 0x12, 0x12, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x00, 0x15, 0x15, 0x15, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x90, 0x00 };
-    uint8_t ATS_AID_3F04[] = { 0x85, 0x17, 0x04, 0x04, 0x02, 0x10, 0x01, 0x1F, 0x12, 0x00, 0x00, 0x01, 0x01, 0x01,0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,0x00, 0x90, 0x00  };
-    uint8_t ATS_ICC_0002[] = { 0x85, 0x17, 0x02, 0x04, 0x02, 0x1D, 0x01, 0x1F, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,0x90, 0x00 };
-    uint8_t ATS_ID_0003[] =  { 0x85, 0x17, 0x03, 0x04, 0x02, 0x1D, 0x01, 0x01, 0x12, 0x00, 0x00, 0x01, 0x02, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x90, 0x00 };
-
-    uint8_t REQ_WTX[] = { 0xF2, 0x3B, 0xAF, 0xCF }; // S(WTX) avec un WTXM = 59 [1-59]
 
     bool active = false; // flag pour indiquer si la carte est en etat actif
 
@@ -400,31 +527,11 @@ void SimulateCalypsoTag(const uint8_t* pupi) {
         respATQB[3] = 0x0B;
         respATQB[4] = 0xF7;
     }
-
-    CalypsoFrame  calypso_ATS[] = {
-        { NULL, 0, ATS_INIT, sizeof(ATS_INIT), false, false},
-        { NULL, 0, ATS_AID_3F04, sizeof(ATS_AID_3F04), false, false },
-        { NULL, 0, ATS_ICC_0002, sizeof(ATS_ICC_0002), false, false },
-        { NULL, 0, ATS_ID_0003, sizeof(ATS_ID_0003), false, false }
-
-    };
+    AddCrc14B(respATQB, 12);
 
     CalypsoFrame  calypso_RESP[] = {
     { NULL, 0, respATQB, sizeof(respATQB), true, true },
     { NULL, 0, respOK, sizeof(respOK), true, true },
-    { NULL, 0, respe, sizeof(respe), false, false }, 
-    { NULL, 0, resp_get_data, sizeof(resp_get_data), false, false },
-    { NULL, 0, respFILE_NOT_FOUND, sizeof(respFILE_NOT_FOUND), false, false },
-    { NULL, 0, resp_rec_mul, sizeof(resp_rec_mul), false, false },
-    { NULL, 0, respAID_3F04, sizeof(respAID_3F04), false, false },
-    { NULL, 0, respICC_0002, sizeof(respICC_0002), false, false },
-    { NULL, 0, respID_0003, sizeof(respID_0003), false, false },
-    { NULL, 0, respNO_MORE_RECORD, sizeof(respNO_MORE_RECORD), false, false },
-    };
-
-    CalypsoFrame  calypso_REQ[] = {
-    { NULL, 0, REQ_WTX, sizeof(REQ_WTX), true, true}
-
     };
 
     uint16_t len, cmdsReceived = 0;
@@ -433,39 +540,34 @@ void SimulateCalypsoTag(const uint8_t* pupi) {
 
     tosend_t* ts = get_tosend();
 
-
-    // Prepare WTX
-    CodeIso14443bAsTag(calypso_REQ[0].data, calypso_REQ[0].dataSize);
-    calypso_REQ[0].encodedData = BigBuf_malloc(ts->max);
-    calypso_REQ[0].encodedDataLen = ts->max;
-    memcpy(calypso_REQ[0].encodedData, ts->buf, ts->max);
-
     // Prepare first frame for initialisation (ATQB et OK)
 
-    for (size_t i = 0; i < 3; ++i) {
+    for (size_t i = 0; i < ARRAYLEN(calypso_RESP); ++i) {
         CodeIso14443bAsTag(calypso_RESP[i].data, calypso_RESP[i].dataSize);
         calypso_RESP[i].encodedData = BigBuf_malloc(ts->max);
         calypso_RESP[i].encodedDataLen = ts->max;
         memcpy(calypso_RESP[i].encodedData, ts->buf, ts->max);
     }
 
-    BigBuf_free();
+    // then every answer of the profile
+    calypso_cache_init(profile);
+    if (g_dbglevel >= DBG_INFO) {
+        Dbprintf("Pre-encoded %u frames, %u bytes", calypso_cache.cached, calypso_cache.pool.used);
+    }
+
+    calypso_sel_t sel = { CALYPSO_MF, CALYPSO_NO_FILE };
+    calypso_last_resp_len = 0;
+
     StartCountUS();
 
     // Donn�es de synchronisation
     uint32_t eof_time = 0;
     uint32_t sof_time = 0;
-    uint8_t state = 0;
-    uint8_t* data_ptr = &state;
- 
 
     // Simulation loop
     while (BUTTON_PRESS() == false) {
 
         WDT_HIT();
-        //   Dbprintf("state : %d", *data_ptr);
-
-        uint8_t* prev_cmd = 0; // Pour suivre la derni�re commande re�ue cmd -1
 
         if (data_available()) {
             Dbprintf("Data available");
@@ -487,182 +589,68 @@ void SimulateCalypsoTag(const uint8_t* pupi) {
         }
         sof_time = GetCountUS();
 
-        // Je vais utiliser un systeme de jeton pour gerer les WTX
-        if (cardSTATE == HANDLE_WTX ){
-            bool jetons = false;
-            while (!jetons) {
-				if (GetIso14443bCommandFromReader(receivedCmd, &len) == false) {
-					Dbprintf("button pressed, received %d commands", cmdsReceived);
-					break;
-				}
-				if (len == 4 && receivedCmd[0] == WTX_PCB) {
-					LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-                    jetons = true; // On a re�u un jeton (ack de wtx par PCD)
-                    cardSTATE = SIMCAL_IDLE; // On revient � l'�tat idle
-					continue;
-				}
-
-			}
-		}
-        else 
-        {
-            if (GetIso14443bCommandFromReader(receivedCmd, &len) == false) {
-                Dbprintf("button pressed, received %d commands", cmdsReceived);
-                break;
-            }
-
-        }
         // Get reader command
-
-
-        eof_time = GetCountUS();
-
-        // Control automatic the FWT
-        /*
-        if (receivedCmd[0] == CALYPSO_ATTRIB) {
-            Dbprintf("FWT ideal trouv� : %d", fwt);
-        }
-        else
-        {
-            fwt = fwt + 10;
-            Dbprintf("fwt : %d", fwt);
+        if (GetIso14443bCommandFromReader(receivedCmd, &len) == false) {
+            Dbprintf("button pressed, received %d commands", cmdsReceived);
+            break;
         }
-        */
-        BigBuf_free();
-
 
+        eof_time = GetCountUS();
 
-        if (receivedCmd[0] != WTX_PCB) {
-            //save the last command received
-            prev_cmd = receivedCmd;
-        }
+        LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
 
         if (receivedCmd[0] == CALYPSO_WUPB) {
             if (len == 5 && receivedCmd[2] == 0x08 && !active) {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
                 cardSTATE = SIMCAL_SELECTING;
             }
             else if (len == 5 && receivedCmd[2] == 0x00 && !active) {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
                 cardSTATE = SIMCAL_REQUESTING;
             }
             else
             {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
                 continue;
             }
         }
 
         else if (len == 11 && receivedCmd[0] == ISO14443B_ATTRIB && !active ) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
             cardSTATE = SIMCAL_HALTING;
         }
 
-        else if (len == 19 && receivedCmd[5] == WIN_APP[0] && receivedCmd[6] == WIN_APP[1] ) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_WIN_APP;
-        }
-        else if (len == 8 && receivedCmd[2] == GET_DATA) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_GET_DATA;
-
-        }
-        else if (len == 17 && receivedCmd[0] == CALYPSO_C ) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_EXC;
-
-        }
-
-        else if (len == 3 && receivedCmd[0] == READ_RECORD ) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_READ_RECORD;
-            *data_ptr = DATA_INVALID; // Pour l'application WIN_APP
+        // I-block
+        else if ((receivedCmd[0] & 0xE2) == 0x02 && len >= 7) {
+            cardSTATE = SIMCAL_APDU;
         }
 
-        else if (len == 3 && receivedCmd[0] == READ_RECORD_MUL  ) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_READ_REC_MUL;
-        }
-
-        //SELECT (CardPeek)
-        else if (len == 11 && receivedCmd[6] == NAV_INIT[0] && receivedCmd[7] == NAV_INIT[1]) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_INIT;
-        }
-
-        else if (len == 11 && receivedCmd[2] == SELECT ) {
-
-            if (receivedCmd[6] == AID_3F04[0] && receivedCmd[7] == AID_3F04[1]) {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-                cardSTATE = SIMCAL_AID_3F04;
-            }
-            else if (receivedCmd[6] == ICC_0002[0] && receivedCmd[7] == ICC_0002[1]) {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-                cardSTATE = SIMCAL_ICC_0002;
-            }
-            else if (receivedCmd[6] == ID_0003[0] && receivedCmd[7] == ID_0003[1]) {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-                cardSTATE = SIMCAL_ID_0003;
-            }
-            else
-            {
-                LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-                cardSTATE = SIMCAL_SELECT_NULL;
-                continue;
-            }
-        }
-
-        else if (len == 8 && receivedCmd[2] == READ_RECORD  ) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_READ_RECORD;
-            
+        // R(NAK)
+        else if ((receivedCmd[0] & 0xF6) == 0xB2 && len == 3) {
+            cardSTATE = SIMCAL_NAK;
         }
 
         // Reset command
         else if (len == 3 && receivedCmd[0] == CALYPSO_RESET) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
             active = false;
-        }
-
-        else if (len == 4 && receivedCmd[0] == WTX_PCB) {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            cardSTATE = SIMCAL_WAITING;
+            continue;
         }
 
         else {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
             continue;
         }
 
-
-
-
         /*
         * How should this flow go?
         *  REQB or WUPB
         *   send response  ( waiting for Attrib)
         *  ATTRIB
         *   send response  ( waiting for commands 7816)
-        *  HALT
-            send halt response ( waiting for wupb )
+        *  I-block
+        *   answer from the card profile
         */
 
         switch (cardSTATE) {
 
             //Initialisation de la communication
 
-        case SIMCAL_IDLE: {
-            LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
-            break;
-
-        }
-        case SIMCAL_SELECTING: {
-            sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[0].encodedData, calypso_RESP[0].encodedDataLen);
-            eof_time = GetCountUS();
-            LogTrace(respATQB, sizeof(respATQB), (sof_time), (eof_time), NULL, false);
-            break;
-        }
+        case SIMCAL_SELECTING:
         case SIMCAL_REQUESTING: {
             sof_time = GetCountUS();
             TransmitFor14443b_AsTag(calypso_RESP[0].encodedData, calypso_RESP[0].encodedDataLen);
@@ -675,137 +663,25 @@ void SimulateCalypsoTag(const uint8_t* pupi) {
             TransmitFor14443b_AsTag(calypso_RESP[1].encodedData, calypso_RESP[1].encodedDataLen);
             eof_time = GetCountUS();
             LogTrace(respOK, sizeof(respOK), (sof_time), (eof_time), NULL, false);
+            sel.df = CALYPSO_MF;
+            sel.ef = CALYPSO_NO_FILE;
             break;
         }
-                           //Windows (Generic)
-
-        case SIMCAL_WIN_APP: {
-            // process_and_send_frame(&calypso_RESP[2], receivedCmd, len);
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_WIN_APP);
-            cardSTATE = HANDLE_WTX;
-            // process_and_send_frame(&calypso_RESP[3], receivedCmd, len);
+        case SIMCAL_APDU: {
+            calypso_answer_apdu(profile, &sel, receivedCmd, len);
             active = true; // la carte est activ�e
             break;
         }
-        case SIMCAL_GET_DATA: {
-
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_GET_DATA);
-            //process_and_send_frame(&calypso_RESP[2], receivedCmd, len);
-            break;
-        }
-        case SIMCAL_EXC: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_EXC);
-            //process_and_send_frame(&calypso_RESP[3], receivedCmd, len);
-            break;
-
-        }
-
-        case SIMCAL_EXE: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_EXE);
-            //process_and_send_frame(&calypso_RESP[4], receivedCmd, len);
-            break;
-        }
-
-        case SIMCAL_READ_REC_MUL: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_READ_REC_MUL);
-            //process_and_send_frame(&calypso_RESP[5], receivedCmd, len);
-            break;
-        }
-                                // STATE (Cardpeek)
-
-        case SIMCAL_INIT: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_INIT);
-            process_and_send_frame(&calypso_ATS[0], receivedCmd, len);
-            break;
-        }
-        case SIMCAL_AID_3F04: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_INIT);
-            //process_and_send_frame(&calypso_ATS[1], receivedCmd, len);
-            *data_ptr = FIRST_DATA; //POur le prochain etat (Select_file)
-            break;
-
-        }
-        case SIMCAL_ICC_0002: {
-            // Dbprintf("ICC_0002");
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_INIT);
-            //process_and_send_frame(&calypso_ATS[2], receivedCmd, len);
-            *data_ptr = SECOND_DATA;
-            break;
-        }
-        case SIMCAL_ID_0003: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_INIT);
-            //process_and_send_frame(&calypso_ATS[3], receivedCmd, len);
-            *data_ptr = THIRD_DATA;
-            break;
-        }
-        case SIMCAL_SELECT_NULL: {
-            Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_INIT);
-            //process_and_send_frame(&calypso_RESP[4], receivedCmd, len);
-            break;
-        }
-
-        case SIMCAL_READ_RECORD: {
-            // Vu que la comd pour lire un fichier apres l'ATS est la meme que pour les autres, je vais mettre un suivi state pour les differencier
-            if (*data_ptr == FIRST_DATA) { // Premier donn�e de l'application AID_3F04
-                Send_WTX(calypso_REQ[0].encodedData, calypso_REQ[0].encodedDataLen, REQ_WTX, sizeof(REQ_WTX), SIMCAL_READ_RECORD);
-                //process_and_send_frame(&calypso_RESP[6], receivedCmd, len);
-                *data_ptr = NO_DATA;
-                break;
-            }
-            else if (*data_ptr == SECOND_DATA) {
-                process_and_send_frame(&calypso_RESP[7], receivedCmd, len);
-                eof_time = GetCountUS();
-                *data_ptr = NO_DATA;
-                break;
-            }
-            else if (*data_ptr == THIRD_DATA) {
-                process_and_send_frame(&calypso_RESP[8], receivedCmd, len);
-                *data_ptr = NO_DATA;
-                break;
-            }
-
-            // Si on a pas de donn�e a lire cela signifie qu'il faudra remttre state a 0 a chaque fin de lecture des donn�es
-            else if (*data_ptr == NO_DATA) {
-                process_and_send_frame(&calypso_RESP[9], receivedCmd, len);
-                break;
-            }
-            else if (*data_ptr == DATA_INVALID) {
-                sof_time = GetCountUS();
-                TransmitFor14443b_AsTag(calypso_RESP[2].encodedData, calypso_RESP[2].encodedDataLen);
-                eof_time = GetCountUS();
-                LogTrace(respe, sizeof(respe), (sof_time), (eof_time), NULL, false);
-				break;
-			}
-            else
-            {
-                //process_and_send_frame(&calypso_REQ[0], receivedCmd, len);
-                break;
-            }
-            break;
-        }
-
-        case SIMCAL_WAITING: {
-
-            switch (lastState)
-            {
-            case SIMCAL_WIN_APP: {
-                process_and_send_frame(&calypso_RESP[4], prev_cmd, sizeof(prev_cmd));
-                break;
-            case SIMCAL_GET_DATA: {
-                process_and_send_frame(&calypso_RESP[4], prev_cmd, sizeof(prev_cmd));
-                break;
-            }
-
+        case SIMCAL_NAK: {
+            if (calypso_cache.last) {
+                calypso_send_frame(calypso_cache.last);
             }
-            default:
-                break;
+            else if (calypso_last_resp_len) {
+                calypso_transmit(calypso_last_resp, calypso_last_resp_len);
             }
             break;
-
         }
-
         default: {
-
             Dbprintf("Etat non reconnu");
             break;
         }
@@ -813,15 +689,8 @@ void SimulateCalypsoTag(const uint8_t* pupi) {
         }
 
         ++cmdsReceived;
-        // Ici je fais une sorte de pause.. Necessaire pour que le lecteur puisse traiter la reponse sinon c'est trop rapide 
-        // Attention a ne pas toucher a cette valeur. 700 microsecondes est le temps necessaire pour que le lecteur puisse traiter la reponse
-        //waitForFWT(600);
-
-
-	}
+    }
 
-       
-    
     switch_off();
 
     if (g_dbglevel >= DBG_DEBUG) {
@@ -8,27 +8,11 @@
 #define SIMCAL_ACKNOWLEDGE  5  // �tat o� la carte envoie une r�ponse � une commande ATTRIB du lecteur
 #define SIMCAL_WORK		    6  // �tat o� la carte est activement engag�e dans la communication avec le lecteur
 #define SIMCAL_WIN_APP	    8  // Etape 1 de l'�change de donn�es
-#define SIMCAL_GET_DATA	    9  // Etape 2 de l'�change de donn�es
-#define SIMCAL_EXC		    10 // Etape 3 de l'�change de donn�es
-#define SIMCAL_EXD		    11 // Etape 4 de l'�change de donn�es
-#define SIMCAL_EXE		    12 // Etape 5 de l'�change de donn�es
-#define SIMCAL_READ_REC_MUL 13 // Etape 6 de l'�change de donn�es
 
 
 
 
 
-// les etats de state ptr
-
-#define DATA_INVALID 99
-#define NO_DATA 0
-#define FIRST_DATA 1
-#define SECOND_DATA 2
-#define THIRD_DATA 3
-
-
-
-
 // Les commandes ISO14443B
 
 #define CALYPSO_WUPB        0x05
@@ -61,56 +45,17 @@
 #define DELAY_AIR2ARM_AS_TAG (2 + 3 + 8 + 8 + 7*16 + 8 + 4*16 - 8*16)
 
 
-
-// Les applications Calypso Navigo
+// Calypso Windows application (SELECT by AID, start of the AID)
 #define WIN_APP              ( (unsigned char[]) {(0x0B), (0xA0)} )
-#define NAV_INIT             ( (unsigned char[]) {(0x20), (0x00)} )
-#define AID_3F04             ( (unsigned char[]) {(0x3F), (0x04)} )
-#define ICC_0002             ( (unsigned char[]) {(0x00), (0x02)} )
-#define ID_0003              ( (unsigned char[]) {(0x00), (0x03)} )
-#define DISPLAY_2F10         ( (unsigned char[]) {(0x2F), (0x10)} )
-#define TICKETING_2000       ( (unsigned char[]) {(0x20), (0x00)} )
-#define AID_2004             ( (unsigned char[]) {(0x20), (0x04)} )
-#define ENVIRONMENT_2001     ( (unsigned char[]) {(0x20), (0x01)} )
-#define EVENT_LOG_2010       ( (unsigned char[]) {(0x20), (0x10)} )
-#define CONTRACTS_2020       ( (unsigned char[]) {(0x20), (0x20)} )
-#define CONTRACTS_2030       ( (unsigned char[]) {(0x20), (0x30)} )
-#define COUNTERS_202A        ( (unsigned char[]) {(0x20), (0x2A)} )
-#define COUNTERS_202B        ( (unsigned char[]) {(0x20), (0x2B)} )
-#define COUNTERS_202C        ( (unsigned char[]) {(0x20), (0x2C)} )
-#define COUNTERS_2069        ( (unsigned char[]) {(0x20), (0x69)} )
-#define SPECIAL_EVENTS_2040  ( (unsigned char[]) {(0x20), (0x40)} )
-#define CONTRACT_LIST_2050   ( (unsigned char[]) {(0x20), (0x50)} )
-#define RECORD               ( (unsigned char[]) {(0x20), (0x00)} )
-
 
 
 // les etats associ�s a chaque commandes
-#define SIMCAL_INIT                     14
-#define SIMCAL_AID_3F04                 15
-#define SIMCAL_ICC_0002                 16
-#define SIMCAL_ID_0003                  17
-#define SIMCAL_DISPLAY_2F10             18
-#define SIMCAL_TICKETING_2000           19
-#define SIMCAL_AID_2004                 20
-#define SIMCAL_ENVIRONMENT_2001         21
-#define SIMCAL_EVENT_LOG_2010           22
-#define SIMCAL_CONTRACTS_2020           23
-#define SIMCAL_CONTRACTS_2030		    24
-#define SIMCAL_COUNTERS_202A            25
-#define SIMCAL_COUNTERS_202B            26
-#define SIMCAL_COUNTERS_202C            27 
-#define SIMCAL_COUNTERS_2069            28
-#define SIMCAL_SPECIAL_EVENTS_2040      29
-#define SIMCAL_CONTRACT_LIST_2050       30
-#define SIMCAL_SELECT_NULL              31
-#define SIMCAL_READ_RECORD              32
 #define SIMCAL_REQUESTING               33
-#define SIMCAL_UNKNOW                   34
-#define SIMCAL_WAITING                  35
 #define PYTHON_HANDLER				    36
 #define HANDLE_WTX                      37
 #define SIMCAL_B3					    38
+#define SIMCAL_APDU                     39  // I-block, answered from the card profile (calypso_profile.h)
+#define SIMCAL_NAK                      40  // R(NAK), last I-block sent again
 
 
 //structs pour les ATS et RESP
@@ -123,6 +68,28 @@ typedef struct {
     bool crc_added;
 } CalypsoFrame;
 
+// Tag response encoded once, ready for TransmitFor14443b_AsTag(), see calypso_pool_encode()
+typedef struct {
+    uint8_t* data;          // frame as sent, PCB .. CRC, for the trace
+    uint16_t dataLen;
+    uint8_t* encoded;
+    uint16_t encodedLen;
+    uint16_t capacity;      // max frame length this slot can hold
+} CalypsoEncFrame;
+
+// Arena in BigBuf holding the encoded responses
+typedef struct {
+    uint8_t* base;
+    uint32_t size;
+    uint32_t used;
+} CalypsoEncPool;
+
+// CodeIso14443bAsTag() output for a n bytes frame: TR1, SOF, EOF and 10 bits per byte, 4 samples per bit
+#define CALYPSO_ENC_LEN(n)      (16 + 5 * (n))
+#define CALYPSO_POOL_ALIGN(x)   (((x) + 3) & ~3)
+// pool bytes used by a frame of n bytes
+#define CALYPSO_POOL_NEED(n)    (CALYPSO_POOL_ALIGN(n) + CALYPSO_POOL_ALIGN(CALYPSO_ENC_LEN(n)))
+
 //la structure pour contenir la trame S(WTX)
 typedef struct {
     uint8_t pcb;
@@ -149,6 +116,10 @@ void create_WTX_command_with_crc(uint8_t duration_ms, uint8_t* frame, size_t* fr
 void print_frame(uint8_t* frame, size_t frame_size);
 void CheckRF(const uint8_t* period_ms);
 void init14b(const uint8_t* pupi);
+bool calypso_pool_init(CalypsoEncPool* pool, uint32_t size);
+bool calypso_pool_reserve(CalypsoEncPool* pool, uint16_t maxlen, CalypsoEncFrame* out);
+bool calypso_pool_encode(CalypsoEncPool* pool, const uint8_t* frame, uint16_t len, CalypsoEncFrame* out);
+bool calypso_frame_encode(CalypsoEncFrame* f, const uint8_t* frame, uint16_t len);
 
 
 
@@ -35,6 +35,8 @@
 #include "ticks.h"
 #include "iso14b.h"       // defines for ETU conversions
 #include "iclass.h"       // picopass buffer defines
+#include "iso14b_codec.h"
+#include "iso7816_fs.h"
 
 /*
 * Current timing issues with ISO14443-b implementation
@@ -352,103 +354,23 @@ static bool s_field_on = false;
 
 //etait static
 void CodeIso14443bAsTag(const uint8_t* cmd, int len) {
-
-    tosend_reset();
-
-    // Transmit a burst of ones, as the initial thing that lets the
-    // reader get phase sync.
-    // This loop is TR1, per specification
-    // TR1 minimum must be > 80/fs
-    // TR1 maximum 200/fs
-    // 80/fs < TR1 < 200/fs
-    // 10 ETU < TR1 < 24 ETU
-
-    int i;
-    // Send TR1.
-    // 10-11 ETU * 4times samples ONES
-    for (i = 0; i < 10; i++) {
-        SEND4STUFFBIT(1);
-    }
-
-    // Send SOF.
-    // 10-11 ETU * 4times samples ZEROS
-    for (i = 0; i < 10; i++) {
-        SEND4STUFFBIT(0);
-    }
-
-    // 2-3 ETU * 4times samples ONES
-    for (i = 0; i < 2; i++) {
-        SEND4STUFFBIT(1);
-    }
-
-    // data
-    for (i = 0; i < len; i++) {
-
-        // Start bit
-        SEND4STUFFBIT(0);
-
-        // Data bits
-        uint8_t b = cmd[i];
-        for (int j = 0; j < 8; j++) {
-            SEND4STUFFBIT(b & 1);
-            b >>= 1;
-        }
-
-        // Stop bit
-        SEND4STUFFBIT(1);
-
-        // Extra Guard bit
-        // For PICC it ranges 0-18us (1etu = 9us)
-        //SEND4STUFFBIT(1);
-    }
-
-    // Send EOF.
-    // 10-11 ETU * 4 sample rate = ZEROS
-    for (i = 0; i < 10; i++) {
-        SEND4STUFFBIT(0);
-    }
-
-    // why this? push out transfers between arm and fpga?
-    //for (i = 0; i < 2; i++) {
-    //    SEND4STUFFBIT(1);
-    //}
-
     tosend_t* ts = get_tosend();
-    // Convert from last byte pos to length
-    ts->max++;
+    ts->max = iso14b_code_as_tag(cmd, len, ts->buf, TOSEND_BUFFER_SIZE);
+    ts->bit = 8;
 }
 
 //-----------------------------------------------------------------------------
 // The software UART that receives commands from the reader, and its state
 // variables.
 //-----------------------------------------------------------------------------
-static struct {
-    enum {
-        STATE_14B_UNSYNCD,
-        STATE_14B_GOT_FALLING_EDGE_OF_SOF,
-        STATE_14B_AWAITING_START_BIT,
-        STATE_14B_RECEIVING_DATA
-    }       state;
-    uint16_t shiftReg;
-    int      bitCnt;
-    int      byteCnt;
-    int      byteCntMax;
-    int      posCnt;
-    uint8_t* output;
-} Uart;
+static iso14b_uart_t Uart;
 
 static void Uart14bReset(void) {
-    Uart.state = STATE_14B_UNSYNCD;
-    Uart.shiftReg = 0;
-    Uart.bitCnt = 0;
-    Uart.byteCnt = 0;
-    Uart.byteCntMax = MAX_FRAME_SIZE;
-    Uart.posCnt = 0;
+    iso14b_uart_reset(&Uart);
 }
 
 static void Uart14bInit(uint8_t* data) {
-    Uart.output = data;
-    Uart14bReset();
+    iso14b_uart_init(&Uart, data);
 }
 
 // param timeout accepts ETU
@@ -493,181 +415,15 @@ static void iso14b_set_maxframesize(uint16_t size) {
 #define NOISE_THRESHOLD          80                   // don't try to correlate noise
 #define MAX_PREVIOUS_AMPLITUDE   (-1 - NOISE_THRESHOLD)
 
-static struct {
-    enum {
-        DEMOD_UNSYNCD,
-        DEMOD_PHASE_REF_TRAINING,
-        WAIT_FOR_RISING_EDGE_OF_SOF,
-        DEMOD_AWAITING_START_BIT,
-        DEMOD_RECEIVING_DATA
-    }       state;
-    uint16_t bitCount;
-    int      posCount;
-    int      thisBit;
-    uint16_t shiftReg;
-    uint16_t max_len;
-    uint8_t* output;
-    uint16_t len;
-    int      sumI;
-    int      sumQ;
-} Demod;
+static iso14b_demod_t Demod;
 
 // Clear out the state of the "UART" that receives from the tag.
 static void Demod14bReset(void) {
-    Demod.state = DEMOD_UNSYNCD;
-    Demod.bitCount = 0;
-    Demod.posCount = 0;
-    Demod.thisBit = 0;
-    Demod.shiftReg = 0;
-    Demod.len = 0;
-    Demod.sumI = 0;
-    Demod.sumQ = 0;
+    iso14b_demod_reset(&Demod);
 }
 
 static void Demod14bInit(uint8_t* data, uint16_t max_len) {
-    Demod.output = data;
-    Demod.max_len = max_len;
-    Demod14bReset();
-}
-
-/* Receive & handle a bit coming from the reader.
- *
- * This function is called 4 times per bit (every 2 subcarrier cycles).
- * Subcarrier frequency fs is 848kHz, 1/fs = 1,18us, i.e. function is called every 2,36us
- *
- * LED handling:
- * LED A -> ON once we have received the SOF and are expecting the rest.
- * LED A -> OFF once we have received EOF or are in error state or unsynced
- *
- * Returns: true if we received a EOF
- *          false if we are still waiting for some more
- */
-static RAMFUNC int Handle14443bSampleFromReader(uint8_t bit) {
-    switch (Uart.state) {
-    case STATE_14B_UNSYNCD:
-        if (bit == false) {
-            // we went low, so this could be the beginning of an SOF
-            Uart.state = STATE_14B_GOT_FALLING_EDGE_OF_SOF;
-            Uart.posCnt = 0;
-            Uart.bitCnt = 0;
-        }
-        break;
-
-    case STATE_14B_GOT_FALLING_EDGE_OF_SOF:
-        Uart.posCnt++;
-
-        if (Uart.posCnt == 2) { // sample every 4 1/fs in the middle of a bit
-
-            if (bit) {
-                if (Uart.bitCnt > 9) {
-                    // we've seen enough consecutive
-                    // zeros that it's a valid SOF
-                    Uart.posCnt = 0;
-                    Uart.byteCnt = 0;
-                    Uart.state = STATE_14B_AWAITING_START_BIT;
-                    LED_A_ON(); // Indicate we got a valid SOF
-                }
-                else {
-                    // didn't stay down long enough before going high, error
-                    Uart.state = STATE_14B_UNSYNCD;
-                }
-            }
-            else {
-                // do nothing, keep waiting
-            }
-            Uart.bitCnt++;
-        }
-
-        if (Uart.posCnt >= 4) {
-            Uart.posCnt = 0;
-        }
-
-        if (Uart.bitCnt > 12) {
-            // Give up if we see too many zeros without a one, too.
-            LED_A_OFF();
-            Uart.state = STATE_14B_UNSYNCD;
-        }
-        break;
-
-    case STATE_14B_AWAITING_START_BIT:
-        Uart.posCnt++;
-
-        if (bit) {
-
-            // max 57us between characters = 49 1/fs,
-            // max 3 etus after low phase of SOF = 24 1/fs
-            if (Uart.posCnt > 50 / 2) {
-                // stayed high for too long between characters, error
-                Uart.state = STATE_14B_UNSYNCD;
-            }
-
-        }
-        else {
-            // falling edge, this starts the data byte
-            Uart.posCnt = 0;
-            Uart.bitCnt = 0;
-            Uart.shiftReg = 0;
-            Uart.state = STATE_14B_RECEIVING_DATA;
-        }
-        break;
-
-    case STATE_14B_RECEIVING_DATA:
-
-        Uart.posCnt++;
-
-        if (Uart.posCnt == 2) {
-            // time to sample a bit
-            Uart.shiftReg >>= 1;
-            if (bit) {
-                Uart.shiftReg |= 0x200;
-            }
-            Uart.bitCnt++;
-        }
-
-        if (Uart.posCnt >= 4) {
-            Uart.posCnt = 0;
-        }
-
-        if (Uart.bitCnt == 10) {
-            if ((Uart.shiftReg & 0x200) && !(Uart.shiftReg & 0x001)) {
-                // this is a data byte, with correct
-                // start and stop bits
-                Uart.output[Uart.byteCnt] = (Uart.shiftReg >> 1) & 0xFF;
-                Uart.byteCnt++;
-
-                if (Uart.byteCnt >= Uart.byteCntMax) {
-                    // Buffer overflowed, give up
-                    LED_A_OFF();
-                    Uart.state = STATE_14B_UNSYNCD;
-                }
-                else {
-                    // so get the next byte now
-                    Uart.posCnt = 0;
-                    Uart.state = STATE_14B_AWAITING_START_BIT;
-                }
-            }
-            else if (Uart.shiftReg == 0x000) {
-                // this is an EOF byte
-                LED_A_OFF(); // Finished receiving
-                Uart.state = STATE_14B_UNSYNCD;
-                if (Uart.byteCnt != 0)
-                    return true;
-
-            }
-            else {
-                // this is an error
-                LED_A_OFF();
-                Uart.state = STATE_14B_UNSYNCD;
-            }
-        }
-        break;
-
-    default:
-        LED_A_OFF();
-        Uart.state = STATE_14B_UNSYNCD;
-        break;
-    }
-    return false;
+    iso14b_demod_init(&Demod, data, max_len);
 }
 
 //-----------------------------------------------------------------------------
@@ -696,7 +452,7 @@ static RAMFUNC int Handle14443bSampleFromReader(uint8_t bit) {
         if (AT91C_BASE_SSC->SSC_SR & (AT91C_SSC_RXRDY)) {
             uint8_t b = (uint8_t)AT91C_BASE_SSC->SSC_RHR;
             for (uint8_t mask = 0x80; mask != 0x00; mask >>= 1) {
-                if (Handle14443bSampleFromReader(b & mask)) {
+                if (iso14b_uart_sample(&Uart, b & mask)) {
                     *len = Uart.byteCnt;
                     return true;
                 }
@@ -732,11 +488,95 @@ static RAMFUNC int Handle14443bSampleFromReader(uint8_t bit) {
         }
     }
 }
+// FSD from the FSDI of the ATTRIB param 2
+static const uint16_t sim_fsd[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+// command APDU sent by the reader in chained I-blocks, CLA INS P1 P2 Lc data Le
+static uint8_t sim_fs_chain[5 + 256 + 1];
+static uint16_t sim_fs_chain_len = 0;
+
+// Answer a reader block (PCB [CID] [NAD] INF CRC) from the ISO7816 file system,
+// the I-block, R(ACK) or S(DESELECT) frame to send goes to resp. Returns its length, 0 when no answer.
+// Chained I-blocks are acknowledged and their INF kept until the last block completes the APDU.
+static uint16_t sim_fs_answer(const iso7816_fs_hdr_t* fs, iso7816_fs_state_t* st, const uint8_t* cmd, uint16_t len, uint8_t* resp, uint16_t fsd) {
+
+    uint8_t pcb = cmd[0];
+    uint8_t hlen = 1 + ((pcb & 0x08) ? 1 : 0) + ((pcb & 0x04) ? 1 : 0);
+    if (len < hlen + 2) {
+        return 0;
+    }
+
+    // S(DESELECT), same block back
+    if ((pcb & 0xF7) == 0xC2) {
+        memcpy(resp, cmd, len - 2);
+        AddCrc14B(resp, len - 2);
+        return len;
+    }
+
+    if ((pcb & 0xE2) != 0x02) {
+        return 0;
+    }
+
+    const uint8_t* apdu = cmd + hlen;
+    uint16_t apdu_len = len - hlen - 2;
+    if ((pcb & 0x10) || sim_fs_chain_len) {
+        if (sim_fs_chain_len + apdu_len > sizeof(sim_fs_chain)) {
+            sim_fs_chain_len = 0;
+            return 0;
+        }
+        memcpy(sim_fs_chain + sim_fs_chain_len, apdu, apdu_len);
+        sim_fs_chain_len += apdu_len;
+
+        // more to come, R(ACK) with the block number and CID of the I-block
+        if (pcb & 0x10) {
+            uint8_t rlen = 0;
+            resp[rlen++] = 0xA2 | (pcb & 0x09);
+            if (pcb & 0x08) {
+                resp[rlen++] = cmd[1];
+            }
+            AddCrc14B(resp, rlen);
+            return rlen + 2;
+        }
+
+        apdu = sim_fs_chain;
+        apdu_len = sim_fs_chain_len;
+        sim_fs_chain_len = 0;
+    }
+
+    if (apdu_len < 4) {
+        return 0;
+    }
+
+    // I-block, same PCB / CID / NAD and the APDU answer
+    memcpy(resp, cmd, hlen);
+    resp[0] &= ~0x10;
+    uint16_t n = iso7816_fs_apdu(fs, st, apdu, apdu_len, resp + hlen, fsd - hlen - 2);
+    if (n == 0) {
+        return 0;
+    }
+    AddCrc14B(resp, hlen + n);
+    return hlen + n + 2;
+}
+
 //-----------------------------------------------------------------------------
 // Main loop of simulated tag: receive commands from reader, decide what
 // response to send, and send it.
+// With ISO14B_SIM_FS, the I-blocks are answered from the ISO7816 file system
+// loaded in emulator memory by `hf 14b eload`.
 //-----------------------------------------------------------------------------
-void SimulateIso14443bTag(const uint8_t* pupi) {
+void SimulateIso14443bTag(const uint8_t* pupi, uint8_t flags) {
+
+    const iso7816_fs_hdr_t* fs = NULL;
+    iso7816_fs_state_t fs_state;
+    if (flags & ISO14B_SIM_FS) {
+        fs = iso7816_fs_check(BigBuf_get_EM_addr(), CARD_MEMORY_SIZE);
+        if (fs == NULL) {
+            DbpString("No ISO7816 file system in emulator memory, see `hf 14b eload`");
+            return;
+        }
+        iso7816_fs_reset(&fs_state);
+        sim_fs_chain_len = 0;
+    }
 
     /*
         // the only commands we understand is WUPB, AFI=0, Select All, N=1:
@@ -777,6 +617,12 @@ void SimulateIso14443bTag(const uint8_t* pupi) {
         0x5e, 0xd7
     };
 
+    // ...ATQB of the file system
+    if (fs && (fs->flags & ISO7816_FS_ATQB)) {
+        memcpy(respATQB + 1, fs->atqb, sizeof(fs->atqb));
+        AddCrc14B(respATQB, 12);
+    }
+
     // ...PUPI/UID supplied from user. Adjust ATQB response accordingly
     if (memcmp("\x00\x00\x00\x00", pupi, 4) != 0) {
         memcpy(respATQB + 1, pupi, 4);
@@ -794,6 +640,14 @@ void SimulateIso14443bTag(const uint8_t* pupi) {
 
     uint8_t* receivedCmd = BigBuf_calloc(MAX_FRAME_SIZE);
 
+    // last file system answer, an R-block asks for it again
+    uint8_t* fsResp = NULL;
+    uint16_t fsRespLen = 0;
+    uint16_t fsd = 256;
+    if (fs) {
+        fsResp = BigBuf_calloc(MAX_FRAME_SIZE);
+    }
+
     // prepare "ATQB" tag answer (encoded):
     CodeIso14443bAsTag(respATQB, sizeof(respATQB));
     uint8_t* encodedATQB = BigBuf_malloc(ts->max);
@@ -909,6 +763,12 @@ void SimulateIso14443bTag(const uint8_t* pupi) {
                 TransmitFor14443b_AsTag(encodedOK, encodedOKLen);
                 LogTrace(respOK, sizeof(respOK), 0, 0, NULL, false);
                 cardSTATE = SIM_ACTIVE;
+                if (fs) {
+                    fsd = sim_fsd[MIN(receivedCmd[6] & 0x0F, ARRAYLEN(sim_fsd) - 1)];
+                    fsRespLen = 0;
+                    iso7816_fs_reset(&fs_state);
+                    sim_fs_chain_len = 0;
+                }
                 break;
             }
             case SIM_IDLE:
@@ -923,6 +783,30 @@ void SimulateIso14443bTag(const uint8_t* pupi) {
             }
             }
         }
+        else if (fs && cardSTATE == SIM_ACTIVE && len >= 3) {
+            // ISO14443-4 block
+            if ((receivedCmd[0] & 0xE6) == 0xA2) {
+                // R(ACK) / R(NAK), last block again
+                if (fsRespLen) {
+                    CodeIso14443bAsTag(fsResp, fsRespLen);
+                    TransmitFor14443b_AsTag(ts->buf, ts->max);
+                    LogTrace(fsResp, fsRespLen, 0, 0, NULL, false);
+                }
+            }
+            else {
+                uint16_t n = sim_fs_answer(fs, &fs_state, receivedCmd, len, fsResp, fsd);
+                if (n) {
+                    CodeIso14443bAsTag(fsResp, n);
+                    TransmitFor14443b_AsTag(ts->buf, ts->max);
+                    LogTrace(fsResp, n, 0, 0, NULL, false);
+                    fsRespLen = n;
+                    if ((receivedCmd[0] & 0xF7) == 0xC2) {
+                        cardSTATE = SIM_HALT;
+                        fsRespLen = 0;
+                    }
+                }
+            }
+        }
 
         ++cmdsReceived;
     }
@@ -1148,208 +1032,6 @@ void Simulate_iso14443b_srx_tag(uint8_t *uid) {
 // xxxxxxxxxxxxxxxx111111111111111111111-0........1-0........1-0........1-1-0........1-0........1-000000000000xxxxxxx
 //                 SOF?                  start-stop  ^^^^^^^^byte         ^ occasional stuff bit  EOF
 
-/*
- * Handles reception of a bit from the tag
- *
- * This function is called 2 times per bit (every 4 subcarrier cycles).
- * Subcarrier frequency fs is 848kHz, 1/fs = 1,18us, i.e. function is called every 4,72us
- *
- * LED handling:
- * LED C -> ON once we have received the SOF and are expecting the rest.
- * LED C -> OFF once we have received EOF or are unsynced
- *
- * Returns: true if we received a EOF
- *          false if we are still waiting for some more
- *
- */
-static RAMFUNC int Handle14443bSamplesFromTag(int ci, int cq) {
-
-    int v = 0;
-
-    // The soft decision on the bit uses an estimate of just the
-    // quadrant of the reference angle, not the exact angle.
-#define MAKE_SOFT_DECISION() { \
-        if(Demod.sumI > 0) { \
-            v = ci; \
-        } else { \
-            v = -ci; \
-        } \
-        if(Demod.sumQ > 0) { \
-            v += cq; \
-        } else { \
-            v -= cq; \
-        } \
-    }
-
-#define SUBCARRIER_DETECT_THRESHOLD  8
-// Subcarrier amplitude v = sqrt(ci^2 + cq^2), approximated here by max(abs(ci),abs(cq)) + 1/2*min(abs(ci),abs(cq)))
-#define AMPLITUDE(ci,cq) (MAX(ABS(ci),ABS(cq)) + (MIN(ABS(ci),ABS(cq))/2))
-
-    switch (Demod.state) {
-
-    case DEMOD_UNSYNCD: {
-        if (AMPLITUDE(ci, cq) > SUBCARRIER_DETECT_THRESHOLD) {  // subcarrier detected
-            Demod.state = DEMOD_PHASE_REF_TRAINING;
-            Demod.sumI = ci;
-            Demod.sumQ = cq;
-            Demod.posCount = 1;
-        }
-        break;
-    }
-    case DEMOD_PHASE_REF_TRAINING: {
-        // While we get a constant signal
-        if (AMPLITUDE(ci, cq) > SUBCARRIER_DETECT_THRESHOLD) {
-            if (((ABS(Demod.sumI) > ABS(Demod.sumQ)) && (((ci > 0) && (Demod.sumI > 0)) || ((ci < 0) && (Demod.sumI < 0)))) ||  // signal closer to horizontal, polarity check based on on I
-                ((ABS(Demod.sumI) <= ABS(Demod.sumQ)) && (((cq > 0) && (Demod.sumQ > 0)) || ((cq < 0) && (Demod.sumQ < 0))))) { // signal closer to vertical, polarity check based on on Q
-
-                if (Demod.posCount < 10) {  // refine signal approximation during first 10 samples
-                    Demod.sumI += ci;
-                    Demod.sumQ += cq;
-                }
-                Demod.posCount += 1;
-            }
-            else {
-                // transition
-                if (Demod.posCount < 10) {
-                    // subcarrier lost
-                    Demod.state = DEMOD_UNSYNCD;
-                    break;
-                }
-                else {
-                    // at this point it can be start of 14b' data or start of 14b SOF
-                    MAKE_SOFT_DECISION();
-                    Demod.posCount = 1;             // this was the first half
-                    Demod.thisBit = v;
-                    Demod.shiftReg = 0;
-                    Demod.state = DEMOD_RECEIVING_DATA;
-                }
-            }
-        }
-        else {
-            // subcarrier lost
-            Demod.state = DEMOD_UNSYNCD;
-        }
-        break;
-    }
-    case DEMOD_AWAITING_START_BIT: {
-        Demod.posCount++;
-        MAKE_SOFT_DECISION();
-        if (v > 0) {
-            if (Demod.posCount > 3 * 2) {       // max 19us between characters = 16 1/fs, max 3 etu after low phase of SOF = 24 1/fs
-                LED_C_OFF();
-                if (Demod.bitCount == 0 && Demod.len == 0) { // received SOF only, this is valid for iClass/Picopass
-                    return true;
-                }
-                else {
-                    Demod.state = DEMOD_UNSYNCD;
-                }
-            }
-        }
-        else {                            // start bit detected
-            Demod.posCount = 1;             // this was the first half
-            Demod.thisBit = v;
-            Demod.shiftReg = 0;
-            Demod.state = DEMOD_RECEIVING_DATA;
-        }
-        break;
-    }
-    case WAIT_FOR_RISING_EDGE_OF_SOF: {
-
-        Demod.posCount++;
-        MAKE_SOFT_DECISION();
-        if (v > 0) {
-            if (Demod.posCount < 9 * 2) { // low phase of SOF too short (< 9 etu). Note: spec is >= 10, but FPGA tends to "smear" edges
-                Demod.state = DEMOD_UNSYNCD;
-            }
-            else {
-                LED_C_ON(); // Got SOF
-                Demod.posCount = 0;
-                Demod.bitCount = 0;
-                Demod.len = 0;
-                Demod.state = DEMOD_AWAITING_START_BIT;
-            }
-        }
-        else {
-            if (Demod.posCount > 12 * 2) { // low phase of SOF too long (> 12 etu)
-                Demod.state = DEMOD_UNSYNCD;
-                LED_C_OFF();
-            }
-        }
-        break;
-    }
-    case DEMOD_RECEIVING_DATA: {
-
-        MAKE_SOFT_DECISION();
-
-        if (Demod.posCount == 0) {          // first half of bit
-            Demod.thisBit = v;
-            Demod.posCount = 1;
-        }
-        else {                            // second half of bit
-            Demod.thisBit += v;
-
-            Demod.shiftReg >>= 1;
-            if (Demod.thisBit > 0) {    // logic '1'
-                Demod.shiftReg |= 0x200;
-            }
-
-            Demod.bitCount++;
-            if (Demod.bitCount == 10) {
-
-                uint16_t s = Demod.shiftReg;
-
-                if ((s & 0x200) && !(s & 0x001)) { // stop bit == '1', start bit == '0'
-                    Demod.output[Demod.len] = (s >> 1);
-                    Demod.len++;
-                    Demod.bitCount = 0;
-                    Demod.state = DEMOD_AWAITING_START_BIT;
-                }
-                else {
-                    if (s == 0x000) {
-                        if (Demod.len > 0) {
-                            LED_C_OFF();
-                            // This is EOF (start, stop and all data bits == '0'
-                            return true;
-                        }
-                        else {
-                            // Zeroes but no data acquired yet?
-                            // => Still in SOF of 14b, wait for raising edge
-                            Demod.posCount = 10 * 2;
-                            Demod.bitCount = 0;
-                            Demod.len = 0;
-                            Demod.state = WAIT_FOR_RISING_EDGE_OF_SOF;
-                            break;
-                        }
-                    }
-                    if (AMPLITUDE(ci, cq) < SUBCARRIER_DETECT_THRESHOLD) {
-                        LED_C_OFF();
-                        // subcarrier lost
-                        Demod.state = DEMOD_UNSYNCD;
-                        if (Demod.len > 0) { // no EOF but no signal anymore and we got data, e.g. ASK CTx
-                            return true;
-                        }
-                    }
-                    // we have still signal but no proper byte or EOF? this shouldn't happen
-                    //Demod.posCount = 10 * 2;
-                    Demod.bitCount = 0;
-                    Demod.len = 0;
-                    Demod.state = WAIT_FOR_RISING_EDGE_OF_SOF;
-                    break;
-                }
-            }
-            Demod.posCount = 0;
-        }
-        break;
-    }
-    default: {
-        Demod.state = DEMOD_UNSYNCD;
-        LED_C_OFF();
-        break;
-    }
-    }
-    return false;
-}
-
 /*
  *  Demodulate the samples we received from the tag, also log to tracebuffer
  */
@@ -1423,7 +1105,7 @@ static int Get14443bAnswerFromTag(uint8_t* response, uint16_t max_len, uint32_t
             }
         }
 
-        if (Handle14443bSamplesFromTag(ci, cq)) {
+        if (iso14b_demod_samples(&Demod, ci, cq)) {
 
             *eof_time = GetCountSspClkDelta(dma_start_time) - DELAY_TAG_TO_ARM;  // end of EOF
 
@@ -2407,7 +2089,68 @@ out:
  * DMA Buffer - ISO14443B_DMA_BUFFER_SIZE
  * Demodulated samples received - all the rest
  */
-void SniffIso14443b(void) {
+
+// frames not logged, the trace was full
+static uint32_t sniff_dropped = 0;
+
+static void Sniff14bLogTrace(const uint8_t* data, uint16_t len, uint32_t ts_start, uint32_t ts_end, bool reader2tag) {
+    if (LogTrace(data, len, ts_start, ts_end, NULL, reader2tag) == false) {
+        sniff_dropped++;
+    }
+}
+
+// hf 14b sniff --stream: LogTrace fills the trace while the records of the
+// previous swap are sent from buf, ISO14B_SNIFF_CHUNK bytes at a time.
+// USB only, see SniffIso14443b().
+#define ISO14B_SNIFF_MAX_BEHIND    (DMA_BUFFER_SIZE / 8)   // samples waiting in the DMA buffer
+typedef struct {
+    uint8_t* buf;
+    uint32_t len;
+    uint32_t sent;
+} sniff14b_stream_t;
+
+// Send the next chunk or, once buf is drained, swap the trace into it. One
+// step per call, with all set, send everything logged so far.
+static void Sniff14bStreamFlush(sniff14b_stream_t* st, bool all) {
+
+    uint8_t buf[sizeof(iso14b_sniff_chunk_t) + ISO14B_SNIFF_CHUNK];
+    iso14b_sniff_chunk_t* chunk = (iso14b_sniff_chunk_t*)buf;
+
+    do {
+        if (st->sent == st->len) {
+            uint32_t tracelen = BigBuf_get_traceLen();
+            if (tracelen == 0) {
+                return;
+            }
+            // buf is larger than the trace, see SniffIso14443b()
+            memcpy(st->buf, BigBuf_get_addr(), tracelen);
+            st->len = tracelen;
+            st->sent = 0;
+            clear_trace();
+            set_tracing(true);
+            if (all == false) {
+                return;
+            }
+        }
+
+        chunk->dropped = sniff_dropped;
+        chunk->len = MIN(ISO14B_SNIFF_CHUNK, st->len - st->sent);
+        memcpy(chunk->data, st->buf + st->sent, chunk->len);
+        reply_ng(CMD_HF_ISO14443B_SNIFF, PM3_SUCCESS, buf, sizeof(iso14b_sniff_chunk_t) + chunk->len);
+        st->sent += chunk->len;
+
+    } while (all);
+}
+
+int SniffIso14443b(uint8_t flags) {
+
+    // a chunk takes ~23 ms at 115200 baud, far longer than a DMA buffer turn
+    if ((flags & ISO14B_SNIFF_STREAM) && g_reply_via_usb == false) {
+        if (g_dbglevel >= DBG_ERROR) {
+            DbpString("Streaming sniff needs the USB connection");
+        }
+        return PM3_ENOTIMPL;
+    }
 
     LEDsoff();
     LED_A_ON();
@@ -2421,6 +2164,13 @@ void SniffIso14443b(void) {
     BigBuf_free();
     clear_trace();
     set_tracing(true);
+    sniff_dropped = 0;
+
+    // streaming, the larger half of BigBuf for the records being sent
+    sniff14b_stream_t stream = { NULL, 0, 0 };
+    if (flags & ISO14B_SNIFF_STREAM) {
+        stream.buf = BigBuf_malloc(BigBuf_max_traceLen() / 2 + 4);
+    }
 
     // Initialize Demod and Uart structs
     uint8_t dm_buf[MAX_FRAME_SIZE] = { 0 };
@@ -2449,7 +2199,7 @@ void SniffIso14443b(void) {
     if (!FpgaSetupSscDma((uint8_t*)dma->buf, DMA_BUFFER_SIZE)) {
         if (g_dbglevel > DBG_ERROR) DbpString("FpgaSetupSscDma failed. Exiting");
         switch_off();
-        return;
+        return PM3_EMALLOC;
     }
 
     // We won't start recording the frames that we acquire until we trigger;
@@ -2501,24 +2251,30 @@ void SniffIso14443b(void) {
                 }
 
                 WDT_HIT();
-                if (BUTTON_PRESS()) {
+                if (BUTTON_PRESS() || data_available()) {
                     DbpString("Sniff stopped");
                     break;
                 }
             }
+
+            // one chunk, or the swap, per DMA buffer turn. Skipped while the samples
+            // pile up, the DMA buffer must not be overrun
+            if (stream.buf && behind_by < ISO14B_SNIFF_MAX_BEHIND) {
+                Sniff14bStreamFlush(&stream, false);
+            }
         }
 
         // no need to try decoding reader data if the tag is sending
         if (tag_is_active == false) {
 
-            if (Handle14443bSampleFromReader(ci & 0x01)) {
+            if (iso14b_uart_sample(&Uart, ci & 0x01)) {
                 uint32_t eof_time = dma_start_time + (samples * 16) + 8; // - DELAY_READER_TO_ARM_SNIFF; // end of EOF
                 if (Uart.byteCnt > 0) {
                     uint32_t sof_time = eof_time
                         - Uart.byteCnt * 1 // time for byte transfers
                         - 32 * 16          // time for SOF transfer
                         - 16 * 16;         // time for EOF transfer
-                    LogTrace(Uart.output, Uart.byteCnt, (sof_time * 4), (eof_time * 4), NULL, true);
+                    Sniff14bLogTrace(Uart.output, Uart.byteCnt, (sof_time * 4), (eof_time * 4), true);
                 }
                 // And ready to receive another command.
                 Uart14bReset();
@@ -2526,7 +2282,7 @@ void SniffIso14443b(void) {
                 expect_tag_answer = true;
             }
 
-            if (Handle14443bSampleFromReader(cq & 0x01)) {
+            if (iso14b_uart_sample(&Uart, cq & 0x01)) {
 
                 uint32_t eof_time = dma_start_time + (samples * 16) + 16; // - DELAY_READER_TO_ARM_SNIFF; // end of EOF
                 if (Uart.byteCnt > 0) {
@@ -2534,7 +2290,7 @@ void SniffIso14443b(void) {
                         - Uart.byteCnt * 1 // time for byte transfers
                         - 32 * 16          // time for SOF transfer
                         - 16 * 16;         // time for EOF transfer
-                    LogTrace(Uart.output, Uart.byteCnt, (sof_time * 4), (eof_time * 4), NULL, true);
+                    Sniff14bLogTrace(Uart.output, Uart.byteCnt, (sof_time * 4), (eof_time * 4), true);
                 }
                 // And ready to receive another command
                 Uart14bReset();
@@ -2548,7 +2304,7 @@ void SniffIso14443b(void) {
         // no need to try decoding tag data if the reader is sending - and we cannot afford the time
         if (reader_is_active == false && expect_tag_answer) {
 
-            if (Handle14443bSamplesFromTag((ci >> 1), (cq >> 1))) {
+            if (iso14b_demod_samples(&Demod, (ci >> 1), (cq >> 1))) {
 
                 uint32_t eof_time = dma_start_time + (samples * 16); // - DELAY_TAG_TO_ARM_SNIFF; // end of EOF
                 uint32_t sof_time = eof_time
@@ -2556,7 +2312,7 @@ void SniffIso14443b(void) {
                     - (32 * 16)             // time for SOF transfer
                     - 0;                    // time for EOF transfer
 
-                LogTrace(Demod.output, Demod.len, (sof_time * 4), (eof_time * 4), NULL, false);
+                Sniff14bLogTrace(Demod.output, Demod.len, (sof_time * 4), (eof_time * 4), false);
                 // And ready to receive another response.
                 Uart14bReset();
                 Demod14bReset();
@@ -2572,6 +2328,10 @@ void SniffIso14443b(void) {
     FpgaDisableTracing();
     switch_off();
 
+    if (stream.buf) {
+        Sniff14bStreamFlush(&stream, true);
+    }
+
     DbpString("");
     DbpString(_CYAN_("Sniff statistics"));
     DbpString("=================================");
@@ -2582,7 +2342,9 @@ void SniffIso14443b(void) {
     Dbprintf("  DecodeReader byteCnt...%d", Uart.byteCnt);
     Dbprintf("  DecodeReader posCount..%d", Uart.posCnt);
     Dbprintf("  Trace length..........." _YELLOW_("%d"), BigBuf_get_traceLen());
+    Dbprintf("  Dropped frames........." _YELLOW_("%u"), sniff_dropped);
     DbpString("");
+    return PM3_SUCCESS;
 }
 
 static void iso14b_set_trigger(bool enable) {
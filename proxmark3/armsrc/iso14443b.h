@@ -43,9 +43,9 @@ int iso14443b_apdu(uint8_t const *msg, size_t msg_len, bool send_chaining, void
 
 int iso14443b_select_card(iso14b_card_select_t *card);
 
-void SimulateIso14443bTag(const uint8_t *pupi);
+void SimulateIso14443bTag(const uint8_t *pupi, uint8_t flags);
 void read_14b_st_block(uint8_t blocknr);
-void SniffIso14443b(void);
+int SniffIso14443b(uint8_t flags);
 void SendRawCommand14443B(iso14b_raw_cmd_t *p);
 
 bool GetIso14443bCommandFromReader(uint8_t* received, uint16_t* len);
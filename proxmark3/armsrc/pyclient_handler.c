@@ -88,8 +88,84 @@
 static pycliresp_t pyresp;
 uint8_t last_cmd[RESPONSE_SIZE]; // save last cmd before WTX since add_pcb need it
 
-uint8_t _pyframe[] = { 0x00 };
-CalypsoFrame tempframe = { NULL, 0, _pyframe, sizeof(_pyframe), true, true };
+// The python client answers the I-blocks in order. When the reader moves on before an answer came,
+// that answer is still owed and dropped when it arrives, instead of going out for the next I-block.
+static bool py_waiting;     // the last I-block relayed has no answer yet
+static uint32_t py_stale;   // answers owed to I-blocks given up on
+
+// fixed answers and the answer relayed from the python client, encoded in advance
+static CalypsoEncPool pypool;
+static CalypsoEncFrame pyframe;
+
+// S(WTX) scheduling for the answers relayed from the python client.
+// The answer comes one host round trip after the reader command. We keep a
+// smoothed estimate of that round trip and its deviation (as the TCP RTO,
+// RFC 6298) and ask the reader for srtt + 4 * rttvar with each S(WTX).
+#define PY_WTX_FWT_US(fwi)  (302 << (fwi))  // FWT = (256 x 16 / fc) * 2^FWI
+#define PY_WTX_GUARD_US     3000            // kept to transmit before the extended FWT ends
+#define PY_WTXM_MAX         59
+
+static struct {
+    uint32_t fwt_us;
+    uint32_t srtt;          // us, smoothed host round trip
+    uint32_t rttvar;        // us, mean deviation of the round trip
+    uint32_t worst;
+    uint32_t samples;
+    uint32_t misses;        // S(WTX) sent again because the answer was not there in time
+    uint32_t forwarded;     // us, reader I-block relayed to the host
+    uint8_t wtxm;           // of the S(WTX) in frame
+    CalypsoEncFrame frame;  // next S(WTX), encoded before it is needed
+} pywtx;
+
+static void py_wtx_arm(uint8_t wtxm) {
+    if (wtxm == pywtx.wtxm) {
+        return;
+    }
+    uint8_t req[4];
+    size_t reqlen;
+    create_WTX_command_with_crc(wtxm, req, &reqlen);
+    if (calypso_frame_encode(&pywtx.frame, req, reqlen)) {
+        pywtx.wtxm = wtxm;
+    }
+}
+
+static void py_wtx_init(uint8_t fwi) {
+    pywtx.fwt_us = PY_WTX_FWT_US(fwi);
+    pywtx.srtt = 0;
+    pywtx.rttvar = 0;
+    pywtx.worst = 0;
+    pywtx.samples = 0;
+    pywtx.misses = 0;
+    pywtx.wtxm = 0;
+    // nothing measured yet, ask for the longest wait
+    py_wtx_arm(PY_WTXM_MAX);
+}
+
+static void py_wtx_sample(uint32_t rtt) {
+    if (pywtx.samples == 0) {
+        pywtx.srtt = rtt;
+        pywtx.rttvar = rtt / 2;
+    } else {
+        uint32_t delta = (rtt > pywtx.srtt) ? rtt - pywtx.srtt : pywtx.srtt - rtt;
+        pywtx.rttvar = (3 * pywtx.rttvar + delta) / 4;
+        pywtx.srtt = (7 * pywtx.srtt + rtt) / 8;
+    }
+    pywtx.worst = MAX(pywtx.worst, rtt);
+    pywtx.samples++;
+}
+
+// WTXM for the next S(WTX), late when the previous extension ran out
+static uint8_t py_wtx_next(bool late) {
+    if (pywtx.samples == 0) {
+        return PY_WTXM_MAX;
+    }
+    if (late) {
+        return MIN(2 * pywtx.wtxm, PY_WTXM_MAX);
+    }
+    uint32_t need = pywtx.srtt + 4 * pywtx.rttvar + PY_WTX_GUARD_US;
+    uint32_t wtxm = (need + pywtx.fwt_us - 1) / pywtx.fwt_us;
+    return MIN(MAX(wtxm, 1), PY_WTXM_MAX);
+}
 
 
 
@@ -175,32 +251,47 @@ static void Uart14bInit(uint8_t* data) {
 // ptr tpour les reponses recues
 
 
-// Fonction pour convertir un octet en sa repr�sentation hexad�cimale dans une cha�ne
-static void byte_to_hex(uint8_t byte, char* hex) {
-    static const char hex_digits[] = "0123456789ABCDEF";
-    hex[0] = hex_digits[(byte >> 4) & 0xF];
-    hex[1] = hex_digits[byte & 0xF];
-    hex[2] = ' ';  // Ajouter un espace entre chaque octet hexad�cimal
-}
-
-// Pour envoyer des donn�es au thread du client python..
-static void SendToPyCli(const uint8_t* data, size_t length) {
+// Relay a RF frame to the python client as raw bytes plus timestamps, in one NG reply.
+// Replaces the former hex dump through Dbprintf, which cost formatting time in the 14443-B timing window.
+static void SendToPyCli(const uint8_t *data, size_t length, uint32_t sof, uint32_t eof, uint8_t flags) {
     if (length > PYCLIENT_MAX_MSG_SIZE) {
-        length = PYCLIENT_MAX_MSG_SIZE;  // S'assurer que la longueur ne d�passe pas la taille maximale
+        length = PYCLIENT_MAX_MSG_SIZE;
     }
 
-    char output[PYCLIENT_MAX_MSG_SIZE * 2 + 1] = { 0 };
-    size_t index = 0;
-    for (size_t i = 0; i < length; ++i) {
-        byte_to_hex(data[i], &output[index]);
-        index += 2;  
-    }
+    uint8_t buf[sizeof(py_client_frame_t) + PYCLIENT_MAX_MSG_SIZE];
+    py_client_frame_t *frame = (py_client_frame_t *)buf;
+    frame->sof = sof;
+    frame->eof = eof;
+    frame->flags = flags;
+    frame->len = length;
+    memcpy(frame->data, data, length);
+    reply_ng(CMD_PY_CLIENT_FRAME, PM3_SUCCESS, buf, sizeof(py_client_frame_t) + length);
+}
 
-    Dbprintf("%s", output);
+// Log the card response and relay it to the python client
+static void LogTraceCard(const uint8_t *data, uint16_t len, uint32_t sof, uint32_t eof) {
+    LogTrace(data, len, sof, eof, NULL, false);
+    SendToPyCli(data, len, sof, eof, PY_CLIENT_FRAME_CARD);
+}
+
+// Send the armed S(WTX), late when the python answer missed the previous one
+static void SendWTX(bool late) {
+    uint32_t sof = GetCountUS();
+    TransmitFor14443b_AsTag(pywtx.frame.encoded, pywtx.frame.encodedLen);
+    uint32_t eof = GetCountUS();
+    LogTrace(pywtx.frame.data, pywtx.frame.dataLen, sof, eof, NULL, false);
+    SendToPyCli(pywtx.frame.data, pywtx.frame.dataLen, sof, eof, PY_CLIENT_FRAME_CARD | (late ? PY_CLIENT_FRAME_WTX_MISS : 0));
 }
 
 // First function called when we received a data over the UART from pyclient
 void notify_middleware(PacketCommandNG* packet, uint8_t * receivedcmd, size_t cmdlen) {
+    if (py_stale) {
+        py_stale--;
+        if (g_dbglevel >= DBG_DEBUG) Dbprintf("late python answer dropped");
+        return;
+    }
+    py_waiting = false;
+
     if (packet->length == 0) {
         return;
     }
@@ -210,12 +301,13 @@ void notify_middleware(PacketCommandNG* packet, uint8_t * receivedcmd, size_t cm
     pyresp.ok = true;
     add_pcb_generic(&pyresp, receivedcmd, cmdlen);
     add_crc(&pyresp);
-    memcpy(tempframe.data, pyresp.data, pyresp.len);
-    tempframe.dataSize = pyresp.len;
-    Dbprintf("tempframe.dataSize: %d", tempframe.dataSize);
-    Dbprintf("tempframe.data: %02X %02X %02X %02X", tempframe.data[0], tempframe.data[1], tempframe.data[2], tempframe.data[3]); // les 4 premiers octets
-    // Dbprintf tempframe
-    //Dbprintf("tempframe: %02X %02X %02X %02X", tempframe[0], tempframe[1], tempframe[2], tempframe[3]); // les 4 premiers octets
+
+    // encoded now, the reader only gets it after the next WTX
+    pyresp.ok = calypso_frame_encode(&pyframe, pyresp.data, pyresp.len);
+    if (g_dbglevel >= DBG_DEBUG) {
+        Dbprintf("pyframe.dataLen: %d", pyframe.dataLen);
+        Dbprintf("pyframe.data: %02X %02X %02X %02X", pyframe.data[0], pyframe.data[1], pyframe.data[2], pyframe.data[3]); // les 4 premiers octets
+    }
 }
 
 // Mini packetReceived juste pour gerer les donnees recu du pyclient lors de la simulation.
@@ -247,31 +339,6 @@ static void PyCliPacketReceived(PacketCommandNG* packet, uint8_t* receivedcmd, s
     
     }
 }
-// Fonction pour encoder les paquets avant transmission RF
-
-static void encodeFrames(CalypsoFrame* frames, size_t frameCount) {
-    tosend_t* ts = get_tosend();  // Récupère le tampon d'envoi global
-
-    for (size_t i = 0; i < frameCount; ++i) {
-        CodeIso14443bAsTag(frames[i].data, frames[i].dataSize);
-        frames[i].encodedData = BigBuf_malloc(ts->max);
-        frames[i].encodedDataLen = ts->max;
-        memcpy(frames[i].encodedData, ts->buf, ts->max);
-    }
-    BigBuf_free();
-}
-
-
-//Fonnction pour encoder une frame avant transmission RF [one shot]
-static void encodeFrame(CalypsoFrame* frame) {
-    tosend_t* ts = get_tosend(); 
-    CodeIso14443bAsTag(frame->data, frame->dataSize);
-    frame->encodedData = BigBuf_malloc(ts->max);
-    frame->encodedDataLen = ts->max;
-    memcpy(frame->encodedData, ts->buf, ts->max);
-    BigBuf_free();
-}
-
 void handlePyClientSim(uint8_t* pupi) {
     /*
     l'objectif de cette fonction est de simuler une carte calypso avec un script python.
@@ -326,9 +393,6 @@ void handlePyClientSim(uint8_t* pupi) {
 
     uint8_t respOK[] = { 0x00, 0x78,  0xF0 };
     uint8_t respFILE_NOT_FOUND[] = { 0x02, 0x6A, 0x82, 0x4B, 0x4C };
-    uint8_t REQ_WTX[] = { 0xF2, 0x3B, 0xAF, 0xCF }; // S(WTX) avec un WTXM(0x3B) = 59 [1-59] = 2283ms [1-59] * 38.7ms
-    //uint8_t REQ_WTX[] = { 0xF2, 0x32, 0x6E, 0x52 }; // S(WTX) avec un WTXM(0x32) = 50 [1-59] = 1935ms [1-59] * 38.7ms
-    //uint8_t REQ_WTX[] = { 0xF2, 0x01, 0x76, 0x51 }; // S(WTX) avec un WTXM(0x00) = 0 [1-59] = 38.7ms [1-59] * 38.7ms
     uint8_t respEnd[] = { 0xA2,  0x60,  0x76 };
     
     // bool active = false; // flag pour indiquer si la carte est en etat actif
@@ -352,25 +416,41 @@ void handlePyClientSim(uint8_t* pupi) {
     CalypsoFrame  calypso_RESP[] = {
     { NULL, 0, respATQB, sizeof(respATQB), true, true },
     { NULL, 0, respOK, sizeof(respOK), true, true },
-    { NULL, 0, REQ_WTX, sizeof(REQ_WTX), true, true },
     { NULL, 0, respFILE_NOT_FOUND, sizeof(respFILE_NOT_FOUND), true, true },
     { NULL, 0, respEnd, sizeof(respEnd), true, true }
     };
-
-    
+    CalypsoEncFrame encoded_RESP[ARRAYLEN(calypso_RESP)];
 
     uint16_t len, cmdsReceived = 0;
     int cardSTATE = SIMCAL_NOFIELD;
     int vHf = 0; // in mV
 
-    encodeFrames(calypso_RESP, 4);
-    // 6 premiers octets de tempframe
+    // one arena for the fixed answers, a slot for the relayed one and one for the S(WTX)
+    uint32_t poolsize = CALYPSO_POOL_NEED(MAX_FRAME_SIZE) + CALYPSO_POOL_NEED(4);
+    for (size_t i = 0; i < ARRAYLEN(calypso_RESP); ++i) {
+        poolsize += CALYPSO_POOL_NEED(calypso_RESP[i].dataSize);
+    }
+    bool pool_ok = calypso_pool_init(&pypool, poolsize);
+    for (size_t i = 0; pool_ok && i < ARRAYLEN(calypso_RESP); ++i) {
+        pool_ok = calypso_pool_encode(&pypool, calypso_RESP[i].data, calypso_RESP[i].dataSize, &encoded_RESP[i]);
+    }
+    if (pool_ok == false
+            || calypso_pool_reserve(&pypool, MAX_FRAME_SIZE, &pyframe) == false
+            || calypso_pool_reserve(&pypool, 4, &pywtx.frame) == false) {
+        if (g_dbglevel > DBG_ERROR) DbpString("Not enough BigBuf for the encoded answers. Exiting");
+        switch_off();
+        return;
+    }
+
+    // FWI from the ATQB protocol info
+    py_wtx_init(respATQB[11] >> 4);
+    pyresp.ok = false;
+    py_waiting = false;
+    py_stale = 0;
 
     StartCountUS();
     uint32_t eof_time = 0; // pour les logs
     uint32_t sof_time = 0;
-    uint32_t sow_time = 0; // pour suivre le WTX
-    uint32_t eow_time = 0;
 
 
     // Simulation loop
@@ -400,9 +480,8 @@ void handlePyClientSim(uint8_t* pupi) {
             Dbprintf("button pressed, received %d commands", cmdsReceived);
             break;
         }
-        SendToPyCli(receivedCmd, len);
         eof_time = GetCountUS();
-        BigBuf_free();
+        SendToPyCli(receivedCmd, len, sof_time, eof_time, PY_CLIENT_FRAME_READER);
 
 
         if (receivedCmd[0] == CALYPSO_WUPB) {
@@ -442,6 +521,7 @@ void handlePyClientSim(uint8_t* pupi) {
 		}
         else if (receivedCmd[0] == 0x02 || receivedCmd[0] == 0x03) { // Iblock avec NS = 1 ou NS = 0
             memcpy(last_cmd, receivedCmd, len); // Copy cmd since add_pcb need it
+            pywtx.forwarded = eof_time;         // round trip to the python client starts here
             cardSTATE = PYTHON_HANDLER;
             LogTrace(receivedCmd, len, (sof_time), (eof_time), NULL, true);
         }
@@ -471,91 +551,85 @@ void handlePyClientSim(uint8_t* pupi) {
         }
         case SIMCAL_SELECTING: {
             sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[0].encodedData, calypso_RESP[0].encodedDataLen);
+            TransmitFor14443b_AsTag(encoded_RESP[0].encoded, encoded_RESP[0].encodedLen);
             eof_time = GetCountUS();
-            LogTrace(respATQB, sizeof(respATQB), (sof_time), (eof_time), NULL, false);
+            LogTraceCard(respATQB, sizeof(respATQB), (sof_time), (eof_time));
             break;
         }
         case SIMCAL_REQUESTING: {
             sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[0].encodedData, calypso_RESP[0].encodedDataLen);
+            TransmitFor14443b_AsTag(encoded_RESP[0].encoded, encoded_RESP[0].encodedLen);
             eof_time = GetCountUS();
-            LogTrace(respATQB, sizeof(respATQB), (sof_time), (eof_time), NULL, false);
+            LogTraceCard(respATQB, sizeof(respATQB), (sof_time), (eof_time));
             break;
         }
         case SIMCAL_HALTING: {
             sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[1].encodedData, calypso_RESP[1].encodedDataLen);
+            TransmitFor14443b_AsTag(encoded_RESP[1].encoded, encoded_RESP[1].encodedLen);
             eof_time = GetCountUS();
-            LogTrace(respOK, sizeof(respOK), (sof_time), (eof_time), NULL, false);
+            LogTraceCard(respOK, sizeof(respOK), (sof_time), (eof_time));
             break;
         }
 
         case SIMCAL_WIN_APP: {
             sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[3].encodedData, calypso_RESP[3].encodedDataLen);
+            TransmitFor14443b_AsTag(encoded_RESP[2].encoded, encoded_RESP[2].encodedLen);
             eof_time = GetCountUS();
-            LogTrace(respFILE_NOT_FOUND, sizeof(respFILE_NOT_FOUND), (sof_time), (eof_time), NULL, false);
+            LogTraceCard(respFILE_NOT_FOUND, sizeof(respFILE_NOT_FOUND), (sof_time), (eof_time));
             break;
         }
         case SIMCAL_B3: {
             sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[4].encodedData, calypso_RESP[4].encodedDataLen);
+            TransmitFor14443b_AsTag(encoded_RESP[3].encoded, encoded_RESP[3].encodedLen);
             eof_time = GetCountUS(); 
-            LogTrace(respEnd, sizeof(respEnd), (sof_time), (eof_time), NULL, false);
+            LogTraceCard(respEnd, sizeof(respEnd), (sof_time), (eof_time));
             break;
         }
         case HANDLE_WTX: {
-            //WTX = [2283 ms ]
-            sow_time = GetCountUS();
-            eow_time = GetCountUS();
-            bool flag = true;
-            while ((eow_time - sow_time) < ( 1 * 100000 ) || flag == true ) {   // Sortir une fois donné recu ou apres 2s pour faire une autre requete
-                // Check if there is a packet available
+            // The reader granted WTXM * FWT from the end of its S(WTX) response.
+            // Wait for the python answer until just before that, else ask again.
+            uint32_t granted = (receivedCmd[1] & 0x3F) * pywtx.fwt_us;
+            uint32_t wait_us = (granted > PY_WTX_GUARD_US) ? granted - PY_WTX_GUARD_US : 0;
+            while (pyresp.ok == false && (GetCountUS() - eof_time) < wait_us) {
+                WDT_HIT();
                 PacketCommandNG rx;
                 memset(&rx.data, 0, sizeof(rx.data));
                 int ret = receive_ng(&rx);
-                if (ret == PM3_SUCCESS && flag == true) {
+                if (ret == PM3_SUCCESS) {
                     PyCliPacketReceived(&rx, last_cmd, sizeof(last_cmd));
-                    // encode tempframe
-                    encodeFrame(&tempframe);
-                    pyresp.ok = true;
-                    flag = false;
-                    Dbprintf("data encoded");
-                }
-                else if (ret != PM3_ENODATA) {
+                    if (pyresp.ok) {
+                        py_wtx_sample(GetCountUS() - pywtx.forwarded);
+                    }
+                } else if (ret != PM3_ENODATA) {
                     Dbprintf("Error in data reception from pyclient : %d %s", ret, (ret == PM3_EIO) ? "PM3_EIO" : "");
                     // TODO if error, shall we resync ?
                 }
-                WaitUS(100);
-                eow_time = GetCountUS(); 
             }
 
-            Dbprintf("py resp :  %d", pyresp.ok);  
-           if (pyresp.ok) {
-                Dbprintf("py resp ok");
+            if (pyresp.ok) {
                 sof_time = GetCountUS();
-                TransmitFor14443b_AsTag(tempframe.encodedData, tempframe.encodedDataLen);
-                LogTrace(tempframe.data, tempframe.dataSize , sof_time, eof_time, NULL, false);
-                Dbprintf("frame sent to reader"); 
-                pyresp.ok = false; 
-            }
-            else {
-                Dbprintf("py resp not ok");
-                sof_time = GetCountUS();
-                TransmitFor14443b_AsTag(calypso_RESP[2].encodedData, calypso_RESP[2].encodedDataLen); // On renvoie le WTX
+                TransmitFor14443b_AsTag(pyframe.encoded, pyframe.encodedLen);
                 eof_time = GetCountUS();
-                LogTrace(REQ_WTX, sizeof(REQ_WTX), (sof_time), (eof_time), NULL, false);
-
+                LogTraceCard(pyframe.data, pyframe.dataLen, sof_time, eof_time);
+                pyresp.ok = false;
+                // ready for the next command, out of the timing window
+                py_wtx_arm(py_wtx_next(false));
+            } else {
+                pywtx.misses++;
+                py_wtx_arm(py_wtx_next(true));
+                SendWTX(true);
+                if (g_dbglevel >= DBG_INFO) Dbprintf("WTX miss, python answer not there after %u us, WTXM %u", GetCountUS() - pywtx.forwarded, pywtx.wtxm);
             }
             break;
         }
         case PYTHON_HANDLER: {
-            sof_time = GetCountUS();
-            TransmitFor14443b_AsTag(calypso_RESP[2].encodedData, calypso_RESP[2].encodedDataLen);
-            eof_time = GetCountUS();
-            LogTrace(REQ_WTX, sizeof(REQ_WTX), (sof_time), (eof_time), NULL, false);
-            Dbprintf("REQ_WTX sent");
+            // new command, a late answer to the previous one is no longer wanted
+            pyresp.ok = false;
+            if (py_waiting) {
+                py_stale++;
+            }
+            py_waiting = true;
+            SendWTX(false);
             break;
         }
 
@@ -571,6 +645,7 @@ void handlePyClientSim(uint8_t* pupi) {
         WaitUS(500);
     }
     switch_off();
+    if (g_dbglevel >= DBG_INFO) Dbprintf("WTX: %u answers relayed, round trip avg %u us / worst %u us, %u misses", pywtx.samples, pywtx.srtt, pywtx.worst, pywtx.misses);
     if (g_dbglevel >= DBG_DEBUG) {
         Dbprintf("Emulator stopped. Trace length: %d ", BigBuf_get_traceLen());
         BigBuf_free();
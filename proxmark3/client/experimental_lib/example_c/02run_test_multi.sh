@@ -0,0 +1,3 @@
+#!/bin/bash
+
+LD_LIBRARY_PATH=../build ./test_multi /dev/ttyACM0 /dev/ttyACM1
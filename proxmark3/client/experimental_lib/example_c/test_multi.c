@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pm3.h"
+
+// one thread per device, each drives its own Proxmark3
+static void *run(void *arg) {
+    pm3 *p = (pm3 *)arg;
+    printf("[%s] start\n", pm3_name_get(p));
+    pm3_console(p, "hw ping");
+    pm3_console(p, "hf 14a info");
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s <port> <port> [<port>...]\n", argv[0]);
+        exit(-1);
+    }
+    int n = argc - 1;
+    pm3 *p[n];
+    pthread_t t[n];
+    for (int i = 0; i < n; i++) {
+        p[i] = pm3_open(argv[i + 1]);
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_create(&t[i], NULL, run, p[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(t[i], NULL);
+        pm3_close(p[i]);
+    }
+}
@@ -16,11 +16,31 @@
 #ifndef LIBPM3_H
 #define LIBPM3_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct pm3_device pm3;
 
+// NG frame sent by the device, see PacketResponseNG
+typedef struct {
+    uint16_t cmd;
+    int16_t status;
+    uint16_t length;
+    uint8_t data[512];  // PM3_CMD_DATA_SIZE
+} pm3_frame;
+
 pm3 *pm3_open(const char *port);
 int pm3_console(pm3 *dev, const char *cmd);
 const char *pm3_name_get(pm3 *dev);
 void pm3_close(pm3 *dev);
 pm3 *pm3_get_current_dev(void);
+
+// raw commands / replies, through the client communication thread
+int pm3_send(pm3 *dev, uint16_t cmd, const uint8_t *data, uint16_t len);
+int pm3_recv(pm3 *dev, pm3_frame *frame, uint32_t timeout_ms);
+
+// NG frame codec, for callers doing their own I/O
+int pm3_frame_encode(uint16_t cmd, const uint8_t *data, uint16_t len, bool with_crc, uint8_t *out, size_t outlen);
+int pm3_frame_decode(const uint8_t *buf, size_t len, pm3_frame *frame, size_t *consumed);
 #endif // LIBPM3_H
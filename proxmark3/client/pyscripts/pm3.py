@@ -73,8 +73,27 @@ class pm3(object):
         return _pm3.pm3_console(self, cmd)
     name = property(_pm3.pm3_name_get)
 
+    def send(self, cmd, data=b''):
+        return _pm3.send(self, cmd, data)
+
+    def recv(self, timeout=1000):
+        return _pm3.recv(self, timeout)
+
+    def frames(self, timeout=100):
+        # replies as read by the client communication thread, (cmd, status, payload)
+        while True:
+            frame = _pm3.recv(self, timeout)
+            if frame is not None:
+                yield frame
+
+
 # Register pm3 in _pm3:
 _pm3.pm3_swigregister(pm3)
 
+frame_encode = _pm3.frame_encode
+frame_decode = _pm3.frame_decode
+send = _pm3.send
+recv = _pm3.recv
+
 
 
@@ -35,6 +35,8 @@
 #include "fileutils.h"          // saveFile
 #include "iclass_cmd.h"         // picopass defines
 #include "cmdhf.h"               // handle HF plot
+#include "iso7816_fs.h"         // 14b sim file system
+#include "util_posix.h"         // msclock
 
 #define MAX_14B_TIMEOUT_MS (4949U)
 
@@ -47,6 +49,12 @@
 // for static arrays
 #define ST25TB_SR_BLOCK_SIZE 4
 
+// emulator memory writes kept in flight by `hf 14b eload`
+#define HF14B_ELOAD_WINDOW   4
+
+// client side time out, waiting for the device to end a streamed sniff after an abort
+#define ISO14B_SNIFF_ABORT_TIMEOUT  3000
+
 
 // SR memory sizes
 #define SR_SIZE_512      1
@@ -850,54 +858,578 @@ static int CmdHF14BList(const char *Cmd) {
     return CmdTraceListAlias(Cmd, "hf 14b", "14b -c");
 }
 
+// ISO7816 file system image, see iso7816_fs.h
+typedef struct {
+    iso7816_fs_hdr_t hdr;
+    iso7816_fs_file_t files[ISO7816_FS_MAX_FILES];
+    uint8_t data[ISO7816_FS_MAX_SIZE];
+    uint16_t data_len;      // data offsets are from data[] until hf14b_fs_build()
+    uint16_t records;
+} hf14b_fs_builder_t;
+
+static int hf14b_fs_data(hf14b_fs_builder_t *b, const uint8_t *data, size_t len, uint16_t *offset) {
+    if (b->data_len + len > sizeof(b->data)) {
+        PrintAndLogEx(ERR, "file system too large for emulator memory");
+        return PM3_EOVFLOW;
+    }
+    memcpy(b->data + b->data_len, data, len);
+    *offset = b->data_len;
+    b->data_len += len;
+    return PM3_SUCCESS;
+}
+
+// file fid of the DF parent, added with type when missing
+static int hf14b_fs_file(hf14b_fs_builder_t *b, uint8_t parent, uint16_t fid, uint8_t type, uint8_t *idx) {
+    for (uint8_t i = 1; i < b->hdr.file_count; i++) {
+        if (b->files[i].parent == parent && b->files[i].fid == fid) {
+            *idx = i;
+            return PM3_SUCCESS;
+        }
+    }
+    if (b->files[parent].type != ISO7816_FS_DF) {
+        PrintAndLogEx(ERR, "%04X is not a DF", b->files[parent].fid);
+        return PM3_EINVARG;
+    }
+    if (b->hdr.file_count >= ISO7816_FS_MAX_FILES) {
+        PrintAndLogEx(ERR, "too many files, max " _YELLOW_("%u"), ISO7816_FS_MAX_FILES);
+        return PM3_EOVFLOW;
+    }
+    *idx = b->hdr.file_count++;
+    iso7816_fs_file_t *f = &b->files[*idx];
+    memset(f, 0, sizeof(iso7816_fs_file_t));
+    f->fid = fid;
+    f->parent = parent;
+    f->type = type;
+    return PM3_SUCCESS;
+}
+
+static int hf14b_fs_json_hex(json_t *obj, const char *key, uint8_t *data, size_t maxlen, int *len) {
+    const char *s = json_string_value(json_object_get(obj, key));
+    if (s == NULL) {
+        *len = 0;
+        return PM3_SUCCESS;
+    }
+    *len = hex_to_bytes(s, data, maxlen);
+    if (*len < 0) {
+        PrintAndLogEx(ERR, "invalid hex in " _YELLOW_("%s") " `%s`", key, s);
+        return PM3_EFILE;
+    }
+    return PM3_SUCCESS;
+}
+
+// One entry of "files", the DFs on its path are added when missing
+static int hf14b_fs_from_json_file(hf14b_fs_builder_t *b, json_t *jf, size_t n) {
+
+    const char *path = json_string_value(json_object_get(jf, "path"));
+    if (path == NULL) {
+        PrintAndLogEx(ERR, "no path in file %zu", n);
+        return PM3_EFILE;
+    }
+
+    uint8_t data[ISO7816_FS_MAX_SIZE];
+    int dlen = 0;
+
+    json_t *records = json_object_get(jf, "records");
+    const char *type = json_string_value(json_object_get(jf, "type"));
+    uint8_t ftype = ISO7816_FS_DF;
+    if (type == NULL) {
+        if (records) {
+            ftype = ISO7816_FS_EF_LINEAR;
+        } else if (json_object_get(jf, "data")) {
+            ftype = ISO7816_FS_EF_BINARY;
+        }
+    } else if (strcmp(type, "df") == 0) {
+        ftype = ISO7816_FS_DF;
+    } else if (strcmp(type, "binary") == 0) {
+        ftype = ISO7816_FS_EF_BINARY;
+    } else if (strcmp(type, "linear") == 0) {
+        ftype = ISO7816_FS_EF_LINEAR;
+    } else if (strcmp(type, "cyclic") == 0) {
+        ftype = ISO7816_FS_EF_CYCLIC;
+    } else {
+        PrintAndLogEx(ERR, "unknown type " _YELLOW_("%s") " in " _YELLOW_("%s"), type, path);
+        return PM3_EFILE;
+    }
+
+    // "2000/2010" or "3F00/2000/2010", from the MF
+    uint8_t idx = 0;
+    const char *p = path;
+    while (*p) {
+        char *end;
+        uint16_t fid = strtoul(p, &end, 16);
+        if (end == p || (*end && *end != '/')) {
+            PrintAndLogEx(ERR, "invalid path " _YELLOW_("%s"), path);
+            return PM3_EFILE;
+        }
+        p = (*end) ? end + 1 : end;
+
+        if (idx == 0 && fid == ISO7816_FS_MF) {
+            continue;
+        }
+        int res = hf14b_fs_file(b, idx, fid, (*p) ? ISO7816_FS_DF : ftype, &idx);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+    }
+
+    iso7816_fs_file_t *f = &b->files[idx];
+    if (f->type != ftype) {
+        PrintAndLogEx(ERR, _YELLOW_("%s") " type mismatch", path);
+        return PM3_EFILE;
+    }
+
+    json_t *jsfi = json_object_get(jf, "sfi");
+    if (jsfi) {
+        f->sfi = json_is_string(jsfi) ? strtoul(json_string_value(jsfi), NULL, 16) : json_integer_value(jsfi);
+        if (f->sfi == 0 || f->sfi > 30) {
+            PrintAndLogEx(ERR, "invalid sfi in " _YELLOW_("%s"), path);
+            return PM3_EFILE;
+        }
+    }
+
+    if (hf14b_fs_json_hex(jf, "aid", f->aid, sizeof(f->aid), &dlen) != PM3_SUCCESS) {
+        return PM3_EFILE;
+    }
+    f->aid_len = dlen;
+
+    if (hf14b_fs_json_hex(jf, "fci", data, sizeof(data), &dlen) != PM3_SUCCESS) {
+        return PM3_EFILE;
+    }
+    if (dlen) {
+        uint16_t offset = 0;
+        int res = hf14b_fs_data(b, data, dlen, &offset);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+        f->fci_offset = offset;
+        f->fci_len = dlen;
+    }
+
+    uint16_t offset = 0;
+    if (ftype == ISO7816_FS_EF_BINARY) {
+        if (hf14b_fs_json_hex(jf, "data", data, sizeof(data), &dlen) != PM3_SUCCESS) {
+            return PM3_EFILE;
+        }
+        int res = hf14b_fs_data(b, data, dlen, &offset);
+        f->data_offset = offset;
+        f->data_len = dlen;
+        return res;
+    }
+
+    if (ftype == ISO7816_FS_EF_LINEAR || ftype == ISO7816_FS_EF_CYCLIC) {
+        // fixed size records, the shorter ones padded with zeros
+        size_t count = json_array_size(records);
+        if (count > 0xFF) {
+            PrintAndLogEx(ERR, "too many records in " _YELLOW_("%s"), path);
+            return PM3_EFILE;
+        }
+        uint8_t reclen = 0;
+        for (size_t r = 0; r < count; r++) {
+            const char *rs = json_string_value(json_array_get(records, r));
+            dlen = (rs) ? hex_to_bytes(rs, data, 0xFF) : -1;
+            if (dlen <= 0) {
+                PrintAndLogEx(ERR, "invalid record %zu in " _YELLOW_("%s"), r + 1, path);
+                return PM3_EFILE;
+            }
+            reclen = MAX(reclen, dlen);
+        }
+        if (reclen * count > sizeof(data)) {
+            PrintAndLogEx(ERR, "file system too large for emulator memory");
+            return PM3_EOVFLOW;
+        }
+
+        memset(data, 0, reclen * count);
+        for (size_t r = 0; r < count; r++) {
+            hex_to_bytes(json_string_value(json_array_get(records, r)), data + r * reclen, reclen);
+        }
+        int res = hf14b_fs_data(b, data, reclen * count, &offset);
+        f->rec_len = reclen;
+        f->rec_count = count;
+        f->data_offset = offset;
+        f->data_len = reclen * count;
+        b->records += count;
+        return res;
+    }
+    return PM3_SUCCESS;
+}
+
+//  {
+//    "FileType": "14b fs",
+//    "atqb": "820DE174 20381922 002185",               optional: PUPI, application data, protocol info
+//    "files": [
+//      { "path": "2000", "aid": "315449432E494341", "fci": "6F22..." },
+//      { "path": "2000/2001", "type": "linear", "sfi": 1, "records": [ "...", ... ] },
+//      { "path": "0002", "type": "binary", "data": "..." }, ...
+//    ]
+//  }
+static int hf14b_fs_from_json(hf14b_fs_builder_t *b, json_t *root) {
+
+    memset(b, 0, sizeof(hf14b_fs_builder_t));
+    b->hdr.file_count = 1;
+    b->files[0].fid = ISO7816_FS_MF;
+    b->files[0].parent = ISO7816_FS_NO_FILE;
+    b->files[0].type = ISO7816_FS_DF;
+
+    int dlen = 0;
+    if (hf14b_fs_json_hex(root, "atqb", b->hdr.atqb, sizeof(b->hdr.atqb), &dlen) != PM3_SUCCESS) {
+        return PM3_EFILE;
+    }
+    if (dlen) {
+        if (dlen != sizeof(b->hdr.atqb)) {
+            PrintAndLogEx(ERR, "atqb must be %zu bytes, PUPI + application data + protocol info", sizeof(b->hdr.atqb));
+            return PM3_EFILE;
+        }
+        b->hdr.flags |= ISO7816_FS_ATQB;
+    }
+
+    json_t *files = json_object_get(root, "files");
+    if (json_array_size(files) == 0) {
+        PrintAndLogEx(ERR, "no files");
+        return PM3_EFILE;
+    }
+    for (size_t i = 0; i < json_array_size(files); i++) {
+        int res = hf14b_fs_from_json_file(b, json_array_get(files, i), i);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+    }
+    return PM3_SUCCESS;
+}
+
+// Lay out the image: header, file table, data
+static int hf14b_fs_build(hf14b_fs_builder_t *b, uint8_t **out, size_t *outlen) {
+
+    size_t tables = sizeof(iso7816_fs_hdr_t) + b->hdr.file_count * sizeof(iso7816_fs_file_t);
+    size_t size = tables + b->data_len;
+    if (size > ISO7816_FS_MAX_SIZE) {
+        PrintAndLogEx(ERR, "file system is " _YELLOW_("%zu") " bytes, max " _YELLOW_("%u"), size, ISO7816_FS_MAX_SIZE);
+        return PM3_EOVFLOW;
+    }
+
+    uint8_t *buf = calloc(size, sizeof(uint8_t));
+    if (buf == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    b->hdr.magic = ISO7816_FS_MAGIC;
+    b->hdr.version = ISO7816_FS_VERSION;
+    b->hdr.size = size;
+    memcpy(buf, &b->hdr, sizeof(iso7816_fs_hdr_t));
+
+    iso7816_fs_file_t *files = (iso7816_fs_file_t *)(buf + sizeof(iso7816_fs_hdr_t));
+    for (uint8_t i = 0; i < b->hdr.file_count; i++) {
+        files[i] = b->files[i];
+        files[i].fci_offset += tables;
+        files[i].data_offset += tables;
+    }
+    memcpy(buf + tables, b->data, b->data_len);
+
+    if (iso7816_fs_check(buf, size) == NULL) {
+        PrintAndLogEx(ERR, "invalid file system");
+        free(buf);
+        return PM3_ESOFT;
+    }
+
+    *out = buf;
+    *outlen = size;
+    return PM3_SUCCESS;
+}
+
+// Emulator memory upload, HF14B_ELOAD_WINDOW writes in flight
+static int hf14b_fs_upload(const uint8_t *data, size_t len) {
+    struct p {
+        uint32_t offset;
+        uint16_t count;
+        uint8_t data[];
+    } PACKED;
+
+    uint8_t buf[PM3_CMD_DATA_SIZE];
+    struct p *payload = (struct p *)buf;
+    size_t chunksize = sizeof(buf) - sizeof(struct p);
+    size_t chunks = (len + chunksize - 1) / chunksize;
+
+    uint32_t tags[HF14B_ELOAD_WINDOW];
+    size_t next = 0;
+
+    clearCommandBuffer();
+
+    for (size_t done = 0; done < chunks; done++) {
+
+        // keep the pipeline full
+        while (next < chunks && (next - done) < HF14B_ELOAD_WINDOW) {
+            payload->offset = next * chunksize;
+            payload->count = MIN(chunksize, len - payload->offset);
+            memcpy(payload->data, data + payload->offset, payload->count);
+            int res = SendCommandNGAsync(CMD_HF_ISO14443B_EML_SETMEM, buf, sizeof(struct p) + payload->count, CMD_HF_ISO14443B_EML_SETMEM, &tags[next % HF14B_ELOAD_WINDOW]);
+            if (res != PM3_SUCCESS) {
+                break;
+            }
+            next++;
+        }
+
+        if (next == done) {
+            PrintAndLogEx(WARNING, "failed to send emulator memory");
+            ClearAsyncRequests();
+            return PM3_ESOFT;
+        }
+
+        PacketResponseNG resp;
+        if (WaitForAsyncResponse(tags[done % HF14B_ELOAD_WINDOW], &resp, 1500) == false) {
+            PrintAndLogEx(WARNING, "command execution time out");
+            ClearAsyncRequests();
+            return PM3_ETIMEOUT;
+        }
+        if (resp.status != PM3_SUCCESS) {
+            PrintAndLogEx(FAILED, "Can't set emulator memory at offset: %zu / 0x%zx", done * chunksize, done * chunksize);
+            ClearAsyncRequests();
+            return resp.status;
+        }
+    }
+    return PM3_SUCCESS;
+}
+
+static int CmdHF14BELoad(const char *Cmd) {
+
+    CLIParserContext *ctx;
+    CLIParserInit(&ctx, "hf 14b eload",
+                  "Load an ISO7816-4 file system to emulator memory, to be used with 'hf 14b sim --fs'.\n"
+                  "The JSON file lists the DF / EF tree with the FCI, records and binary contents\n"
+                  "of each file, and optionally the ATQB of the card",
+                  "hf 14b eload -f hf-14b-fs.json\n"
+                  "hf 14b eload -f hf-14b-fs.json --save fs   -> also save fs.bin"
+                 );
+
+    void *argtable[] = {
+        arg_param_begin,
+        arg_str1("f", "file", "<fn>", "Specify a filename for the file system"),
+        arg_str0(NULL, "save", "<fn>", "save the built image as binary"),
+        arg_param_end
+    };
+    CLIExecWithReturn(ctx, Cmd, argtable, false);
+
+    int fnlen = 0;
+    char filename[FILE_PATH_SIZE];
+    CLIParamStrToBuf(arg_get_str(ctx, 1), (uint8_t *)filename, FILE_PATH_SIZE, &fnlen);
+
+    int savelen = 0;
+    char savename[FILE_PATH_SIZE] = {0};
+    CLIParamStrToBuf(arg_get_str(ctx, 2), (uint8_t *)savename, FILE_PATH_SIZE, &savelen);
+    CLIParserFree(ctx);
+
+    hf14b_fs_builder_t *b = calloc(1, sizeof(hf14b_fs_builder_t));
+    if (b == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    json_t *root = NULL;
+    int res = loadFileJSONroot(filename, (void **)&root, true);
+    if (res == PM3_SUCCESS) {
+        res = hf14b_fs_from_json(b, root);
+        json_decref(root);
+    }
+
+    uint8_t *image = NULL;
+    size_t size = 0;
+    if (res == PM3_SUCCESS) {
+        res = hf14b_fs_build(b, &image, &size);
+    }
+    if (res != PM3_SUCCESS) {
+        free(b);
+        return res;
+    }
+
+    PrintAndLogEx(INFO, "File system, " _YELLOW_("%u") " files, " _YELLOW_("%u") " records, " _YELLOW_("%zu") " bytes"
+                  , b->hdr.file_count, b->records, size);
+    free(b);
+
+    if (savelen) {
+        res = saveFile(savename, ".bin", image, size);
+        if (res != PM3_SUCCESS) {
+            free(image);
+            return res;
+        }
+    }
+
+    res = hf14b_fs_upload(image, size);
+    free(image);
+    if (res != PM3_SUCCESS) {
+        return res;
+    }
+    PrintAndLogEx(SUCCESS, "uploaded " _YELLOW_("%zu") " bytes to emulator memory", size);
+    PrintAndLogEx(HINT, "You are ready to simulate. See " _YELLOW_("`hf 14b sim -h`"));
+    return PM3_SUCCESS;
+}
+
 static int CmdHF14BSim(const char *Cmd) {
 
     CLIParserContext *ctx;
     CLIParserInit(&ctx, "hf 14b sim",
-                  "Simulate a ISO/IEC 14443 type B tag with 4 byte UID / PUPI",
-                  "hf 14b sim -u 11AA33BB"
+                  "Simulate a ISO/IEC 14443 type B tag with 4 byte UID / PUPI.\n"
+                  "With --fs, the APDUs are answered from the ISO7816 file system loaded by `hf 14b eload`,\n"
+                  "the PUPI defaults to the one of the file system",
+                  "hf 14b sim -u 11AA33BB\n"
+                  "hf 14b sim --fs"
                  );
 
     void *argtable[] = {
         arg_param_begin,
-        arg_str1("u", "uid", "hex", "4byte UID/PUPI"),
+        arg_str0("u", "uid", "hex", "4byte UID/PUPI"),
+        arg_lit0(NULL, "fs", "answer APDUs from the file system in emulator memory"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, false);
 
-    uint8_t pupi[4];
+    iso14b_sim_t payload = {0};
     int n = 0;
-    int res = CLIParamHexToBuf(arg_get_str(ctx, 1), pupi, sizeof(pupi), &n);
+    int res = CLIParamHexToBuf(arg_get_str(ctx, 1), payload.pupi, sizeof(payload.pupi), &n);
+    bool use_fs = arg_get_lit(ctx, 2);
     CLIParserFree(ctx);
 
-    if (res) {
+    if (res || (n != sizeof(payload.pupi) && (n || use_fs == false))) {
         PrintAndLogEx(FAILED, "failed to read pupi");
         return PM3_EINVARG;
     }
 
-    PrintAndLogEx(INFO, "Simulate with PUPI : " _GREEN_("%s"), sprint_hex_inrow(pupi, sizeof(pupi)));
+    if (use_fs) {
+        payload.flags |= ISO14B_SIM_FS;
+    }
+
+    if (n) {
+        PrintAndLogEx(INFO, "Simulate with PUPI : " _GREEN_("%s"), sprint_hex_inrow(payload.pupi, sizeof(payload.pupi)));
+    }
+    if (use_fs) {
+        PrintAndLogEx(INFO, "Answering APDUs from the emulator memory file system");
+    }
     PrintAndLogEx(INFO, "Press " _GREEN_("pm3 button") " to abort simulation");
     clearCommandBuffer();
-    SendCommandNG(CMD_HF_ISO14443B_SIMULATE, pupi, sizeof(pupi));
+    SendCommandNG(CMD_HF_ISO14443B_SIMULATE, (uint8_t *)&payload, sizeof(payload));
     return PM3_SUCCESS;
 }
 
+// hf 14b sniff --stream, the trace records are appended to a .trace file as the device sends them
+static int hf14b_sniff_stream(const char *filename) {
+
+    char *fn = newfilenamemcopyEx(filename, ".trace", spTrace);
+    if (fn == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    FILE *f = fopen(fn, "wb");
+    if (f == NULL) {
+        PrintAndLogEx(WARNING, "file not found or locked `" _YELLOW_("%s") "`", fn);
+        free(fn);
+        return PM3_EFILE;
+    }
+
+    PrintAndLogEx(INFO, "Streaming trace to `" _YELLOW_("%s") "`", fn);
+    PrintAndLogEx(INFO, "Press " _GREEN_("pm3 button") " or " _GREEN_("<Enter>") " to abort sniffing");
+
+    uint8_t flags = ISO14B_SNIFF_STREAM;
+    clearCommandBuffer();
+    SendCommandNG(CMD_HF_ISO14443B_SNIFF, &flags, sizeof(flags));
+
+    size_t total = 0;
+    uint32_t dropped = 0;
+    bool aborted = false;
+    uint64_t aborted_at = 0;
+    int res = PM3_SUCCESS;
+
+    for (;;) {
+
+        if (aborted == false && kbd_enter_pressed()) {
+            SendCommandNG(CMD_BREAK_LOOP, NULL, 0);
+            aborted = true;
+            aborted_at = msclock();
+        }
+
+        PacketResponseNG resp;
+        if (WaitForResponseTimeout(CMD_HF_ISO14443B_SNIFF, &resp, 500) == false) {
+            // a quiet field sends nothing, keep waiting until the device goes away or ignores the abort
+            if (IsCommunicationThreadDead()) {
+                PrintAndLogEx(NORMAL, "");
+                PrintAndLogEx(WARNING, "lost connection to the Proxmark3");
+                res = PM3_EIO;
+                break;
+            }
+            if (aborted && (msclock() - aborted_at) > ISO14B_SNIFF_ABORT_TIMEOUT) {
+                PrintAndLogEx(NORMAL, "");
+                PrintAndLogEx(WARNING, "timeout while waiting for the end of the sniff");
+                res = PM3_ETIMEOUT;
+                break;
+            }
+            continue;
+        }
+
+        // the final answer has no records
+        if (resp.length < sizeof(iso14b_sniff_chunk_t)) {
+            if (resp.status == PM3_ENOTIMPL) {
+                PrintAndLogEx(FAILED, "Streaming needs the Proxmark3 connected over USB");
+                res = resp.status;
+            }
+            break;
+        }
+
+        iso14b_sniff_chunk_t *chunk = (iso14b_sniff_chunk_t *)resp.data.asBytes;
+        if (chunk->len > resp.length - sizeof(iso14b_sniff_chunk_t)) {
+            PrintAndLogEx(WARNING, "invalid trace chunk, %u bytes", chunk->len);
+            res = PM3_ESOFT;
+            continue;
+        }
+
+        if (fwrite(chunk->data, 1, chunk->len, f) != chunk->len) {
+            PrintAndLogEx(WARNING, "failed to write `" _YELLOW_("%s") "`", fn);
+            res = PM3_EFILE;
+        }
+        fflush(f);
+        total += chunk->len;
+
+        if (chunk->dropped != dropped) {
+            PrintAndLogEx(NORMAL, "");
+            PrintAndLogEx(WARNING, "trace full, " _RED_("%u") " frames dropped", chunk->dropped - dropped);
+            dropped = chunk->dropped;
+        }
+        PrintAndLogEx(INPLACE, "received " _YELLOW_("%zu") " bytes", total);
+    }
+    fclose(f);
+
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(SUCCESS, "Saved " _YELLOW_("%zu") " bytes to trace file `" _YELLOW_("%s") "`, " _YELLOW_("%u") " frames dropped", total, fn, dropped);
+    PrintAndLogEx(HINT, "Try `" _YELLOW_("trace load -f %s") "` and `" _YELLOW_("hf 14b list -1") "` to view captured tracelog", fn);
+    free(fn);
+    return res;
+}
+
 static int CmdHF14BSniff(const char *Cmd) {
 
     CLIParserContext *ctx;
     CLIParserInit(&ctx, "hf 14b sniff",
                   "Sniff the communication between reader and tag.\n"
-                  "Use `hf 14b list` to view collected data.",
-                  "hf 14b sniff"
+                  "Use `hf 14b list` to view collected data.\n"
+                  "With --stream, the trace is sent to the client while sniffing and saved to a trace file,\n"
+                  "the session is no longer limited by the device memory",
+                  "hf 14b sniff\n"
+                  "hf 14b sniff --stream -f validator   -> saves validator.trace"
                  );
 
     void *argtable[] = {
         arg_param_begin,
+        arg_lit0(NULL, "stream", "stream the trace to a file while sniffing"),
+        arg_str0("f", "file", "<fn>", "trace file name for --stream"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, true);
+    bool stream = arg_get_lit(ctx, 1);
+    int fnlen = 0;
+    char filename[FILE_PATH_SIZE] = {0};
+    CLIParamStrToBuf(arg_get_str(ctx, 2), (uint8_t *)filename, FILE_PATH_SIZE, &fnlen);
     CLIParserFree(ctx);
 
+    if (stream) {
+        return hf14b_sniff_stream((fnlen) ? filename : "hf-14b-sniff");
+    }
+
     PrintAndLogEx(INFO, "Press " _GREEN_("pm3 button") " to abort sniffing");
 
     PacketResponseNG resp;
@@ -2884,6 +3416,7 @@ static command_t CommandTable[] = {
     {"---------", CmdHelp,             AlwaysAvailable, "----------------------- " _CYAN_("Operations") " -----------------------"},
     {"apdu",      CmdHF14BAPDU,        IfPm3Iso14443b,  "Send ISO 14443-4 APDU to tag"},
     {"dump",      CmdHF14BDump,        IfPm3Iso14443b,  "Read all memory pages of an ISO-14443-B tag, save to file"},
+    {"eload",     CmdHF14BELoad,       IfPm3Iso14443b,  "Load ISO7816 file system to emulator memory"},
     {"info",      CmdHF14Binfo,        IfPm3Iso14443b,  "Tag information"},
     {"ndefread",  CmdHF14BNdefRead,    IfPm3Iso14443b,  "Read NDEF file on tag"},
     {"raw",       CmdHF14BRaw,         IfPm3Iso14443b,  "Send raw hex data to tag"},
@@ -50,6 +50,7 @@
 #define FrameEOF                Iso15693FrameEOF
 #define CARD_MEMORY_SIZE        4096
 #define HF15_UID_LENGTH         8
+#define HF15_DUMP_WINDOW        8   // block reads kept in flight by `hf 15 dump`
 
 #ifndef Crc15
 # define Crc15(data, len)       Crc16ex(CRC_15693, (data), (len))
@@ -1953,60 +1954,86 @@ static int CmdHF15Dump(const char *Cmd) {
 
     PrintAndLogEx(SUCCESS, "Reading memory");
 
+    // block reads are pipelined, keeping up to HF15_DUMP_WINDOW reads in flight.
+    // The device answers in order, so when a block fails the speculative reads after it are dropped
+    // and reading restarts from the failing block.
+    uint32_t tags[HF15_DUMP_WINDOW];
     int blocknum = 0;
+    int next = 0;
+    int retry = 0;
+    bool stop = false;
 
-    for (int retry = 0; (retry < 2 && blocknum < tag->pagesCount); retry++) {
-        if (used_uid) {
-            packet->raw[10] = (uint8_t)blocknum & 0xFF;
-            AddCrc15(packet->raw, 11);
-        } else {
-            packet->raw[2] = (uint8_t)blocknum & 0xFF;
-            AddCrc15(packet->raw, 3);
-        }
+    clearCommandBuffer();
 
-        clearCommandBuffer();
-        SendCommandNG(CMD_HF_ISO15693_COMMAND, (uint8_t *)packet, ISO15_RAW_LEN(packet->rawlen));
+    while (retry < 2 && blocknum < tag->pagesCount && stop == false) {
 
-        if (WaitForResponseTimeout(CMD_HF_ISO15693_COMMAND, &resp, 2000)) {
+        // keep the pipeline full
+        while (next < tag->pagesCount && (next - blocknum) < HF15_DUMP_WINDOW) {
+            if (used_uid) {
+                packet->raw[10] = (uint8_t)next & 0xFF;
+                AddCrc15(packet->raw, 11);
+            } else {
+                packet->raw[2] = (uint8_t)next & 0xFF;
+                AddCrc15(packet->raw, 3);
+            }
 
-            if (resp.length < 2) {
-                PrintAndLogEx(NORMAL, "");
-                PrintAndLogEx(FAILED, "iso15693 command failed");
-                continue;
+            if (SendCommandNGAsync(CMD_HF_ISO15693_COMMAND, (uint8_t *)packet, ISO15_RAW_LEN(packet->rawlen), CMD_HF_ISO15693_COMMAND, &tags[next % HF15_DUMP_WINDOW]) != PM3_SUCCESS) {
+                break;
             }
+            next++;
+        }
+
+        if (next == blocknum) {
+            break;
+        }
+
+        bool ok = false;
+
+        if (WaitForAsyncResponse(tags[blocknum % HF15_DUMP_WINDOW], &resp, 2000)) {
 
             d = resp.data.asBytes;
 
-            if (CheckCrc15(d, resp.length) == false) {
+            if (resp.length < 2) {
+                PrintAndLogEx(NORMAL, "");
+                PrintAndLogEx(FAILED, "iso15693 command failed");
+            } else if (CheckCrc15(d, resp.length) == false) {
                 PrintAndLogEx(NORMAL, "");
                 PrintAndLogEx(FAILED, "crc ( " _RED_("fail") " )");
-                continue;
-            }
-
-            if ((d[0] & ISO15_RES_ERROR) == ISO15_RES_ERROR) {
+            } else if ((d[0] & ISO15_RES_ERROR) == ISO15_RES_ERROR) {
 
                 // heuristic determine end of available memory
-                if (d[1] == 0x0F || d[1] == 0x10) {
-                    break;
+                if (d[1] != 0x0F && d[1] != 0x10) {
+                    PrintAndLogEx(NORMAL, "");
+                    PrintAndLogEx(FAILED, "Tag returned Error %i: %s", d[1], TagErrorStr(d[1]));
                 }
+                stop = true;
+            } else {
+                ok = true;
+            }
+        }
 
-                PrintAndLogEx(NORMAL, "");
-                PrintAndLogEx(FAILED, "Tag returned Error %i: %s", d[1], TagErrorStr(d[1]));
-                break;
+        if (ok == false) {
+            // drop the reads queued after the failing block
+            for (int i = blocknum + 1; i < next; i++) {
+                CancelAsyncRequest(tags[i % HF15_DUMP_WINDOW]);
             }
+            next = blocknum;
+            retry++;
+            continue;
+        }
 
-            tag->locks[blocknum] = d[1];
+        tag->locks[blocknum] = d[1];
 
-            // copy read data
-            memcpy(&tag->data[blocknum * tag->bytesPerPage], d + 2, tag->bytesPerPage);
+        // copy read data
+        memcpy(&tag->data[blocknum * tag->bytesPerPage], d + 2, tag->bytesPerPage);
 
-            retry = 0;
-            blocknum++;
+        retry = 0;
+        blocknum++;
 
-            PrintAndLogEx(INPLACE, "blk %3d", blocknum);
-        }
+        PrintAndLogEx(INPLACE, "blk %3d", blocknum);
     }
 
+    ClearAsyncRequests();
     free(packet);
     DropField();
 
@@ -19,11 +19,13 @@
 #include "cmdhflist.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "commonutil.h"  // ARRAYLEN
 #include "mifare/mifarehost.h"
+#include "mifare/mfkey.h"      // mfkey_auth_candidates
 #include "parity.h"         // oddparity
 #include "ui.h"
 #include "crc16.h"
@@ -2171,16 +2173,12 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
             }
 
             // check default keys
-            if (!traceCrypto1 && dicKeys != NULL && dicKeysCount > 0) {
-                for (int i = 0; i < dicKeysCount; i++) {
-                    if (NestedCheckKey(dicKeys[i], &AuthData, cmd, cmdsize, parity)) {
-                        PrintAndLogEx(NORMAL, "            |            |  *  |%60s " _GREEN_("%012" PRIX64) "|     |", "key", dicKeys[i]);
+            uint64_t key64 = 0;
+            if (!traceCrypto1 && dicKeys != NULL && dicKeysCount > 0 && NestedCheckKeys(dicKeys, dicKeysCount, &AuthData, cmd, cmdsize, parity, &key64)) {
+                PrintAndLogEx(NORMAL, "            |            |  *  |%60s " _GREEN_("%012" PRIX64) "|     |", "key", key64);
 
-                        mfLastKey = dicKeys[i];
-                        traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
-                        break;
-                    };
-                }
+                mfLastKey = key64;
+                traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
             }
 
             // nested
@@ -2343,6 +2341,36 @@ bool NestedCheckKey(uint64_t key, AuthData_t *ad, uint8_t *cmd, uint8_t cmdsize,
     return true;
 }
 
+// NestedCheckKey() on a whole dictionary: the bitsliced pre-check leaves the keys giving
+// the right ar and at, verified in dictionary order. The first valid key goes to *key.
+bool NestedCheckKeys(const uint64_t *keys, uint32_t count, AuthData_t *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, uint64_t *key) {
+    uint32_t *cand = NULL;
+    int n = mfkey_auth_candidates(keys, count, ad->uid, ad->nt_enc, ad->nr_enc, ad->ar_enc, ad->at_enc, &cand);
+
+    // out of memory, one at a time
+    if (n < 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (NestedCheckKey(keys[i], ad, cmd, cmdsize, parity)) {
+                *key = keys[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    AuthData.ks2 = 0;
+    AuthData.ks3 = 0;
+    for (int i = 0; i < n; i++) {
+        if (NestedCheckKey(keys[cand[i]], ad, cmd, cmdsize, parity)) {
+            *key = keys[cand[i]];
+            free(cand);
+            return true;
+        }
+    }
+    free(cand);
+    return false;
+}
+
 bool CheckCrypto1Parity(const uint8_t *cmd_enc, uint8_t cmdsize, uint8_t *cmd, const uint8_t *parity_enc) {
     for (int i = 0; i < cmdsize - 1; i++) {
         if (oddparity8(cmd[i]) ^ (cmd[i + 1] & 0x01) ^ ((parity_enc[i / 8] >> (7 - i % 8)) & 0x01) ^ (cmd_enc[i + 1] & 0x01))
@@ -71,6 +71,7 @@ void annotateSeos(char *exp, size_t size, uint8_t *cmd, uint8_t cmdsize);
 bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isResponse, uint8_t *mfData, size_t *mfDataLen, const uint64_t *dicKeys, uint32_t dicKeysCount);
 bool NTParityChk(AuthData_t *ad, uint32_t ntx);
 bool NestedCheckKey(uint64_t key, AuthData_t *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity);
+bool NestedCheckKeys(const uint64_t *keys, uint32_t count, AuthData_t *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, uint64_t *key);
 bool CheckCrypto1Parity(const uint8_t *cmd_enc, uint8_t cmdsize, uint8_t *cmd, const uint8_t *parity_enc);
 uint64_t GetCrypto1ProbableKey(AuthData_t *ad);
 
@@ -2197,6 +2197,8 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
                   "hf mf hardnested --blk 0 -a -k FFFFFFFFFFFF --tblk 4 --ta -f nonces.bin -w -s\n"
                   "hf mf hardnested -r\n"
                   "hf mf hardnested -r --tk a0a1a2a3a4a5\n"
+                  "hf mf hardnested --tblk 4 --ta --resume\n"
+                  "hf mf hardnested --tblk 4 --ta --resume -u 11223344     --> continue brute force without the card\n"
                   "hf mf hardnested -t --tk a0a1a2a3a4a5\n"
                   "hf mf hardnested --blk 0 -a -k a0a1a2a3a4a5 --tblk 4 --ta --tk FFFFFFFFFFFF\n"
                  );
@@ -2217,6 +2219,7 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
         arg_lit0("s",  "slow",           "Slower acquisition (required by some non standard cards)"),
         arg_lit0("t",  "tests",          "Run tests"),
         arg_lit0("w",  "wr",             "Acquire nonces and UID, and write them to file `hf-mf-<UID>-nonces.bin`"),
+        arg_lit0(NULL, "resume",         "Resume from checkpoint `hf-mf-<UID>-hardnested.ckpt`, otherwise `hardnested.ckpt`"),
 
         arg_lit0(NULL, "in", "None (use CPU regular instruction set)"),
 #if defined(COMPILER_HAS_SIMD_X86)
@@ -2277,19 +2280,20 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
     bool slow = arg_get_lit(ctx, 12);
     bool tests = arg_get_lit(ctx, 13);
     bool nonce_file_write = arg_get_lit(ctx, 14);
+    bool resume = arg_get_lit(ctx, 15);
 
-    bool in = arg_get_lit(ctx, 15);
+    bool in = arg_get_lit(ctx, 16);
 #if defined(COMPILER_HAS_SIMD_X86)
-    bool im = arg_get_lit(ctx, 16);
-    bool is = arg_get_lit(ctx, 17);
-    bool ia = arg_get_lit(ctx, 18);
-    bool i2 = arg_get_lit(ctx, 19);
+    bool im = arg_get_lit(ctx, 17);
+    bool is = arg_get_lit(ctx, 18);
+    bool ia = arg_get_lit(ctx, 19);
+    bool i2 = arg_get_lit(ctx, 20);
 #endif
 #if defined(COMPILER_HAS_SIMD_AVX512)
-    bool i5 = arg_get_lit(ctx, 20);
+    bool i5 = arg_get_lit(ctx, 21);
 #endif
 #if defined(COMPILER_HAS_SIMD_NEON)
-    bool ie = arg_get_lit(ctx, 16);
+    bool ie = arg_get_lit(ctx, 17);
 #endif
     CLIParserFree(ctx);
 
@@ -2345,6 +2349,21 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
         snprintf(filename, FILE_PATH_SIZE, "hf-mf-%s-nonces.bin", uid);
     }
 
+    // checkpoints of the attack, to resume it. Not for tests, nor when attacking a nonce file
+    // without resuming, there's no acquisition then. GenerateFilename() selects the card
+    char checkpoint[FILE_PATH_SIZE] = {0};
+    bool use_checkpoint = (tests == false) && (nonce_file_read == false || resume);
+    if (use_checkpoint && uidlen) {
+        snprintf(checkpoint, FILE_PATH_SIZE, "hf-mf-%s-hardnested.ckpt", uid);
+    } else if (use_checkpoint) {
+        char *fptr = (g_session.pm3_present) ? GenerateFilename("hf-mf-", "-hardnested.ckpt") : NULL;
+        if (fptr == NULL)
+            strncpy(checkpoint, "hardnested.ckpt", FILE_PATH_SIZE - 1);
+        else
+            strncpy(checkpoint, fptr, FILE_PATH_SIZE - 1);
+        free(fptr);
+    }
+
     if (g_session.pm3_present && !tests) {
         // detect MFC EV1 Signature
         if (detect_mfc_ev1_signature() && keylen == 0) {
@@ -2381,9 +2400,12 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
                   nonce_file_write ? "write" : nonce_file_read ? "read" : "none",
                   slow ? "Yes" : "No",
                   tests);
+    if (checkpoint[0]) {
+        PrintAndLogEx(INFO, "Checkpoint: " _YELLOW_("%s") "%s", checkpoint, resume ? ", resuming" : "");
+    }
 
     uint64_t foundkey = 0;
-    int16_t isOK = mfnestedhard(blockno, keytype, key, trg_blockno, trg_keytype, known_target_key ? trg_key : NULL, nonce_file_read, nonce_file_write, slow, tests, &foundkey, filename);
+    int16_t isOK = mfnestedhard(blockno, keytype, key, trg_blockno, trg_keytype, known_target_key ? trg_key : NULL, nonce_file_read, nonce_file_write, slow, tests, &foundkey, filename, checkpoint[0] ? checkpoint : NULL, resume);
     switch (isOK) {
         case PM3_ETIMEOUT :
             PrintAndLogEx(ERR, "Error: No response from Proxmark3\n");
@@ -3044,7 +3066,7 @@ tryHardnested: // If the nested attack fails then we try the hardnested attack
                         }
 
                         foundkey = 0;
-                        isOK = mfnestedhard(mfFirstBlockOfSector(sectorno), keytype, key, mfFirstBlockOfSector(current_sector_i), current_key_type_i, NULL, false, false, slow, 0, &foundkey, NULL);
+                        isOK = mfnestedhard(mfFirstBlockOfSector(sectorno), keytype, key, mfFirstBlockOfSector(current_sector_i), current_key_type_i, NULL, false, false, slow, 0, &foundkey, NULL, NULL, false);
                         DropField();
                         if (isOK != PM3_SUCCESS) {
                             switch (isOK) {
@@ -32,6 +32,12 @@
 #include <time.h> // MingW
 #include <lz4frame.h>
 #include <bzlib.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "commonutil.h"  // ARRAYLEN
 #include "comms.h"
@@ -56,6 +62,13 @@
 #define STATE_FILE_TEMPLATE_LZ4         "bitflip_%d_%03" PRIx16 "_states.bin.lz4"
 #define STATE_FILE_TEMPLATE_BZ2         "bitflip_%d_%03" PRIx16 "_states.bin.bz2"
 
+// decompressed bitflip tables, in the user .proxmark3 directory
+#define BITFLIP_CACHE_FILE              "hardnested_bitflips.bin"
+#define BITFLIP_CACHE_MAGIC             0x46423348  // "H3BF"
+#define BITFLIP_CACHE_VERSION           1
+#define BITFLIP_CACHE_PAGE              4096
+#define BITFLIP_BITARRAY_SIZE           (sizeof(uint32_t) * (1 << 19))
+
 #define DEBUG_KEY_ELIMINATION
 // #define DEBUG_REDUCTION
 
@@ -227,6 +240,26 @@ static inline uint32_t next_state(uint32_t *bitarray, uint32_t state) {
 static uint32_t *bitflip_bitarrays[2][0x400];
 static uint32_t count_bitflip_bitarrays[2][0x400];
 
+// The bitflip tables are decompressed once into a single cache file, which later runs
+// map read-only: no decompression at startup, and concurrent hardnested processes
+// share the tables through the page cache. The header is followed by the bitarrays
+// of the tables below IGNORE_BITFLIP_THRESHOLD, each page aligned. Delete the file
+// to rebuild it after changing the tables.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_bitarrays;
+    uint32_t header_pages;
+    uint32_t count[2][0x400];
+    uint32_t page[2][0x400];            // of the bitarray, 0 when none
+} bitflip_cache_hdr_t;
+
+#define BITFLIP_CACHE_HEADER_PAGES      ((sizeof(bitflip_cache_hdr_t) + BITFLIP_CACHE_PAGE - 1) / BITFLIP_CACHE_PAGE)
+#define BITFLIP_BITARRAY_PAGES          (BITFLIP_BITARRAY_SIZE / BITFLIP_CACHE_PAGE)
+
+static void *bitflip_cache = NULL;
+static size_t bitflip_cache_size = 0;
+
 static int compare_count_bitflip_bitarrays(const void *b1, const void *b2) {
     uint64_t count1 = (uint64_t)count_bitflip_bitarrays[ODD_STATE][*(uint16_t *)b1] * count_bitflip_bitarrays[EVEN_STATE][*(uint16_t *)b1];
     uint64_t count2 = (uint64_t)count_bitflip_bitarrays[ODD_STATE][*(uint16_t *)b2] * count_bitflip_bitarrays[EVEN_STATE][*(uint16_t *)b2];
@@ -254,7 +287,130 @@ static void init_bunzip2(bz_stream *compressed_stream, char *input_buffer, uint3
 
 }
 
-static void init_bitflip_bitarrays(void) {
+// Map the bitflip table cache, filling bitflip_bitarrays[] and effective_bitflip[]
+// from it. False when there is none or it doesn't fit this client.
+static bool map_bitflip_cache(void) {
+#ifdef _WIN32
+    return false;
+#else
+    char *path;
+    if (searchHomeFilePath(&path, CACHE_SUBDIR, BITFLIP_CACHE_FILE, false) != PM3_SUCCESS) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bitflip_cache_hdr_t)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const bitflip_cache_hdr_t *hdr = map;
+    size_t pages = size / BITFLIP_CACHE_PAGE;
+    if (hdr->magic != BITFLIP_CACHE_MAGIC
+            || hdr->version != BITFLIP_CACHE_VERSION
+            || hdr->header_pages != BITFLIP_CACHE_HEADER_PAGES
+            || size != ((size_t)hdr->header_pages + (size_t)hdr->num_bitarrays * BITFLIP_BITARRAY_PAGES) * BITFLIP_CACHE_PAGE) {
+        munmap(map, size);
+        return false;
+    }
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            uint32_t page = hdr->page[odd_even][bitflip];
+            if (page != 0 && (page < hdr->header_pages || page + BITFLIP_BITARRAY_PAGES > pages)) {
+                munmap(map, size);
+                return false;
+            }
+        }
+    }
+
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        num_effective_bitflips[odd_even] = 0;
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            uint32_t page = hdr->page[odd_even][bitflip];
+            bitflip_bitarrays[odd_even][bitflip] = NULL;
+            count_bitflip_bitarrays[odd_even][bitflip] = hdr->count[odd_even][bitflip];
+            if (page != 0) {
+                effective_bitflip[odd_even][num_effective_bitflips[odd_even]++] = bitflip;
+                bitflip_bitarrays[odd_even][bitflip] = (uint32_t *)((uint8_t *)map + (size_t)page * BITFLIP_CACHE_PAGE);
+            }
+        }
+        effective_bitflip[odd_even][num_effective_bitflips[odd_even]] = 0x400; // EndOfList marker
+    }
+    bitflip_cache = map;
+    bitflip_cache_size = size;
+    return true;
+#endif
+}
+
+// Write the loaded bitflip tables to the cache. Written to a temporary file first,
+// a concurrent run never maps a partial cache.
+static void write_bitflip_cache(void) {
+#ifndef _WIN32
+    char *path;
+    if (searchHomeFilePath(&path, CACHE_SUBDIR, BITFLIP_CACHE_FILE, true) != PM3_SUCCESS) {
+        return;
+    }
+    char tmp_path[strlen(path) + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+    bitflip_cache_hdr_t *hdr = calloc(BITFLIP_CACHE_HEADER_PAGES, BITFLIP_CACHE_PAGE);
+    if (hdr == NULL) {
+        free(path);
+        return;
+    }
+    hdr->magic = BITFLIP_CACHE_MAGIC;
+    hdr->version = BITFLIP_CACHE_VERSION;
+    hdr->header_pages = BITFLIP_CACHE_HEADER_PAGES;
+    uint32_t page = BITFLIP_CACHE_HEADER_PAGES;
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            hdr->count[odd_even][bitflip] = count_bitflip_bitarrays[odd_even][bitflip];
+            if (bitflip_bitarrays[odd_even][bitflip] != NULL) {
+                hdr->page[odd_even][bitflip] = page;
+                page += BITFLIP_BITARRAY_PAGES;
+                hdr->num_bitarrays++;
+            }
+        }
+    }
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        PrintAndLogEx(WARNING, "Could not create bitflip table cache " _YELLOW_("%s"), tmp_path);
+        free(hdr);
+        free(path);
+        return;
+    }
+    bool ok = (fwrite(hdr, BITFLIP_CACHE_PAGE, BITFLIP_CACHE_HEADER_PAGES, f) == BITFLIP_CACHE_HEADER_PAGES);
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE && ok; odd_even++) {
+        for (uint16_t bitflip = 0x001; bitflip < 0x400 && ok; bitflip++) {
+            if (bitflip_bitarrays[odd_even][bitflip] != NULL) {
+                ok = (fwrite(bitflip_bitarrays[odd_even][bitflip], BITFLIP_BITARRAY_SIZE, 1, f) == 1);
+            }
+        }
+    }
+    ok &= (fclose(f) == 0);
+    if (ok == false || rename(tmp_path, path) != 0) {
+        PrintAndLogEx(WARNING, "Could not write bitflip table cache " _YELLOW_("%s"), path);
+        remove(tmp_path);
+    }
+    free(hdr);
+    free(path);
+#endif
+}
+
+// Decompress the bitflip tables from the resources directory
+static void load_bitflip_bitarrays(void) {
 #if defined (DEBUG_REDUCTION)
     uint8_t line = 0;
 #endif
@@ -490,6 +646,22 @@ static void init_bitflip_bitarrays(void) {
         snprintf(progress_text, sizeof(progress_text), "Loaded %u RAW / %u LZ4 / %u BZ2 in %"PRIu64" ms", nraw, nlz4, nbz2, msclock() - init_bitflip_bitarrays_starttime);
         hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
     }
+    if (nraw + nlz4 + nbz2 > 0) {
+        write_bitflip_cache();
+    }
+}
+
+static void init_bitflip_bitarrays(void) {
+    uint64_t init_bitflip_bitarrays_starttime = msclock();
+
+    if (map_bitflip_cache()) {
+        char progress_text[80];
+        snprintf(progress_text, sizeof(progress_text), "Mapped %u bitflip tables from cache in %"PRIu64" ms", ((bitflip_cache_hdr_t *)bitflip_cache)->num_bitarrays, msclock() - init_bitflip_bitarrays_starttime);
+        hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
+    } else {
+        load_bitflip_bitarrays();
+    }
+
     uint16_t i = 0;
     uint16_t j = 0;
     num_all_effective_bitflips = 0;
@@ -532,6 +704,15 @@ static void init_bitflip_bitarrays(void) {
 }
 
 static void free_bitflip_bitarrays(void) {
+#ifndef _WIN32
+    if (bitflip_cache != NULL) {
+        munmap(bitflip_cache, bitflip_cache_size);
+        bitflip_cache = NULL;
+        bitflip_cache_size = 0;
+        memset(bitflip_bitarrays, 0, sizeof(bitflip_bitarrays));
+        return;
+    }
+#endif
     for (int16_t bitflip = 0x3ff; bitflip > 0x000; bitflip--) {
         free_bitarray(bitflip_bitarrays[ODD_STATE][bitflip]);
     }
@@ -687,6 +868,34 @@ static uint64_t sample_period = 0;
 static uint64_t num_keys_tested = 0;
 static statelist_t *candidates = NULL;
 
+// Checkpoint of a running attack: the acquired nonces, as records of the nonces file,
+// and the Sum(a8) guesses brute forced without finding the key. Rewritten while
+// acquiring and after each guess, `hf mf hardnested --resume` continues from it.
+#define HARDNESTED_CKPT_MAGIC           0x4B43484E  // "NHCK"
+#define HARDNESTED_CKPT_VERSION         1
+#define HARDNESTED_CKPT_INTERVAL        10000       // ms between checkpoints while acquiring
+#define HARDNESTED_CKPT_ACQUIRING       0
+#define HARDNESTED_CKPT_BRUTE_FORCE     1
+#define HARDNESTED_CKPT_ALL_STATES      0x80000000  // in sum_a8_done: brute force ignoring Sum(a8) done
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t stage;
+    uint8_t trgBlockNo;
+    uint8_t trgKeyType;
+    uint8_t pad[3];
+    uint32_t cuid;
+    uint32_t sum_a8_done;       // bit per sum index
+    uint32_t num_records;       // 9 bytes each: two encrypted nonces and their parities
+} PACKED hardnested_ckpt_hdr_t;
+
+static const char *ckpt_filename = NULL;
+static hardnested_ckpt_hdr_t ckpt;
+static uint8_t *ckpt_records = NULL;
+static uint32_t ckpt_records_size = 0;
+static uint64_t ckpt_last_write = 0;
+
 static int add_nonce(uint32_t nonce_enc, uint8_t par_enc) {
     uint8_t first_byte = nonce_enc >> 24;
     noncelistentry_t *p1 = nonces[first_byte].first;
@@ -1198,6 +1407,120 @@ static void estimate_sum_a8(void) {
     }
 }
 
+static void free_checkpoint(void) {
+    free(ckpt_records);
+    ckpt_records = NULL;
+    ckpt_records_size = 0;
+    ckpt_filename = NULL;
+}
+
+// Keep a nonces file record for the checkpoint
+static int add_ckpt_record(const uint8_t *record) {
+    if (ckpt_filename == NULL) {
+        return PM3_SUCCESS;
+    }
+    if (ckpt.num_records == ckpt_records_size) {
+        uint32_t size = ckpt_records_size ? ckpt_records_size * 2 : 1024;
+        uint8_t *records = realloc(ckpt_records, size * 9);
+        if (records == NULL) {
+            return PM3_EMALLOC;
+        }
+        ckpt_records = records;
+        ckpt_records_size = size;
+    }
+    memcpy(ckpt_records + ckpt.num_records * 9, record, 9);
+    ckpt.num_records++;
+    return PM3_SUCCESS;
+}
+
+// Write the checkpoint. Written to a temporary file first, an interrupted
+// write leaves the previous checkpoint intact.
+static void write_checkpoint(uint8_t stage) {
+    if (ckpt_filename == NULL || ckpt.num_records == 0) {
+        return;
+    }
+    ckpt.stage = stage;
+    ckpt_last_write = msclock();
+
+    char tmp_filename[strlen(ckpt_filename) + 5];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", ckpt_filename);
+    FILE *f = fopen(tmp_filename, "wb");
+    if (f == NULL) {
+        PrintAndLogEx(WARNING, "Could not create checkpoint " _YELLOW_("%s"), tmp_filename);
+        return;
+    }
+    bool ok = (fwrite(&ckpt, sizeof(ckpt), 1, f) == 1);
+    ok &= (fwrite(ckpt_records, 9, ckpt.num_records, f) == ckpt.num_records);
+    ok &= (fclose(f) == 0);
+#ifdef _WIN32
+    // rename() doesn't replace on Windows
+    remove(ckpt_filename);
+#endif
+    if (ok == false || rename(tmp_filename, ckpt_filename) != 0) {
+        PrintAndLogEx(WARNING, "Could not write checkpoint " _YELLOW_("%s"), ckpt_filename);
+        remove(tmp_filename);
+    }
+}
+
+// Load the checkpoint of an attack on the same target, its nonces added as if acquired
+static int read_checkpoint(uint8_t trgBlockNo, uint8_t trgKeyType) {
+    FILE *f = fopen(ckpt_filename, "rb");
+    if (f == NULL) {
+        PrintAndLogEx(WARNING, "Could not open checkpoint " _YELLOW_("%s") ", starting a new attack", ckpt_filename);
+        return PM3_EFILE;
+    }
+
+    hardnested_ckpt_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != HARDNESTED_CKPT_MAGIC || hdr.version != HARDNESTED_CKPT_VERSION) {
+        PrintAndLogEx(WARNING, "Checkpoint " _YELLOW_("%s") " is of an unknown version, starting a new attack", ckpt_filename);
+        fclose(f);
+        return PM3_EFILE;
+    }
+    if (hdr.trgBlockNo != trgBlockNo || hdr.trgKeyType != trgKeyType) {
+        PrintAndLogEx(WARNING, "Checkpoint " _YELLOW_("%s") " is of target block %u key %c, starting a new attack", ckpt_filename, hdr.trgBlockNo, hdr.trgKeyType == 0 ? 'A' : 'B');
+        fclose(f);
+        return PM3_EINVARG;
+    }
+
+    uint8_t *records = calloc(hdr.num_records, 9);
+    if (records == NULL || fread(records, 9, hdr.num_records, f) != hdr.num_records) {
+        PrintAndLogEx(WARNING, "Checkpoint " _YELLOW_("%s") " is truncated, starting a new attack", ckpt_filename);
+        free(records);
+        fclose(f);
+        return PM3_EFILE;
+    }
+    fclose(f);
+
+    free(ckpt_records);
+    ckpt = hdr;
+    ckpt_records = records;
+    ckpt_records_size = hdr.num_records;
+
+    cuid = hdr.cuid;
+    for (uint32_t i = 0; i < hdr.num_records; i++) {
+        uint8_t *record = records + i * 9;
+        num_acquired_nonces += add_nonce(bytes_to_num(record, 4), record[8] >> 4);
+        num_acquired_nonces += add_nonce(bytes_to_num(record + 4, 4), record[8] & 0x0f);
+    }
+
+    char progress_text[80];
+    snprintf(progress_text, sizeof(progress_text), "Resumed %u nonces from checkpoint. cuid = %08x", num_acquired_nonces, cuid);
+    hardnested_print_progress(num_acquired_nonces, progress_text, (float)(1LL << 47), 0);
+    return PM3_SUCCESS;
+}
+
+// First_Byte_Sum to its index in sums[], once all first bytes are seen
+static int first_byte_sum_to_idx(void) {
+    for (uint8_t i = 0; i < NUM_SUMS; i++) {
+        if (first_byte_Sum == sums[i]) {
+            first_byte_Sum = i;
+            return PM3_SUCCESS;
+        }
+    }
+    PrintAndLogEx(FAILED, "No match for the First_Byte_Sum (%u), is the card a genuine MFC Ev1? ", first_byte_Sum);
+    return PM3_ESOFT;
+}
+
 static int read_nonce_file(char *filename) {
 
     if (filename == NULL) {
@@ -1223,6 +1546,7 @@ static int read_nonce_file(char *filename) {
         return PM3_EFILE;
     }
     cuid = bytes_to_num(read_buf, 4);
+    ckpt.cuid = cuid;
     uint8_t trgBlockNo = bytes_to_num(read_buf + 4, 1);
     uint8_t trgKeyType = bytes_to_num(read_buf + 5, 1);
 
@@ -1234,6 +1558,7 @@ static int read_nonce_file(char *filename) {
         add_nonce(nt_enc1, par_enc >> 4);
         add_nonce(nt_enc2, par_enc & 0x0f);
         num_acquired_nonces += 2;
+        add_ckpt_record(read_buf);
         bytes_read = fread(read_buf, 1, 9, fnonces);
     }
     fclose(fnonces);
@@ -1244,19 +1569,7 @@ static int read_nonce_file(char *filename) {
     snprintf(progress_string, sizeof(progress_string), "Target Block=%d, Keytype=%c", trgBlockNo, trgKeyType == 0 ? 'A' : 'B');
     hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL << 47), 0);
 
-    bool got_match = false;
-    for (uint8_t i = 0; i < NUM_SUMS; i++) {
-        if (first_byte_Sum == sums[i]) {
-            first_byte_Sum = i;
-            got_match = true;
-            break;
-        }
-    }
-    if (got_match == false) {
-        PrintAndLogEx(FAILED, "No match for the First_Byte_Sum (%u), is the card a genuine MFC Ev1? ", first_byte_Sum);
-        return PM3_ESOFT;
-    }
-    return PM3_SUCCESS;
+    return first_byte_sum_to_idx();
 }
 
 static noncelistentry_t *SearchFor2ndByte(uint8_t b1, uint8_t b2) {
@@ -1550,7 +1863,6 @@ static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_
 
     last_sample_clock = msclock();
     hardnested_stage = CHECK_1ST_BYTES;
-    num_acquired_nonces = 0;
 
     // initial rough estimate. Will be refined.
     sample_period = 2000;
@@ -1609,6 +1921,13 @@ static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_
             }
 
             cuid = resp.oldarg[1];
+            if (ckpt.num_records && cuid != ckpt.cuid) {
+                PrintAndLogEx(WARNING, "Card " _YELLOW_("%08x") " is not the card of the checkpoint " _YELLOW_("%08x"), cuid, ckpt.cuid);
+                DropField();
+                return PM3_EINVARG;
+            }
+            ckpt.cuid = cuid;
+
             if (nonce_file_write && fnonces == NULL) {
 
                 if ((fnonces = fopen(filename, "wb")) == NULL) {
@@ -1646,23 +1965,18 @@ static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_
                     fwrite(bufp, 1, 9, fnonces);
                     fflush(fnonces);
                 }
+                add_ckpt_record(bufp);
                 bufp += 9;
             }
             //total_num_nonces += num_sampled_nonces;
 
+            if (msclock() - ckpt_last_write > HARDNESTED_CKPT_INTERVAL) {
+                write_checkpoint(HARDNESTED_CKPT_ACQUIRING);
+            }
+
             if (first_byte_num == 256) {
                 if (hardnested_stage == CHECK_1ST_BYTES) {
-                    bool got_match = false;
-                    for (uint8_t i = 0; i < NUM_SUMS; i++) {
-                        if (first_byte_Sum == sums[i]) {
-                            first_byte_Sum = i;
-                            got_match = true;
-                            break;
-                        }
-                    }
-
-                    if (got_match == false) {
-                        PrintAndLogEx(FAILED, "No match for the First_Byte_Sum (%u), is the card a genuine MFC Ev1? ", first_byte_Sum);
+                    if (first_byte_sum_to_idx() != PM3_SUCCESS) {
                         if (nonce_file_write) {
                             fclose(fnonces);
                         }
@@ -2392,7 +2706,7 @@ static void init_it_all(void) {
     memset(sum_a0_bitarrays, 0, sizeof(sum_a0_bitarrays));
 }
 
-int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, uint64_t *foundkey, char *filename) {
+int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, uint64_t *foundkey, char *filename, const char *checkpoint, bool resume) {
     char progress_text[80];
     char instr_set[12] = {0};
 
@@ -2542,8 +2856,33 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
         init_nonce_memory();
         update_reduction_rate(0.0, true);
 
+        memset(&ckpt, 0, sizeof(ckpt));
+        ckpt.magic = HARDNESTED_CKPT_MAGIC;
+        ckpt.version = HARDNESTED_CKPT_VERSION;
+        ckpt.trgBlockNo = trgBlockNo;
+        ckpt.trgKeyType = trgKeyType;
+        ckpt_filename = checkpoint;
+        ckpt_last_write = msclock();
+        bool resumed = (resume && checkpoint != NULL && read_checkpoint(trgBlockNo, trgKeyType) == PM3_SUCCESS);
+
         int res;
-        if (nonce_file_read) {  // use pre-acquired data from file nonces.bin
+        if (resumed && (ckpt.stage == HARDNESTED_CKPT_BRUTE_FORCE || nonce_file_read)) {  // all nonces in the checkpoint
+            res = first_byte_sum_to_idx();
+            if (res != PM3_SUCCESS) {
+                free_bitflip_bitarrays();
+                free_nonces_memory();
+                free_bitarray(all_bitflips_bitarray[ODD_STATE]);
+                free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
+                free_sum_bitarrays();
+                free_part_sum_bitarrays();
+                free_checkpoint();
+                return res;
+            }
+            hardnested_stage = CHECK_1ST_BYTES | CHECK_2ND_BYTES;
+            update_nonce_data(false);
+            float brute_force_depth;
+            shrink_key_space(&brute_force_depth);
+        } else if (nonce_file_read) {  // use pre-acquired data from file nonces.bin
             res = read_nonce_file(filename);
             if (res != PM3_SUCCESS) {
                 free_bitflip_bitarrays();
@@ -2552,24 +2891,29 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
                 free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
                 free_sum_bitarrays();
                 free_part_sum_bitarrays();
+                free_checkpoint();
                 return res;
             }
             hardnested_stage = CHECK_1ST_BYTES | CHECK_2ND_BYTES;
             update_nonce_data(false);
             float brute_force_depth;
             shrink_key_space(&brute_force_depth);
-        } else { // acquire nonces.
+        } else { // acquire nonces, after the ones of the checkpoint
             res = acquire_nonces(blockNo, keyType, key, trgBlockNo, trgKeyType, nonce_file_write, slow, filename);
             if (res != PM3_SUCCESS) {
+                // keep what was acquired until the card left
+                write_checkpoint(HARDNESTED_CKPT_ACQUIRING);
                 free_bitflip_bitarrays();
                 free_nonces_memory();
                 free_bitarray(all_bitflips_bitarray[ODD_STATE]);
                 free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
                 free_sum_bitarrays();
                 free_part_sum_bitarrays();
+                free_checkpoint();
                 return res;
             }
         }
+        write_checkpoint(HARDNESTED_CKPT_BRUTE_FORCE);
 
         if (trgkey != NULL) {
             known_target_key = bytes_to_num(trgkey, 6);
@@ -2603,7 +2947,15 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             pre_XOR_nonces();
             prepare_bf_test_nonces(nonces, best_first_bytes[0]);
 
-            key_found = brute_force(foundkey);
+            if (ckpt.sum_a8_done & HARDNESTED_CKPT_ALL_STATES) {
+                hardnested_print_progress(num_acquired_nonces, "(Brute forced before the checkpoint)", 0, 0);
+            } else {
+                key_found = brute_force(foundkey);
+                if (key_found == false) {
+                    ckpt.sum_a8_done |= HARDNESTED_CKPT_ALL_STATES;
+                    write_checkpoint(HARDNESTED_CKPT_BRUTE_FORCE);
+                }
+            }
             free(candidates->states[ODD_STATE]);
             free(candidates->states[EVEN_STATE]);
             free_candidates_memory(candidates);
@@ -2615,9 +2967,18 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
 
             for (uint8_t j = 0; j < NUM_SUMS && !key_found; j++) {
                 float expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
-                snprintf(progress_text, sizeof(progress_text), "(%d. guess: Sum(a8) = %" PRIu16 ")", j + 1, sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx]);
+                uint8_t sum_a8_idx = nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx;
+                snprintf(progress_text, sizeof(progress_text), "(%d. guess: Sum(a8) = %" PRIu16 ")", j + 1, sums[sum_a8_idx]);
                 hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
 
+                if (ckpt.sum_a8_done & (1U << sum_a8_idx)) {
+                    hardnested_print_progress(num_acquired_nonces, "(Brute forced before the checkpoint)", expected_brute_force, 0);
+                    nonces[best_first_bytes[0]].sum_a8_guess[j].prob = 0;
+                    nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = 0;
+                    update_expected_brute_force(best_first_bytes[0]);
+                    continue;
+                }
+
                 if (trgkey != NULL && sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx] != real_sum_a8) {
                     snprintf(progress_text, sizeof(progress_text), "(Estimated Sum(a8) is WRONG! Correct Sum(a8) = %" PRIu16 ")", real_sum_a8);
                     hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
@@ -2634,6 +2995,9 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
                     nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = 0;
                     // and calculate new expected number of brute forces
                     update_expected_brute_force(best_first_bytes[0]);
+
+                    ckpt.sum_a8_done |= 1U << sum_a8_idx;
+                    write_checkpoint(HARDNESTED_CKPT_BRUTE_FORCE);
                 }
             }
         }
@@ -2644,6 +3008,12 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
         free_sum_bitarrays();
         free_part_sum_bitarrays();
 
+        // the attack is done, nothing to resume
+        if (key_found && ckpt_filename != NULL) {
+            remove(ckpt_filename);
+        }
+        free_checkpoint();
+
         return (key_found) ? PM3_SUCCESS : PM3_EFAILED;
     }
 
@@ -40,6 +40,8 @@
 #include "flash.h"          // reboot to bootloader mode
 #include "proxgui.h"
 #include "graph.h"          // for graph data
+#include "fileutils.h"      // saveFileJSONroot
+#include "jansson.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -1340,6 +1342,170 @@ static int CmdPing(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
+static json_t *comm_stats_to_json(const comm_link_stats_t *link, const comm_rx_stats_t *rx, const comm_cmd_stats_t *cs, size_t n) {
+
+    json_t *root = json_object();
+    json_object_set_new(root, "FileType", json_string("pm3 comm stats"));
+
+    json_t *jlink = json_object();
+    json_object_set_new(jlink, "elapsed_ms", json_integer(link->since ? msclock() - link->since : 0));
+    json_object_set_new(jlink, "tx_frames", json_integer(link->tx_frames));
+    json_object_set_new(jlink, "tx_bytes", json_integer(link->tx_bytes));
+    json_object_set_new(jlink, "rx_frames", json_integer(link->rx_frames));
+    json_object_set_new(jlink, "rx_bytes", json_integer(link->rx_bytes));
+    json_object_set_new(jlink, "rx_queue_size", json_integer(rx->size));
+    json_object_set_new(jlink, "rx_queue_high_water", json_integer(rx->high_water));
+    json_object_set_new(jlink, "rx_queue_stalls", json_integer(rx->stalls));
+    json_object_set_new(jlink, "rx_queue_dropped", json_integer(rx->dropped));
+    json_object_set_new(root, "link", jlink);
+
+    json_t *jcmds = json_array();
+    for (size_t i = 0; i < n; i++) {
+        const comm_cmd_stats_t *e = &cs[i];
+        uint32_t measured = 0;
+        json_t *jhist = json_array();
+        for (uint8_t b = 0; b < CMD_STATS_HIST_BUCKETS; b++) {
+            json_array_append_new(jhist, json_integer(e->hist[b]));
+            measured += e->hist[b];
+        }
+
+        char id[7];
+        snprintf(id, sizeof(id), "0x%04x", e->cmd);
+
+        json_t *jc = json_object();
+        json_object_set_new(jc, "cmd", json_string(id));
+        json_object_set_new(jc, "sent", json_integer(e->sent));
+        json_object_set_new(jc, "replies", json_integer(e->replies));
+        json_object_set_new(jc, "timeouts", json_integer(e->timeouts));
+        json_object_set_new(jc, "wtx", json_integer(e->wtx));
+        json_object_set_new(jc, "bytes_out", json_integer(e->bytes_out));
+        json_object_set_new(jc, "bytes_in", json_integer(e->bytes_in));
+        json_object_set_new(jc, "latency_min_ms", json_integer(measured ? e->lat_min : 0));
+        json_object_set_new(jc, "latency_max_ms", json_integer(e->lat_max));
+        json_object_set_new(jc, "latency_avg_ms", json_real(measured ? (double)e->lat_total / measured : 0.0));
+        json_object_set_new(jc, "latency_hist", jhist);
+        json_array_append_new(jcmds, jc);
+    }
+    json_object_set_new(root, "commands", jcmds);
+    return root;
+}
+
+static int CmdStats(const char *Cmd) {
+    CLIParserContext *ctx;
+    CLIParserInit(&ctx, "hw stats",
+                  "Show per command communication statistics of this client session.\n"
+                  "Latency is measured from sending a command to receiving its first reply.\n"
+                  "Histogram buckets are powers of two, in ms:  <1, <2, <4, ... <1024, >=1024",
+                  "hw stats              --> show statistics\n"
+                  "hw stats -v           --> also show latency histograms\n"
+                  "hw stats --json       --> print statistics as JSON\n"
+                  "hw stats -f mystats   --> save statistics to mystats.json\n"
+                  "hw stats --reset      --> clear statistics"
+                 );
+
+    void *argtable[] = {
+        arg_param_begin,
+        arg_lit0("v", "verbose", "show latency histograms"),
+        arg_lit0("j", "json", "print as JSON"),
+        arg_str0("f", "file", "<fn>", "save JSON to file"),
+        arg_lit0("r", "reset", "clear statistics"),
+        arg_param_end
+    };
+    CLIExecWithReturn(ctx, Cmd, argtable, true);
+    bool verbose = arg_get_lit(ctx, 1);
+    bool print_json = arg_get_lit(ctx, 2);
+    int fnlen = 0;
+    char filename[FILE_PATH_SIZE] = {0};
+    CLIParamStrToBuf(arg_get_str(ctx, 3), (uint8_t *)filename, FILE_PATH_SIZE, &fnlen);
+    bool reset = arg_get_lit(ctx, 4);
+    CLIParserFree(ctx);
+
+    if (reset) {
+        ResetCommunicationCmdStats();
+        ResetCommunicationRxStats();
+        PrintAndLogEx(SUCCESS, "Communication statistics " _GREEN_("cleared"));
+        return PM3_SUCCESS;
+    }
+
+    comm_cmd_stats_t *cs = calloc(CMD_STATS_SIZE, sizeof(comm_cmd_stats_t));
+    if (cs == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    comm_link_stats_t link;
+    comm_rx_stats_t rx;
+    GetCommunicationLinkStats(&link);
+    GetCommunicationRxStats(&rx);
+    size_t n = GetCommunicationCmdStats(cs, CMD_STATS_SIZE);
+
+    if (print_json || fnlen) {
+        json_t *root = comm_stats_to_json(&link, &rx, cs, n);
+        int res = PM3_SUCCESS;
+        if (print_json) {
+            char *js = json_dumps(root, JSON_INDENT(2));
+            if (js) {
+                PrintAndLogEx(NORMAL, "%s", js);
+                free(js);
+            }
+        }
+        if (fnlen) {
+            res = saveFileJSONroot(filename, root, JSON_INDENT(2), true);
+        }
+        json_decref(root);
+        free(cs);
+        return res;
+    }
+
+    uint64_t elapsed = link.since ? msclock() - link.since : 0;
+
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(INFO, "--- " _CYAN_("Link") " ---------------------------");
+    PrintAndLogEx(INFO, " elapsed.......... %" PRIu64 " ms", elapsed);
+    PrintAndLogEx(INFO, " sent............. %u frames, %" PRIu64 " bytes", link.tx_frames, link.tx_bytes);
+    PrintAndLogEx(INFO, " received......... %u frames, %" PRIu64 " bytes", link.rx_frames, link.rx_bytes);
+    PrintAndLogEx(INFO, " rx queue......... high water %u / %u, stalls %u, dropped %u", rx.high_water, rx.size, rx.stalls, rx.dropped);
+
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(INFO, "--- " _CYAN_("Commands") " -----------------------");
+    PrintAndLogEx(INFO, " cmd  |   sent | replies | t/o |  wtx |  bytes out |   bytes in |  min ms |  avg ms |  max ms");
+    PrintAndLogEx(INFO, "------+--------+---------+-----+------+------------+------------+---------+---------+--------");
+    for (size_t i = 0; i < n; i++) {
+        const comm_cmd_stats_t *e = &cs[i];
+        uint32_t measured = 0;
+        for (uint8_t b = 0; b < CMD_STATS_HIST_BUCKETS; b++) {
+            measured += e->hist[b];
+        }
+
+        PrintAndLogEx(INFO, " %04x | %6u | %7u | %3u | %4u | %10" PRIu64 " | %10" PRIu64 " | %7u | %7.1f | %7u"
+                      , e->cmd
+                      , e->sent
+                      , e->replies
+                      , e->timeouts
+                      , e->wtx
+                      , e->bytes_out
+                      , e->bytes_in
+                      , measured ? e->lat_min : 0
+                      , measured ? (double)e->lat_total / measured : 0.0
+                      , e->lat_max
+                     );
+
+        if (verbose && measured) {
+            char line[CMD_STATS_HIST_BUCKETS * 8 + 1] = {0};
+            for (uint8_t b = 0; b < CMD_STATS_HIST_BUCKETS; b++) {
+                snprintf(line + strlen(line), sizeof(line) - strlen(line), " %6u", e->hist[b]);
+            }
+            PrintAndLogEx(INFO, "      | hist %s", line);
+        }
+    }
+    if (n == 0) {
+        PrintAndLogEx(INFO, " no commands sent yet");
+    }
+    PrintAndLogEx(NORMAL, "");
+    free(cs);
+    return PM3_SUCCESS;
+}
+
 static int CmdConnect(const char *Cmd) {
 
     CLIParserContext *ctx;
@@ -1453,6 +1619,7 @@ static command_t CommandTable[] = {
     {"help",          CmdHelp,         AlwaysAvailable,  "This help"},
     {"-------------", CmdHelp,         AlwaysAvailable,  "----------------------- " _CYAN_("Operation") " -----------------------"},
     {"detectreader",  CmdDetectReader, IfPm3Present,     "Detect external reader field"},
+    {"stats",         CmdStats,        AlwaysAvailable,  "Show per command communication statistics of this session"},
     {"status",        CmdStatus,       IfPm3Present,     "Show runtime status information about the connected Proxmark3"},
     {"tearoff",       CmdTearoff,      IfPm3Present,     "Program a tearoff hook for the next command supporting tearoff"},
     {"timeout",       CmdTimeout,      AlwaysAvailable,  "Set the communication timeout on the client side"},
@@ -41,6 +41,11 @@
 #include "graph.h"
 #include "fpga.h"
 #include "cmdscard.h"
+#include "fileutils.h"
+#include "util.h"
+#include "commonutil.h"    // ARRAYLEN
+#include "jansson.h"
+#include "calypso_profile.h"
 
 //static int CmdHelp(const char* Cmd);
 
@@ -111,19 +116,600 @@ static int CmdpyInitCal(const char* Cmd) {
 }
 
 
+//-----------------------------------------------------------------------------
+// Calypso card profile, see calypso_profile.h
+//-----------------------------------------------------------------------------
+
+#define CALYPSO_PROFILE_MAX_ENTRIES 256
+#define CALYPSO_XML_MAX_DEPTH       16
+
+typedef struct {
+    calypso_profile_entry_t entries[CALYPSO_PROFILE_MAX_ENTRIES];
+    uint16_t count;
+    uint8_t resp[CALYPSO_PROFILE_MAX_SIZE];
+    uint16_t resp_len;
+    uint16_t files;
+    uint16_t records;
+} calypso_profile_builder_t;
+
+static int calypso_profile_add(calypso_profile_builder_t *b, uint16_t file, uint8_t ins, uint8_t p1, uint8_t p2, uint16_t arg,
+                               uint16_t target, uint8_t flags, const uint8_t *resp, size_t resp_len) {
+
+    if (resp_len == 0 || resp_len > CALYPSO_PROFILE_MAX_RESP) {
+        PrintAndLogEx(ERR, "response too long for %02X %02X %02X ( %zu bytes )", ins, p1, p2, resp_len);
+        return PM3_EOVFLOW;
+    }
+
+    // identical responses are stored once, a record is answered by SFI and by current EF
+    uint16_t offset = b->resp_len;
+    for (uint16_t i = 0; i + resp_len <= b->resp_len; i++) {
+        if (memcmp(b->resp + i, resp, resp_len) == 0) {
+            offset = i;
+            break;
+        }
+    }
+    if (offset == b->resp_len) {
+        if (b->resp_len + resp_len > sizeof(b->resp)) {
+            PrintAndLogEx(ERR, "card profile too large");
+            return PM3_EOVFLOW;
+        }
+        memcpy(b->resp + b->resp_len, resp, resp_len);
+        b->resp_len += resp_len;
+    }
+
+    // a later answer to the same command replaces the previous one
+    calypso_profile_entry_t *e = NULL;
+    for (uint16_t i = 0; i < b->count; i++) {
+        calypso_profile_entry_t *t = &b->entries[i];
+        if (t->file == file && t->ins == ins && t->p1 == p1 && t->p2 == p2 && t->arg == arg) {
+            e = t;
+            break;
+        }
+    }
+    if (e == NULL) {
+        if (b->count == CALYPSO_PROFILE_MAX_ENTRIES) {
+            PrintAndLogEx(ERR, "too many entries in card profile, max %u", CALYPSO_PROFILE_MAX_ENTRIES);
+            return PM3_EOVFLOW;
+        }
+        e = &b->entries[b->count++];
+    }
+
+    memset(e, 0, sizeof(*e));
+    e->file = file;
+    e->arg = arg;
+    e->target = target;
+    e->ins = ins;
+    e->p1 = p1;
+    e->p2 = p2;
+    e->flags = flags;
+    e->resp_offset = offset;
+    e->resp_len = resp_len;
+    return PM3_SUCCESS;
+}
+
+// answer to SELECT (FCI) + 9000, by FID and by path
+static int calypso_profile_add_file(calypso_profile_builder_t *b, uint16_t df, uint16_t fid, bool is_df, const uint8_t *fci, size_t fci_len) {
+    uint8_t resp[CALYPSO_PROFILE_MAX_RESP];
+    if (fci_len > sizeof(resp) - 2) {
+        PrintAndLogEx(ERR, "FCI of %04X too long", fid);
+        return PM3_EOVFLOW;
+    }
+    memcpy(resp, fci, fci_len);
+    resp[fci_len] = 0x90;
+    resp[fci_len + 1] = 0x00;
+
+    uint16_t file = (df == CALYPSO_NO_FILE) ? CALYPSO_ANY_FILE : df;
+    uint8_t flags = is_df ? CALYPSO_ENTRY_SELECT_DF : CALYPSO_ENTRY_SELECT_EF;
+
+    int res = calypso_profile_add(b, file, CALYPSO_INS_SELECT, 0x00, 0x00, fid, fid, flags, resp, fci_len + 2);
+    if (res == PM3_SUCCESS) {
+        res = calypso_profile_add(b, file, CALYPSO_INS_SELECT, 0x08, 0x00, fid, fid, flags, resp, fci_len + 2);
+    }
+    b->files++;
+    return res;
+}
+
+// record + 9000, READ RECORD on the current EF and by SFI from its DF
+static int calypso_profile_add_record(calypso_profile_builder_t *b, uint16_t df, uint16_t fid, uint8_t sfi, uint8_t recno, const uint8_t *data, size_t len) {
+    uint8_t resp[CALYPSO_PROFILE_MAX_RESP];
+    if (len > sizeof(resp) - 2) {
+        PrintAndLogEx(ERR, "record %u of %04X too long", recno, fid);
+        return PM3_EOVFLOW;
+    }
+    memcpy(resp, data, len);
+    resp[len] = 0x90;
+    resp[len + 1] = 0x00;
+
+    int res = calypso_profile_add(b, fid, CALYPSO_INS_READ_RECORD, recno, 0x04, 0, 0, 0, resp, len + 2);
+    if (res == PM3_SUCCESS && sfi && sfi < 0x1F) {
+        uint16_t file = (df == CALYPSO_NO_FILE) ? CALYPSO_MF : df;
+        res = calypso_profile_add(b, file, CALYPSO_INS_READ_RECORD, recno, (sfi << 3) | 0x04, 0, fid, CALYPSO_ENTRY_SELECT_EF, resp, len + 2);
+    }
+    b->records++;
+    return res;
+}
+
+// FCI returned by Calypso cards:  85 17 <SFI> <file type> ...,  file type 02 is a DF
+static bool calypso_fci_is_df(const uint8_t *fci, size_t len) {
+    return (len >= 4 && fci[0] == 0x85 && fci[3] == 0x02);
+}
+
+static uint8_t calypso_fci_sfi(const uint8_t *fci, size_t len) {
+    return (len >= 4 && fci[0] == 0x85) ? fci[2] : 0;
+}
+
+static int calypso_profile_build(calypso_profile_builder_t *b, uint8_t **out, size_t *outlen) {
+
+    if (b->count == 0) {
+        PrintAndLogEx(ERR, "card profile is empty");
+        return PM3_EINVARG;
+    }
+
+    uint16_t buckets = 1;
+    while (buckets < b->count) {
+        buckets <<= 1;
+    }
+
+    size_t tables = sizeof(calypso_profile_hdr_t) + buckets * sizeof(uint16_t) + b->count * sizeof(calypso_profile_entry_t);
+    size_t size = tables + b->resp_len;
+    if (size > CALYPSO_PROFILE_MAX_SIZE) {
+        PrintAndLogEx(ERR, "card profile too large, " _RED_("%zu") " > %u bytes", size, CALYPSO_PROFILE_MAX_SIZE);
+        return PM3_EOVFLOW;
+    }
+
+    uint8_t *buf = calloc(size, sizeof(uint8_t));
+    if (buf == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    calypso_profile_hdr_t *hdr = (calypso_profile_hdr_t *)buf;
+    hdr->magic = CALYPSO_PROFILE_MAGIC;
+    hdr->version = CALYPSO_PROFILE_VERSION;
+    hdr->size = size;
+    hdr->entry_count = b->count;
+    hdr->bucket_count = buckets;
+
+    uint16_t *bucket = (uint16_t *)(buf + sizeof(calypso_profile_hdr_t));
+    calypso_profile_entry_t *entries = (calypso_profile_entry_t *)(bucket + buckets);
+
+    for (uint16_t i = 0; i < buckets; i++) {
+        bucket[i] = CALYPSO_ENTRY_END;
+    }
+
+    for (uint16_t i = 0; i < b->count; i++) {
+        calypso_profile_entry_t *e = &entries[i];
+        memcpy(e, &b->entries[i], sizeof(*e));
+        e->resp_offset += tables;
+
+        uint32_t h = calypso_profile_hash(e->file, e->ins, e->p1, e->p2, e->arg) & (buckets - 1);
+        e->next = bucket[h];
+        bucket[h] = i;
+    }
+
+    memcpy(buf + tables, b->resp, b->resp_len);
+
+    *out = buf;
+    *outlen = size;
+    return PM3_SUCCESS;
+}
+
+// Value of the next <attr name="..."> in a cardpeek XML, NULL when there is none left
+static const char *calypso_xml_attr(const char *p, char *name, size_t namelen, const char **value, size_t *valuelen) {
+    const char *tag = strstr(p, "<attr name=\"");
+    if (tag == NULL) {
+        return NULL;
+    }
+    tag += strlen("<attr name=\"");
+
+    const char *q = strchr(tag, '"');
+    const char *v = strchr(tag, '>');
+    if (q == NULL || v == NULL) {
+        return NULL;
+    }
+    snprintf(name, namelen, "%.*s", (int)(q - tag), tag);
+
+    v++;
+    const char *end = strstr(v, "</attr>");
+    if (end == NULL) {
+        return NULL;
+    }
+    *value = v;
+    *valuelen = end - v;
+    return end + strlen("</attr>");
+}
+
+typedef struct {
+    char classname[16];
+    uint16_t id;
+    uint8_t sfi;
+} calypso_xml_node_t;
+
+// cardpeek XML:  card > file | folder > file,  header (answer to select) and record nodes hold the data
+static int calypso_profile_from_xml(calypso_profile_builder_t *b, const char *xml) {
+
+    calypso_xml_node_t stack[CALYPSO_XML_MAX_DEPTH];
+    int depth = -1;
+
+    const char *p = xml;
+    while (*p) {
+
+        const char *node = strstr(p, "<node>");
+        const char *node_end = strstr(p, "</node>");
+        const char *attr = strstr(p, "<attr ");
+
+        // next tag among <node>, </node> and <attr>
+        const char *next = NULL;
+        if (node && (next == NULL || node < next)) next = node;
+        if (node_end && (next == NULL || node_end < next)) next = node_end;
+        if (attr && (next == NULL || attr < next)) next = attr;
+        if (next == NULL) {
+            break;
+        }
+
+        if (next == node) {
+            if (++depth == CALYPSO_XML_MAX_DEPTH) {
+                PrintAndLogEx(ERR, "XML nested too deep");
+                return PM3_EFILE;
+            }
+            memset(&stack[depth], 0, sizeof(stack[depth]));
+            p = node + strlen("<node>");
+            continue;
+        }
+
+        if (next == node_end) {
+            if (depth < 0) {
+                PrintAndLogEx(ERR, "XML unbalanced </node>");
+                return PM3_EFILE;
+            }
+            depth--;
+            p = node_end + strlen("</node>");
+            continue;
+        }
+
+        char name[16];
+        const char *value;
+        size_t vlen;
+        p = calypso_xml_attr(attr, name, sizeof(name), &value, &vlen);
+        if (p == NULL) {
+            PrintAndLogEx(ERR, "XML malformed attr");
+            return PM3_EFILE;
+        }
+        if (depth < 0) {
+            continue;
+        }
+
+        calypso_xml_node_t *n = &stack[depth];
+
+        if (strcmp(name, "classname") == 0) {
+            snprintf(n->classname, sizeof(n->classname), "%.*s", (int)vlen, value);
+
+        } else if (strcmp(name, "id") == 0) {
+            bool is_record = (strcmp(n->classname, "record") == 0);
+            n->id = strtoul(value, NULL, is_record ? 10 : 16);
+
+        } else if (strcmp(name, "val") == 0 && depth > 0) {
+
+            bool is_header = (strcmp(n->classname, "header") == 0);
+            bool is_record = (strcmp(n->classname, "record") == 0);
+            if (is_header == false && is_record == false) {
+                continue;
+            }
+
+            calypso_xml_node_t *f = &stack[depth - 1];
+            if (strcmp(f->classname, "file") && strcmp(f->classname, "folder")) {
+                continue;
+            }
+
+            // parent DF of the file
+            uint16_t df = CALYPSO_NO_FILE;
+            for (int i = depth - 2; i >= 0; i--) {
+                if (strcmp(stack[i].classname, "folder") == 0) {
+                    df = stack[i].id;
+                    break;
+                }
+            }
+
+            // "8:<hex>", bytes encoding
+            const char *hex = memchr(value, ':', vlen);
+            hex = (hex) ? hex + 1 : value;
+
+            char tmp[(CALYPSO_PROFILE_MAX_RESP * 2) + 1];
+            size_t hexlen = vlen - (hex - value);
+            if (hexlen >= sizeof(tmp)) {
+                PrintAndLogEx(ERR, "value too long in file %04X", f->id);
+                return PM3_EOVFLOW;
+            }
+            memcpy(tmp, hex, hexlen);
+            tmp[hexlen] = '\0';
+
+            uint8_t data[CALYPSO_PROFILE_MAX_RESP];
+            int dlen = hex_to_bytes(tmp, data, sizeof(data));
+            if (dlen <= 0) {
+                PrintAndLogEx(ERR, "invalid hex value in file %04X", f->id);
+                return PM3_EFILE;
+            }
+
+            int res;
+            if (is_header) {
+                bool is_df = (strcmp(f->classname, "folder") == 0) || calypso_fci_is_df(data, dlen);
+                f->sfi = is_df ? 0 : calypso_fci_sfi(data, dlen);
+                res = calypso_profile_add_file(b, df, f->id, is_df, data, dlen);
+            } else {
+                res = calypso_profile_add_record(b, df, f->id, f->sfi, n->id, data, dlen);
+            }
+            if (res != PM3_SUCCESS) {
+                return res;
+            }
+        }
+    }
+    return PM3_SUCCESS;
+}
+
+static int calypso_json_hex(json_t *obj, const char *key, uint8_t *data, size_t maxlen, int *len) {
+    const char *s = json_string_value(json_object_get(obj, key));
+    if (s == NULL) {
+        *len = 0;
+        return PM3_SUCCESS;
+    }
+    *len = hex_to_bytes(s, data, maxlen);
+    if (*len < 0) {
+        PrintAndLogEx(ERR, "invalid hex in " _YELLOW_("%s") " `%s`", key, s);
+        return PM3_EFILE;
+    }
+    return PM3_SUCCESS;
+}
+
+// "2000/2010" or "3F00/2000/2010", the file and its parent DF
+static int calypso_json_path(const char *path, uint16_t *df, uint16_t *fid) {
+    uint16_t fids[8];
+    size_t n = 0;
+    const char *p = path;
+    while (*p && n < ARRAYLEN(fids)) {
+        char *end;
+        fids[n++] = strtoul(p, &end, 16);
+        if (end == p || (*end && *end != '/')) {
+            return PM3_EINVARG;
+        }
+        p = (*end) ? end + 1 : end;
+    }
+    if (n == 0 || *p) {
+        return PM3_EINVARG;
+    }
+    *fid = fids[n - 1];
+    *df = (n > 1 && fids[n - 2] != CALYPSO_MF) ? fids[n - 2] : CALYPSO_NO_FILE;
+    return PM3_SUCCESS;
+}
+
+//  {
+//    "FileType": "calypso",
+//    "files": [ { "path": "2000/2010", "fci": "8517...", "records": [ "...", ... ] }, ... ],
+//    "apdus": [ { "df": "2000", "apdu": "00CA7F6800", "response": "6B00" }, ... ]
+//  }
+static int calypso_profile_from_json(calypso_profile_builder_t *b, json_t *root) {
+
+    uint8_t data[CALYPSO_PROFILE_MAX_RESP];
+    int dlen = 0;
+
+    json_t *files = json_object_get(root, "files");
+    for (size_t i = 0; i < json_array_size(files); i++) {
+        json_t *jf = json_array_get(files, i);
+
+        uint16_t df, fid;
+        const char *path = json_string_value(json_object_get(jf, "path"));
+        if (path == NULL || calypso_json_path(path, &df, &fid) != PM3_SUCCESS) {
+            PrintAndLogEx(ERR, "invalid path in file %zu", i);
+            return PM3_EFILE;
+        }
+
+        if (calypso_json_hex(jf, "fci", data, sizeof(data) - 2, &dlen) != PM3_SUCCESS) {
+            return PM3_EFILE;
+        }
+
+        uint8_t sfi = 0;
+        if (dlen) {
+            bool is_df = calypso_fci_is_df(data, dlen);
+            sfi = is_df ? 0 : calypso_fci_sfi(data, dlen);
+            int res = calypso_profile_add_file(b, df, fid, is_df, data, dlen);
+            if (res != PM3_SUCCESS) {
+                return res;
+            }
+        }
+
+        json_t *records = json_object_get(jf, "records");
+        for (size_t r = 0; r < json_array_size(records); r++) {
+            const char *s = json_string_value(json_array_get(records, r));
+            dlen = (s) ? hex_to_bytes(s, data, sizeof(data) - 2) : -1;
+            if (dlen <= 0) {
+                PrintAndLogEx(ERR, "invalid record %zu in " _YELLOW_("%s"), r + 1, path);
+                return PM3_EFILE;
+            }
+            int res = calypso_profile_add_record(b, df, fid, sfi, r + 1, data, dlen);
+            if (res != PM3_SUCCESS) {
+                return res;
+            }
+        }
+    }
+
+    // raw commands, response with its SW
+    json_t *apdus = json_object_get(root, "apdus");
+    for (size_t i = 0; i < json_array_size(apdus); i++) {
+        json_t *ja = json_array_get(apdus, i);
+
+        uint8_t apdu[CALYPSO_PROFILE_MAX_RESP];
+        int alen = 0;
+        if (calypso_json_hex(ja, "apdu", apdu, sizeof(apdu), &alen) != PM3_SUCCESS ||
+                calypso_json_hex(ja, "response", data, sizeof(data), &dlen) != PM3_SUCCESS) {
+            return PM3_EFILE;
+        }
+        if (alen < 4 || dlen < 2) {
+            PrintAndLogEx(ERR, "invalid apdu %zu", i);
+            return PM3_EFILE;
+        }
+
+        uint16_t file = CALYPSO_ANY_FILE;
+        const char *df = json_string_value(json_object_get(ja, "df"));
+        if (df) {
+            file = strtoul(df, NULL, 16);
+        }
+
+        int res = calypso_profile_add(b, file, apdu[1], apdu[2], apdu[3], calypso_profile_arg(apdu, alen), 0, 0, data, dlen);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+    }
+    return PM3_SUCCESS;
+}
+
+static int calypso_profile_upload(const uint8_t *data, size_t len) {
+    struct p {
+        uint32_t offset;
+        uint16_t count;
+        uint8_t data[];
+    } PACKED;
+
+    uint8_t buf[PM3_CMD_DATA_SIZE];
+    struct p *payload = (struct p *)buf;
+    size_t chunksize = sizeof(buf) - sizeof(struct p);
+
+    for (size_t offset = 0; offset < len; offset += chunksize) {
+        payload->offset = offset;
+        payload->count = MIN(chunksize, len - offset);
+        memcpy(payload->data, data + offset, payload->count);
+
+        clearCommandBuffer();
+        SendCommandNG(CMD_HF_CALYPSO_EML_MEMSET, buf, sizeof(struct p) + payload->count);
+        PacketResponseNG resp;
+        if (WaitForResponseTimeout(CMD_HF_CALYPSO_EML_MEMSET, &resp, 1500) == false) {
+            PrintAndLogEx(WARNING, "command execution time out");
+            return PM3_ETIMEOUT;
+        }
+        if (resp.status != PM3_SUCCESS) {
+            PrintAndLogEx(FAILED, "Can't set emulator memory at offset: %zu / 0x%zx", offset, offset);
+            return resp.status;
+        }
+    }
+    return PM3_SUCCESS;
+}
+
+// Build the card profile from a cardpeek XML or a JSON file and upload it to emulator memory,
+// also saved as binary to savename when set
+static int calypso_profile_load(const char *filename, const char *savename) {
+
+    calypso_profile_builder_t *b = calloc(1, sizeof(calypso_profile_builder_t));
+    if (b == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    int res;
+    if (str_endswith(filename, ".xml")) {
+        char *xml = NULL;
+        size_t xmllen = 0;
+        res = loadFile_safe(filename, "", (void **)&xml, &xmllen);
+        if (res == PM3_SUCCESS) {
+            char *s = realloc(xml, xmllen + 1);
+            if (s == NULL) {
+                free(xml);
+                res = PM3_EMALLOC;
+            } else {
+                s[xmllen] = '\0';
+                res = calypso_profile_from_xml(b, s);
+                free(s);
+            }
+        }
+    } else {
+        json_t *root = NULL;
+        res = loadFileJSONroot(filename, (void **)&root, true);
+        if (res == PM3_SUCCESS) {
+            res = calypso_profile_from_json(b, root);
+            json_decref(root);
+        }
+    }
+
+    uint8_t *profile = NULL;
+    size_t size = 0;
+    if (res == PM3_SUCCESS) {
+        res = calypso_profile_build(b, &profile, &size);
+    }
+    if (res != PM3_SUCCESS) {
+        free(b);
+        return res;
+    }
+
+    PrintAndLogEx(INFO, "Card profile, " _YELLOW_("%u") " files, " _YELLOW_("%u") " records, " _YELLOW_("%u") " entries, " _YELLOW_("%zu") " bytes"
+                  , b->files, b->records, b->count, size);
+    free(b);
+
+    if (savename != NULL && savename[0] != '\0') {
+        res = saveFile(savename, ".bin", profile, size);
+        if (res != PM3_SUCCESS) {
+            free(profile);
+            return res;
+        }
+    }
+
+    res = calypso_profile_upload(profile, size);
+    free(profile);
+    if (res == PM3_SUCCESS) {
+        PrintAndLogEx(SUCCESS, "uploaded " _YELLOW_("%zu") " bytes to emulator memory", size);
+    }
+    return res;
+}
+
+static int CmdScardELoad(const char* Cmd) {
+
+    CLIParserContext* ctx;
+    CLIParserInit(&ctx, "scard eload",
+        "Load a Calypso card profile to emulator memory, to be used with 'scard simcalypso'.\n"
+        "The profile is a cardpeek XML dump (.xml) or a JSON file with the files, records\n"
+        "and raw APDU answers of the card",
+        "scard eload -f navigo_cardkeep.xml\n"
+        "scard eload -f calypso.json\n"
+        "scard eload -f navigo_cardkeep.xml --save navigo   -> also save navigo.bin, for tools/iso14b_sim -p"
+    );
+
+    void* argtable[] = {
+        arg_param_begin,
+        arg_str1("f", "file", "<fn>", "Specify a filename for the card profile"),
+        arg_str0(NULL, "save", "<fn>", "save the built profile as binary"),
+        arg_param_end
+    };
+    CLIExecWithReturn(ctx, Cmd, argtable, false);
+
+    int fnlen = 0;
+    char filename[FILE_PATH_SIZE];
+    CLIParamStrToBuf(arg_get_str(ctx, 1), (uint8_t*)filename, FILE_PATH_SIZE, &fnlen);
+
+    int savelen = 0;
+    char savename[FILE_PATH_SIZE] = {0};
+    CLIParamStrToBuf(arg_get_str(ctx, 2), (uint8_t*)savename, FILE_PATH_SIZE, &savelen);
+    CLIParserFree(ctx);
+
+    int res = calypso_profile_load(filename, savename);
+    if (res == PM3_SUCCESS) {
+        PrintAndLogEx(HINT, "You are ready to simulate. See " _YELLOW_("`scard simcalypso -h`"));
+    }
+    return res;
+}
+
+
 //Pour usage interne
 
 static int CmdHF14BSimCal(const char* Cmd) {
 
     CLIParserContext* ctx;
     CLIParserInit(&ctx, "scard simcalypso",
-        "Simulate a Calypso Card [Add by jev]",
-        "scard simcalypso -u 00000000"
+        "Simulate a Calypso Card [Add by jev]\n"
+        "Commands are answered from the card profile in emulator memory, see 'scard eload'",
+        "scard simcalypso -u 00000000\n"
+        "scard simcalypso -u 00000000 -f navigo_cardkeep.xml   -> load the card profile first"
     );
 
     void* argtable[] = {
         arg_param_begin,
         arg_str1("u", "uid", "hex", "4byte UID/PUPI"),
+        arg_str0("f", "file", "<fn>", "card profile to load, cardpeek XML or JSON"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, false);
@@ -131,6 +717,10 @@ static int CmdHF14BSimCal(const char* Cmd) {
     uint8_t pupi[4];
     int n = 0;
     int res = CLIParamHexToBuf(arg_get_str(ctx, 1), pupi, sizeof(pupi), &n);
+
+    int fnlen = 0;
+    char filename[FILE_PATH_SIZE] = {0};
+    CLIParamStrToBuf(arg_get_str(ctx, 2), (uint8_t*)filename, FILE_PATH_SIZE, &fnlen);
     CLIParserFree(ctx);
 
     if (res) {
@@ -138,6 +728,13 @@ static int CmdHF14BSimCal(const char* Cmd) {
         return PM3_EINVARG;
     }
 
+    if (fnlen) {
+        res = calypso_profile_load(filename, NULL);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+    }
+
     PrintAndLogEx(INFO, "Simulate with PUPI : " _GREEN_("%s"), sprint_hex_inrow(pupi, sizeof(pupi)));
     PrintAndLogEx(INFO, "Press " _GREEN_("pm3 button") " to abort simulation");
     clearCommandBuffer();
@@ -185,6 +782,7 @@ static int CmdHFCheck(const char* Cmd) {
 static command_t CommandTable[] = {
 
         {"simcalypso",  CmdHF14BSimCal,   AlwaysAvailable, "{ Emulation de carte calypso }"},
+        {"eload",       CmdScardELoad,    IfPm3Iso14443b,  "{ Charge un profil de carte calypso (XML cardpeek / JSON) en memoire d'emulation }"},
         {"pyinitcal",   CmdpyInitCal,     AlwaysAvailable, "{ Commande (A utiliser dans python) pour initialiser une comm calypso (ATQB, WUPB..)}"},
         {"pyclient",    CmdpyClientSim,   AlwaysAvailable, "{ Commande (A utiliser dans python) recuperer les requetes d'un PCD  }"},
         {"check",       CmdHFCheck,       AlwaysAvailable, "{ Verifie periodiquement le champs d'un lecteur  }"},
@@ -30,55 +30,320 @@
 #include "util_posix.h" // msclock
 #include "util_darwin.h" // en/dis-ableNapp();
 #include "usart_defs.h"
+#include <lz4.h>        // compressed BigBuf download
 
 // #define COMMS_DEBUG
 // #define COMMS_DEBUG_RAW
 
-// Serial port that we are communicating with the PM3 on.
-static serial_port sp = NULL;
+// the rx queue indices are free running, the slot only stays right across their wrap around
+_Static_assert((CMD_BUFFER_SIZE & (CMD_BUFFER_SIZE - 1)) == 0, "CMD_BUFFER_SIZE must be a power of two");
+
+// Transmit queue.
+// Several commands can be handed over to the communication thread before it gets a chance to send them,
+// which lets callers keep multiple commands in flight (see SendCommandNGAsync)
+typedef struct {
+    union {
+        PacketCommandOLD old;
+        PacketCommandNGRaw ng;
+    } buf;
+    size_t len;
+    uint16_t cmd;
+} tx_slot_t;
+
+// Outstanding asynchronous requests. Only touched by the consumer (main) thread.
+typedef struct {
+    bool used;
+    bool done;
+    bool cancelled;
+    uint16_t reply_cmd;
+    uint16_t cmd;
+    uint32_t tag;
+    uint64_t sent_at;
+    PacketResponseNG resp;
+} async_slot_t;
+
+// Bulk download sink, see GetFromDevice().
+// While armed, download chunks are written straight into the caller's buffer by the
+// communication thread instead of going through the reply queue.
+typedef struct {
+    bool armed;
+    uint8_t *dest;
+    uint32_t bytes;
+    uint32_t rec_cmd;
+    uint32_t completed;
+    bool overflow;
+} download_sink_t;
+
+// Everything needed to talk to one Proxmark3: connection, threads, queues and statistics.
+// The CLI uses default_ctx, the library creates one per device (see pm3_open)
+struct comms_ctx {
+    communication_arg_t conn;
+    capabilities_t capabilities;
+    bool present;
+    pm3_device_t *device;
+
+    // Serial port that we are communicating with the PM3 on.
+    serial_port sp;
+
+    pthread_t communication_thread;
+    pthread_t reconnect_thread;
+
+    bool reconnect_ok;
+
+    bool comm_thread_dead;
+    bool comm_raw_mode;
+    uint8_t *comm_raw_data;
+    size_t comm_raw_len;
+    size_t comm_raw_pos;
+
+    tx_slot_t txQueue[TX_QUEUE_SIZE];
+    // free running indices, protected by txBufferMutex
+    uint32_t tx_head;
+    uint32_t tx_tail;
+    pthread_mutex_t txBufferMutex;
+    pthread_cond_t txBufferSig;
+    // a send from storeReply() failed, picked up by the communication thread
+    bool tx_failed;
+
+    async_slot_t async_slots[PM3_ASYNC_MAX_INFLIGHT];
+    uint32_t async_next_tag;
+    uint32_t async_inflight;
+    // timed out or cancelled requests, their slot is kept to drop a late reply
+    uint32_t async_abandoned;
+
+    // Used by PacketResponseReceived as a single-producer / single-consumer queue for messages
+    // that are yet to be processed by a command handler (WaitForResponse{,Timeout})
+    // Producer is the uart_communication thread, consumer is the main thread.
+    // No lock is needed, each side only ever writes its own index.
+    PacketResponseNG rxBuffer[CMD_BUFFER_SIZE];
+
+    // Monotonic write counter, only written by the producer.  Slot is (cmd_head % CMD_BUFFER_SIZE)
+    uint32_t cmd_head;
+
+    // Monotonic read counter, only written by the consumer.  Slot is (cmd_tail % CMD_BUFFER_SIZE)
+    uint32_t cmd_tail;
+
+    // rx queue statistics, see GetCommunicationRxStats()
+    uint32_t rx_high_water;
+    uint32_t rx_dropped;
+    uint32_t rx_stalls;
+
+    download_sink_t dl_sink;
+    pthread_mutex_t dl_sinkMutex;
+
+    // Per command statistics, see GetCommunicationCmdStats().
+    // Commands are sent and their replies collected on the main thread, which owns the table.
+    comm_cmd_stats_t cmd_stats[CMD_STATS_SIZE];
+    size_t cmd_stats_count;
+
+    // last command sent with SendCommand{OLD,NG,MIX} and when, the latency is taken at its first reply
+    uint16_t stats_last_cmd;
+    uint64_t stats_last_sent;
+    bool stats_waiting;
+
+    // link totals, updated by the communication thread
+    uint32_t link_tx_frames;
+    uint64_t link_tx_bytes;
+    uint32_t link_rx_frames;
+    uint64_t link_rx_bytes;
+    uint64_t link_stats_since;
+
+    // Start time for WaitForResponseTimeout & dl_it, so we can reset timeout when we get packets
+    // as sending lot of these packets can slow down things wuite a lot on slow links (e.g. hw status or lf read at 9600)
+    uint64_t timeout_start_time;
+
+    uint64_t last_packet_time;
+};
+
+static comms_ctx_t default_ctx = {
+    .txBufferMutex = PTHREAD_MUTEX_INITIALIZER,
+    .txBufferSig = PTHREAD_COND_INITIALIZER,
+    .async_next_tag = 1,
+    .dl_sinkMutex = PTHREAD_MUTEX_INITIALIZER,
+    .stats_last_cmd = CMD_UNKNOWN,
+};
+
+// context of the device the calling thread talks to, NULL means default_ctx.
+// Communication threads point it to the context they serve.
+static __thread comms_ctx_t *thread_ctx = NULL;
+
+static comms_ctx_t *current_ctx(void) {
+    return (thread_ctx) ? thread_ctx : &default_ctx;
+}
+
+/**
+ * @brief Allocate the context for one more device.  Make it current with SetCommunicationContext()
+ *  before calling OpenProxmark(), then every comms call made from that thread goes to this device.
+ */
+comms_ctx_t *NewCommunicationContext(void) {
+    comms_ctx_t *ctx = calloc(1, sizeof(comms_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->txBufferMutex, NULL);
+    pthread_cond_init(&ctx->txBufferSig, NULL);
+    pthread_mutex_init(&ctx->dl_sinkMutex, NULL);
+    ctx->async_next_tag = 1;
+    ctx->stats_last_cmd = CMD_UNKNOWN;
+    return ctx;
+}
+
+// the device must be closed already
+void FreeCommunicationContext(comms_ctx_t *ctx) {
+    if (ctx == NULL || ctx == &default_ctx) {
+        return;
+    }
+    if (thread_ctx == ctx) {
+        thread_ctx = NULL;
+    }
+    pthread_mutex_destroy(&ctx->txBufferMutex);
+    pthread_cond_destroy(&ctx->txBufferSig);
+    pthread_mutex_destroy(&ctx->dl_sinkMutex);
+    free(ctx);
+}
+
+/**
+ * @brief Select the device the calling thread talks to. NULL selects the default one.
+ * @return the previously selected context, so callers can restore it
+ */
+comms_ctx_t *SetCommunicationContext(comms_ctx_t *ctx) {
+    comms_ctx_t *prev = thread_ctx;
+    thread_ctx = (ctx == &default_ctx) ? NULL : ctx;
+    return (prev) ? prev : &default_ctx;
+}
+
+comms_ctx_t *GetCommunicationContext(void) {
+    return current_ctx();
+}
+
+communication_arg_t *GetCommunicationArg(void) {
+    return &current_ctx()->conn;
+}
 
-communication_arg_t g_conn;
-capabilities_t g_pm3_capabilities;
+capabilities_t *GetDeviceCapabilities(void) {
+    return &current_ctx()->capabilities;
+}
 
-static pthread_t communication_thread;
-static pthread_t reconnect_thread;
+bool IsCommunicationContextPresent(void) {
+    return current_ctx()->present;
+}
 
-static bool reconnect_ok = false;
+// device opened on the context selected by the calling thread
+pm3_device_t *GetCommunicationDevice(void) {
+    return current_ctx()->device;
+}
 
-static bool comm_thread_dead = false;
-static bool comm_raw_mode = false;
-static uint8_t *comm_raw_data = NULL;
-static size_t comm_raw_len = 0;
-static size_t comm_raw_pos = 0;
+static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd);
+static size_t communication_delay(void);
+static int getReply(PacketResponseNG *packet);
+
+static comm_cmd_stats_t *get_cmd_stats(uint16_t cmd) {
+    comms_ctx_t *ctx = current_ctx();
+    for (size_t i = 0; i < ctx->cmd_stats_count; i++) {
+        if (ctx->cmd_stats[i].cmd == cmd) {
+            return &ctx->cmd_stats[i];
+        }
+    }
 
-// Transmit buffer.
-static PacketCommandOLD txBuffer;
-static PacketCommandNGRaw txBufferNG;
-static size_t txBufferNGLen;
-static bool txBuffer_pending = false;
-static pthread_mutex_t txBufferMutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t txBufferSig = PTHREAD_COND_INITIALIZER;
+    if (ctx->cmd_stats_count == CMD_STATS_SIZE) {
+        return NULL;
+    }
 
-// Used by PacketResponseReceived as a ring buffer for messages that are yet to be
-// processed by a command handler (WaitForResponse{,Timeout})
-static PacketResponseNG rxBuffer[CMD_BUFFER_SIZE];
+    comm_cmd_stats_t *e = &ctx->cmd_stats[ctx->cmd_stats_count++];
+    memset(e, 0, sizeof(comm_cmd_stats_t));
+    e->cmd = cmd;
+    e->lat_min = UINT32_MAX;
+    return e;
+}
 
-// Points to the next empty position to write to
-static int cmd_head = 0;
+static size_t reply_wire_len(const PacketResponseNG *packet) {
+    if (packet->magic != RESPONSENG_PREAMBLE_MAGIC) {
+        return sizeof(PacketResponseOLD);
+    }
+    size_t len = packet->length;
+    if (packet->ng == false) {
+        len += 3 * sizeof(uint64_t);
+    }
+    return sizeof(PacketResponseNGPreamble) + len + sizeof(PacketResponseNGPostamble);
+}
 
-// Points to the position of the last unread command
-static int cmd_tail = 0;
+static void stats_sent(uint16_t cmd, size_t len) {
+    comm_cmd_stats_t *e = get_cmd_stats(cmd);
+    if (e) {
+        e->sent++;
+        e->bytes_out += len;
+    }
+}
 
-// to lock rxBuffer operations from different threads
-static pthread_mutex_t rxBufferMutex = PTHREAD_MUTEX_INITIALIZER;
+static void stats_latency(comm_cmd_stats_t *e, uint64_t sent_at) {
+    uint64_t ms = msclock() - sent_at;
+    uint32_t lat = (ms > UINT32_MAX) ? UINT32_MAX : ms;
 
-// Global start time for WaitForResponseTimeout & dl_it, so we can reset timeout when we get packets
-// as sending lot of these packets can slow down things wuite a lot on slow links (e.g. hw status or lf read at 9600)
-static uint64_t timeout_start_time;
+    uint8_t bucket = 0;
+    while (ms && bucket < CMD_STATS_HIST_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    e->hist[bucket]++;
 
-static uint64_t last_packet_time;
+    e->lat_total += lat;
+    if (lat < e->lat_min) {
+        e->lat_min = lat;
+    }
+    if (lat > e->lat_max) {
+        e->lat_max = lat;
+    }
+}
 
-static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd);
+// a reply to the last command sent was handed to the caller
+static void stats_reply(const PacketResponseNG *packet) {
+    comms_ctx_t *ctx = current_ctx();
+    if (ctx->stats_last_cmd == CMD_UNKNOWN) {
+        return;
+    }
+    comm_cmd_stats_t *e = get_cmd_stats(ctx->stats_last_cmd);
+    if (e == NULL) {
+        return;
+    }
+    e->replies++;
+    if (packet) {
+        e->bytes_in += reply_wire_len(packet);
+    }
+    if (ctx->stats_waiting) {
+        stats_latency(e, ctx->stats_last_sent);
+        ctx->stats_waiting = false;
+    }
+}
+
+static void stats_timeout(void) {
+    comms_ctx_t *ctx = current_ctx();
+    if (ctx->stats_last_cmd == CMD_UNKNOWN) {
+        return;
+    }
+    comm_cmd_stats_t *e = get_cmd_stats(ctx->stats_last_cmd);
+    if (e) {
+        e->timeouts++;
+    }
+    ctx->stats_waiting = false;
+}
+
+static void stats_wtx(void) {
+    comms_ctx_t *ctx = current_ctx();
+    if (ctx->stats_last_cmd == CMD_UNKNOWN) {
+        return;
+    }
+    comm_cmd_stats_t *e = get_cmd_stats(ctx->stats_last_cmd);
+    if (e) {
+        e->wtx++;
+    }
+}
+
+static void stats_sync_sent(uint16_t cmd) {
+    comms_ctx_t *ctx = current_ctx();
+    ctx->stats_last_cmd = cmd;
+    ctx->stats_last_sent = msclock();
+    ctx->stats_waiting = true;
+}
 
 // Simple alias to track usages linked to the Bootloader, these commands must not be migrated.
 // - commands sent to enter bootloader mode as we might have to talk to old firmwares
@@ -88,6 +353,7 @@ void SendCommandBL(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, vo
 }
 
 void SendCommandOLD(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, const void *data, size_t len) {
+    comms_ctx_t *ctx = current_ctx();
     PacketCommandOLD c = {CMD_UNKNOWN, {0, 0, 0}, {{0}}};
     c.cmd = cmd;
     c.arg[0] = arg0;
@@ -105,98 +371,125 @@ void SendCommandOLD(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, c
     print_hex_break((uint8_t *)&c.d, sizeof(c.d), 32);
 #endif
 
-    if (!g_session.pm3_present) {
+    if (!ctx->present) {
         PrintAndLogEx(WARNING, "Sending bytes to Proxmark3 failed ( " _RED_("offline") " )");
         return;
     }
 
-    pthread_mutex_lock(&txBufferMutex);
+    pthread_mutex_lock(&ctx->txBufferMutex);
     /**
     This causes hangups at times, when the pm3 unit is unresponsive or disconnected. The main console thread is alive,
     but comm thread just spins here. Not good.../holiman
     **/
-    while (txBuffer_pending) {
-        // wait for communication thread to complete sending a previous command
-        pthread_cond_wait(&txBufferSig, &txBufferMutex);
+    while (ctx->tx_head - ctx->tx_tail >= TX_QUEUE_SIZE) {
+        // wait for communication thread to make room in the transmit queue
+        pthread_cond_wait(&ctx->txBufferSig, &ctx->txBufferMutex);
     }
 
-    txBuffer = c;
-    txBuffer_pending = true;
+    tx_slot_t *slot = &ctx->txQueue[ctx->tx_head % TX_QUEUE_SIZE];
+    slot->buf.old = c;
+    slot->len = sizeof(PacketCommandOLD);
+    slot->cmd = cmd;
+    ctx->tx_head++;
 
     // tell communication thread that a new command can be send
-    pthread_cond_signal(&txBufferSig);
+    pthread_cond_signal(&ctx->txBufferSig);
+
+    // and get it out of uart_receive() if it is waiting there.
+    // The port is only closed with txBufferMutex held
+    if (ctx->sp) {
+        uart_notify_tx(ctx->sp);
+    }
+
+    pthread_mutex_unlock(&ctx->txBufferMutex);
 
-    pthread_mutex_unlock(&txBufferMutex);
+    stats_sent(cmd, sizeof(PacketCommandOLD));
+    stats_sync_sent(cmd);
 
 //__atomic_test_and_set(&txcmd_pending, __ATOMIC_SEQ_CST);
 }
 
-static void SendCommandNG_internal(uint16_t cmd, uint8_t *data, size_t len, bool ng) {
+static int SendCommandNG_internal(uint16_t cmd, uint8_t *data, size_t len, bool ng) {
+    comms_ctx_t *ctx = current_ctx();
 #ifdef COMMS_DEBUG
     PrintAndLogEx(INFO, "Sending %s", ng ? "NG" : "MIX");
 #endif
 
-    if (!g_session.pm3_present) {
+    if (!ctx->present) {
         PrintAndLogEx(INFO, "Sending bytes to proxmark failed - offline");
-        return;
+        return PM3_EIO;
     }
     if (len > PM3_CMD_DATA_SIZE) {
         PrintAndLogEx(WARNING, "Sending %zu bytes of payload is too much, abort", len);
-        return;
+        return PM3_EOVFLOW;
     }
 
-    PacketCommandNGPostamble *tx_post = (PacketCommandNGPostamble *)((uint8_t *)&txBufferNG + sizeof(PacketCommandNGPreamble) + len);
-
-    pthread_mutex_lock(&txBufferMutex);
+    pthread_mutex_lock(&ctx->txBufferMutex);
     /**
     This causes hangups at times, when the pm3 unit is unresponsive or disconnected. The main console thread is alive,
     but comm thread just spins here. Not good.../holiman
     **/
-    while (txBuffer_pending) {
-        // wait for communication thread to complete sending a previous command
-        pthread_cond_wait(&txBufferSig, &txBufferMutex);
+    while (ctx->tx_head - ctx->tx_tail >= TX_QUEUE_SIZE) {
+        // wait for communication thread to make room in the transmit queue
+        pthread_cond_wait(&ctx->txBufferSig, &ctx->txBufferMutex);
     }
 
-    txBufferNG.pre.magic = COMMANDNG_PREAMBLE_MAGIC;
-    txBufferNG.pre.ng = ng;
-    txBufferNG.pre.length = len;
-    txBufferNG.pre.cmd = cmd;
+    tx_slot_t *slot = &ctx->txQueue[ctx->tx_head % TX_QUEUE_SIZE];
+    PacketCommandNGRaw *txBufferNG = &slot->buf.ng;
+    PacketCommandNGPostamble *tx_post = (PacketCommandNGPostamble *)((uint8_t *)txBufferNG + sizeof(PacketCommandNGPreamble) + len);
+
+    txBufferNG->pre.magic = COMMANDNG_PREAMBLE_MAGIC;
+    txBufferNG->pre.ng = ng;
+    txBufferNG->pre.length = len;
+    txBufferNG->pre.cmd = cmd;
     if (len > 0 && data) {
-        memcpy(&txBufferNG.data, data, len);
+        memcpy(&txBufferNG->data, data, len);
     }
 
     if ((g_conn.send_via_fpc_usart && g_conn.send_with_crc_on_fpc) || ((!g_conn.send_via_fpc_usart) && g_conn.send_with_crc_on_usb)) {
         uint8_t first = 0, second = 0;
-        compute_crc(CRC_14443_A, (uint8_t *)&txBufferNG, sizeof(PacketCommandNGPreamble) + len, &first, &second);
+        compute_crc(CRC_14443_A, (uint8_t *)txBufferNG, sizeof(PacketCommandNGPreamble) + len, &first, &second);
         tx_post->crc = (first << 8) + second;
     } else {
         tx_post->crc = COMMANDNG_POSTAMBLE_MAGIC;
     }
 
-    txBufferNGLen = sizeof(PacketCommandNGPreamble) + len + sizeof(PacketCommandNGPostamble);
+    slot->len = sizeof(PacketCommandNGPreamble) + len + sizeof(PacketCommandNGPostamble);
+    slot->cmd = cmd;
 
 #ifdef COMMS_DEBUG_RAW
-    print_hex_break((uint8_t *)&txBufferNG.pre, sizeof(PacketCommandNGPreamble), 32);
+    print_hex_break((uint8_t *)&txBufferNG->pre, sizeof(PacketCommandNGPreamble), 32);
     if (ng) {
-        print_hex_break((uint8_t *)&txBufferNG.data, len, 32);
+        print_hex_break((uint8_t *)&txBufferNG->data, len, 32);
     } else {
-        print_hex_break((uint8_t *)&txBufferNG.data, 3 * sizeof(uint64_t), 32);
-        print_hex_break((uint8_t *)&txBufferNG.data + 3 * sizeof(uint64_t), len - 3 * sizeof(uint64_t), 32);
+        print_hex_break((uint8_t *)&txBufferNG->data, 3 * sizeof(uint64_t), 32);
+        print_hex_break((uint8_t *)&txBufferNG->data + 3 * sizeof(uint64_t), len - 3 * sizeof(uint64_t), 32);
     }
     print_hex_break((uint8_t *)tx_post, sizeof(PacketCommandNGPostamble), 32);
 #endif
-    txBuffer_pending = true;
+    ctx->tx_head++;
 
     // tell communication thread that a new command can be send
-    pthread_cond_signal(&txBufferSig);
+    pthread_cond_signal(&ctx->txBufferSig);
 
-    pthread_mutex_unlock(&txBufferMutex);
+    // and get it out of uart_receive() if it is waiting there.
+    // The port is only closed with txBufferMutex held
+    if (ctx->sp) {
+        uart_notify_tx(ctx->sp);
+    }
+
+    pthread_mutex_unlock(&ctx->txBufferMutex);
+
+    stats_sent(cmd, sizeof(PacketCommandNGPreamble) + len + sizeof(PacketCommandNGPostamble));
 
 //__atomic_test_and_set(&txcmd_pending, __ATOMIC_SEQ_CST);
+    return PM3_SUCCESS;
 }
 
 void SendCommandNG(uint16_t cmd, uint8_t *data, size_t len) {
-    SendCommandNG_internal(cmd, data, len, true);
+    if (SendCommandNG_internal(cmd, data, len, true) == PM3_SUCCESS) {
+        stats_sync_sent(cmd);
+    }
 }
 
 void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, const void *data, size_t len) {
@@ -209,9 +502,258 @@ void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, c
     memcpy(cmddata, arg, sizeof(arg));
     if (len && data)
         memcpy(cmddata + sizeof(arg), data, len);
-    SendCommandNG_internal(cmd, cmddata, len + sizeof(arg), false);
+    if (SendCommandNG_internal(cmd, cmddata, len + sizeof(arg), false) == PM3_SUCCESS) {
+        stats_sync_sent(cmd);
+    }
+}
+
+
+static void free_async_slot(async_slot_t *slot) {
+    comms_ctx_t *ctx = current_ctx();
+    slot->used = false;
+    if (slot->cancelled) {
+        ctx->async_abandoned--;
+    } else {
+        ctx->async_inflight--;
+    }
+}
+
+// give up on a request, it no longer counts as in flight but its late reply is still dropped
+static void abandon_async_slot(async_slot_t *slot) {
+    comms_ctx_t *ctx = current_ctx();
+    slot->cancelled = true;
+    ctx->async_inflight--;
+    ctx->async_abandoned++;
+}
+
+/**
+ * @brief Queue a NG command without waiting for its reply.
+ *  Up to PM3_ASYNC_MAX_INFLIGHT requests can be outstanding. Replies are routed to the oldest
+ *  outstanding request expecting that reply command, since the device answers in order.
+ *  Use WaitForAsyncResponse() with the returned tag to collect the reply.
+ * @param cmd command to send
+ * @param data payload
+ * @param len payload length
+ * @param reply_cmd command of the expected reply, usually the same as cmd
+ * @param tag receives the request tag
+ * @return PM3_SUCCESS, PM3_EOVFLOW if too many requests are in flight
+ */
+int SendCommandNGAsync(uint16_t cmd, uint8_t *data, size_t len, uint16_t reply_cmd, uint32_t *tag) {
+    comms_ctx_t *ctx = current_ctx();
+
+    async_slot_t *slot = NULL;
+    for (uint8_t i = 0; i < PM3_ASYNC_MAX_INFLIGHT; i++) {
+        if (ctx->async_slots[i].used == false) {
+            slot = &ctx->async_slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL && ctx->async_abandoned) {
+        // the reply of the oldest abandoned request is taken as lost
+        for (uint8_t i = 0; i < PM3_ASYNC_MAX_INFLIGHT; i++) {
+            async_slot_t *s = &ctx->async_slots[i];
+            if (s->cancelled && (slot == NULL || (int32_t)(s->tag - slot->tag) < 0)) {
+                slot = s;
+            }
+        }
+        free_async_slot(slot);
+    }
+
+    if (slot == NULL) {
+        PrintAndLogEx(DEBUG, "Too many asynchronous requests in flight");
+        return PM3_EOVFLOW;
+    }
+
+    // tag 0 is never handed out
+    if (ctx->async_next_tag == 0) {
+        ctx->async_next_tag++;
+    }
+
+    slot->used = true;
+    slot->done = false;
+    slot->cancelled = false;
+    slot->reply_cmd = reply_cmd;
+    slot->cmd = cmd;
+    slot->sent_at = msclock();
+    slot->tag = ctx->async_next_tag++;
+    ctx->async_inflight++;
+
+    int res = SendCommandNG_internal(cmd, data, len, true);
+    if (res != PM3_SUCCESS) {
+        slot->used = false;
+        ctx->async_inflight--;
+        return res;
+    }
+
+    if (tag) {
+        *tag = slot->tag;
+    }
+    return PM3_SUCCESS;
+}
+
+static async_slot_t *get_async_slot(uint32_t tag) {
+    comms_ctx_t *ctx = current_ctx();
+    for (uint8_t i = 0; i < PM3_ASYNC_MAX_INFLIGHT; i++) {
+        if (ctx->async_slots[i].used && ctx->async_slots[i].tag == tag) {
+            return &ctx->async_slots[i];
+        }
+    }
+    return NULL;
+}
+
+
+// hand a reply to the oldest outstanding request waiting for it.
+// returns true if the reply was consumed
+static bool route_async_reply(const PacketResponseNG *packet) {
+    comms_ctx_t *ctx = current_ctx();
+
+    if (ctx->async_inflight == 0 && ctx->async_abandoned == 0) {
+        return false;
+    }
+
+    async_slot_t *oldest = NULL;
+    for (uint8_t i = 0; i < PM3_ASYNC_MAX_INFLIGHT; i++) {
+        async_slot_t *slot = &ctx->async_slots[i];
+        if (slot->used == false || slot->done || slot->reply_cmd != packet->cmd) {
+            continue;
+        }
+        // tags wrap around, compare by distance
+        if (oldest == NULL || (int32_t)(slot->tag - oldest->tag) < 0) {
+            oldest = slot;
+        }
+    }
+
+    if (oldest == NULL) {
+        return false;
+    }
+
+    if (oldest->cancelled) {
+        // nobody is interested anymore, swallow the reply
+        free_async_slot(oldest);
+        return true;
+    }
+
+    comm_cmd_stats_t *e = get_cmd_stats(oldest->cmd);
+    if (e) {
+        e->replies++;
+        e->bytes_in += reply_wire_len(packet);
+        stats_latency(e, oldest->sent_at);
+    }
+
+    memcpy(&oldest->resp, packet, sizeof(PacketResponseNG));
+    oldest->done = true;
+    return true;
+}
+
+/**
+ * @brief Wait for the reply of a request queued with SendCommandNGAsync()
+ * @param tag request tag
+ * @param response struct to copy received reply into
+ * @param ms_timeout timeout in milliseconds, restarted on every packet received
+ * @return true if the reply was received, otherwise false. The request is released either way.
+ */
+bool WaitForAsyncResponse(uint32_t tag, PacketResponseNG *response, size_t ms_timeout) {
+    comms_ctx_t *ctx = current_ctx();
+
+    async_slot_t *slot = get_async_slot(tag);
+    if (slot == NULL || slot->cancelled) {
+        return false;
+    }
+
+    PacketResponseNG resp;
+
+    if (ms_timeout != (size_t) - 1) {
+        ms_timeout += communication_delay();
+    }
+
+    __atomic_store_n(&ctx->timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
+
+    while (slot->done == false) {
+
+        if (IsCommunicationThreadDead()) {
+            break;
+        }
+
+        while (slot->done == false && getReply(&resp)) {
+
+            if (route_async_reply(&resp)) {
+                continue;
+            }
+
+            if (resp.cmd == CMD_WTX && resp.length == sizeof(uint16_t)) {
+                comm_cmd_stats_t *e = get_cmd_stats(slot->cmd);
+                if (e) {
+                    e->wtx++;
+                }
+                uint16_t wtx = resp.data.asDwords[0] & 0xFFFF;
+                PrintAndLogEx(DEBUG, "Got Waiting Time eXtension request %i ms", wtx);
+                if (ms_timeout != (size_t) - 1) {
+                    ms_timeout += wtx;
+                }
+            }
+        }
+
+        if (slot->done) {
+            break;
+        }
+
+        uint64_t tmp_clk = __atomic_load_n(&ctx->timeout_start_time, __ATOMIC_SEQ_CST);
+        if ((ms_timeout != (size_t) - 1) && (msclock() - tmp_clk > ms_timeout)) {
+            break;
+        }
+
+        msleep(1);
+    }
+
+    bool done = slot->done;
+    if (done) {
+        if (response) {
+            memcpy(response, &slot->resp, sizeof(PacketResponseNG));
+        }
+        free_async_slot(slot);
+    } else {
+        comm_cmd_stats_t *e = get_cmd_stats(slot->cmd);
+        if (e) {
+            e->timeouts++;
+        }
+        // the reply might still show up later, make sure it doesn't get routed to a newer request
+        abandon_async_slot(slot);
+    }
+    return done;
+}
+
+/**
+ * @brief Give up on an outstanding request. Its reply is discarded when it arrives.
+ */
+void CancelAsyncRequest(uint32_t tag) {
+    async_slot_t *slot = get_async_slot(tag);
+    if (slot == NULL) {
+        return;
+    }
+
+    if (slot->done) {
+        free_async_slot(slot);
+    } else if (slot->cancelled == false) {
+        abandon_async_slot(slot);
+    }
+}
+
+/**
+ * @brief Forget about all outstanding requests. Late replies end up in the normal
+ *  reply queue and are discarded by the next clearCommandBuffer()
+ */
+void ClearAsyncRequests(void) {
+    comms_ctx_t *ctx = current_ctx();
+    memset(ctx->async_slots, 0, sizeof(ctx->async_slots));
+    ctx->async_inflight = 0;
+    ctx->async_abandoned = 0;
 }
 
+size_t GetAsyncRequestsInFlight(void) {
+    comms_ctx_t *ctx = current_ctx();
+    return ctx->async_inflight;
+}
 
 /**
  * @brief This method should be called when sending a new command to the pm3. In case any old
@@ -220,65 +762,281 @@ void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, c
  *  operation. Right now we'll just have to live with this.
  */
 void clearCommandBuffer(void) {
-    //This is a very simple operation
-    pthread_mutex_lock(&rxBufferMutex);
-    cmd_tail = cmd_head;
-    pthread_mutex_unlock(&rxBufferMutex);
+    comms_ctx_t *ctx = current_ctx();
+    // consumer side, drop everything the producer has published so far
+    uint32_t head = __atomic_load_n(&ctx->cmd_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ctx->cmd_tail, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Send everything waiting in the transmit queue, so pipelined commands go out back to back.
+ *  Must be called from the communication thread with txBufferMutex held.
+ * @return PM3_EIO if a send failed
+ */
+static int flush_tx_queue(comms_ctx_t *ctx) {
+    int ret = PM3_SUCCESS;
+    if (ctx->tx_head == ctx->tx_tail) {
+        return ret;
+    }
+
+    while (ctx->tx_head != ctx->tx_tail) {
+        const tx_slot_t *slot = &ctx->txQueue[ctx->tx_tail % TX_QUEUE_SIZE];
+        if (uart_send(ctx->sp, (uint8_t *) &slot->buf, slot->len) == PM3_EIO) {
+            ret = PM3_EIO;
+        } else {
+            __atomic_add_fetch(&ctx->link_tx_frames, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&ctx->link_tx_bytes, slot->len, __ATOMIC_RELAXED);
+        }
+        g_conn.last_command = slot->cmd;
+        ctx->tx_tail++;
+    }
+
+    // main thread doesn't know send failed...
+
+    // tell main thread that txBuffer is empty
+    pthread_cond_signal(&ctx->txBufferSig);
+    return ret;
 }
+
 /**
- * @brief storeCommand stores a USB command in a circular buffer
- * @param UC
+ * @brief storeReply stores a received reply in the rx queue.
+ *  When the queue is full, the communication thread stalls (which in turn throttles the device
+ *  through the USB / UART flow control) until the consumer catches up.
+ *  If the consumer doesn't drain the queue within RX_QUEUE_BACKPRESSURE_MS, the reply is dropped.
+ *  The transmit queue keeps being flushed meanwhile, a consumer blocked in SendCommand*() on a full
+ *  transmit queue would otherwise never get to drain the rx queue.
+ * @param packet
  */
 static void storeReply(const PacketResponseNG *packet) {
-    pthread_mutex_lock(&rxBufferMutex);
-    if ((cmd_head + 1) % CMD_BUFFER_SIZE == cmd_tail) {
-        //If these two are equal, we're about to overwrite in the
-        // circular buffer.
-        PrintAndLogEx(FAILED, "WARNING: Command buffer about to overwrite command! This needs to be fixed!");
-        fflush(stdout);
+    comms_ctx_t *ctx = current_ctx();
+
+    uint32_t head = __atomic_load_n(&ctx->cmd_head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ctx->cmd_tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= CMD_BUFFER_SIZE) {
+
+        __atomic_add_fetch(&ctx->rx_stalls, 1, __ATOMIC_RELAXED);
+
+        uint64_t start = msclock();
+        while (head - tail >= CMD_BUFFER_SIZE) {
+
+            if (g_conn.run == false || (msclock() - start) > RX_QUEUE_BACKPRESSURE_MS) {
+                __atomic_add_fetch(&ctx->rx_dropped, 1, __ATOMIC_RELAXED);
+                PrintAndLogEx(FAILED, "WARNING: reply queue full, dropping reply " _YELLOW_("0x%04x"), packet->cmd);
+                return;
+            }
+
+            pthread_mutex_lock(&ctx->txBufferMutex);
+            if (flush_tx_queue(ctx) == PM3_EIO) {
+                ctx->tx_failed = true;
+            }
+            pthread_mutex_unlock(&ctx->txBufferMutex);
+
+            msleep(1);
+            tail = __atomic_load_n(&ctx->cmd_tail, __ATOMIC_ACQUIRE);
+        }
     }
+
     //Store the command at the 'head' location
-    PacketResponseNG *destination = &rxBuffer[cmd_head];
-    memcpy(destination, packet, sizeof(PacketResponseNG));
+    memcpy(&ctx->rxBuffer[head % CMD_BUFFER_SIZE], packet, sizeof(PacketResponseNG));
 
-    //increment head and wrap
-    cmd_head = (cmd_head + 1) % CMD_BUFFER_SIZE;
-    pthread_mutex_unlock(&rxBufferMutex);
+    // publish
+    __atomic_store_n(&ctx->cmd_head, head + 1, __ATOMIC_RELEASE);
+
+    uint32_t used = head + 1 - tail;
+    if (used > __atomic_load_n(&ctx->rx_high_water, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&ctx->rx_high_water, used, __ATOMIC_RELAXED);
+    }
 }
+
 /**
- * @brief getCommand gets a command from an internal circular buffer.
+ * @brief getReply gets a reply from the rx queue.
  * @param response location to write command
  * @return 1 if response was returned, 0 if nothing has been received
  */
 static int getReply(PacketResponseNG *packet) {
-    pthread_mutex_lock(&rxBufferMutex);
+    comms_ctx_t *ctx = current_ctx();
+
+    uint32_t tail = __atomic_load_n(&ctx->cmd_tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ctx->cmd_head, __ATOMIC_ACQUIRE);
+
     //If head == tail, there's nothing to read, or if we just got initialized
-    if (cmd_head == cmd_tail)  {
-        pthread_mutex_unlock(&rxBufferMutex);
+    if (head == tail) {
         return 0;
     }
 
     //Pick out the next unread command
-    memcpy(packet, &rxBuffer[cmd_tail], sizeof(PacketResponseNG));
+    memcpy(packet, &ctx->rxBuffer[tail % CMD_BUFFER_SIZE], sizeof(PacketResponseNG));
 
-    //Increment tail - this is a circular buffer, so modulo buffer size
-    cmd_tail = (cmd_tail + 1) % CMD_BUFFER_SIZE;
-
-    pthread_mutex_unlock(&rxBufferMutex);
+    // release the slot to the producer
+    __atomic_store_n(&ctx->cmd_tail, tail + 1, __ATOMIC_RELEASE);
     return 1;
 }
 
+void GetCommunicationRxStats(comm_rx_stats_t *stats) {
+    comms_ctx_t *ctx = current_ctx();
+    if (stats == NULL) {
+        return;
+    }
+    uint32_t head = __atomic_load_n(&ctx->cmd_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ctx->cmd_tail, __ATOMIC_ACQUIRE);
+    stats->queued = head - tail;
+    stats->size = CMD_BUFFER_SIZE;
+    stats->high_water = __atomic_load_n(&ctx->rx_high_water, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&ctx->rx_dropped, __ATOMIC_RELAXED);
+    stats->stalls = __atomic_load_n(&ctx->rx_stalls, __ATOMIC_RELAXED);
+}
+
+void ResetCommunicationRxStats(void) {
+    comms_ctx_t *ctx = current_ctx();
+    __atomic_store_n(&ctx->rx_high_water, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->rx_dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->rx_stalls, 0, __ATOMIC_RELAXED);
+}
+
+void GetCommunicationLinkStats(comm_link_stats_t *stats) {
+    comms_ctx_t *ctx = current_ctx();
+    if (stats == NULL) {
+        return;
+    }
+    stats->tx_frames = __atomic_load_n(&ctx->link_tx_frames, __ATOMIC_RELAXED);
+    stats->tx_bytes = __atomic_load_n(&ctx->link_tx_bytes, __ATOMIC_RELAXED);
+    stats->rx_frames = __atomic_load_n(&ctx->link_rx_frames, __ATOMIC_RELAXED);
+    stats->rx_bytes = __atomic_load_n(&ctx->link_rx_bytes, __ATOMIC_RELAXED);
+    stats->since = __atomic_load_n(&ctx->link_stats_since, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Copy the per command statistics, in order of first use
+ * @param stats array to copy into
+ * @param maxcount size of the array
+ * @return number of entries copied
+ */
+size_t GetCommunicationCmdStats(comm_cmd_stats_t *stats, size_t maxcount) {
+    comms_ctx_t *ctx = current_ctx();
+    if (stats == NULL) {
+        return 0;
+    }
+    size_t n = MIN(ctx->cmd_stats_count, maxcount);
+    memcpy(stats, ctx->cmd_stats, n * sizeof(comm_cmd_stats_t));
+    return n;
+}
+
+void ResetCommunicationCmdStats(void) {
+    comms_ctx_t *ctx = current_ctx();
+    ctx->cmd_stats_count = 0;
+    ctx->stats_waiting = false;
+    __atomic_store_n(&ctx->link_tx_frames, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->link_tx_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->link_rx_frames, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->link_rx_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->link_stats_since, msclock(), __ATOMIC_RELAXED);
+}
+
+static void arm_download_sink(uint8_t *dest, uint32_t bytes, uint32_t rec_cmd) {
+    comms_ctx_t *ctx = current_ctx();
+    pthread_mutex_lock(&ctx->dl_sinkMutex);
+    ctx->dl_sink.dest = dest;
+    ctx->dl_sink.bytes = bytes;
+    ctx->dl_sink.rec_cmd = rec_cmd;
+    ctx->dl_sink.completed = 0;
+    ctx->dl_sink.overflow = false;
+    __atomic_store_n(&ctx->dl_sink.armed, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->dl_sinkMutex);
+}
+
+// once this returns, the communication thread doesn't touch dest anymore
+static void disarm_download_sink(uint32_t *completed, bool *overflow) {
+    comms_ctx_t *ctx = current_ctx();
+    pthread_mutex_lock(&ctx->dl_sinkMutex);
+    __atomic_store_n(&ctx->dl_sink.armed, false, __ATOMIC_RELEASE);
+    if (completed) {
+        *completed = ctx->dl_sink.completed;
+    }
+    if (overflow) {
+        *overflow = ctx->dl_sink.overflow;
+    }
+    ctx->dl_sink.dest = NULL;
+    pthread_mutex_unlock(&ctx->dl_sinkMutex);
+}
+
+// communication thread side, returns true if the packet was consumed by the sink
+static bool store_download_chunk(const PacketResponseNG *packet) {
+    comms_ctx_t *ctx = current_ctx();
+
+    if (__atomic_load_n(&ctx->dl_sink.armed, __ATOMIC_ACQUIRE) == false) {
+        return false;
+    }
+
+    bool consumed = false;
+    pthread_mutex_lock(&ctx->dl_sinkMutex);
+
+    // LZ4 compressed BigBuf block
+    // arg0 = offset of the block, arg1 = uncompressed length
+    if (ctx->dl_sink.armed && packet->cmd == CMD_DOWNLOADED_BIGBUF_LZ4 && ctx->dl_sink.rec_cmd == CMD_DOWNLOADED_BIGBUF) {
+
+        uint32_t offset = packet->oldarg[0];
+        uint32_t expected = packet->oldarg[1];
+
+        int res = -1;
+        if (offset < ctx->dl_sink.bytes && expected <= ctx->dl_sink.bytes - offset) {
+            res = LZ4_decompress_safe((const char *)packet->data.asBytes, (char *)ctx->dl_sink.dest + offset, packet->length, expected);
+        }
+
+        if (res < 0 || (uint32_t)res != expected) {
+            if (ctx->dl_sink.overflow == false) {
+                PrintAndLogEx(FAILED, "ERROR: Invalid compressed block when downloading from device,  offset %u | len %u | buf_size %u", offset, expected, ctx->dl_sink.bytes);
+            }
+            ctx->dl_sink.overflow = true;
+        } else {
+            ctx->dl_sink.completed += res;
+        }
+
+        pthread_mutex_unlock(&ctx->dl_sinkMutex);
+        return true;
+    }
+
+    if (ctx->dl_sink.armed && packet->cmd == ctx->dl_sink.rec_cmd) {
+
+        // arg0 = offset in transfer. Startindex of this chunk
+        // arg1 = length bytes to transfer
+        uint32_t offset = packet->oldarg[0];
+        uint32_t copy_bytes = MIN(packet->oldarg[1], PM3_CMD_DATA_SIZE);
+
+        if ((uint64_t)offset + copy_bytes > ctx->dl_sink.bytes) {
+            copy_bytes = (offset < ctx->dl_sink.bytes) ? ctx->dl_sink.bytes - offset : 0;
+            if (ctx->dl_sink.overflow == false) {
+                PrintAndLogEx(FAILED, "ERROR: Out of bounds when downloading from device,  offset %u | len %" PRIu64 " | buf_size %u", offset, packet->oldarg[1], ctx->dl_sink.bytes);
+            }
+            ctx->dl_sink.overflow = true;
+        }
+
+        if (copy_bytes) {
+            memcpy(ctx->dl_sink.dest + offset, packet->data.asBytes, copy_bytes);
+            ctx->dl_sink.completed += copy_bytes;
+        }
+        consumed = true;
+    }
+
+    pthread_mutex_unlock(&ctx->dl_sinkMutex);
+    return consumed;
+}
+
 //-----------------------------------------------------------------------------
 // Entry point into our code: called whenever we received a packet over USB
 // that we weren't necessarily expecting, for example a debug print.
 //-----------------------------------------------------------------------------
 static void PacketResponseReceived(PacketResponseNG *packet) {
+    comms_ctx_t *ctx = current_ctx();
+
+    __atomic_add_fetch(&ctx->link_rx_frames, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->link_rx_bytes, reply_wire_len(packet), __ATOMIC_RELAXED);
 
     // we got a packet, reset WaitForResponseTimeout timeout
-    uint64_t prev_clk = __atomic_load_n(&last_packet_time, __ATOMIC_SEQ_CST);
+    uint64_t prev_clk = __atomic_load_n(&ctx->last_packet_time, __ATOMIC_SEQ_CST);
     uint64_t clk = msclock();
-    __atomic_store_n(&timeout_start_time,  clk, __ATOMIC_SEQ_CST);
-    __atomic_store_n(&last_packet_time, clk, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->timeout_start_time,  clk, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->last_packet_time, clk, __ATOMIC_SEQ_CST);
     (void) prev_clk;
 //    PrintAndLogEx(NORMAL, "[%07"PRIu64"] RECV %s magic %08x length %04x status %04x crc %04x cmd %04x",
 //                clk - prev_clk, packet->ng ? "NG" : "OLD", packet->magic, packet->length, packet->status, packet->crc, packet->cmd);
@@ -340,6 +1098,10 @@ static void PacketResponseReceived(PacketResponseNG *packet) {
         // CMD_DOWNLOAD_BIGBUF packages which is not dealt with. I wonder if simply ignoring them will
         // work. lets try it.
         default: {
+            // bulk download chunks go straight into the destination buffer
+            if (store_download_chunk(packet)) {
+                break;
+            }
             storeReply(packet);
             break;
         }
@@ -350,7 +1112,9 @@ static void PacketResponseReceived(PacketResponseNG *packet) {
 // When communication thread is dead,   start up and try to start it again
 void *uart_reconnect(void *targ) {
 
-    const communication_arg_t *connection = (communication_arg_t *)targ;
+    comms_ctx_t *ctx = (comms_ctx_t *)targ;
+    thread_ctx = ctx;
+    const communication_arg_t *connection = &ctx->conn;
 
 #if defined(__MACH__) && defined(__APPLE__)
     disableAppNap("Proxmark3 polling UART");
@@ -364,12 +1128,12 @@ void *uart_reconnect(void *targ) {
     while (1) {
         // throttle
         msleep(200);
-        if (OpenProxmarkSilent(&g_session.current_device, connection->serial_port_name, speed) == false) {
+        if (OpenProxmarkSilent(&ctx->device, connection->serial_port_name, speed) == false) {
             continue;
         }
 
-        if (g_session.pm3_present && (TestProxmark(g_session.current_device) != PM3_SUCCESS)) {
-            CloseProxmark(g_session.current_device);
+        if (ctx->present && (TestProxmark(ctx->device) != PM3_SUCCESS)) {
+            CloseProxmark(ctx->device);
         } else {
             break;
         }
@@ -380,18 +1144,20 @@ void *uart_reconnect(void *targ) {
     enableAppNap();
 #endif
 
-    __atomic_test_and_set(&reconnect_ok, __ATOMIC_SEQ_CST);
+    __atomic_test_and_set(&ctx->reconnect_ok, __ATOMIC_SEQ_CST);
 
     pthread_exit(NULL);
     return NULL;
 }
 
 void StartReconnectProxmark(void) {
-    pthread_create(&reconnect_thread, NULL, &uart_reconnect, &g_conn);
+    comms_ctx_t *ctx = current_ctx();
+    pthread_create(&ctx->reconnect_thread, NULL, &uart_reconnect, ctx);
 }
 
 bool IsReconnectedOk(void) {
-    bool ret = __atomic_load_n(&reconnect_ok, __ATOMIC_SEQ_CST);
+    comms_ctx_t *ctx = current_ctx();
+    bool ret = __atomic_load_n(&ctx->reconnect_ok, __ATOMIC_SEQ_CST);
     return ret;
 }
 
@@ -405,7 +1171,9 @@ __attribute__((force_align_arg_pointer))
 #endif
 #endif
 *uart_communication(void *targ) {
-    const communication_arg_t *connection = (communication_arg_t *)targ;
+    comms_ctx_t *ctx = (comms_ctx_t *)targ;
+    thread_ctx = ctx;
+    const communication_arg_t *connection = &ctx->conn;
     uint32_t rxlen;
     bool commfailed = false;
     PacketResponseNG rx;
@@ -417,6 +1185,10 @@ __attribute__((force_align_arg_pointer))
     disableAppNap("Proxmark3 polling UART");
 #endif
 
+    // link statistics start with the first connection and survive reconnects
+    uint64_t zero = 0;
+    __atomic_compare_exchange_n(&ctx->link_stats_since, &zero, msclock(), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
     // is this connection->run a cross thread call?
     while (connection->run) {
         rxlen = 0;
@@ -430,26 +1202,26 @@ __attribute__((force_align_arg_pointer))
             if (g_conn.last_command != CMD_HARDWARE_RESET) {
                 PrintAndLogEx(WARNING, "\nCommunicating with Proxmark3 device " _RED_("failed"));
             }
-            __atomic_test_and_set(&comm_thread_dead, __ATOMIC_SEQ_CST);
+            __atomic_test_and_set(&ctx->comm_thread_dead, __ATOMIC_SEQ_CST);
             break;
         }
 
-        bool is_receiving_raw = __atomic_load_n(&comm_raw_mode, __ATOMIC_SEQ_CST);
+        bool is_receiving_raw = __atomic_load_n(&ctx->comm_raw_mode, __ATOMIC_SEQ_CST);
 
         if (is_receiving_raw) {
-            uint8_t *bufferData = __atomic_load_n(&comm_raw_data, __ATOMIC_SEQ_CST); // read only
-            size_t bufferLen = __atomic_load_n(&comm_raw_len, __ATOMIC_SEQ_CST); // read only
-            size_t bufferPos = __atomic_load_n(&comm_raw_pos, __ATOMIC_SEQ_CST); // read and write
+            uint8_t *bufferData = __atomic_load_n(&ctx->comm_raw_data, __ATOMIC_SEQ_CST); // read only
+            size_t bufferLen = __atomic_load_n(&ctx->comm_raw_len, __ATOMIC_SEQ_CST); // read only
+            size_t bufferPos = __atomic_load_n(&ctx->comm_raw_pos, __ATOMIC_SEQ_CST); // read and write
             if (bufferPos < bufferLen) {
                 size_t rxMaxLen = bufferLen - bufferPos;
 
                 rxMaxLen = MIN(COMM_RAW_RECEIVE_LEN, rxMaxLen);
 
-                res = uart_receive(sp, bufferData + bufferPos, rxMaxLen, &rxlen);
+                res = uart_receive(ctx->sp, bufferData + bufferPos, rxMaxLen, &rxlen);
                 if (res == PM3_SUCCESS) {
                     uint64_t clk = msclock();
-                    __atomic_store_n(&timeout_start_time,  clk, __ATOMIC_SEQ_CST);
-                    __atomic_store_n(&comm_raw_pos, bufferPos + rxlen, __ATOMIC_SEQ_CST);
+                    __atomic_store_n(&ctx->timeout_start_time,  clk, __ATOMIC_SEQ_CST);
+                    __atomic_store_n(&ctx->comm_raw_pos, bufferPos + rxlen, __ATOMIC_SEQ_CST);
                 } else if (res != PM3_ENODATA) {
                     PrintAndLogEx(WARNING, "Error when reading raw data: %zu/%zu, %d", bufferPos, bufferLen, res);
                     error = true;
@@ -461,7 +1233,7 @@ __attribute__((force_align_arg_pointer))
                 // Ignore data when bufferPos >= bufferLen and is_receiving_raw has not been set to false
                 uint8_t dummyData[64];
                 uint32_t dummyLen;
-                uart_receive(sp, dummyData, sizeof(dummyData), &dummyLen);
+                uart_receive(ctx->sp, dummyData, sizeof(dummyData), &dummyLen);
             }
         } else {
             if (is_receiving_raw_last) {
@@ -469,9 +1241,9 @@ __attribute__((force_align_arg_pointer))
 
                 // Set the buffer as undefined
                 // comm_raw_data == NULL is used in SetCommunicationReceiveMode()
-                __atomic_store_n(&comm_raw_data, NULL, __ATOMIC_SEQ_CST);
+                __atomic_store_n(&ctx->comm_raw_data, NULL, __ATOMIC_SEQ_CST);
             }
-            res = uart_receive(sp, (uint8_t *)&rx_raw.pre, sizeof(PacketResponseNGPreamble), &rxlen);
+            res = uart_receive(ctx->sp, (uint8_t *)&rx_raw.pre, sizeof(PacketResponseNGPreamble), &rxlen);
 
             if ((res == PM3_SUCCESS) && (rxlen == sizeof(PacketResponseNGPreamble))) {
 
@@ -490,7 +1262,7 @@ __attribute__((force_align_arg_pointer))
 
                     if ((!error) && (length > 0)) { // Get the variable length payload
 
-                        res = uart_receive(sp, (uint8_t *)&rx_raw.data, length, &rxlen);
+                        res = uart_receive(ctx->sp, (uint8_t *)&rx_raw.data, length, &rxlen);
 
                         if ((res != PM3_SUCCESS) || (rxlen != length)) {
 
@@ -541,7 +1313,7 @@ __attribute__((force_align_arg_pointer))
                     }
 
                     if (!error) {                        // Get the postamble
-                        res = uart_receive(sp, (uint8_t *)&rx_raw.foopost, sizeof(PacketResponseNGPostamble), &rxlen);
+                        res = uart_receive(ctx->sp, (uint8_t *)&rx_raw.foopost, sizeof(PacketResponseNGPostamble), &rxlen);
                         if ((res != PM3_SUCCESS) || (rxlen != sizeof(PacketResponseNGPostamble))) {
                             PrintAndLogEx(WARNING, "Received packet frame without postamble");
                             error = true;
@@ -577,7 +1349,7 @@ __attribute__((force_align_arg_pointer))
                     PacketResponseOLD rx_old;
                     memcpy(&rx_old, &rx_raw.pre, sizeof(PacketResponseNGPreamble));
 
-                    res = uart_receive(sp, ((uint8_t *)&rx_old) + sizeof(PacketResponseNGPreamble), sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble), &rxlen);
+                    res = uart_receive(ctx->sp, ((uint8_t *)&rx_old) + sizeof(PacketResponseNGPreamble), sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble), &rxlen);
                     if ((res != PM3_SUCCESS) || (rxlen != sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble))) {
                         PrintAndLogEx(WARNING, "Received packet OLD frame with payload too short? %d/%zu", rxlen, sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble));
                         error = true;
@@ -621,7 +1393,7 @@ __attribute__((force_align_arg_pointer))
         is_receiving_raw_last = is_receiving_raw;
         // TODO if error, shall we resync ?
 
-        pthread_mutex_lock(&txBufferMutex);
+        pthread_mutex_lock(&ctx->txBufferMutex);
 
         if (connection->block_after_ACK) {
             // if we just received an ACK, wait here until a new command is to be transmitted
@@ -630,43 +1402,25 @@ __attribute__((force_align_arg_pointer))
 #ifdef COMMS_DEBUG
                 PrintAndLogEx(NORMAL, "Received ACK, fast TX mode: ignoring other RX till TX");
 #endif
-                while (!txBuffer_pending) {
-                    pthread_cond_wait(&txBufferSig, &txBufferMutex);
+                while (ctx->tx_head == ctx->tx_tail) {
+                    pthread_cond_wait(&ctx->txBufferSig, &ctx->txBufferMutex);
                 }
             }
         }
 
-        if (txBuffer_pending) {
-
-            if (txBufferNGLen) { // NG packet
-                res = uart_send(sp, (uint8_t *) &txBufferNG, txBufferNGLen);
-                if (res == PM3_EIO) {
-                    commfailed = true;
-                }
-                g_conn.last_command = txBufferNG.pre.cmd;
-                txBufferNGLen = 0;
-            } else {
-                res = uart_send(sp, (uint8_t *) &txBuffer, sizeof(PacketCommandOLD));
-                if (res == PM3_EIO) {
-                    commfailed = true;
-                }
-                g_conn.last_command = txBuffer.cmd;
-            }
-
-            txBuffer_pending = false;
-
-            // main thread doesn't know send failed...
-
-            // tell main thread that txBuffer is empty
-            pthread_cond_signal(&txBufferSig);
+        if (flush_tx_queue(ctx) == PM3_EIO || ctx->tx_failed) {
+            ctx->tx_failed = false;
+            commfailed = true;
         }
 
-        pthread_mutex_unlock(&txBufferMutex);
+        pthread_mutex_unlock(&ctx->txBufferMutex);
     }
 
     // when thread dies, we close the serial port.
-    uart_close(sp);
-    sp = NULL;
+    pthread_mutex_lock(&ctx->txBufferMutex);
+    uart_close(ctx->sp);
+    ctx->sp = NULL;
+    pthread_mutex_unlock(&ctx->txBufferMutex);
 
 #if defined(__MACH__) && defined(__APPLE__)
     enableAppNap();
@@ -677,7 +1431,8 @@ __attribute__((force_align_arg_pointer))
 }
 
 bool IsCommunicationThreadDead(void) {
-    bool ret = __atomic_load_n(&comm_thread_dead, __ATOMIC_SEQ_CST);
+    comms_ctx_t *ctx = current_ctx();
+    bool ret = __atomic_load_n(&ctx->comm_thread_dead, __ATOMIC_SEQ_CST);
     return ret;
 }
 
@@ -701,37 +1456,41 @@ bool IsCommunicationThreadDead(void) {
 // SetCommunicationRawReceiveBuffer() and GetCommunicationRawReceiveNum()
 
 bool SetCommunicationReceiveMode(bool isRawMode) {
+    comms_ctx_t *ctx = current_ctx();
     if (isRawMode) {
-        const uint8_t *buffer = __atomic_load_n(&comm_raw_data, __ATOMIC_SEQ_CST);
+        const uint8_t *buffer = __atomic_load_n(&ctx->comm_raw_data, __ATOMIC_SEQ_CST);
         if (buffer == NULL) {
             PrintAndLogEx(ERR, "Buffer for raw data is not set");
             return false;
         }
     }
-    __atomic_store_n(&comm_raw_mode, isRawMode, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->comm_raw_mode, isRawMode, __ATOMIC_SEQ_CST);
     return true;
 }
 
 void SetCommunicationRawReceiveBuffer(uint8_t *buffer, size_t len) {
-    __atomic_store_n(&comm_raw_data,  buffer, __ATOMIC_SEQ_CST);
-    __atomic_store_n(&comm_raw_len,  len, __ATOMIC_SEQ_CST);
-    __atomic_store_n(&comm_raw_pos,  0, __ATOMIC_SEQ_CST);
+    comms_ctx_t *ctx = current_ctx();
+    __atomic_store_n(&ctx->comm_raw_data,  buffer, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->comm_raw_len,  len, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->comm_raw_pos,  0, __ATOMIC_SEQ_CST);
 }
 
 size_t GetCommunicationRawReceiveNum(void) {
-    return __atomic_load_n(&comm_raw_pos, __ATOMIC_SEQ_CST);
+    comms_ctx_t *ctx = current_ctx();
+    return __atomic_load_n(&ctx->comm_raw_pos, __ATOMIC_SEQ_CST);
 }
 
 bool OpenProxmarkSilent(pm3_device_t **dev, const char *port, uint32_t speed) {
+    comms_ctx_t *ctx = current_ctx();
 
-    sp = uart_open(port, speed, true);
+    ctx->sp = uart_open(port, speed, true);
 
     // check result of uart opening
-    if (sp == INVALID_SERIAL_PORT) {
-        sp = NULL;
+    if (ctx->sp == INVALID_SERIAL_PORT) {
+        ctx->sp = NULL;
         return false;
-    } else if (sp == CLAIMED_SERIAL_PORT) {
-        sp = NULL;
+    } else if (ctx->sp == CLAIMED_SERIAL_PORT) {
+        ctx->sp = NULL;
         return false;
     } else {
         // start the communication thread
@@ -748,50 +1507,54 @@ bool OpenProxmarkSilent(pm3_device_t **dev, const char *port, uint32_t speed) {
         // "Session" flag, to tell via which interface next msgs should be sent: USB or FPC USART
         g_conn.send_via_fpc_usart = false;
 
-        pthread_create(&communication_thread, NULL, &uart_communication, &g_conn);
-        __atomic_clear(&comm_thread_dead, __ATOMIC_SEQ_CST);
-        __atomic_clear(&reconnect_ok, __ATOMIC_SEQ_CST);
+        pthread_create(&ctx->communication_thread, NULL, &uart_communication, ctx);
+        __atomic_clear(&ctx->comm_thread_dead, __ATOMIC_SEQ_CST);
+        __atomic_clear(&ctx->reconnect_ok, __ATOMIC_SEQ_CST);
 
-        g_session.pm3_present = true; // TODO support for multiple devices
+        ctx->present = true;
+        g_session.pm3_present = true;
 
         fflush(stdout);
         if (*dev == NULL) {
             *dev = calloc(sizeof(pm3_device_t), sizeof(uint8_t));
         }
-        (*dev)->g_conn = &g_conn; // TODO g_conn shouldn't be global
+        (*dev)->conn = &ctx->conn;
+        (*dev)->ctx = ctx;
+        ctx->device = *dev;
         return true;
     }
 }
 
 bool OpenProxmark(pm3_device_t **dev, const char *port, bool wait_for_port, int timeout, bool flash_mode, uint32_t speed) {
+    comms_ctx_t *ctx = current_ctx();
 
     if (wait_for_port == false) {
         PrintAndLogEx(SUCCESS, "Using UART port " _GREEN_("%s"), port);
-        sp = uart_open(port, speed, false);
+        ctx->sp = uart_open(port, speed, false);
     } else {
         PrintAndLogEx(SUCCESS, "Waiting for Proxmark3 to appear on " _YELLOW_("%s"), port);
         fflush(stdout);
         int openCount = 0;
         PrintAndLogEx(INPLACE, "% 3i", timeout);
         do {
-            sp = uart_open(port, speed, false);
+            ctx->sp = uart_open(port, speed, false);
             msleep(500);
             PrintAndLogEx(INPLACE, "% 3i", timeout - openCount - 1);
 
-        } while (++openCount < timeout && (sp == INVALID_SERIAL_PORT || sp == CLAIMED_SERIAL_PORT));
+        } while (++openCount < timeout && (ctx->sp == INVALID_SERIAL_PORT || ctx->sp == CLAIMED_SERIAL_PORT));
     }
 
     // check result of uart opening
-    if (sp == INVALID_SERIAL_PORT) {
+    if (ctx->sp == INVALID_SERIAL_PORT) {
         PrintAndLogEx(WARNING, "\n" _RED_("ERROR:") " invalid serial port " _YELLOW_("%s"), port);
         PrintAndLogEx(HINT, "Try the shell script " _YELLOW_("`./pm3 --list`") " to get a list of possible serial ports");
-        sp = NULL;
+        ctx->sp = NULL;
         return false;
-    } else if (sp == CLAIMED_SERIAL_PORT) {
+    } else if (ctx->sp == CLAIMED_SERIAL_PORT) {
         PrintAndLogEx(WARNING, "\n" _RED_("ERROR:") " serial port " _YELLOW_("%s") " is claimed by another process", port);
         PrintAndLogEx(HINT, "Try the shell script " _YELLOW_("`./pm3 --list`") " to get a list of possible serial ports");
 
-        sp = NULL;
+        ctx->sp = NULL;
         return false;
     } else {
         // start the communication thread
@@ -808,21 +1571,25 @@ bool OpenProxmark(pm3_device_t **dev, const char *port, bool wait_for_port, int
         // "Session" flag, to tell via which interface next msgs should be sent: USB or FPC USART
         g_conn.send_via_fpc_usart = false;
 
-        pthread_create(&communication_thread, NULL, &uart_communication, &g_conn);
-        __atomic_clear(&comm_thread_dead, __ATOMIC_SEQ_CST);
-        g_session.pm3_present = true; // TODO support for multiple devices
+        pthread_create(&ctx->communication_thread, NULL, &uart_communication, ctx);
+        __atomic_clear(&ctx->comm_thread_dead, __ATOMIC_SEQ_CST);
+        ctx->present = true;
+        g_session.pm3_present = true;
 
         fflush(stdout);
         if (*dev == NULL) {
             *dev = calloc(sizeof(pm3_device_t), sizeof(uint8_t));
         }
-        (*dev)->g_conn = &g_conn; // TODO g_conn shouldn't be global
+        (*dev)->conn = &ctx->conn;
+        (*dev)->ctx = ctx;
+        ctx->device = *dev;
         return true;
     }
 }
 
 // check if we can communicate with Pm3
 int TestProxmark(pm3_device_t *dev) {
+    comms_ctx_t *ctx = current_ctx();
 
     uint16_t len = 32;
     uint8_t data[len];
@@ -830,7 +1597,7 @@ int TestProxmark(pm3_device_t *dev) {
         data[i] = i & 0xFF;
     }
 
-    __atomic_store_n(&last_packet_time,  msclock(), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->last_packet_time,  msclock(), __ATOMIC_SEQ_CST);
     clearCommandBuffer();
     SendCommandNG(CMD_PING, data, len);
 
@@ -900,31 +1667,37 @@ int TestProxmark(pm3_device_t *dev) {
 }
 
 void CloseProxmark(pm3_device_t *dev) {
-    dev->g_conn->run = false;
+    comms_ctx_t *ctx = (dev->ctx) ? dev->ctx : current_ctx();
+    dev->conn->run = false;
 
 #ifdef __BIONIC__
-    if (communication_thread != 0) {
-        pthread_join(communication_thread, NULL);
+    if (ctx->communication_thread != 0) {
+        pthread_join(ctx->communication_thread, NULL);
     }
 #else
-    pthread_join(communication_thread, NULL);
+    pthread_join(ctx->communication_thread, NULL);
 #endif
 
-    if (sp) {
-        uart_close(sp);
+    pthread_mutex_lock(&ctx->txBufferMutex);
+    if (ctx->sp) {
+        uart_close(ctx->sp);
     }
 
     // Clean up our state
-    sp = NULL;
+    ctx->sp = NULL;
+    pthread_mutex_unlock(&ctx->txBufferMutex);
 #ifdef __BIONIC__
-    if (communication_thread != 0) {
-        memset(&communication_thread, 0, sizeof(pthread_t));
+    if (ctx->communication_thread != 0) {
+        memset(&ctx->communication_thread, 0, sizeof(pthread_t));
     }
 #else
-    memset(&communication_thread, 0, sizeof(pthread_t));
+    memset(&ctx->communication_thread, 0, sizeof(pthread_t));
 #endif
 
-    g_session.pm3_present = false;
+    ctx->present = false;
+    if (ctx == &default_ctx) {
+        g_session.pm3_present = false;
+    }
 }
 
 // Gives a rough estimate of the communication delay based on channel & baudrate
@@ -955,6 +1728,7 @@ static size_t communication_delay(void) {
  * @return the number of received bytes
  */
 size_t WaitForRawDataTimeout(uint8_t *buffer, size_t len, size_t ms_timeout, bool show_process) {
+    comms_ctx_t *ctx = current_ctx();
     uint8_t print_counter = 0;
     size_t last_pos = 0;
 
@@ -962,7 +1736,7 @@ size_t WaitForRawDataTimeout(uint8_t *buffer, size_t len, size_t ms_timeout, boo
     if (ms_timeout != (size_t) - 1) {
         ms_timeout += communication_delay();
     }
-    __atomic_store_n(&timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
 
     SetCommunicationRawReceiveBuffer(buffer, len);
     SetCommunicationReceiveMode(true);
@@ -982,11 +1756,11 @@ size_t WaitForRawDataTimeout(uint8_t *buffer, size_t len, size_t ms_timeout, boo
             }
         }
 
-        pos = __atomic_load_n(&comm_raw_pos, __ATOMIC_SEQ_CST);
+        pos = __atomic_load_n(&ctx->comm_raw_pos, __ATOMIC_SEQ_CST);
 
         // Check the timeout if pos is not updated
         if (last_pos == pos) {
-            uint64_t tmp_clk = __atomic_load_n(&timeout_start_time, __ATOMIC_SEQ_CST);
+            uint64_t tmp_clk = __atomic_load_n(&ctx->timeout_start_time, __ATOMIC_SEQ_CST);
             // If ms_timeout == -1, the loop can only be breaked by pressing Enter or receiving enough data
             if ((ms_timeout != (size_t) - 1) && (msclock() - tmp_clk > ms_timeout)) {
                 break;
@@ -1012,7 +1786,7 @@ size_t WaitForRawDataTimeout(uint8_t *buffer, size_t len, size_t ms_timeout, boo
         msleep(ms_timeout);
     }
     SetCommunicationReceiveMode(false);
-    pos = __atomic_load_n(&comm_raw_pos, __ATOMIC_SEQ_CST);
+    pos = __atomic_load_n(&ctx->comm_raw_pos, __ATOMIC_SEQ_CST);
     return pos;
 }
 
@@ -1027,6 +1801,7 @@ size_t WaitForRawDataTimeout(uint8_t *buffer, size_t len, size_t ms_timeout, boo
  * @return true if command was returned, otherwise false
  */
 bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout, bool show_warning) {
+    comms_ctx_t *ctx = current_ctx();
 
     PacketResponseNG resp;
     // init to ZERO
@@ -1049,7 +1824,7 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
     if (ms_timeout != (size_t) - 1)
         ms_timeout += communication_delay();
 
-    __atomic_store_n(&timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ctx->timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
 
     // Wait until the command is received
     while (true) {
@@ -1060,11 +1835,19 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
         }
 
         while (getReply(response)) {
+
+            // replies belonging to pipelined requests are not for us
+            if (route_async_reply(response)) {
+                continue;
+            }
+
             if (cmd == CMD_UNKNOWN || response->cmd == cmd) {
+                stats_reply(response);
                 return true;
             }
 
             if (response->cmd == CMD_WTX && response->length == sizeof(uint16_t)) {
+                stats_wtx();
                 uint16_t wtx = response->data.asDwords[0] & 0xFFFF;
                 PrintAndLogEx(DEBUG, "Got Waiting Time eXtension request %i ms", wtx);
                 if (ms_timeout != (size_t) - 1) {
@@ -1073,8 +1856,9 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
             }
         }
 
-        uint64_t tmp_clk = __atomic_load_n(&timeout_start_time, __ATOMIC_SEQ_CST);
+        uint64_t tmp_clk = __atomic_load_n(&ctx->timeout_start_time, __ATOMIC_SEQ_CST);
         if ((ms_timeout != (size_t) - 1) && (msclock() - tmp_clk > ms_timeout)) {
+            stats_timeout();
             break;
         }
 
@@ -1097,6 +1881,11 @@ bool WaitForResponse(uint32_t cmd, PacketResponseNG *response) {
     return WaitForResponseTimeoutW(cmd, response, -1, true);
 }
 
+// BigBuf downloads are LZ4 compressed on the device when the link is slower than USB-CDC
+static bool use_compressed_download(void) {
+    return g_conn.send_via_fpc_usart || (g_conn.send_via_ip != PM3_NONE) || (memcmp(g_conn.serial_port_name, "bt:", 3) == 0);
+}
+
 /**
 * Data transfer from Proxmark to client. This method times out after
 * ms_timeout milliseconds.
@@ -1141,18 +1930,24 @@ bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint3
 
     switch (memtype) {
         case BIG_BUF: {
-            SendCommandMIX(CMD_DOWNLOAD_BIGBUF, start_index, bytes, 0, NULL, 0);
+            // on slow links, ask for LZ4 compressed blocks.  Older firmwares ignore the flag and send plain chunks
+            uint32_t flags = use_compressed_download() ? DOWNLOAD_BIGBUF_FLAG_LZ4 : 0;
+            arm_download_sink(dest, bytes, CMD_DOWNLOADED_BIGBUF);
+            SendCommandMIX(CMD_DOWNLOAD_BIGBUF, start_index, bytes, flags, NULL, 0);
             return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_BIGBUF);
         }
         case BIG_BUF_EML: {
+            arm_download_sink(dest, bytes, CMD_DOWNLOADED_EML_BIGBUF);
             SendCommandMIX(CMD_DOWNLOAD_EML_BIGBUF, start_index, bytes, 0, NULL, 0);
             return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_EML_BIGBUF);
         }
         case SPIFFS: {
+            arm_download_sink(dest, bytes, CMD_SPIFFS_DOWNLOADED);
             SendCommandMIX(CMD_SPIFFS_DOWNLOAD, start_index, bytes, 0, data, datalen);
             return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_SPIFFS_DOWNLOADED);
         }
         case FLASH_MEM: {
+            arm_download_sink(dest, bytes, CMD_FLASHMEM_DOWNLOADED);
             SendCommandMIX(CMD_FLASHMEM_DOWNLOAD, start_index, bytes, 0, NULL, 0);
             return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_FLASHMEM_DOWNLOADED);
         }
@@ -1162,12 +1957,14 @@ bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint3
             return false;
         }
         case FPGA_MEM: {
+            arm_download_sink(dest, bytes, CMD_FPGAMEM_DOWNLOADED);
             SendCommandNG(CMD_FPGAMEM_DOWNLOAD, NULL, 0);
             return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_FPGAMEM_DOWNLOADED);
         }
         case MCU_FLASH:
         case MCU_MEM: {
             uint32_t flags = (memtype == MCU_MEM) ? READ_MEM_DOWNLOAD_FLAG_RAW : 0;
+            arm_download_sink(dest, bytes, CMD_READ_MEM_DOWNLOADED);
             SendCommandBL(CMD_READ_MEM_DOWNLOAD, start_index, bytes, flags, NULL, 0);
             return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_READ_MEM_DOWNLOADED);
         }
@@ -1175,10 +1972,16 @@ bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint3
     return false;
 }
 
+// The download chunks themselves are written into dest by the communication thread (see store_download_chunk),
+// here we only wait for the final ACK.
 static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd) {
+    comms_ctx_t *ctx = current_ctx();
 
-    uint32_t bytes_completed = 0;
-    __atomic_store_n(&timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
+    (void) dest;
+
+    bool ret = false;
+    uint64_t start_time = msclock();
+    __atomic_store_n(&ctx->timeout_start_time, start_time, __ATOMIC_SEQ_CST);
 
     // Add delay depending on the communication channel & speed
     if (ms_timeout != (size_t) - 1)
@@ -1188,47 +1991,36 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, siz
 
         if (getReply(response)) {
 
-            if (response->cmd == CMD_ACK)
-                return true;
+            if (response->cmd == CMD_ACK) {
+                ret = true;
+                break;
+            }
             if (response->cmd == CMD_SPIFFS_DOWNLOAD && response->status == PM3_EMALLOC)
-                return false;
+                break;
             // Spiffs // fpgamem-plot download is converted to NG,
-            if (response->cmd == CMD_SPIFFS_DOWNLOAD || response->cmd == CMD_FPGAMEM_DOWNLOAD)
-                return true;
-
-            // sample_buf is a array pointer, located in data.c
-            // arg0 = offset in transfer. Startindex of this chunk
-            // arg1 = length bytes to transfer
-            // arg2 = bigbuff tracelength (?)
-            if (response->cmd == rec_cmd) {
-
-                uint32_t offset = response->oldarg[0];
-                uint32_t copy_bytes = MIN(bytes - bytes_completed, response->oldarg[1]);
-                //uint32_t tracelen = response->oldarg[2];
-
-                // extended bounds check1.  upper limit is PM3_CMD_DATA_SIZE
-                // shouldn't happen
-                copy_bytes = MIN(copy_bytes, PM3_CMD_DATA_SIZE);
-
-                // extended bounds check2.
-                if (offset + copy_bytes > bytes) {
-                    PrintAndLogEx(FAILED, "ERROR: Out of bounds when downloading from device,  offset %u | len %u | total len %u > buf_size %u", offset, copy_bytes,  offset + copy_bytes,  bytes);
-                    break;
-                }
+            if (response->cmd == CMD_SPIFFS_DOWNLOAD || response->cmd == CMD_FPGAMEM_DOWNLOAD) {
+                ret = true;
+                break;
+            }
 
-                memcpy(dest + offset, response->data.asBytes, copy_bytes);
-                bytes_completed += copy_bytes;
-            } else if (response->cmd == CMD_WTX && response->length == sizeof(uint16_t)) {
+            if (response->cmd == CMD_WTX && response->length == sizeof(uint16_t)) {
+                stats_wtx();
                 uint16_t wtx = response->data.asDwords[0] & 0xFFFF;
                 PrintAndLogEx(DEBUG, "Got Waiting Time eXtension request %i ms", wtx);
                 if (ms_timeout != (size_t) - 1)
                     ms_timeout += wtx;
             }
+            continue;
         }
 
-        uint64_t tmp_clk = __atomic_load_n(&timeout_start_time, __ATOMIC_SEQ_CST);
+        if (IsCommunicationThreadDead()) {
+            break;
+        }
+
+        uint64_t tmp_clk = __atomic_load_n(&ctx->timeout_start_time, __ATOMIC_SEQ_CST);
         if (msclock() - tmp_clk > ms_timeout) {
             PrintAndLogEx(FAILED, "Timed out while trying to download data from device");
+            stats_timeout();
             break;
         }
 
@@ -1238,6 +2030,40 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, siz
             PrintAndLogEx(INFO, "You can cancel this operation by pressing the pm3 button");
             show_warning = false;
         }
+
+        // just to avoid CPU busy loop:
+        msleep(1);
     }
-    return false;
+
+    uint32_t bytes_completed = 0;
+    bool overflow = false;
+    disarm_download_sink(&bytes_completed, &overflow);
+
+    if (overflow) {
+        ret = false;
+    }
+
+    // BigBuf: arg0 of the ACK is the status of the transfer, a compressed one may stop partway
+    if (ret && rec_cmd == CMD_DOWNLOADED_BIGBUF && (response->oldarg[0] == 0 || bytes_completed != bytes)) {
+        PrintAndLogEx(FAILED, "ERROR: Incomplete download from device, got %u of %u bytes", bytes_completed, bytes);
+        ret = false;
+    }
+
+    if (ret) {
+        stats_reply(response);
+    }
+    // the chunks bypassed the reply queue, account their payload
+    comm_cmd_stats_t *e = (ctx->stats_last_cmd != CMD_UNKNOWN) ? get_cmd_stats(ctx->stats_last_cmd) : NULL;
+    if (e) {
+        e->bytes_in += bytes_completed;
+    }
+
+    uint64_t delta = msclock() - start_time;
+    PrintAndLogEx(INFO, "Downloaded %u / %u bytes in %" PRIu64 " ms ( %.3f MB/s )"
+                  , bytes_completed
+                  , bytes
+                  , delta
+                  , (delta) ? ((double)bytes_completed / 1000.0) / (double)delta : 0.0
+                 );
+    return ret;
 }
@@ -41,12 +41,34 @@ extern "C" {
 #endif
 
 //For storing command that are received from the device
+// must be a power of two, the rx queue indices are free running uint32_t
 #ifndef CMD_BUFFER_SIZE
-#define CMD_BUFFER_SIZE 100
+#define CMD_BUFFER_SIZE 256
+#endif
+
+// how long the communication thread waits for the consumer when the rx queue is full, before dropping
+#ifndef RX_QUEUE_BACKPRESSURE_MS
+#define RX_QUEUE_BACKPRESSURE_MS 2000
 #endif
 
 #define COMM_RAW_RECEIVE_LEN (1024)
 
+// max number of pipelined requests, see SendCommandNGAsync()
+#ifndef PM3_ASYNC_MAX_INFLIGHT
+#define PM3_ASYNC_MAX_INFLIGHT 16
+#endif
+
+// number of commands which can be queued for the communication thread
+#define TX_QUEUE_SIZE PM3_ASYNC_MAX_INFLIGHT
+
+// number of distinct commands tracked by the per command statistics, see GetCommunicationCmdStats()
+#ifndef CMD_STATS_SIZE
+#define CMD_STATS_SIZE 256
+#endif
+
+// latency histogram buckets: [0] < 1 ms,  [i] < 2^i ms,  [last] >= 2^(CMD_STATS_HIST_BUCKETS - 2) ms
+#define CMD_STATS_HIST_BUCKETS 12
+
 typedef enum {
     BIG_BUF,
     BIG_BUF_EML,
@@ -84,14 +106,60 @@ typedef struct {
     char serial_port_name[FILE_PATH_SIZE];
 } communication_arg_t;
 
-extern communication_arg_t g_conn;
+// Per device communication state, see NewCommunicationContext().
+// g_conn and g_pm3_capabilities resolve to the device selected by the calling thread.
+typedef struct comms_ctx comms_ctx_t;
+
+communication_arg_t *GetCommunicationArg(void);
+capabilities_t *GetDeviceCapabilities(void);
+#define g_conn (*GetCommunicationArg())
+#define g_pm3_capabilities (*GetDeviceCapabilities())
+
+typedef struct {
+    uint32_t queued;      // replies currently waiting in the rx queue
+    uint32_t size;        // rx queue capacity
+    uint32_t high_water;  // max number of replies queued at once
+    uint32_t dropped;     // replies dropped because the queue stayed full
+    uint32_t stalls;      // times the communication thread had to wait for the consumer
+} comm_rx_stats_t;
+
+typedef struct {
+    uint32_t tx_frames;   // frames written to the link
+    uint64_t tx_bytes;
+    uint32_t rx_frames;   // valid frames read from the link
+    uint64_t rx_bytes;
+    uint64_t since;       // msclock() of the last reset
+} comm_link_stats_t;
+
+// bytes are counted as frames on the wire, bulk download chunks as payload
+typedef struct {
+    uint16_t cmd;
+    uint32_t sent;
+    uint32_t replies;
+    uint32_t timeouts;    // waits which expired while this command was the last one sent
+    uint32_t wtx;         // waiting time extensions requested by the device
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint32_t lat_min;     // send to first reply, in ms
+    uint32_t lat_max;
+    uint64_t lat_total;
+    uint32_t hist[CMD_STATS_HIST_BUCKETS];
+} comm_cmd_stats_t;
 
 typedef struct pm3_device {
-    communication_arg_t *g_conn;
+    communication_arg_t *conn;
+    comms_ctx_t *ctx;
     int script_embedded;
 } pm3_device_t;
 
 
+comms_ctx_t *NewCommunicationContext(void);
+void FreeCommunicationContext(comms_ctx_t *ctx);
+comms_ctx_t *SetCommunicationContext(comms_ctx_t *ctx);
+comms_ctx_t *GetCommunicationContext(void);
+bool IsCommunicationContextPresent(void);
+pm3_device_t *GetCommunicationDevice(void);
+
 void *uart_reconnect(void *targ);
 
 void *uart_receiver(void *targ);
@@ -101,6 +169,17 @@ void SendCommandNG(uint16_t cmd, uint8_t *data, size_t len);
 void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, const void *data, size_t len);
 void clearCommandBuffer(void);
 
+int SendCommandNGAsync(uint16_t cmd, uint8_t *data, size_t len, uint16_t reply_cmd, uint32_t *tag);
+bool WaitForAsyncResponse(uint32_t tag, PacketResponseNG *response, size_t ms_timeout);
+void CancelAsyncRequest(uint32_t tag);
+void ClearAsyncRequests(void);
+size_t GetAsyncRequestsInFlight(void);
+void GetCommunicationRxStats(comm_rx_stats_t *stats);
+void ResetCommunicationRxStats(void);
+void GetCommunicationLinkStats(comm_link_stats_t *stats);
+size_t GetCommunicationCmdStats(comm_cmd_stats_t *stats, size_t maxcount);
+void ResetCommunicationCmdStats(void);
+
 #define FLASHMODE_SPEED 460800
 
 bool IsReconnectedOk(void);
@@ -18,7 +18,12 @@
 //-----------------------------------------------------------------------------
 #include "mfkey.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
 #include "crapto1/crapto1.h"
+#include "util.h"       // num_CPUs
 
 // MIFARE
 int inline compare_uint64(const void *a, const void *b) {
@@ -49,17 +54,123 @@ uint32_t intersection(uint64_t *listA, uint64_t *listB) {
     return p3 - listA;
 }
 
+// intersection() of two unsorted lists, through a hash set of listB. The order of
+// listA is kept. Lists are terminated by -1. Result will be in list1. Number of elements is returned.
+uint32_t intersection_unsorted(uint64_t *listA, const uint64_t *listB) {
+    if (listA == NULL || listB == NULL)
+        return 0;
+
+    uint32_t countB = 0;
+    while (listB[countB] != UINT64_C(-1)) {
+        countB++;
+    }
+
+    // open addressing, at most half full, -1 marks a free slot
+    uint32_t bits = 4;
+    while ((1U << bits) < countB * 2) {
+        bits++;
+    }
+    uint32_t mask = (1U << bits) - 1;
+    uint64_t *set = malloc((mask + 1) * sizeof(uint64_t));
+    if (set == NULL)
+        return 0;
+    memset(set, 0xFF, (mask + 1) * sizeof(uint64_t));
+
+    for (uint32_t i = 0; i < countB; i++) {
+        uint32_t h = (listB[i] * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits);
+        while (set[h] != UINT64_C(-1) && set[h] != listB[i]) {
+            h = (h + 1) & mask;
+        }
+        set[h] = listB[i];
+    }
+
+    uint64_t *p3 = listA;
+    for (uint64_t *p1 = listA; *p1 != UINT64_C(-1); p1++) {
+        uint32_t h = (*p1 * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits);
+        while (set[h] != UINT64_C(-1) && set[h] != *p1) {
+            h = (h + 1) & mask;
+        }
+        if (set[h] == *p1) {
+            *p3++ = *p1;
+        }
+    }
+    *p3 = UINT64_C(-1);
+    free(set);
+    return p3 - listA;
+}
+
+typedef struct {
+    uint32_t uid_nt;
+    uint32_t nr;
+    uint32_t ar;
+    uint32_t no_par;
+    uint8_t par[8][8];
+    const uint32_t *odd;        // slice of the odd list of this thread
+    uint32_t odd_len;
+    const uint32_t *even;
+    uint32_t even_len;
+    uint64_t *keys;
+    uint32_t keys_len;
+    bool error;
+} nonce2key_job_t;
+
+static void
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer))
+#endif
+#endif
+*nonce2key_worker(void *arg) {
+    nonce2key_job_t *job = arg;
+    uint32_t keys_size = 0;
+
+    struct Crypto1State *sl = calloc(job->even_len * 64 + 1, sizeof(struct Crypto1State));
+    if (sl == NULL) {
+        job->error = true;
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < job->odd_len; i++) {
+        struct Crypto1State *end = lfsr_common_prefix_odd(job->nr, job->ar, job->par, job->no_par, job->odd[i], job->even, sl);
+        uint32_t n = end - sl;
+        if (n == 0) {
+            continue;
+        }
+
+        if (job->keys_len + n > keys_size) {
+            uint32_t size = keys_size ? keys_size : 1024;
+            while (size < job->keys_len + n) {
+                size *= 2;
+            }
+            uint64_t *keys = realloc(job->keys, size * sizeof(uint64_t));
+            if (keys == NULL) {
+                job->error = true;
+                break;
+            }
+            job->keys = keys;
+            keys_size = size;
+        }
+
+        for (struct Crypto1State *t = sl; t < end; t++) {
+            lfsr_rollback_word(t, job->uid_nt, 0);
+            crypto1_get_lfsr(t, job->keys + job->keys_len++);
+        }
+    }
+    free(sl);
+    return NULL;
+}
+
 // Darkside attack (hf mf mifare)
 // if successful it will return a list of keys, not just one.
+// The odd x even x 64 states of lfsr_common_prefix() are checked on num_CPUs()
+// threads, each a contiguous slice of the odd list, so the keys come in the same
+// order as from the single threaded lfsr_common_prefix().
 uint32_t nonce2key(uint32_t uid, uint32_t nt, uint32_t nr, uint32_t ar, uint64_t par_info, uint64_t ks_info, uint64_t **keys) {
-    union {
-        struct Crypto1State *states;
-        uint64_t *keylist;
-    } unionstate;
 
-    uint32_t i, pos;
+    uint32_t pos;
     uint8_t ks3x[8], par[8][8];
-    uint64_t key_recovered;
+
+    *keys = NULL;
 
     // Reset the last three significant bits of the reader nonce
     nr &= 0xFFFFFF1F;
@@ -78,22 +189,97 @@ uint32_t nonce2key(uint32_t uid, uint32_t nt, uint32_t nr, uint32_t ar, uint64_t
         par[7 - pos][7] = (bt >> 7) & 1;
     }
 
-    unionstate.states = lfsr_common_prefix(nr, ar, ks3x, par, (par_info == 0));
+    uint32_t *odd = lfsr_prefix_ks(ks3x, 1);
+    uint32_t *even = lfsr_prefix_ks(ks3x, 0);
+    if (odd == NULL || even == NULL) {
+        free(odd);
+        free(even);
+        return 0;
+    }
+
+    uint32_t odd_len = 0, even_len = 0;
+    while (odd[odd_len] + 1) {
+        odd_len++;
+    }
+    while (even[even_len] + 1) {
+        even_len++;
+    }
+
+    uint32_t threads = num_CPUs();
+    if (threads > odd_len) {
+        threads = odd_len;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
 
-    if (!unionstate.states) {
-        *keys = NULL;
+    nonce2key_job_t *jobs = calloc(threads, sizeof(nonce2key_job_t));
+    pthread_t *thread_id = calloc(threads, sizeof(pthread_t));
+    if (jobs == NULL || thread_id == NULL) {
+        free(jobs);
+        free(thread_id);
+        free(odd);
+        free(even);
         return 0;
     }
 
-    for (i = 0; unionstate.keylist[i]; i++) {
-        lfsr_rollback_word(unionstate.states + i, uid ^ nt, 0);
-        crypto1_get_lfsr(unionstate.states + i, &key_recovered);
-        unionstate.keylist[i] = key_recovered;
+    for (uint32_t i = 0; i < threads; i++) {
+        uint32_t first = (uint64_t)odd_len * i / threads;
+        uint32_t last = (uint64_t)odd_len * (i + 1) / threads;
+        jobs[i].uid_nt = uid ^ nt;
+        jobs[i].nr = nr;
+        jobs[i].ar = ar;
+        jobs[i].no_par = (par_info == 0);
+        memcpy(jobs[i].par, par, sizeof(par));
+        jobs[i].odd = odd + first;
+        jobs[i].odd_len = last - first;
+        jobs[i].even = even;
+        jobs[i].even_len = even_len;
     }
-    unionstate.keylist[i] = -1;
 
-    *keys = unionstate.keylist;
-    return i;
+    if (threads == 1) {
+        nonce2key_worker(jobs);
+    } else {
+        for (uint32_t i = 0; i < threads; i++) {
+            pthread_create(thread_id + i, NULL, nonce2key_worker, jobs + i);
+        }
+        for (uint32_t i = 0; i < threads; i++) {
+            pthread_join(thread_id[i], NULL);
+        }
+    }
+
+    bool error = false;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        error |= jobs[i].error;
+        count += jobs[i].keys_len;
+    }
+
+    uint64_t *keylist = NULL;
+    if (error == false && count) {
+        keylist = malloc((count + 1) * sizeof(uint64_t));
+    }
+    if (keylist) {
+        uint64_t *p = keylist;
+        for (uint32_t i = 0; i < threads; i++) {
+            memcpy(p, jobs[i].keys, jobs[i].keys_len * sizeof(uint64_t));
+            p += jobs[i].keys_len;
+        }
+        *p = UINT64_C(-1);
+    } else {
+        count = 0;
+    }
+
+    for (uint32_t i = 0; i < threads; i++) {
+        free(jobs[i].keys);
+    }
+    free(jobs);
+    free(thread_id);
+    free(odd);
+    free(even);
+
+    *keys = keylist;
+    return count;
 }
 
 // recover key from 2 different reader responses on same tag challenge
@@ -180,3 +366,148 @@ int mfkey64(nonces_t *data, uint64_t *outputkey) {
     *outputkey = key;
     return 0;
 }
+
+#define MFKEY_BS_WORDS      4               // nt, nr, ar, at
+#define MFKEY_BS_TASK       1024            // keys per thread task
+
+typedef struct {
+    const uint64_t *keys;
+    uint32_t count;
+    uint32_t in[MFKEY_BS_WORDS];
+    uint32_t nt_enc;
+    uint32_t ar_enc;
+    uint32_t at_enc;
+    uint32_t ar_tab[4][256];    // prng_successor(nt, 64) is the xor of ar_tab[j][byte j of nt]
+    uint32_t at_tab[4][256];
+    uint32_t next;              // next task
+    uint32_t *cand;
+    uint32_t cand_len;
+    uint32_t cand_size;
+    bool error;
+    pthread_mutex_t lock;
+} mfkey_bs_job_t;
+
+static void
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer))
+#endif
+#endif
+*mfkey_bs_worker(void *arg) {
+    mfkey_bs_job_t *job = arg;
+    uint32_t ks[MFKEY_BS_TASK * MFKEY_BS_WORDS];
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        uint32_t task = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (task >= (job->count + MFKEY_BS_TASK - 1) / MFKEY_BS_TASK) {
+            break;
+        }
+        uint32_t first = task * MFKEY_BS_TASK;
+        uint32_t n = (job->count - first < MFKEY_BS_TASK) ? job->count - first : MFKEY_BS_TASK;
+
+        // nt and nr fed encrypted, ar and at only clocked
+        crypto1_bs_words(job->keys + first, n, job->in, 0x3, MFKEY_BS_WORDS, ks);
+
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t *k = ks + i * MFKEY_BS_WORDS;
+            uint32_t nt = job->nt_enc ^ k[0];
+            uint32_t ar = job->ar_tab[0][nt & 0xFF] ^ job->ar_tab[1][(nt >> 8) & 0xFF] ^ job->ar_tab[2][(nt >> 16) & 0xFF] ^ job->ar_tab[3][nt >> 24];
+            if ((job->ar_enc ^ k[2]) != ar) {
+                continue;
+            }
+            uint32_t at = job->at_tab[0][nt & 0xFF] ^ job->at_tab[1][(nt >> 8) & 0xFF] ^ job->at_tab[2][(nt >> 16) & 0xFF] ^ job->at_tab[3][nt >> 24];
+            if ((job->at_enc ^ k[3]) != at) {
+                continue;
+            }
+
+            pthread_mutex_lock(&job->lock);
+            if (job->cand_len == job->cand_size) {
+                uint32_t size = job->cand_size ? job->cand_size * 2 : 16;
+                uint32_t *cand = realloc(job->cand, size * sizeof(uint32_t));
+                if (cand == NULL) {
+                    job->error = true;
+                    pthread_mutex_unlock(&job->lock);
+                    continue;
+                }
+                job->cand = cand;
+                job->cand_size = size;
+            }
+            job->cand[job->cand_len++] = first + i;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+static int compare_uint32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Dictionary keys matching one captured authentication: the keystream they give for
+// nt_enc, nr_enc, ar_enc and at_enc decrypts ar and at to the successors of nt.
+// Checked with the bitsliced crypto1_bs_words(), on num_CPUs() threads for
+// large dictionaries. The indexes of the matching keys go to *cand in ascending
+// order, to free() by the caller. Returns their count, -1 when out of memory.
+int mfkey_auth_candidates(const uint64_t *keys, uint32_t count, uint32_t uid, uint32_t nt_enc, uint32_t nr_enc, uint32_t ar_enc, uint32_t at_enc, uint32_t **cand) {
+    mfkey_bs_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.keys = keys;
+    job.count = count;
+    job.in[0] = nt_enc ^ uid;
+    job.in[1] = nr_enc;
+    job.nt_enc = nt_enc;
+    job.ar_enc = ar_enc;
+    job.at_enc = at_enc;
+    *cand = NULL;
+
+    // prng_successor() is linear, tabulated per byte from the images of the unit vectors
+    for (uint32_t j = 0; j < 4; j++) {
+        for (uint32_t r = 0; r < 8; r++) {
+            job.ar_tab[j][1 << r] = prng_successor(1U << (j * 8 + r), 64);
+            job.at_tab[j][1 << r] = prng_successor(1U << (j * 8 + r), 96);
+        }
+        for (uint32_t v = 3; v < 256; v++) {
+            uint32_t low = v & -v;
+            job.ar_tab[j][v] = job.ar_tab[j][v ^ low] ^ job.ar_tab[j][low];
+            job.at_tab[j][v] = job.at_tab[j][v ^ low] ^ job.at_tab[j][low];
+        }
+    }
+    pthread_mutex_init(&job.lock, NULL);
+
+    uint32_t tasks = (count + MFKEY_BS_TASK - 1) / MFKEY_BS_TASK;
+    uint32_t threads = num_CPUs();
+    if (threads > tasks) {
+        threads = tasks;
+    }
+
+    if (threads <= 1) {
+        mfkey_bs_worker(&job);
+    } else {
+        pthread_t *thread_id = calloc(threads, sizeof(pthread_t));
+        if (thread_id == NULL) {
+            mfkey_bs_worker(&job);
+        } else {
+            for (uint32_t i = 0; i < threads; i++) {
+                pthread_create(thread_id + i, NULL, mfkey_bs_worker, &job);
+            }
+            for (uint32_t i = 0; i < threads; i++) {
+                pthread_join(thread_id[i], NULL);
+            }
+            free(thread_id);
+        }
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    if (job.error) {
+        free(job.cand);
+        return -1;
+    }
+    qsort(job.cand, job.cand_len, sizeof(uint32_t), compare_uint32);
+    *cand = job.cand;
+    return job.cand_len;
+}
@@ -27,8 +27,10 @@ uint32_t nonce2key(uint32_t uid, uint32_t nt, uint32_t nr, uint32_t ar, uint64_t
 bool mfkey32(nonces_t *data, uint64_t *outputkey);
 bool mfkey32_moebius(nonces_t *data, uint64_t *outputkey);
 int mfkey64(nonces_t *data, uint64_t *outputkey);
+int mfkey_auth_candidates(const uint64_t *keys, uint32_t count, uint32_t uid, uint32_t nt_enc, uint32_t nr_enc, uint32_t ar_enc, uint32_t at_enc, uint32_t **cand);
 
 int compare_uint64(const void *a, const void *b);
 uint32_t intersection(uint64_t *listA, uint64_t *listB);
+uint32_t intersection_unsorted(uint64_t *listA, const uint64_t *listB);
 
 #endif
@@ -43,6 +43,43 @@
 #include "cmdhf14a.h"
 #include "gen4.h"
 
+#define MF_DARKSIDE_PIPELINE    2   // key blocks queued on the device
+
+// mfCheckKeys() in two halves, to queue several key blocks on the device
+static void mf_check_keys_send(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keycnt, const uint8_t *keyBlock) {
+    uint8_t data[PM3_CMD_DATA_SIZE] = {0};
+    data[0] = keyType;
+    data[1] = blockNo;
+    data[2] = clear_trace;
+    data[3] = 0;
+    data[4] = keycnt;
+    memcpy(data + 5, keyBlock, 6 * keycnt);
+    SendCommandNG(CMD_HF_MIFARE_CHKKEYS, data, (5 + 6 * keycnt));
+}
+
+static int mf_check_keys_recv(uint64_t *key) {
+    *key = -1;
+    PacketResponseNG resp;
+    if (!WaitForResponseTimeout(CMD_HF_MIFARE_CHKKEYS, &resp, 2500)) {
+        return PM3_ETIMEOUT;
+    }
+    if (resp.status != PM3_SUCCESS) {
+        return resp.status;
+    }
+
+    struct kr {
+        uint8_t key[6];
+        bool found;
+    } PACKED;
+    struct kr *keyresult = (struct kr *)&resp.data.asBytes;
+    if (!keyresult->found) {
+        return PM3_ESOFT;
+    }
+
+    *key = bytes_to_num(keyresult->key, sizeof(keyresult->key));
+    return PM3_SUCCESS;
+}
+
 int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key) {
     uint32_t uid = 0;
     uint32_t nt = 0, nr = 0, ar = 0;
@@ -138,8 +175,7 @@ int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key) {
 
         // only parity zero attack
         if (par_list == 0) {
-            qsort(keylist, keycount, sizeof(*keylist), compare_uint64);
-            keycount = intersection(last_keylist, keylist);
+            keycount = intersection_unsorted(last_keylist, keylist);
             if (keycount == 0) {
                 free(last_keylist);
                 last_keylist = keylist;
@@ -150,22 +186,37 @@ int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key) {
 
         PrintAndLogEx(SUCCESS, "found " _YELLOW_("%u") " candidate key%s", keycount, (keycount > 1) ? "s" : "");
 
+        // the next key block is queued while the device checks the current one,
+        // no USB round trip in between
         *key = UINT64_C(-1);
+        const uint64_t *candidates = (par_list == 0) ? last_keylist : keylist;
         uint8_t keyBlock[PM3_CMD_DATA_SIZE];
         uint32_t max_keys = KEYS_IN_BLOCK;
-        for (uint32_t i = 0; i < keycount; i += max_keys) {
-
-            uint8_t size = keycount - i > max_keys ? max_keys : keycount - i;
-            register uint8_t j;
-            for (j = 0; j < size; j++) {
-                if (par_list == 0) {
-                    num_to_bytes(last_keylist[i * max_keys + j], 6, keyBlock + (j * 6));
-                } else {
-                    num_to_bytes(keylist[i * max_keys + j], 6, keyBlock + (j * 6));
+        uint32_t i = 0, pending = 0;
+
+        clearCommandBuffer();
+        while (i < keycount || pending) {
+
+            while (pending < MF_DARKSIDE_PIPELINE && i < keycount && *key == UINT64_C(-1)) {
+                uint8_t size = keycount - i > max_keys ? max_keys : keycount - i;
+                for (uint8_t j = 0; j < size; j++) {
+                    num_to_bytes(candidates[i + j], 6, keyBlock + (j * 6));
                 }
+                mf_check_keys_send(blockno, key_type - 0x60, false, size, keyBlock);
+                i += size;
+                pending++;
+            }
+            if (pending == 0) {
+                break;
             }
 
-            if (mfCheckKeys(blockno, key_type - 0x60, false, size, keyBlock, key) == PM3_SUCCESS) {
+            uint64_t found;
+            int res = mf_check_keys_recv(&found);
+            pending--;
+            if (res == PM3_SUCCESS && *key == UINT64_C(-1)) {
+                *key = found;
+            } else if (res == PM3_ETIMEOUT) {
+                // the responses still queued are dropped by the next clearCommandBuffer()
                 break;
             }
         }
@@ -185,36 +236,9 @@ int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key) {
 }
 
 int mfCheckKeys(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keycnt, uint8_t *keyBlock, uint64_t *key) {
-    *key = -1;
     clearCommandBuffer();
-    uint8_t data[PM3_CMD_DATA_SIZE] = {0};
-    data[0] = keyType;
-    data[1] = blockNo;
-    data[2] = clear_trace;
-    data[3] = 0;
-    data[4] = keycnt;
-    memcpy(data + 5, keyBlock, 6 * keycnt);
-    SendCommandNG(CMD_HF_MIFARE_CHKKEYS, data, (5 + 6 * keycnt));
-
-    PacketResponseNG resp;
-    if (!WaitForResponseTimeout(CMD_HF_MIFARE_CHKKEYS, &resp, 2500)) {
-        return PM3_ETIMEOUT;
-    }
-    if (resp.status != PM3_SUCCESS) {
-        return resp.status;
-    }
-
-    struct kr {
-        uint8_t key[6];
-        bool found;
-    } PACKED;
-    struct kr *keyresult = (struct kr *)&resp.data.asBytes;
-    if (!keyresult->found) {
-        return PM3_ESOFT;
-    }
-
-    *key = bytes_to_num(keyresult->key, sizeof(keyresult->key));
-    return PM3_SUCCESS;
+    mf_check_keys_send(blockNo, keyType, clear_trace, keycnt, keyBlock);
+    return mf_check_keys_recv(key);
 }
 
 // Sends chunks of keys to device.
@@ -438,11 +462,430 @@ __attribute__((force_align_arg_pointer))
     return statelist->head.slhead;
 }
 
+// mfnested() key recovery on a pool of num_CPUs() threads, in three steps:
+//   1. lfsr_recovery32_table() of both nonces, odd and even tables, the initial states split in parts
+//   2. lfsr_recovery32_bucket() of both nonces for each top byte of the tables
+//   3. for each value of the even byte of the 16 key bits (Compare16Bits), the intersection and
+//      roll back of both statelists. Key candidates are queued and tested by the caller with
+//      mfCheckKeys while the other slices are still running.
+// Each step 2 thread holds a crapto1_recovery_ws_t of about 56 MB, their number is
+// capped so the workspaces stay within NESTED_WS_BUDGET whatever num_CPUs() says.
+#define NESTED_MAX_PARTS        64
+#define NESTED_BUCKETS          0x100
+#define NESTED_SLICES           0x100
+#define NESTED_WS_SIZE          (56u << 20)
+#define NESTED_WS_BUDGET        (512u << 20)
+
+typedef struct {
+    StateList_t *statelists;
+    uint32_t threads;
+    uint32_t running;                                   // threads started for the current step
+    uint32_t parts;
+    uint8_t step;
+    uint32_t next;                                      // next task of the step
+    bool error;                                         // out of memory
+    bool stop;                                          // key found
+
+    uint32_t *tbl[2][2][NESTED_MAX_PARTS];              // step 1, [nonce][odd][part]
+    uint32_t tbl_len[2][2][NESTED_MAX_PARTS];
+    uint32_t *grp[2][2];                                // step 1 tables grouped by top byte
+    uint32_t grp_off[2][2][NESTED_BUCKETS + 1];
+    struct Crypto1State *sl[2][NESTED_BUCKETS];         // step 2, sorted with Compare16Bits
+    uint32_t sl_len[2][NESTED_BUCKETS];
+
+    uint64_t *keys;                                     // step 3, key candidates
+    uint32_t keys_len;
+    uint32_t keys_size;
+    uint32_t busy;                                      // step 3 threads still running
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} nested_pool_t;
+
+static int nested_pool_task(nested_pool_t *pool, uint32_t count) {
+    pthread_mutex_lock(&pool->lock);
+    int task = (pool->error || pool->stop || pool->next >= count) ? -1 : (int)pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    return task;
+}
+
+static void nested_pool_error(nested_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->error = true;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static uint8_t nested_even_byte(const struct Crypto1State *s) {
+    return (s->even >> 16) & 0xFF;
+}
+
+// first state with an even key byte <= b, Compare16Bits sorts the statelists in descending order
+static uint32_t nested_lower_bound(const struct Crypto1State *sl, uint32_t len, int b) {
+    uint32_t lo = 0, hi = len;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (nested_even_byte(sl + mid) > b) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// states of one nonce with the even key byte b, sorted, terminated by -1
+static struct Crypto1State *nested_slice(nested_pool_t *pool, uint8_t nonce, int b, uint32_t *len) {
+    uint32_t start[NESTED_BUCKETS], stop[NESTED_BUCKETS];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < NESTED_BUCKETS; i++) {
+        start[i] = nested_lower_bound(pool->sl[nonce][i], pool->sl_len[nonce][i], b);
+        stop[i] = nested_lower_bound(pool->sl[nonce][i], pool->sl_len[nonce][i], b - 1);
+        n += stop[i] - start[i];
+    }
+
+    struct Crypto1State *slice = calloc(n + 1, sizeof(struct Crypto1State));
+    if (slice == NULL) {
+        return NULL;
+    }
+    struct Crypto1State *p = slice;
+    for (uint32_t i = 0; i < NESTED_BUCKETS; i++) {
+        memcpy(p, pool->sl[nonce][i] + start[i], (stop[i] - start[i]) * sizeof(struct Crypto1State));
+        p += stop[i] - start[i];
+    }
+    p->odd = -1;
+    p->even = -1;
+
+    qsort(slice, n, sizeof(uint64_t), Compare16Bits);
+    *len = n;
+    return slice;
+}
+
+// the intersection of one slice, as mfnested() did on the whole statelists
+static int nested_intersect(nested_pool_t *pool, int b) {
+    struct Crypto1State *head[2], *p1, *p2, *p3, *p4;
+    uint32_t len[2];
+    StateList_t *statelists = pool->statelists;
+
+    head[0] = nested_slice(pool, 0, b, &len[0]);
+    head[1] = nested_slice(pool, 1, b, &len[1]);
+    if (head[0] == NULL || head[1] == NULL) {
+        free(head[0]);
+        free(head[1]);
+        return PM3_EMALLOC;
+    }
+
+    // the first 16 Bits of the cryptostate already contain part of our key.
+    // Create the intersection of the two lists based on these 16 Bits and
+    // roll back the cryptostate
+    struct Crypto1State *tail[2] = { head[0] + len[0] - 1, head[1] + len[1] - 1 };
+    p1 = p3 = head[0];
+    p2 = p4 = head[1];
+
+    while (p1 <= tail[0] && p2 <= tail[1]) {
+        if (Compare16Bits(p1, p2) == 0) {
+
+            struct Crypto1State savestate;
+            savestate = *p1;
+            while (Compare16Bits(p1, &savestate) == 0 && p1 <= tail[0]) {
+                *p3 = *p1;
+                lfsr_rollback_word(p3, statelists[0].nt_enc ^ statelists[0].uid, 0);
+                p3++;
+                p1++;
+            }
+            savestate = *p2;
+            while (Compare16Bits(p2, &savestate) == 0 && p2 <= tail[1]) {
+                *p4 = *p2;
+                lfsr_rollback_word(p4, statelists[1].nt_enc ^ statelists[1].uid, 0);
+                p4++;
+                p2++;
+            }
+        } else {
+            while (Compare16Bits(p1, p2) == -1 && p1 <= tail[0]) p1++;
+            while (Compare16Bits(p1, p2) == 1 && p2 <= tail[1]) p2++;
+        }
+    }
+
+    p3->odd = -1;
+    p3->even = -1;
+    p4->odd = -1;
+    p4->even = -1;
+
+    // the key we are searching for must be in the intersection of both lists
+    qsort(head[0], p3 - head[0], sizeof(uint64_t), compare_uint64);
+    qsort(head[1], p4 - head[1], sizeof(uint64_t), compare_uint64);
+    uint32_t keycnt = intersection((uint64_t *)head[0], (uint64_t *)head[1]);
+
+    int res = PM3_SUCCESS;
+    if (keycnt) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->keys_len + keycnt > pool->keys_size) {
+            uint32_t size = (pool->keys_len + keycnt) * 2;
+            uint64_t *keys = realloc(pool->keys, size * sizeof(uint64_t));
+            if (keys == NULL) {
+                res = PM3_EMALLOC;
+            } else {
+                pool->keys = keys;
+                pool->keys_size = size;
+            }
+        }
+        if (res == PM3_SUCCESS) {
+            for (uint32_t i = 0; i < keycnt; i++) {
+                crypto1_get_lfsr(head[0] + i, pool->keys + pool->keys_len++);
+            }
+            pthread_cond_signal(&pool->cond);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(head[0]);
+    free(head[1]);
+    return res;
+}
+
+static void
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer))
+#endif
+#endif
+*nested_pool_worker(void *arg) {
+    nested_pool_t *pool = arg;
+    StateList_t *statelists = pool->statelists;
+    int task;
+
+    switch (pool->step) {
+        case 1: {
+            while ((task = nested_pool_task(pool, 4 * pool->parts)) >= 0) {
+                uint8_t nonce = task & 1;
+                uint8_t odd = (task >> 1) & 1;
+                uint32_t part = task >> 2;
+                pool->tbl[nonce][odd][part] = lfsr_recovery32_table(statelists[nonce].ks1, statelists[nonce].nt_enc ^ statelists[nonce].uid,
+                                                                     odd, part, pool->parts, &pool->tbl_len[nonce][odd][part]);
+                if (pool->tbl[nonce][odd][part] == NULL) {
+                    nested_pool_error(pool);
+                }
+            }
+            break;
+        }
+        case 2: {
+            crapto1_recovery_ws_t *ws = crapto1_recovery_ws_alloc();
+            if (ws == NULL) {
+                nested_pool_error(pool);
+                break;
+            }
+            while ((task = nested_pool_task(pool, 2 * NESTED_BUCKETS)) >= 0) {
+                uint8_t nonce = task & 1;
+                uint32_t b = task >> 1;
+                struct Crypto1State *sl = lfsr_recovery32_bucket(ws, statelists[nonce].ks1, statelists[nonce].nt_enc ^ statelists[nonce].uid,
+                                                                 pool->grp[nonce][1] + pool->grp_off[nonce][1][b], pool->grp_off[nonce][1][b + 1] - pool->grp_off[nonce][1][b],
+                                                                 pool->grp[nonce][0] + pool->grp_off[nonce][0][b], pool->grp_off[nonce][0][b + 1] - pool->grp_off[nonce][0][b]);
+                if (sl == NULL) {
+                    nested_pool_error(pool);
+                    break;
+                }
+
+                uint32_t len = 0;
+                while (sl[len].odd | sl[len].even) {
+                    len++;
+                }
+                // give back the room lfsr_recovery32_bucket() reserves for the worst case
+                struct Crypto1State *shrunk = realloc(sl, (len + 1) * sizeof(struct Crypto1State));
+                if (shrunk) {
+                    sl = shrunk;
+                }
+                qsort(sl, len, sizeof(uint64_t), Compare16Bits);
+                pool->sl[nonce][b] = sl;
+                pool->sl_len[nonce][b] = len;
+            }
+            crapto1_recovery_ws_free(ws);
+            break;
+        }
+        case 3: {
+            while ((task = nested_pool_task(pool, NESTED_SLICES)) >= 0) {
+                if (nested_intersect(pool, task) != PM3_SUCCESS) {
+                    nested_pool_error(pool);
+                }
+            }
+            pthread_mutex_lock(&pool->lock);
+            pool->busy--;
+            pthread_cond_signal(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        default:
+            break;
+    }
+    return NULL;
+}
+
+static void nested_pool_run(nested_pool_t *pool, uint8_t step, pthread_t *thread_id) {
+    pool->step = step;
+    pool->next = 0;
+    pool->running = pool->threads;
+    if (step == 2 && pool->running > NESTED_WS_BUDGET / NESTED_WS_SIZE) {
+        pool->running = NESTED_WS_BUDGET / NESTED_WS_SIZE;
+    }
+    pool->busy = pool->running;
+    for (uint32_t i = 0; i < pool->running; i++) {
+        pthread_create(thread_id + i, NULL, nested_pool_worker, pool);
+    }
+}
+
+static void nested_pool_join(nested_pool_t *pool, pthread_t *thread_id) {
+    for (uint32_t i = 0; i < pool->running; i++) {
+        pthread_join(thread_id[i], NULL);
+    }
+}
+
+// step 1 tables of a nonce grouped by their top byte, the input of step 2
+static int nested_pool_group(nested_pool_t *pool, uint8_t nonce, uint8_t odd) {
+    uint32_t *off = pool->grp_off[nonce][odd];
+    memset(off, 0, (NESTED_BUCKETS + 1) * sizeof(uint32_t));
+    for (uint32_t p = 0; p < pool->parts; p++) {
+        for (uint32_t i = 0; i < pool->tbl_len[nonce][odd][p]; i++) {
+            off[(pool->tbl[nonce][odd][p][i] >> 24) + 1]++;
+        }
+    }
+    for (uint32_t b = 0; b < NESTED_BUCKETS; b++) {
+        off[b + 1] += off[b];
+    }
+
+    pool->grp[nonce][odd] = calloc(off[NESTED_BUCKETS] + 1, sizeof(uint32_t));
+    if (pool->grp[nonce][odd] == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    uint32_t pos[NESTED_BUCKETS];
+    memcpy(pos, off, sizeof(pos));
+    for (uint32_t p = 0; p < pool->parts; p++) {
+        for (uint32_t i = 0; i < pool->tbl_len[nonce][odd][p]; i++) {
+            uint32_t x = pool->tbl[nonce][odd][p][i];
+            pool->grp[nonce][odd][pos[x >> 24]++] = x;
+        }
+        free(pool->tbl[nonce][odd][p]);
+        pool->tbl[nonce][odd][p] = NULL;
+    }
+    return PM3_SUCCESS;
+}
+
+static void nested_pool_free(nested_pool_t *pool) {
+    for (uint8_t n = 0; n < 2; n++) {
+        for (uint8_t o = 0; o < 2; o++) {
+            for (uint32_t p = 0; p < NESTED_MAX_PARTS; p++) {
+                free(pool->tbl[n][o][p]);
+            }
+            free(pool->grp[n][o]);
+        }
+        for (uint32_t b = 0; b < NESTED_BUCKETS; b++) {
+            free(pool->sl[n][b]);
+        }
+    }
+    free(pool->keys);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool);
+}
+
+// recover the key of statelists[0..1] and test the candidates as they come
+static int nested_recover_key(StateList_t *statelists, uint64_t *key) {
+
+    nested_pool_t *pool = calloc(1, sizeof(nested_pool_t));
+    if (pool == NULL) {
+        return PM3_EMALLOC;
+    }
+    pool->statelists = statelists;
+    pool->threads = num_CPUs();
+    if (pool->threads < 1) {
+        pool->threads = 1;
+    }
+    pool->parts = (pool->threads > NESTED_MAX_PARTS) ? NESTED_MAX_PARTS : pool->threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pthread_t *thread_id = calloc(pool->threads, sizeof(pthread_t));
+    if (thread_id == NULL) {
+        nested_pool_free(pool);
+        return PM3_EMALLOC;
+    }
+
+    // steps 1 and 2, the statelists of both nonces
+    nested_pool_run(pool, 1, thread_id);
+    nested_pool_join(pool, thread_id);
+    for (uint8_t n = 0; n < 2 && pool->error == false; n++) {
+        for (uint8_t o = 0; o < 2 && pool->error == false; o++) {
+            pool->error = (nested_pool_group(pool, n, o) != PM3_SUCCESS);
+        }
+    }
+    if (pool->error == false) {
+        nested_pool_run(pool, 2, thread_id);
+        nested_pool_join(pool, thread_id);
+    }
+    if (pool->error) {
+        free(thread_id);
+        nested_pool_free(pool);
+        return PM3_EMALLOC;
+    }
+
+    // step 3, test the key candidates while the remaining slices are intersected
+    nested_pool_run(pool, 3, thread_id);
+
+    int res = PM3_ESOFT;
+    uint32_t tested = 0;
+    uint64_t start_time = msclock();
+    uint8_t keyBlock[PM3_CMD_DATA_SIZE] = {0x00};
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->keys_len - tested < KEYS_IN_BLOCK && pool->busy) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        uint32_t size = pool->keys_len - tested;
+        if (size > KEYS_IN_BLOCK) {
+            size = KEYS_IN_BLOCK;
+        }
+        if (size == 0) {
+            break;
+        }
+        for (uint32_t j = 0; j < size; j++) {
+            num_to_bytes(pool->keys[tested + j], 6, keyBlock + j * 6);
+        }
+        tested += size;
+        uint32_t keycnt = pool->keys_len;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, false, size, keyBlock, key) == PM3_SUCCESS) {
+            res = PM3_SUCCESS;
+            pthread_mutex_lock(&pool->lock);
+            pool->stop = true;
+            break;
+        }
+
+        float bruteforce_per_second = (float)tested / ((msclock() - start_time) / 1000.0);
+        PrintAndLogEx(INPLACE, "%6u/%u keys | %5.1f keys/sec", tested, keycnt, bruteforce_per_second);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    bool error = pool->error;
+    pthread_mutex_unlock(&pool->lock);
+    nested_pool_join(pool, thread_id);
+
+    if (res != PM3_SUCCESS) {
+        if (error) {
+            res = PM3_EMALLOC;
+        } else if (pool->keys_len) {
+            PrintAndLogEx(SUCCESS, "\nFound " _YELLOW_("%u") " key candidates", pool->keys_len);
+        }
+    }
+
+    free(thread_id);
+    nested_pool_free(pool);
+    return res;
+}
+
 int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey, bool calibrate) {
 
     uint32_t uid;
     StateList_t statelists[2];
-    struct Crypto1State *p1, *p2, *p3, *p4;
 
     struct {
         uint8_t block;
@@ -499,113 +942,25 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
     memcpy(&statelists[1].ks1, package->ks_b, sizeof(package->ks_b));
 
     // calc keys
-    pthread_t thread_id[2];
-
-    // create and run worker threads
-    for (uint8_t i = 0; i < 2; i++)
-        pthread_create(thread_id + i, NULL, nested_worker_thread, &statelists[i]);
-
-    // wait for threads to terminate:
-    for (uint8_t i = 0; i < 2; i++)
-        pthread_join(thread_id[i], (void *)&statelists[i].head.slhead);
-
-    // the first 16 Bits of the cryptostate already contain part of our key.
-    // Create the intersection of the two lists based on these 16 Bits and
-    // roll back the cryptostate
-    p1 = p3 = statelists[0].head.slhead;
-    p2 = p4 = statelists[1].head.slhead;
-
-    while (p1 <= statelists[0].tail.sltail && p2 <= statelists[1].tail.sltail) {
-        if (Compare16Bits(p1, p2) == 0) {
-
-            struct Crypto1State savestate;
-            savestate = *p1;
-            while (Compare16Bits(p1, &savestate) == 0 && p1 <= statelists[0].tail.sltail) {
-                *p3 = *p1;
-                lfsr_rollback_word(p3, statelists[0].nt_enc ^ statelists[0].uid, 0);
-                p3++;
-                p1++;
-            }
-            savestate = *p2;
-            while (Compare16Bits(p2, &savestate) == 0 && p2 <= statelists[1].tail.sltail) {
-                *p4 = *p2;
-                lfsr_rollback_word(p4, statelists[1].nt_enc ^ statelists[1].uid, 0);
-                p4++;
-                p2++;
-            }
-        } else {
-            while (Compare16Bits(p1, p2) == -1) p1++;
-            while (Compare16Bits(p1, p2) == 1) p2++;
-        }
-    }
-
-    p3->odd = -1;
-    p3->even = -1;
-    p4->odd = -1;
-    p4->even = -1;
-    statelists[0].len = p3 - statelists[0].head.slhead;
-    statelists[1].len = p4 - statelists[1].head.slhead;
-    statelists[0].tail.sltail = --p3;
-    statelists[1].tail.sltail = --p4;
-
-    // the statelists now contain possible keys. The key we are searching for must be in the
-    // intersection of both lists
-    qsort(statelists[0].head.keyhead, statelists[0].len, sizeof(uint64_t), compare_uint64);
-    qsort(statelists[1].head.keyhead, statelists[1].len, sizeof(uint64_t), compare_uint64);
-    // Create the intersection
-    statelists[0].len = intersection(statelists[0].head.keyhead, statelists[1].head.keyhead);
-
-    //statelists[0].tail.keytail = --p7;
-    uint32_t keycnt = statelists[0].len;
-    if (keycnt == 0) goto out;
-
-    PrintAndLogEx(SUCCESS, "Found " _YELLOW_("%u") " key candidates", keycnt);
-
     memset(resultKey, 0, 6);
     uint64_t key64 = -1;
+    int res = nested_recover_key(statelists, &key64);
+    if (res == PM3_SUCCESS) {
+        num_to_bytes(key64, 6, resultKey);
 
-    // The list may still contain several key candidates. Test each of them with mfCheckKeys
-    uint32_t max_keys = keycnt > KEYS_IN_BLOCK ? KEYS_IN_BLOCK : keycnt;
-    uint8_t keyBlock[PM3_CMD_DATA_SIZE] = {0x00};
-
-    for (uint32_t i = 0; i < keycnt; i += max_keys) {
-
-        uint64_t start_time = msclock();
-
-        uint8_t size = keycnt - i > max_keys ? max_keys : keycnt - i;
-
-        register uint8_t j;
-        for (j = 0; j < size; j++) {
-            crypto1_get_lfsr(statelists[0].head.slhead + i, &key64);
-            num_to_bytes(key64, 6, keyBlock + j * 6);
-        }
-
-        if (mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, false, size, keyBlock, &key64) == PM3_SUCCESS) {
-            free(statelists[0].head.slhead);
-            free(statelists[1].head.slhead);
-            num_to_bytes(key64, 6, resultKey);
-
-            PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c -- found valid key [ " _GREEN_("%s") " ]",
-                          package->block,
-                          package->keytype ? 'B' : 'A',
-                          sprint_hex_inrow(resultKey, 6)
-                         );
-            return PM3_SUCCESS;
-        }
-
-        float bruteforce_per_second = (float)(i + max_keys) / ((msclock() - start_time) / 1000.0);
-        PrintAndLogEx(INPLACE, "%6d/%u keys | %5.1f keys/sec | worst case %6.1f seconds remaining", i, keycnt, bruteforce_per_second, (keycnt - i) / bruteforce_per_second);
+        PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c -- found valid key [ " _GREEN_("%s") " ]",
+                      package->block,
+                      package->keytype ? 'B' : 'A',
+                      sprint_hex_inrow(resultKey, 6)
+                     );
+        return PM3_SUCCESS;
     }
 
-out:
     PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c",
                   package->block,
                   package->keytype ? 'B' : 'A'
                  );
-
-    free(statelists[0].head.slhead);
-    free(statelists[1].head.slhead);
-    return PM3_ESOFT;
+    return (res == PM3_EMALLOC) ? PM3_EMALLOC : PM3_ESOFT;
 }
 
 int mfStaticNested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey) {
@@ -19,6 +19,7 @@
 #include "pm3.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "proxmark3.h"
 #include "cmdmain.h"
@@ -26,45 +27,212 @@
 #include "usart_defs.h"
 #include "util_posix.h"
 #include "comms.h"
+#include "crc16.h"
 
 pm3_device_t *pm3_open(const char *port) {
-    pm3_init();
-    OpenProxmark(&g_session.current_device, port, false, 20, false, USART_BAUD_RATE);
-    if (g_session.pm3_present && (TestProxmark(g_session.current_device) != PM3_SUCCESS)) {
+
+    // the first device uses the default context, every further one gets its own,
+    // so one process can drive several devices from different threads
+    comms_ctx_t *ctx = NULL;
+    if (g_session.current_device == NULL) {
+        pm3_init();
+    } else {
+        ctx = NewCommunicationContext();
+        if (ctx == NULL) {
+            PrintAndLogEx(ERR, "error, cannot allocate memory");
+            return NULL;
+        }
+    }
+
+    comms_ctx_t *prev = SetCommunicationContext(ctx);
+
+    pm3_device_t *dev = NULL;
+    OpenProxmark(&dev, port, false, 20, false, USART_BAUD_RATE);
+    if (IsCommunicationContextPresent() && (TestProxmark(dev) != PM3_SUCCESS)) {
         PrintAndLogEx(ERR, _RED_("ERROR:") " cannot communicate with the Proxmark3\n");
-        CloseProxmark(g_session.current_device);
+        CloseProxmark(dev);
     }
 
-    if ((port != NULL) && (!g_session.pm3_present))
+    bool present = IsCommunicationContextPresent();
+
+    // only the first device ends the process, an extra one is just not opened
+    if ((port != NULL) && (present == false) && (ctx == NULL))
         exit(EXIT_FAILURE);
 
-    if (!g_session.pm3_present) {
+    if (present == false && ctx == NULL) {
         PrintAndLogEx(INFO, _RED_("OFFLINE") " mode");
     }
-    // For now, there is no real device context:
-    return g_session.current_device;
+
+    SetCommunicationContext(prev);
+
+    // an extra device which failed to open doesn't keep its context
+    if (ctx != NULL && present == false) {
+        free(dev);
+        FreeCommunicationContext(ctx);
+        return NULL;
+    }
+
+    if (g_session.current_device == NULL) {
+        g_session.current_device = dev;
+    }
+    return dev;
 }
 
 void pm3_close(pm3_device_t *dev) {
+    if (dev == NULL) {
+        return;
+    }
+
+    comms_ctx_t *prev = SetCommunicationContext(dev->ctx);
+
     // Clean up the port
-    if (g_session.pm3_present) {
+    if (IsCommunicationContextPresent()) {
         clearCommandBuffer();
         SendCommandNG(CMD_QUIT_SESSION, NULL, 0);
         msleep(100); // Make sure command is sent before killing client
         CloseProxmark(dev);
     }
+
+    SetCommunicationContext(prev);
+
+    // extra devices own their context
+    if (dev != g_session.current_device) {
+        FreeCommunicationContext(dev->ctx);
+        free(dev);
+    }
 }
 
 int pm3_console(pm3_device_t *dev, const char *cmd) {
-    // For now, there is no real device context:
-    (void) dev;
-    return CommandReceived(cmd);
+    // commands issued from this thread go to dev
+    comms_ctx_t *prev = SetCommunicationContext((dev) ? dev->ctx : NULL);
+    int res = CommandReceived(cmd);
+    SetCommunicationContext(prev);
+    return res;
 }
 
 const char *pm3_name_get(pm3_device_t *dev) {
-    return dev->g_conn->serial_port_name;
+    return dev->conn->serial_port_name;
 }
 
 pm3_device_t *pm3_get_current_dev(void) {
-    return g_session.current_device;
+    pm3_device_t *dev = GetCommunicationDevice();
+    return (dev) ? dev : g_session.current_device;
+}
+
+int pm3_send(pm3_device_t *dev, uint16_t cmd, const uint8_t *data, uint16_t len) {
+    if (len > PM3_CMD_DATA_SIZE) {
+        return PM3_EOVFLOW;
+    }
+
+    comms_ctx_t *prev = SetCommunicationContext((dev) ? dev->ctx : NULL);
+    int res = PM3_EIO;
+    if (IsCommunicationContextPresent()) {
+        SendCommandNG(cmd, (uint8_t *)data, len);
+        res = PM3_SUCCESS;
+    }
+    SetCommunicationContext(prev);
+    return res;
+}
+
+// Next reply of the device, whatever the command. Debug prints are still
+// printed by the communication thread and never come out here
+int pm3_recv(pm3_device_t *dev, pm3_frame *frame, uint32_t timeout_ms) {
+    comms_ctx_t *prev = SetCommunicationContext((dev) ? dev->ctx : NULL);
+    PacketResponseNG resp;
+    bool got = IsCommunicationContextPresent() && WaitForResponseTimeoutW(CMD_UNKNOWN, &resp, timeout_ms, false);
+    SetCommunicationContext(prev);
+
+    if (got == false) {
+        return PM3_ETIMEOUT;
+    }
+    frame->cmd = resp.cmd;
+    frame->status = resp.status;
+    frame->length = MIN(resp.length, sizeof(frame->data));
+    memcpy(frame->data, resp.data.asBytes, frame->length);
+    return PM3_SUCCESS;
+}
+
+// host -> device frame, returns its length or a negative error
+int pm3_frame_encode(uint16_t cmd, const uint8_t *data, uint16_t len, bool with_crc, uint8_t *out, size_t outlen) {
+    size_t total = sizeof(PacketCommandNGPreamble) + len + sizeof(PacketCommandNGPostamble);
+    if (len > PM3_CMD_DATA_SIZE) {
+        return PM3_EOVFLOW;
+    }
+    if (outlen < total) {
+        return PM3_EINVARG;
+    }
+
+    PacketCommandNGPreamble *pre = (PacketCommandNGPreamble *)out;
+    pre->magic = COMMANDNG_PREAMBLE_MAGIC;
+    pre->ng = true;
+    pre->length = len;
+    pre->cmd = cmd;
+    if (len) {
+        memcpy(out + sizeof(PacketCommandNGPreamble), data, len);
+    }
+
+    PacketCommandNGPostamble *post = (PacketCommandNGPostamble *)(out + sizeof(PacketCommandNGPreamble) + len);
+    if (with_crc) {
+        uint8_t first = 0, second = 0;
+        compute_crc(CRC_14443_A, out, sizeof(PacketCommandNGPreamble) + len, &first, &second);
+        post->crc = (first << 8) + second;
+    } else {
+        post->crc = COMMANDNG_POSTAMBLE_MAGIC;
+    }
+    return total;
+}
+
+// Device -> host NG frame from a byte stream. *consumed gets the bytes to drop,
+// garbage before the frame included.
+// Returns PM3_SUCCESS with a frame, PM3_EPARTIAL when more bytes are needed,
+// PM3_ECRC when the frame was dropped for a bad CRC
+int pm3_frame_decode(const uint8_t *buf, size_t len, pm3_frame *frame, size_t *consumed) {
+    const uint32_t magic = RESPONSENG_PREAMBLE_MAGIC;
+    size_t i = 0;
+    *consumed = 0;
+
+    for (;; i++) {
+        // keep a possible start of the magic for the next call
+        if (len - i < sizeof(magic)) {
+            *consumed = i;
+            return PM3_EPARTIAL;
+        }
+        if (memcmp(buf + i, &magic, sizeof(magic)) != 0) {
+            continue;
+        }
+        if (len - i < sizeof(PacketResponseNGPreamble)) {
+            *consumed = i;
+            return PM3_EPARTIAL;
+        }
+
+        PacketResponseNGPreamble pre;
+        memcpy(&pre, buf + i, sizeof(pre));
+        if (pre.length > PM3_CMD_DATA_SIZE) {
+            // not a preamble after all, resync
+            continue;
+        }
+
+        size_t total = sizeof(PacketResponseNGPreamble) + pre.length + sizeof(PacketResponseNGPostamble);
+        if (len - i < total) {
+            *consumed = i;
+            return PM3_EPARTIAL;
+        }
+        *consumed = i + total;
+
+        uint16_t crc;
+        memcpy(&crc, buf + i + total - sizeof(crc), sizeof(crc));
+        if (crc != RESPONSENG_POSTAMBLE_MAGIC) {
+            uint8_t first = 0, second = 0;
+            compute_crc(CRC_14443_A, buf + i, total - sizeof(crc), &first, &second);
+            if ((first << 8) + second != crc) {
+                return PM3_ECRC;
+            }
+        }
+
+        frame->cmd = pre.cmd;
+        frame->status = pre.status;
+        frame->length = pre.length;
+        memcpy(frame->data, buf + i + sizeof(PacketResponseNGPreamble), pre.length);
+        return PM3_SUCCESS;
+    }
 }
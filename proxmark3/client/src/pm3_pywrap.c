@@ -3305,6 +3305,114 @@ SWIG_FromCharPtr(const char *cptr) {
     return SWIG_FromCharPtrAndSize(cptr, (cptr ? strlen(cptr) : 0));
 }
 
+/* Native NG frame helpers: bytes in, bytes out, the GIL is released while waiting */
+static PyObject *pm3_py_frame_encode(PyObject *self, PyObject *args) {
+    unsigned int cmd = 0;
+    Py_buffer data = { NULL };
+    int with_crc = 0;
+    uint8_t out[sizeof(PacketCommandNGRaw)];
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "I|y*p:frame_encode", &cmd, &data, &with_crc))
+        return NULL;
+    int res = (data.len > PM3_CMD_DATA_SIZE) ? PM3_EOVFLOW : pm3_frame_encode(cmd, data.buf, data.len, with_crc, out, sizeof(out));
+    PyBuffer_Release(&data);
+    if (res < 0) {
+        PyErr_SetString(PyExc_ValueError, "payload too long");
+        return NULL;
+    }
+    return PyBytes_FromStringAndSize((const char *)out, res);
+}
+
+static PyObject *pm3_py_frame_decode(PyObject *self, PyObject *args) {
+    Py_buffer buf;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "y*:frame_decode", &buf))
+        return NULL;
+
+    PyObject *frames = PyList_New(0);
+    const uint8_t *p = buf.buf;
+    size_t len = buf.len;
+    while (frames) {
+        pm3_frame frame;
+        size_t consumed = 0;
+        int res = pm3_frame_decode(p, len, &frame, &consumed);
+        p += consumed;
+        len -= consumed;
+        if (res == PM3_EPARTIAL)
+            break;
+        if (res != PM3_SUCCESS)
+            continue;
+        PyObject *t = Py_BuildValue("(iiy#)", frame.cmd, frame.status, frame.data, (Py_ssize_t)frame.length);
+        if (t == NULL || PyList_Append(frames, t) < 0) {
+            Py_XDECREF(t);
+            Py_CLEAR(frames);
+            break;
+        }
+        Py_DECREF(t);
+    }
+
+    PyObject *result = NULL;
+    if (frames)
+        result = Py_BuildValue("(Ny#)", frames, (const char *)p, (Py_ssize_t)len);
+    PyBuffer_Release(&buf);
+    return result;
+}
+
+static int pm3_py_get_dev(PyObject *obj, pm3 **dev) {
+    void *argp = NULL;
+    if (!SWIG_IsOK(SWIG_ConvertPtr(obj, &argp, SWIGTYPE_p_pm3, 0))) {
+        PyErr_SetString(PyExc_TypeError, "a 'pm3 *' is expected");
+        return 0;
+    }
+    *dev = (pm3 *)argp;
+    return 1;
+}
+
+static PyObject *pm3_py_send(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    unsigned int cmd = 0;
+    Py_buffer data = { NULL };
+    pm3 *dev = NULL;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "OI|y*:send", &obj, &cmd, &data))
+        return NULL;
+    if (!pm3_py_get_dev(obj, &dev)) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    int res = PM3_EOVFLOW;
+    if (data.len <= PM3_CMD_DATA_SIZE) {
+        Py_BEGIN_ALLOW_THREADS
+        res = pm3_send(dev, cmd, data.buf, data.len);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&data);
+    return PyLong_FromLong(res);
+}
+
+static PyObject *pm3_py_recv(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    unsigned int timeout = 1000;
+    pm3 *dev = NULL;
+    pm3_frame frame;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "O|I:recv", &obj, &timeout))
+        return NULL;
+    if (!pm3_py_get_dev(obj, &dev))
+        return NULL;
+    int res;
+    Py_BEGIN_ALLOW_THREADS
+    res = pm3_recv(dev, &frame, timeout);
+    Py_END_ALLOW_THREADS
+    if (res != PM3_SUCCESS)
+        Py_RETURN_NONE;
+    return Py_BuildValue("(iiy#)", frame.cmd, frame.status, frame.data, (Py_ssize_t)frame.length);
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -3475,6 +3583,10 @@ static PyMethodDef SwigMethods[] = {
     { "pm3_name_get", _wrap_pm3_name_get, METH_O, NULL},
     { "pm3_swigregister", pm3_swigregister, METH_O, NULL},
     { "pm3_swiginit", pm3_swiginit, METH_VARARGS, NULL},
+    { "frame_encode", pm3_py_frame_encode, METH_VARARGS, NULL},
+    { "frame_decode", pm3_py_frame_decode, METH_VARARGS, NULL},
+    { "send", pm3_py_send, METH_VARARGS, NULL},
+    { "recv", pm3_py_recv, METH_VARARGS, NULL},
     { NULL, NULL, 0, NULL }
 };
 
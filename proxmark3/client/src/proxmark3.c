@@ -41,6 +41,13 @@
 
 #ifndef _WIN32
 #include <locale.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "jansson.h"
 #endif
 
 
@@ -621,6 +628,381 @@ static void dumpAllHelp(int markdown, bool full_help) {
     g_session.help_dump_mode = false;
     PrintAndLogEx(NORMAL, "Full help dump done.");
 }
+
+#if !defined(_WIN32)
+// Daemon mode: keep the client and the device session alive and serve commands over a Unix socket.
+//
+// Requests are one line each.
+// A plain line is executed like at the prompt, ';' separating several commands. The captured output
+// is sent back followed by a NUL byte.
+// A line starting with '{' is a JSON request  {"cmd": "hw version", "id": 1}  and gets one JSON line back:
+//   {"id": 1, "cmd": "hw version", "status": 0, "output": "..."}
+// where status is the PM3_xxx return code of the last command.
+// Clients are served in turn, one command at a time, as there is only one device.
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[PM3_DAEMON_MAX_LINE];
+} daemon_client_t;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_signal(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static bool daemon_send(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int daemon_listen(const char *path) {
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        PrintAndLogEx(ERR, "daemon socket path too long " _YELLOW_("%s"), path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // don't steal the socket of a running daemon, but clean up after one which died
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (S_ISSOCK(st.st_mode) == false) {
+            PrintAndLogEx(ERR, _YELLOW_("%s") " exists and is not a socket", path);
+            return -1;
+        }
+
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0) {
+            int res = connect(probe, (struct sockaddr *)&addr, sizeof(addr));
+            close(probe);
+            if (res == 0) {
+                PrintAndLogEx(ERR, "another daemon is already listening on " _YELLOW_("%s"), path);
+                return -1;
+            }
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        PrintAndLogEx(ERR, "daemon socket failed: %s", strerror(errno));
+        return -1;
+    }
+
+    // commands can write files, only the owner may connect
+    mode_t old_mask = umask(0077);
+    int res = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if (res < 0 || listen(fd, PM3_DAEMON_MAX_CLIENTS) < 0) {
+        PrintAndLogEx(ERR, "daemon cannot listen on " _YELLOW_("%s") ": %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Run one request line with stdout and stderr redirected to the capture file.
+// Returns the status of the last command; *output is malloc'ed and NUL terminated.
+static int daemon_exec(int capture_fd, char *line, char **output, size_t *outlen) {
+
+    int ret = PM3_SUCCESS;
+
+    fflush(stdout);
+    fflush(stderr);
+    if (ftruncate(capture_fd, 0) < 0) {
+        PrintAndLogEx(WARNING, "daemon failed to reset capture file");
+    }
+    lseek(capture_fd, 0, SEEK_SET);
+
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    dup2(capture_fd, STDOUT_FILENO);
+    dup2(capture_fd, STDERR_FILENO);
+
+    char *tmp_ptr = NULL;
+    for (char *cmd = strtok_r(line, ";", &tmp_ptr); cmd != NULL; cmd = strtok_r(NULL, ";", &tmp_ptr)) {
+
+        while (isspace(*cmd)) {
+            cmd++;
+        }
+        size_t l = strlen(cmd);
+        while (l > 0 && isspace(cmd[l - 1])) {
+            cmd[--l] = '\0';
+        }
+        if (cmd[0] == '\0')
+            continue;
+
+        g_pendingPrompt = false;
+        ret = CommandReceived(cmd);
+        if (ret == PM3_EFATAL || ret == PM3_SQUIT)
+            break;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    off_t size = lseek(capture_fd, 0, SEEK_END);
+    if (size < 0)
+        size = 0;
+
+    *outlen = 0;
+    *output = calloc(size + 1, sizeof(char));
+    if (*output == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    while (*outlen < (size_t)size) {
+        ssize_t n = pread(capture_fd, *output + *outlen, size - *outlen, *outlen);
+        if (n <= 0)
+            break;
+        *outlen += n;
+    }
+    return ret;
+}
+
+// The result of the command is returned, *send_failed tells if the reply didn't reach the client
+static int daemon_json_request(int capture_fd, daemon_client_t *client, char *line, bool *send_failed) {
+
+    json_error_t error;
+    json_t *req = json_loads(line, 0, &error);
+    json_t *reply = json_object();
+
+    int ret = PM3_EINVARG;
+    const char *cmd = json_is_object(req) ? json_string_value(json_object_get(req, "cmd")) : NULL;
+    if (cmd == NULL) {
+        json_object_set_new(reply, "status", json_integer(ret));
+        json_object_set_new(reply, "error", json_string(req ? "missing \"cmd\"" : error.text));
+    } else {
+        json_t *id = json_object_get(req, "id");
+        if (id) {
+            json_object_set(reply, "id", id);
+        }
+        json_object_set_new(reply, "cmd", json_string(cmd));
+
+        char *cmdline = str_dup(cmd);
+        char *output = NULL;
+        size_t outlen = 0;
+        ret = (cmdline) ? daemon_exec(capture_fd, cmdline, &output, &outlen) : PM3_EMALLOC;
+        free(cmdline);
+
+        json_object_set_new(reply, "status", json_integer(ret));
+
+        json_t *jout = json_stringn(output ? output : "", outlen);
+        if (jout == NULL) {
+            // not valid UTF-8, keep it readable
+            for (size_t i = 0; i < outlen; i++) {
+                if ((uint8_t)output[i] > 0x7F)
+                    output[i] = '?';
+            }
+            jout = json_stringn(output, outlen);
+        }
+        json_object_set_new(reply, "output", jout);
+        free(output);
+    }
+
+    char *s = json_dumps(reply, JSON_COMPACT);
+    *send_failed = (s == NULL || daemon_send(client->fd, s, strlen(s)) == false || daemon_send(client->fd, "\n", 1) == false);
+    free(s);
+    json_decref(reply);
+    json_decref(req);
+    return ret;
+}
+
+static int daemon_text_request(int capture_fd, daemon_client_t *client, char *line, bool *send_failed) {
+    char *output = NULL;
+    size_t outlen = 0;
+    int ret = daemon_exec(capture_fd, line, &output, &outlen);
+    *send_failed = (daemon_send(client->fd, output ? output : "", outlen) == false || daemon_send(client->fd, "", 1) == false);
+    free(output);
+    return ret;
+}
+
+static void daemon_drop_client(daemon_client_t *client) {
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+}
+
+// Execute all complete lines received from this client.
+// Returns false if the client has to be dropped.
+static bool daemon_serve_client(int capture_fd, daemon_client_t *client) {
+
+    ssize_t n = read(client->fd, client->buf + client->len, sizeof(client->buf) - client->len);
+    if (n <= 0) {
+        return (n < 0 && errno == EINTR);
+    }
+    client->len += n;
+
+    char *eol;
+    while ((eol = memchr(client->buf, '\n', client->len)) != NULL) {
+        *eol = '\0';
+        size_t linelen = eol - client->buf + 1;
+
+        char line[PM3_DAEMON_MAX_LINE];
+        memcpy(line, client->buf, linelen);
+        client->len -= linelen;
+        memmove(client->buf, client->buf + linelen, client->len);
+
+        str_cleanrn(line, linelen);
+
+        bool send_failed = false;
+        if (line[0] == '{')
+            mainret = daemon_json_request(capture_fd, client, line, &send_failed);
+        else
+            mainret = daemon_text_request(capture_fd, client, line, &send_failed);
+
+        if (mainret == PM3_EFATAL) {
+            daemon_stop = 1;
+            return false;
+        }
+        // quit / exit only end this client session, as does a client no longer reading
+        if (mainret == PM3_SQUIT || send_failed) {
+            mainret = PM3_SUCCESS;
+            return false;
+        }
+    }
+
+    if (client->len == sizeof(client->buf)) {
+        const char msg[] = "request too long\n";
+        daemon_send(client->fd, msg, strlen(msg));
+        return false;
+    }
+    return true;
+}
+
+static int daemon_loop(const char *socket_path) {
+
+    FILE *capture = tmpfile();
+    if (capture == NULL) {
+        PrintAndLogEx(ERR, "daemon cannot create capture file");
+        return PM3_EFILE;
+    }
+
+    int listen_fd = daemon_listen(socket_path);
+    if (listen_fd < 0) {
+        fclose(capture);
+        return PM3_EIO;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // a client leaving early must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+    // keep stdout and stderr lines in order in the captured output
+    SetFlushAfterWrite(true);
+
+    // cache Version information now
+    pm3_version(false, false);
+
+    PrintAndLogEx(SUCCESS, "daemon listening on " _YELLOW_("%s"), socket_path);
+
+    daemon_client_t clients[PM3_DAEMON_MAX_CLIENTS];
+    for (int i = 0; i < PM3_DAEMON_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+        clients[i].len = 0;
+    }
+
+    mainret = PM3_SUCCESS;
+    while (daemon_stop == 0) {
+
+        struct pollfd pfd[PM3_DAEMON_MAX_CLIENTS + 1];
+        pfd[0].fd = listen_fd;
+        pfd[0].events = POLLIN;
+        for (int i = 0; i < PM3_DAEMON_MAX_CLIENTS; i++) {
+            pfd[i + 1].fd = clients[i].fd;
+            pfd[i + 1].events = POLLIN;
+        }
+
+        int res = poll(pfd, PM3_DAEMON_MAX_CLIENTS + 1, 500);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            PrintAndLogEx(ERR, "daemon poll failed: %s", strerror(errno));
+            mainret = PM3_EIO;
+            break;
+        }
+
+        // device went away, same as at the interactive prompt
+        if (IsCommunicationThreadDead() && g_session.pm3_present) {
+            PrintAndLogEx(WARNING, "lost connection with the Proxmark3, trying to reconnect");
+            CloseProxmark(g_session.current_device);
+            StartReconnectProxmark();
+        }
+
+        if (res == 0)
+            continue;
+
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                int i = 0;
+                while (i < PM3_DAEMON_MAX_CLIENTS && clients[i].fd >= 0) {
+                    i++;
+                }
+                if (i == PM3_DAEMON_MAX_CLIENTS) {
+                    const char msg[] = "too many clients\n";
+                    daemon_send(fd, msg, strlen(msg));
+                    close(fd);
+                } else {
+                    clients[i].fd = fd;
+                    clients[i].len = 0;
+                }
+            }
+        }
+
+        for (int i = 0; i < PM3_DAEMON_MAX_CLIENTS && daemon_stop == 0; i++) {
+            if (clients[i].fd < 0 || pfd[i + 1].fd != clients[i].fd)
+                continue;
+            if ((pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+                continue;
+            if (daemon_serve_client(fileno(capture), &clients[i]) == false) {
+                daemon_drop_client(&clients[i]);
+            }
+        }
+    }
+
+    for (int i = 0; i < PM3_DAEMON_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            daemon_drop_client(&clients[i]);
+        }
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    fclose(capture);
+
+    if (g_session.pm3_present) {
+        clearCommandBuffer();
+        SendCommandNG(CMD_QUIT_SESSION, NULL, 0);
+        msleep(100); // Make sure command is sent before killing client
+    }
+
+    PrintAndLogEx(INFO, "daemon stopped");
+    return mainret;
+}
+#endif // _WIN32
 #endif //LIBPM3
 
 static char *my_executable_path = NULL;
@@ -716,6 +1098,9 @@ static void show_help(bool showFullHelp, char *exec_name) {
     PrintAndLogEx(NORMAL, "        %s [[-p] <port>] [-b] [-w] [-f] [-c <command>]|[-l <lua_script_file>]|[-s <cmd_script_file>] [-i] [-d <0|1|2>]", exec_name);
 #endif // HAVE_PYTHON
     PrintAndLogEx(NORMAL, "        %s [-p] <port> --flash [--unlock-bootloader] [--image <imagefile>]+ [-w] [-f] [-d <0|1|2>]", exec_name);
+#if !defined(_WIN32)
+    PrintAndLogEx(NORMAL, "        %s [[-p] <port>] [-b] [-w] [-f] --daemon <socket> [-d <0|1|2>]", exec_name);
+#endif
 
     if (showFullHelp) {
 
@@ -741,6 +1126,9 @@ static void show_help(bool showFullHelp, char *exec_name) {
         PrintAndLogEx(NORMAL, "      -i/--interactive                    enter interactive mode after executing the script or the command");
         PrintAndLogEx(NORMAL, "      --incognito                         do not use history, prefs file nor log files");
         PrintAndLogEx(NORMAL, "      --ncpu <num_cores>                  override number of CPU cores");
+#if !defined(_WIN32)
+        PrintAndLogEx(NORMAL, "      --daemon <socket>                   keep running and execute commands received on a unix socket");
+#endif
         PrintAndLogEx(NORMAL, "\nOptions in flasher mode:");
         PrintAndLogEx(NORMAL, "      --flash                             flash Proxmark3, requires at least one --image");
         PrintAndLogEx(NORMAL, "      --reboot-to-bootloader              reboot Proxmark3 into bootloader mode");
@@ -762,6 +1150,10 @@ static void show_help(bool showFullHelp, char *exec_name) {
         PrintAndLogEx(NORMAL, "      %s "SERIAL_PORT_EXAMPLE_H" -c \"hf mf chk --1k\"   -- execute cmd and quit client", exec_name);
         PrintAndLogEx(NORMAL, "      %s "SERIAL_PORT_EXAMPLE_H" -l hf_read            -- execute Lua script `hf_read` and quit client", exec_name);
         PrintAndLogEx(NORMAL, "      %s "SERIAL_PORT_EXAMPLE_H" -s mycmds.txt         -- execute each pm3 cmd in file and quit client", exec_name);
+#if !defined(_WIN32)
+        PrintAndLogEx(NORMAL, "\n  to serve commands to other processes:\n");
+        PrintAndLogEx(NORMAL, "      %s "SERIAL_PORT_EXAMPLE_H" --daemon /tmp/pm3.sock  -- then e.g. `echo \"hw version\" | socat - UNIX:/tmp/pm3.sock`", exec_name);
+#endif
         PrintAndLogEx(NORMAL, "\n  to flash fullimage and bootloader:\n");
         PrintAndLogEx(NORMAL, "      %s "SERIAL_PORT_EXAMPLE_H" --flash --unlock-bootloader --image bootrom.elf --image fullimage.elf", exec_name);
 #ifdef __linux__
@@ -853,7 +1245,7 @@ static int dumpmem_pm3(char *serial_port_name, const char *filename, uint32_t ad
 finish2:
     clearCommandBuffer();
     if (in_bootloader) {
-        g_session.current_device->g_conn->run = false;
+        g_session.current_device->conn->run = false;
         SendCommandOLD(CMD_PING, 0, 0, 0, NULL, 0);
     } else {
         SendCommandNG(CMD_QUIT_SESSION, NULL, 0);
@@ -1009,6 +1401,7 @@ int main(int argc, char *argv[]) {
     char *script_cmds_file = NULL;
     char *script_cmd = NULL;
     char *port = NULL;
+    const char *daemon_socket = NULL;
     uint32_t speed = 0;
 
     pm3line_init();
@@ -1229,6 +1622,19 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
+#if !defined(_WIN32)
+        // serve commands on a unix socket
+        if (strcmp(argv[i], "--daemon") == 0) {
+            if (i + 1 == argc) {
+                PrintAndLogEx(ERR, _RED_("ERROR:") " missing socket path specification after --daemon\n");
+                show_help(false, exec_name);
+                return 1;
+            }
+            daemon_socket = argv[++i];
+            continue;
+        }
+#endif
+
         // go to dump mode
         if (strcmp(argv[i], "--dumpmem") == 0) {
             dumpmem_mode = true;
@@ -1363,6 +1769,18 @@ int main(int argc, char *argv[]) {
         exit(EXIT_SUCCESS);
     }
 
+    if (daemon_socket && (script_cmd || script_cmds_file || stayInCommandLoop)) {
+        PrintAndLogEx(ERR, _RED_("ERROR:") " --daemon cannot be combined with -c, -l, -s or -i\n");
+        show_help(false, exec_name);
+        return 1;
+    }
+
+    // daemon output goes to scripts, not to a terminal
+    if (daemon_socket) {
+        g_session.supports_colors = false;
+        g_session.emoji_mode = EMO_ALTTEXT;
+    }
+
     if (script_cmd) {
         while (script_cmd[strlen(script_cmd) - 1] == ' ')
             script_cmd[strlen(script_cmd) - 1] = 0x00;
@@ -1407,7 +1825,7 @@ int main(int argc, char *argv[]) {
     }
 
     // ascii art only in interactive client
-    if (!script_cmds_file && !script_cmd && g_session.stdinOnTTY && g_session.stdoutOnTTY && !dumpmem_mode && !flash_mode && !reboot_bootloader_mode) {
+    if (!script_cmds_file && !script_cmd && !daemon_socket && g_session.stdinOnTTY && g_session.stdoutOnTTY && !dumpmem_mode && !flash_mode && !reboot_bootloader_mode) {
         showBanner();
     }
 
@@ -1432,25 +1850,32 @@ int main(int argc, char *argv[]) {
     }
     */
 
+#if !defined(_WIN32)
+    if (daemon_socket) {
+        mainret = daemon_loop(daemon_socket);
+    } else
+#endif
+    {
 #ifdef HAVE_GUI
 
 #  if defined(_WIN32)
-    InitGraphics(argc, argv, script_cmds_file, script_cmd, stayInCommandLoop);
-    MainGraphics();
-#  else
-    // for *nix distro's,  check environment variable to verify a display
-    const char *display = getenv("DISPLAY");
-    if (display && strlen(display) > 1) {
         InitGraphics(argc, argv, script_cmds_file, script_cmd, stayInCommandLoop);
         MainGraphics();
-    } else {
-        main_loop(script_cmds_file, script_cmd, stayInCommandLoop);
-    }
+#  else
+        // for *nix distro's,  check environment variable to verify a display
+        const char *display = getenv("DISPLAY");
+        if (display && strlen(display) > 1) {
+            InitGraphics(argc, argv, script_cmds_file, script_cmd, stayInCommandLoop);
+            MainGraphics();
+        } else {
+            main_loop(script_cmds_file, script_cmd, stayInCommandLoop);
+        }
 #  endif
 
 #else
-    main_loop(script_cmds_file, script_cmd, stayInCommandLoop);
+        main_loop(script_cmds_file, script_cmd, stayInCommandLoop);
 #endif
+    }
 
     // Clean up the port
     if (g_session.pm3_present) {
@@ -47,6 +47,10 @@
 #define MAX_NESTED_CMDSCRIPT 10
 #define MAX_NESTED_LUASCRIPT 10
 
+// daemon mode, see --daemon
+#define PM3_DAEMON_MAX_CLIENTS 8
+#define PM3_DAEMON_MAX_LINE 1024
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -863,7 +863,7 @@ static int l_hardnested(lua_State *L) {
     }
 
     uint64_t foundkey = 0;
-    int retval = mfnestedhard(blockNo, keyType, key, trgBlockNo, trgKeyType, haveTarget ? trgkey : NULL, nonce_file_read,  nonce_file_write,  slow,  tests, &foundkey, filename);
+    int retval = mfnestedhard(blockNo, keyType, key, trgBlockNo, trgKeyType, haveTarget ? trgkey : NULL, nonce_file_read,  nonce_file_write,  slow,  tests, &foundkey, filename, NULL, false);
     DropField();
 
     //Push the key onto the stack
@@ -84,6 +84,11 @@ int uart_reconfigure_timeouts(uint32_t value);
  */
 uint32_t uart_get_timeouts(void);
 
+/* Tell the receive path a command is queued for sending, so it returns early
+ * instead of waiting for the rx timeout. No-op where the backend doesn't support it.
+ */
+void uart_notify_tx(const serial_port sp);
+
 /* Specify the outbound address and port for TCP/UDP connections
  */
 bool uart_bind(void *socket, const char *bindAddrStr, const char *bindPortStr, bool isBindingIPv6);
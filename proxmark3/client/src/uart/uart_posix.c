@@ -37,6 +37,14 @@
 #include <sys/un.h>
 #include <errno.h>
 
+// On Linux the receive path waits on epoll and reads into a ring buffer in bulk,
+// other systems keep the select / FIONREAD / read path
+#if defined(__linux__)
+#define UART_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #ifdef HAVE_BLUEZ
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/rfcomm.h>
@@ -58,9 +66,15 @@ typedef struct {
     int fd;           // Serial port file descriptor
     term_info tiOld;  // Terminal info before using the port
     term_info tiNew;  // Terminal info during the transaction
-    RingBuffer *udpBuffer;
+    RingBuffer *udpBuffer; // Buffer for UDP, and for all ports when epoll is used
+    int efd;          // epoll instance, -1 when using select
+    int txfd;         // eventfd signalled by uart_notify_tx(), -1 when using select
+    uint8_t rx_empty_counter;
 } serial_port_unix_t_t;
 
+// size of the receive ring used with epoll, holds ~120 full NG frames
+#define UART_RX_RING_SIZE  (64 * 1024)
+
 // see pm3_cmd.h
 struct timeval timeout = {
     .tv_sec  = 0, // 0 second
@@ -69,7 +83,6 @@ struct timeval timeout = {
 
 static uint32_t newtimeout_value = 0;
 static bool newtimeout_pending = false;
-static uint8_t rx_empty_counter = 0;
 
 int uart_reconfigure_timeouts(uint32_t value) {
     newtimeout_value = value;
@@ -81,6 +94,57 @@ uint32_t uart_get_timeouts(void) {
     return newtimeout_value;
 }
 
+#ifdef UART_USE_EPOLL
+// Register the port with a new epoll instance. On failure the port keeps using select()
+// The eventfd is signalled when a command is queued for sending, so the communication thread
+// doesn't sit in uart_receive() until the rx timeout expires.
+static void uart_setup_epoll(serial_port_unix_t_t *sp) {
+
+    if (sp->udpBuffer == NULL) {
+        sp->udpBuffer = RingBuf_create(UART_RX_RING_SIZE);
+        if (sp->udpBuffer == NULL) {
+            return;
+        }
+    }
+
+    int efd = epoll_create1(EPOLL_CLOEXEC);
+    if (efd == -1) {
+        return;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sp->fd };
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, sp->fd, &ev) == -1) {
+        close(efd);
+        return;
+    }
+
+    int txfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (txfd != -1) {
+        ev.data.fd = txfd;
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, txfd, &ev) == -1) {
+            close(txfd);
+            txfd = -1;
+        }
+    }
+    sp->efd = efd;
+    sp->txfd = txfd;
+}
+#endif
+
+void uart_notify_tx(const serial_port sp) {
+#ifdef UART_USE_EPOLL
+    const serial_port_unix_t_t *spu = (serial_port_unix_t_t *)sp;
+    if (spu->txfd != -1) {
+        uint64_t one = 1;
+        if (write(spu->txfd, &one, sizeof(one)) < 0) {
+            // counter saturated, a wakeup is pending anyway
+        }
+    }
+#else
+    (void) sp;
+#endif
+}
+
 serial_port uart_open(const char *pcPortName, uint32_t speed, bool slient) {
     serial_port_unix_t_t *sp = calloc(sizeof(serial_port_unix_t_t), sizeof(uint8_t));
 
@@ -90,7 +154,9 @@ serial_port uart_open(const char *pcPortName, uint32_t speed, bool slient) {
     }
 
     sp->udpBuffer = NULL;
-    rx_empty_counter = 0;
+    sp->efd = -1;
+    sp->txfd = -1;
+    sp->rx_empty_counter = 0;
     // init timeouts
     timeout.tv_usec = UART_FPC_CLIENT_RX_TIMEOUT_MS * 1000;
     g_conn.send_via_local_ip = false;
@@ -254,6 +320,9 @@ serial_port uart_open(const char *pcPortName, uint32_t speed, bool slient) {
             sp->udpBuffer = RingBuf_create(MAX(sizeof(PacketResponseNGRaw), sizeof(PacketResponseOLD)) * 30);
         }
 
+#ifdef UART_USE_EPOLL
+        uart_setup_epoll(sp);
+#endif
         return sp;
     }
 
@@ -304,6 +373,9 @@ serial_port uart_open(const char *pcPortName, uint32_t speed, bool slient) {
 
         sp->fd = sfd;
 
+#ifdef UART_USE_EPOLL
+        uart_setup_epoll(sp);
+#endif
         g_conn.send_via_ip = PM3_NONE;
         return sp;
 #else // HAVE_BLUEZ
@@ -352,6 +424,9 @@ serial_port uart_open(const char *pcPortName, uint32_t speed, bool slient) {
 
         sp->fd = localsocket;
 
+#ifdef UART_USE_EPOLL
+        uart_setup_epoll(sp);
+#endif
         g_conn.send_via_ip = PM3_NONE;
         return sp;
     }
@@ -438,6 +513,10 @@ serial_port uart_open(const char *pcPortName, uint32_t speed, bool slient) {
     }
     g_conn.uart_speed = uart_get_speed(sp);
     g_conn.send_via_ip = PM3_NONE;
+
+#ifdef UART_USE_EPOLL
+    uart_setup_epoll(sp);
+#endif
     return sp;
 }
 
@@ -459,15 +538,113 @@ void uart_close(const serial_port sp) {
         //PrintAndLogEx(ERR, "UART error while closing port");
     }
     RingBuf_destroy(spu->udpBuffer);
+    if (spu->efd != -1) {
+        close(spu->efd);
+    }
+    if (spu->txfd != -1) {
+        close(spu->txfd);
+    }
     close(spu->fd);
     free(sp);
 }
 
+#ifdef UART_USE_EPOLL
+// Bulk receive: one read() pulls everything available into the ring, the following calls
+// (preamble, payload, postamble of the same frames) are then served without any syscall.
+static int uart_receive_epoll(serial_port_unix_t_t *spu, uint8_t *pbtRx, uint32_t pszMaxRxLen, uint32_t *pszRxLen) {
+
+    RingBuffer *ring = spu->udpBuffer;
+    int ms = timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
+
+    while (true) {
+
+        *pszRxLen += RingBuf_dequeueBatch(ring, pbtRx + (*pszRxLen), pszMaxRxLen - (*pszRxLen));
+        if (*pszRxLen == pszMaxRxLen) {
+            // We have all the data we wanted.
+            return PM3_SUCCESS;
+        }
+
+        struct epoll_event events[2];
+        int n = epoll_wait(spu->efd, events, sizeof(events) / sizeof(events[0]), ms);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return PM3_EIO;
+        }
+
+        // Read time-out
+        if (n == 0) {
+            return (*pszRxLen == 0) ? PM3_ENODATA : PM3_SUCCESS;
+        }
+
+        bool readable = false;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == spu->txfd) {
+                uint64_t cnt;
+                if (read(spu->txfd, &cnt, sizeof(cnt)) < 0) {
+                    // already reset
+                }
+                continue;
+            }
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) && (events[i].events & EPOLLIN) == 0) {
+                // This happens when USB-CDC connection is lost
+                return PM3_ENOTTY;
+            }
+            readable = true;
+        }
+
+        if (readable == false) {
+            // a command is waiting to be sent, let the communication thread send it,
+            // unless we are in the middle of a frame
+            if (*pszRxLen == 0) {
+                return PM3_ENODATA;
+            }
+            continue;
+        }
+
+        // the ring is empty at this point, read straight into it when there is room for a full frame
+        int res;
+        if (RingBuf_getContinousAvailableSize(ring) >= (int)MAX(sizeof(PacketResponseNGRaw), sizeof(PacketResponseOLD))) {
+            res = read(spu->fd, RingBuf_getRearPtr(ring), RingBuf_getContinousAvailableSize(ring));
+            if (res > 0) {
+                RingBuf_postEnqueueBatch(ring, res);
+            }
+        } else {
+            uint8_t transitBuf[MAX(sizeof(PacketResponseNGRaw), sizeof(PacketResponseOLD)) * 30];
+            res = read(spu->fd, transitBuf, MIN((int)sizeof(transitBuf), RingBuf_getAvailableSize(ring)));
+            if (res > 0) {
+                RingBuf_enqueueBatch(ring, transitBuf, res);
+            }
+        }
+
+        if (res < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            // Stop if the OS has some troubles reading the data
+            return PM3_EIO;
+        }
+
+        if (res == 0) {
+            // readable but nothing to read ===> maybe disconnected
+            // This happens when TCP connection is lost
+            spu->rx_empty_counter++;
+            if (spu->rx_empty_counter > 3) {
+                return PM3_ENOTTY;
+            }
+        } else {
+            spu->rx_empty_counter = 0;
+        }
+    }
+}
+#endif
+
 int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uint32_t *pszRxLen) {
     uint32_t byteCount;  // FIONREAD returns size on 32b
     fd_set rfds;
     struct timeval tv;
-    const serial_port_unix_t_t *spu = (serial_port_unix_t_t *)sp;
+    serial_port_unix_t_t *spu = (serial_port_unix_t_t *)sp;
 
     if (newtimeout_pending) {
         timeout.tv_usec = newtimeout_value * 1000;
@@ -475,6 +652,12 @@ int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uin
     }
     // Reset the output count
     *pszRxLen = 0;
+
+#ifdef UART_USE_EPOLL
+    if (spu->efd != -1) {
+        return uart_receive_epoll(spu, pbtRx, pszMaxRxLen, pszRxLen);
+    }
+#endif
     do {
         int res;
         if (spu->udpBuffer != NULL) {
@@ -528,12 +711,12 @@ int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uin
             // select() > 0 && byteCount > 0 ===> data available
             // select() > 0 && byteCount always equals to 0 ===> maybe disconnected
             // This happens when TCP connection is lost
-            rx_empty_counter++;
-            if (rx_empty_counter > 3) {
+            spu->rx_empty_counter++;
+            if (spu->rx_empty_counter > 3) {
                 return PM3_ENOTTY;
             }
         } else {
-            rx_empty_counter = 0;
+            spu->rx_empty_counter = 0;
         }
 
         // For UDP connection, put the incoming data into the buffer and handle them in the next round
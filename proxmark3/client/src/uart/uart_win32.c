@@ -61,6 +61,11 @@ uint32_t uart_get_timeouts(void) {
     return newtimeout_value;
 }
 
+void uart_notify_tx(const serial_port sp) {
+    // not supported, the receive path returns at the latest after the rx timeout
+    (void) sp;
+}
+
 static int uart_reconfigure_timeouts_polling(serial_port sp) {
     if (newtimeout_pending == false)
         return PM3_SUCCESS;
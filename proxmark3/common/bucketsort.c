@@ -27,17 +27,19 @@ extern void bucket_sort_intersect(uint32_t *const estart, uint32_t *const estop,
     start[1] = ostart;
     stop[1] = ostop;
 
-    // init buckets to be empty
-    for (uint32_t i = 0; i < 2; i++) {
-        for (uint32_t j = 0x00; j <= 0xff; j++) {
-            bucket[i][j].bp = bucket[i][j].head;
-        }
-    }
+    // buckets used by each list, only those are reset and scanned:
+    // deep in lfsr_recovery32() the lists are a few states long
+    uint64_t used[2][4] = {{0}};
 
     // sort the lists into the buckets based on the MSB (contribution bits)
     for (uint32_t i = 0; i < 2; i++) {
         for (p1 = start[i]; p1 <= stop[i]; p1++) {
             uint32_t bucket_index = (*p1 & 0xff000000) >> 24;
+            uint64_t bit = 1ULL << (bucket_index & 0x3f);
+            if ((used[i][bucket_index >> 6] & bit) == 0) {
+                used[i][bucket_index >> 6] |= bit;
+                bucket[i][bucket_index].bp = bucket[i][bucket_index].head;
+            }
             *(bucket[i][bucket_index].bp++) = *p1;
         }
     }
@@ -47,8 +49,12 @@ extern void bucket_sort_intersect(uint32_t *const estart, uint32_t *const estop,
     for (uint32_t i = 0; i < 2; i++) {
         p1 = start[i];
         uint32_t nonempty_bucket = 0;
-        for (uint32_t j = 0x00; j <= 0xff; j++) {
-            if (bucket[0][j].bp != bucket[0][j].head && bucket[1][j].bp != bucket[1][j].head) { // non-empty intersecting buckets only
+        for (uint32_t w = 0; w < 4; w++) {
+            uint64_t both = used[0][w] & used[1][w]; // non-empty intersecting buckets only
+            for (uint32_t j = w << 6; both; j++, both >>= 1) {
+                if ((both & 1) == 0) {
+                    continue;
+                }
                 bucket_info->bucket_info[i][nonempty_bucket].head = p1;
                 for (p2 = bucket[i][j].head; p2 < bucket[i][j].bp; *p1++ = *p2++);
                 bucket_info->bucket_info[i][nonempty_bucket].tail = p1 - 1;
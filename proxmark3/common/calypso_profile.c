@@ -0,0 +1,172 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Calypso card profile lookup, see calypso_profile.h
+//-----------------------------------------------------------------------------
+#include "calypso_profile.h"
+
+#include <string.h>
+#include "crc16.h"
+
+const uint16_t calypso_profile_sw[CALYPSO_SW_COUNT] = {
+    0x6A82,     // SELECT, file not found
+    0x6A83,     // READ RECORD, record not found
+    0x6B00,     // GET DATA, wrong P1 P2
+    0x6D00,     // INS not supported
+};
+
+uint8_t calypso_profile_sw_index(uint8_t ins) {
+    switch (ins) {
+        case CALYPSO_INS_SELECT:
+            return 0;
+        case CALYPSO_INS_READ_RECORD:
+            return 1;
+        case CALYPSO_INS_GET_DATA:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+// profile at data if it is one and fits in maxsize bytes, else NULL
+const calypso_profile_hdr_t *calypso_profile_check(const uint8_t *data, uint32_t maxsize) {
+    const calypso_profile_hdr_t *hdr = (const calypso_profile_hdr_t *)data;
+
+    if (maxsize < sizeof(calypso_profile_hdr_t)) {
+        return NULL;
+    }
+    if (hdr->magic != CALYPSO_PROFILE_MAGIC || hdr->version != CALYPSO_PROFILE_VERSION) {
+        return NULL;
+    }
+    if (hdr->size > maxsize || hdr->bucket_count == 0 || (hdr->bucket_count & (hdr->bucket_count - 1)) != 0) {
+        return NULL;
+    }
+    uint32_t tables = sizeof(calypso_profile_hdr_t) + hdr->bucket_count * sizeof(uint16_t) + hdr->entry_count * sizeof(calypso_profile_entry_t);
+    if (tables > hdr->size) {
+        return NULL;
+    }
+    // the simulator copies responses into frames of MAX_FRAME_SIZE, don't trust the client cap
+    const calypso_profile_entry_t *entries = calypso_profile_entries(hdr);
+    for (uint16_t i = 0; i < hdr->entry_count; i++) {
+        if (entries[i].resp_len > CALYPSO_PROFILE_MAX_RESP || entries[i].resp_offset + entries[i].resp_len > hdr->size) {
+            return NULL;
+        }
+    }
+    return hdr;
+}
+
+const calypso_profile_entry_t *calypso_profile_entries(const calypso_profile_hdr_t *hdr) {
+    const uint8_t *base = (const uint8_t *)hdr + sizeof(calypso_profile_hdr_t) + hdr->bucket_count * sizeof(uint16_t);
+    return (const calypso_profile_entry_t *)base;
+}
+
+const calypso_profile_entry_t *calypso_profile_lookup(const calypso_profile_hdr_t *hdr, uint16_t file, uint8_t ins, uint8_t p1, uint8_t p2, uint16_t arg) {
+    const uint16_t *buckets = (const uint16_t *)((const uint8_t *)hdr + sizeof(calypso_profile_hdr_t));
+    const calypso_profile_entry_t *entries = calypso_profile_entries(hdr);
+
+    uint16_t i = buckets[calypso_profile_hash(file, ins, p1, p2, arg) & (hdr->bucket_count - 1)];
+
+    // entry_count bounds the walk if the chain is corrupted
+    for (uint16_t n = 0; i < hdr->entry_count && n < hdr->entry_count; n++) {
+        const calypso_profile_entry_t *e = &entries[i];
+        if (e->file == file && e->ins == ins && e->p1 == p1 && e->p2 == p2 && e->arg == arg) {
+            if (e->resp_len > CALYPSO_PROFILE_MAX_RESP || e->resp_offset + e->resp_len > hdr->size) {
+                return NULL;
+            }
+            return e;
+        }
+        i = e->next;
+    }
+    return NULL;
+}
+
+// Entry answering an APDU (CLA INS P1 P2 [Lc data]) with the current selection,
+// NULL when the card answers with a status word
+const calypso_profile_entry_t *calypso_profile_resolve(const calypso_profile_hdr_t *hdr, const calypso_sel_t *sel, const uint8_t *apdu, uint16_t apdu_len) {
+    if (apdu_len < 4) {
+        return NULL;
+    }
+
+    uint8_t ins = apdu[1];
+    uint8_t p1 = apdu[2];
+    uint8_t p2 = apdu[3];
+    uint16_t arg = calypso_profile_arg(apdu, apdu_len);
+
+    if (ins == CALYPSO_INS_READ_RECORD && (p2 >> 3) == 0) {
+        // current EF
+        return calypso_profile_lookup(hdr, sel->ef, ins, p1, p2, arg);
+    }
+
+    uint16_t file = sel->df;
+    uint8_t lc = (apdu_len > 4) ? apdu[4] : 0;
+    if (ins == CALYPSO_INS_SELECT && (p1 & 0x08) && lc >= 4 && lc <= apdu_len - 5) {
+        // select by path, the parent is the FID before the last one
+        file = (apdu[5 + lc - 4] << 8) | apdu[5 + lc - 3];
+    }
+    const calypso_profile_entry_t *e = calypso_profile_lookup(hdr, file, ins, p1, p2, arg);
+    if (e == NULL) {
+        e = calypso_profile_lookup(hdr, CALYPSO_ANY_FILE, ins, p1, p2, arg);
+    }
+    return e;
+}
+
+// What the card selects once e is answered
+void calypso_profile_select(calypso_sel_t *sel, const calypso_profile_entry_t *e) {
+    if (e == NULL) {
+        return;
+    }
+    if (e->flags & CALYPSO_ENTRY_SELECT_DF) {
+        sel->df = e->target;
+        sel->ef = CALYPSO_NO_FILE;
+    } else if (e->flags & CALYPSO_ENTRY_SELECT_EF) {
+        sel->df = (e->file == CALYPSO_ANY_FILE) ? CALYPSO_MF : e->file;
+        sel->ef = e->target;
+    }
+}
+
+// I-block answer to cmd (PCB [CID] [NAD] APDU CRC) in resp: the same PCB / CID / NAD, the answer of
+// entry e or the usual status word when e is NULL, and the CRC. Returns the frame length
+uint16_t calypso_profile_build(const calypso_profile_hdr_t *hdr, const calypso_profile_entry_t *e, const uint8_t *cmd, uint8_t hlen, uint8_t *resp) {
+    memcpy(resp, cmd, hlen);
+    uint16_t n = hlen;
+    if (e) {
+        memcpy(resp + n, (const uint8_t *)hdr + e->resp_offset, e->resp_len);
+        n += e->resp_len;
+    } else {
+        uint16_t sw = calypso_profile_sw[calypso_profile_sw_index(cmd[hlen + 1])];
+        resp[n++] = sw >> 8;
+        resp[n++] = sw & 0xFF;
+    }
+    compute_crc(CRC_14443_B, resp, n, resp + n, resp + n + 1);
+    return n + 2;
+}
+
+// Answer a reader I-block from the profile with the current selection sel. The entry answered, NULL
+// for a status word, goes to entry for calypso_profile_select(). Returns the frame length in resp,
+// 0 when cmd is no I-block with an APDU
+uint16_t calypso_profile_answer(const calypso_profile_hdr_t *hdr, const calypso_sel_t *sel, const uint8_t *cmd, uint16_t len, uint8_t *resp, const calypso_profile_entry_t **entry) {
+    *entry = NULL;
+    if (len < 1 || (cmd[0] & 0xE2) != 0x02) {
+        return 0;
+    }
+
+    uint8_t hlen = 1 + ((cmd[0] & 0x08) ? 1 : 0) + ((cmd[0] & 0x04) ? 1 : 0);
+    if (len < hlen + 4 + 2) {
+        return 0;
+    }
+
+    *entry = calypso_profile_resolve(hdr, sel, cmd + hlen, len - hlen - 2);
+    return calypso_profile_build(hdr, *entry, cmd, hlen, resp);
+}
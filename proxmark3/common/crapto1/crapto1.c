@@ -19,6 +19,7 @@
 #include "bucketsort.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include "parity.h"
 
 
@@ -108,13 +109,268 @@ static inline void extend_table_simple(uint32_t *tbl, uint32_t **end, int bit) {
         }
     }
 }
+
+#if !defined(__arm__) || defined(__linux__) || defined(_WIN32) || defined(__APPLE__) // bare metal ARM Proxmark lacks malloc()/free()
+
+// 64 x 64 bit matrix transpose: bit c of a[r] goes to bit r of a[c]
+static inline void crypto1_bs_transpose(uint64_t *a) {
+    uint64_t m = 0x00000000FFFFFFFFULL;
+    for (uint32_t j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for (uint32_t k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k] ^= t << j;
+            a[k | j] ^= t;
+        }
+    }
+}
+
+// Vectorized table extension for lfsr_recovery32(), see crapto1_simd.h, and
+// bitsliced crypto1 for crypto1_bs_words(), see crypto1_bs.h. The scalar
+// extend_table() and crypto1_word() stay the reference, used with CRAPTO1_SIMD_NONE.
+#if defined(__GNUC__)
+#define SIMD_NAME(x) x##_64
+#define SIMD_ATTR
+#define SIMD_LANES64 1
+#include "crypto1_bs.h"
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRAPTO1_SIMD_X86
+
+#define SIMD_NAME(x) x##_avx512
+#define SIMD_ATTR __attribute__((target("avx512f")))
+#define SIMD_LANES 16
+#include "crapto1_simd.h"
+#define SIMD_NAME(x) x##_avx512
+#define SIMD_ATTR __attribute__((target("avx512f")))
+#define SIMD_LANES64 8
+#include "crypto1_bs.h"
+
+#define SIMD_NAME(x) x##_avx2
+#define SIMD_ATTR __attribute__((target("avx2")))
+#define SIMD_LANES 8
+#include "crapto1_simd.h"
+#define SIMD_NAME(x) x##_avx2
+#define SIMD_ATTR __attribute__((target("avx2")))
+#define SIMD_LANES64 4
+#include "crypto1_bs.h"
+
+#define SIMD_NAME(x) x##_sse2
+#define SIMD_ATTR __attribute__((target("sse2")))
+#define SIMD_LANES 4
+#include "crapto1_simd.h"
+#define SIMD_NAME(x) x##_sse2
+#define SIMD_ATTR __attribute__((target("sse2")))
+#define SIMD_LANES64 2
+#include "crypto1_bs.h"
+
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define CRAPTO1_SIMD_NEON
+
+#define SIMD_NAME(x) x##_neon
+#define SIMD_ATTR
+#define SIMD_LANES 4
+#include "crapto1_simd.h"
+#define SIMD_NAME(x) x##_neon
+#define SIMD_ATTR
+#define SIMD_LANES64 2
+#include "crypto1_bs.h"
+#endif
+
+typedef struct {
+    uint32_t (*extend)(const uint32_t *tbl, uint32_t n, uint32_t *out, int bit, uint32_t m1, uint32_t m2, uint32_t in, bool contrib);
+    void (*init)(uint32_t *odd, uint32_t *odd_cnt, int oks, uint32_t *even, uint32_t *even_cnt, int eks);
+} crapto1_kernel_t;
+
+// kernel and its out of place buffer, no kernel for the scalar tables
+typedef struct {
+    const crapto1_kernel_t *kernel;
+    uint32_t *scratch;
+} crapto1_extend_t;
+
+static crapto1_simd_t crapto1_simd = CRAPTO1_SIMD_AUTO;
+
+bool crapto1_simd_supported(crapto1_simd_t instr) {
+#if defined(CRAPTO1_SIMD_X86)
+    __builtin_cpu_init();
+#endif
+    switch (instr) {
+        case CRAPTO1_SIMD_AVX512:
+#if defined(CRAPTO1_SIMD_X86)
+            return __builtin_cpu_supports("avx512f");
+#else
+            return false;
+#endif
+        case CRAPTO1_SIMD_AVX2:
+#if defined(CRAPTO1_SIMD_X86)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        case CRAPTO1_SIMD_SSE2:
+#if defined(CRAPTO1_SIMD_X86)
+            return __builtin_cpu_supports("sse2");
+#else
+            return false;
+#endif
+        case CRAPTO1_SIMD_NEON:
+#if defined(CRAPTO1_SIMD_NEON)
+            return true;
+#else
+            return false;
+#endif
+        case CRAPTO1_SIMD_NONE:
+            return true;
+        case CRAPTO1_SIMD_AUTO:
+        default:
+            return false;
+    }
+}
+
+crapto1_simd_t crapto1_get_simd_auto(void) {
+    static const crapto1_simd_t order[] = { CRAPTO1_SIMD_AVX512, CRAPTO1_SIMD_AVX2, CRAPTO1_SIMD_SSE2, CRAPTO1_SIMD_NEON };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (crapto1_simd_supported(order[i])) {
+            return order[i];
+        }
+    }
+    return CRAPTO1_SIMD_NONE;
+}
+
+crapto1_simd_t crapto1_get_simd(void) {
+    if (crapto1_simd == CRAPTO1_SIMD_AUTO) {
+        crapto1_simd = crapto1_get_simd_auto();
+    }
+    return crapto1_simd;
+}
+
+// unsupported instruction sets fall back to the scalar tables
+void crapto1_set_simd(crapto1_simd_t instr) {
+    crapto1_simd = (instr == CRAPTO1_SIMD_AUTO || crapto1_simd_supported(instr)) ? instr : CRAPTO1_SIMD_NONE;
+}
+
+static const crapto1_kernel_t *crapto1_get_kernel(void) {
+#if defined(CRAPTO1_SIMD_X86)
+    static const crapto1_kernel_t k_avx512 = { extend_avx512, init_avx512 };
+    static const crapto1_kernel_t k_avx2 = { extend_avx2, init_avx2 };
+    static const crapto1_kernel_t k_sse2 = { extend_sse2, init_sse2 };
+#endif
+#if defined(CRAPTO1_SIMD_NEON)
+    static const crapto1_kernel_t k_neon = { extend_neon, init_neon };
+#endif
+
+    switch (crapto1_get_simd()) {
+#if defined(CRAPTO1_SIMD_X86)
+        case CRAPTO1_SIMD_AVX512:
+            return &k_avx512;
+        case CRAPTO1_SIMD_AVX2:
+            return &k_avx2;
+        case CRAPTO1_SIMD_SSE2:
+            return &k_sse2;
+#else
+        case CRAPTO1_SIMD_AVX512:
+        case CRAPTO1_SIMD_AVX2:
+        case CRAPTO1_SIMD_SSE2:
+#endif
+#if defined(CRAPTO1_SIMD_NEON)
+        case CRAPTO1_SIMD_NEON:
+            return &k_neon;
+#else
+        case CRAPTO1_SIMD_NEON:
+#endif
+        case CRAPTO1_SIMD_AUTO:
+        case CRAPTO1_SIMD_NONE:
+        default:
+            return NULL;
+    }
+}
+
+/** crypto1_bs_words
+ * count keys set up with crypto1_create(), all fed the same nwords words as
+ * crypto1_word(pcs, in[w], (enc >> w) & 1). ks[i * nwords + w] is what word w
+ * returned for keys[i]. Bitsliced over crypto1_bs_lanes() keys at a time.
+ */
+void crypto1_bs_words(const uint64_t *keys, uint32_t count, const uint32_t *in, uint32_t enc, uint32_t nwords, uint32_t *ks) {
+    switch (crapto1_get_simd()) {
+#if defined(CRAPTO1_SIMD_X86)
+        case CRAPTO1_SIMD_AVX512:
+            bs_words_avx512(keys, count, in, enc, nwords, ks);
+            return;
+        case CRAPTO1_SIMD_AVX2:
+            bs_words_avx2(keys, count, in, enc, nwords, ks);
+            return;
+        case CRAPTO1_SIMD_SSE2:
+            bs_words_sse2(keys, count, in, enc, nwords, ks);
+            return;
+#else
+        case CRAPTO1_SIMD_AVX512:
+        case CRAPTO1_SIMD_AVX2:
+        case CRAPTO1_SIMD_SSE2:
+#endif
+#if defined(CRAPTO1_SIMD_NEON)
+        case CRAPTO1_SIMD_NEON:
+            bs_words_neon(keys, count, in, enc, nwords, ks);
+            return;
+#else
+        case CRAPTO1_SIMD_NEON:
+#endif
+        case CRAPTO1_SIMD_AUTO:
+        case CRAPTO1_SIMD_NONE:
+        default:
+            break;
+    }
+#if defined(__GNUC__)
+    bs_words_64(keys, count, in, enc, nwords, ks);
+#else
+    for (uint32_t i = 0; i < count; i++) {
+        struct Crypto1State s;
+        crypto1_init(&s, keys[i]);
+        for (uint32_t w = 0; w < nwords; w++) {
+            ks[i * nwords + w] = crypto1_word(&s, in[w], (enc >> w) & 1);
+        }
+    }
+#endif
+}
+
+// keys per pass of crypto1_bs_words(), callers size their batches on it
+uint32_t crypto1_bs_lanes(void) {
+    switch (crapto1_get_simd()) {
+        case CRAPTO1_SIMD_AVX512:
+            return 512;
+        case CRAPTO1_SIMD_AVX2:
+            return 256;
+        case CRAPTO1_SIMD_SSE2:
+        case CRAPTO1_SIMD_NEON:
+            return 128;
+        case CRAPTO1_SIMD_AUTO:
+        case CRAPTO1_SIMD_NONE:
+        default:
+            return 64;
+    }
+}
+
+// extend_table() / extend_table_simple() with the selected kernel
+static inline void extend_table_any(const crapto1_extend_t *x, uint32_t *tbl, uint32_t **end, int bit, int m1, int m2, uint32_t in, bool contrib) {
+    if (x->kernel == NULL) {
+        if (contrib) {
+            extend_table(tbl, end, bit, m1, m2, in);
+        } else {
+            extend_table_simple(tbl, end, bit);
+        }
+        return;
+    }
+    uint32_t n = x->kernel->extend(tbl, *end + 1 - tbl, x->scratch, bit, m1, m2, in, contrib);
+    memcpy(tbl, x->scratch, n * sizeof(uint32_t));
+    *end = tbl + n - 1;
+}
+
 /** recover
  * recursively narrow down the search space, 4 bits of keystream at a time
  */
 static struct Crypto1State *
 recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
         uint32_t *e_head, uint32_t *e_tail, uint32_t eks, int rem,
-        struct Crypto1State *sl, uint32_t in, bucket_array_t bucket) {
+        struct Crypto1State *sl, uint32_t in, bucket_array_t bucket, const crapto1_extend_t *ext) {
     bucket_info_t bucket_info;
 
     if (rem == -1) {
@@ -133,11 +389,11 @@ recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
         oks >>= 1;
         eks >>= 1;
         in >>= 2;
-        extend_table(o_head, &o_tail, oks & 1, LF_POLY_EVEN << 1 | 1, LF_POLY_ODD << 1, 0);
+        extend_table_any(ext, o_head, &o_tail, oks & 1, LF_POLY_EVEN << 1 | 1, LF_POLY_ODD << 1, 0, true);
         if (o_head > o_tail)
             return sl;
 
-        extend_table(e_head, &e_tail, eks & 1, LF_POLY_ODD, LF_POLY_EVEN << 1 | 1, in & 3);
+        extend_table_any(ext, e_head, &e_tail, eks & 1, LF_POLY_ODD, LF_POLY_EVEN << 1 | 1, in & 3, true);
         if (e_head > e_tail)
             return sl;
     }
@@ -147,14 +403,12 @@ recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
     for (int i = bucket_info.numbuckets - 1; i >= 0; i--) {
         sl = recover(bucket_info.bucket_info[1][i].head, bucket_info.bucket_info[1][i].tail, oks,
                      bucket_info.bucket_info[0][i].head, bucket_info.bucket_info[0][i].tail, eks,
-                     rem, sl, in, bucket);
+                     rem, sl, in, bucket, ext);
     }
 
     return sl;
 }
 
-
-#if !defined(__arm__) || defined(__linux__) || defined(_WIN32) || defined(__APPLE__) // bare metal ARM Proxmark lacks malloc()/free()
 /** lfsr_recovery
  * recover the state of the lfsr given 32 bits of the keystream
  * additionally you can use the in parameter to specify the value
@@ -172,10 +426,15 @@ struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in) {
     for (i = 30; i >= 0; i -= 2)
         eks = eks << 1 | BEBIT(ks2, i);
 
+    crapto1_extend_t ext = { crapto1_get_kernel(), NULL };
+
     odd_head = odd_tail = calloc(1, sizeof(uint32_t) << 21);
     even_head = even_tail = calloc(1, sizeof(uint32_t) << 21);
     statelist =  calloc(1, sizeof(struct Crypto1State) << 18);
-    if (!odd_tail-- || !even_tail-- || !statelist) {
+    if (ext.kernel) {
+        ext.scratch = malloc(sizeof(uint32_t) << 21);
+    }
+    if (!odd_tail-- || !even_tail-- || !statelist || (ext.kernel && !ext.scratch)) {
         free(statelist);
         statelist = 0;
         goto out;
@@ -198,26 +457,33 @@ struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in) {
     // initialize statelists: add all possible states which would result into the rightmost 2 bits of the keystream
     uint8_t oks_b1 = oks & 1;
     uint8_t eks_b1 = eks & 1;
-    register uint8_t tbl_filter;
-    for (i = 1 << 20; i >= 0; --i) {
-        tbl_filter = filter(i);
-        if (tbl_filter == oks_b1)
-            *++odd_tail = i;
-        if (tbl_filter == eks_b1)
-            *++even_tail = i;
+    if (ext.kernel) {
+        uint32_t odd_cnt, even_cnt;
+        ext.kernel->init(odd_head, &odd_cnt, oks_b1, even_head, &even_cnt, eks_b1);
+        odd_tail = odd_head + odd_cnt - 1;
+        even_tail = even_head + even_cnt - 1;
+    } else {
+        register uint8_t tbl_filter;
+        for (i = 1 << 20; i >= 0; --i) {
+            tbl_filter = filter(i);
+            if (tbl_filter == oks_b1)
+                *++odd_tail = i;
+            if (tbl_filter == eks_b1)
+                *++even_tail = i;
+        }
     }
 
     // extend the statelists. Look at the next 8 Bits of the keystream (4 Bit each odd and even):
     for (i = 0; i < 4; i++) {
-        extend_table_simple(odd_head,  &odd_tail, (oks >>= 1) & 1);
-        extend_table_simple(even_head, &even_tail, (eks >>= 1) & 1);
+        extend_table_any(&ext, odd_head,  &odd_tail, (oks >>= 1) & 1, 0, 0, 0, false);
+        extend_table_any(&ext, even_head, &even_tail, (eks >>= 1) & 1, 0, 0, 0, false);
     }
 
     // the statelists now contain all states which could have generated the last 10 Bits of the keystream.
     // 22 bits to go to recover 32 bits in total. From now on, we need to take the "in"
     // parameter into account.
     in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00); // Byte swapping
-    recover(odd_head, odd_tail, oks, even_head, even_tail, eks, 11, statelist, in << 1, bucket);
+    recover(odd_head, odd_tail, oks, even_head, even_tail, eks, 11, statelist, in << 1, bucket, &ext);
 
 out:
     for (i = 0; i < 2; i++)
@@ -225,6 +491,136 @@ out:
             free(bucket[i][j].head);
     free(odd_head);
     free(even_head);
+    free(ext.scratch);
+    return statelist;
+}
+
+/** lfsr_recovery32_table
+ * first step of lfsr_recovery32() split for multi-threaded callers: the odd
+ * (odd != 0) or even table grown from the initial states of part out of
+ * parts, extended up to the first bucket split of recover(). Every part is
+ * independent. Returns a table of *len states to free(), NULL when out of memory.
+ */
+uint32_t *lfsr_recovery32_table(uint32_t ks2, uint32_t in, int odd, uint32_t part, uint32_t parts, uint32_t *len) {
+    uint32_t ks = 0;
+    int i;
+
+    for (i = odd ? 31 : 30; i >= 0; i -= 2)
+        ks = ks << 1 | BEBIT(ks2, i);
+
+    uint32_t lo = ((uint64_t)((1 << 20) + 1) * part) / parts;
+    uint32_t hi = ((uint64_t)((1 << 20) + 1) * (part + 1)) / parts;
+
+    // same headroom as lfsr_recovery32(), the table grows and shrinks while extended
+    uint32_t *head = malloc(sizeof(uint32_t) << 21);
+    uint32_t *tail = head - 1;
+    crapto1_extend_t ext = { crapto1_get_kernel(), NULL };
+    if (ext.kernel) {
+        ext.scratch = malloc(sizeof(uint32_t) << 21);
+    }
+    if (head == NULL || (ext.kernel && ext.scratch == NULL)) {
+        free(head);
+        free(ext.scratch);
+        return NULL;
+    }
+
+    for (uint32_t x = lo; x < hi; x++) {
+        if (filter(x) == (ks & 1))
+            *++tail = x;
+    }
+
+    for (i = 0; i < 4; i++) {
+        extend_table_any(&ext, head, &tail, (ks >>= 1) & 1, 0, 0, 0, false);
+    }
+
+    in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00);
+    in <<= 1;
+    for (i = 0; i < 4; i++) {
+        ks >>= 1;
+        in >>= 2;
+        if (odd) {
+            extend_table_any(&ext, head, &tail, ks & 1, LF_POLY_EVEN << 1 | 1, LF_POLY_ODD << 1, 0, true);
+        } else {
+            extend_table_any(&ext, head, &tail, ks & 1, LF_POLY_ODD, LF_POLY_EVEN << 1 | 1, in & 3, true);
+        }
+    }
+
+    free(ext.scratch);
+    *len = tail + 1 - head;
+    return head;
+}
+
+// tables of lfsr_recovery32_bucket(), kept by the calling thread: mapping fresh
+// memory for each of the 256 buckets would cost more than recovering them
+struct crapto1_recovery_ws {
+    uint32_t *odd;
+    uint32_t *even;
+    uint32_t *buckets;
+    crapto1_extend_t ext;
+};
+
+crapto1_recovery_ws_t *crapto1_recovery_ws_alloc(void) {
+    crapto1_recovery_ws_t *ws = calloc(1, sizeof(crapto1_recovery_ws_t));
+    if (ws == NULL) {
+        return NULL;
+    }
+    ws->odd = malloc(sizeof(uint32_t) << 21);
+    ws->even = malloc(sizeof(uint32_t) << 21);
+    ws->buckets = malloc(sizeof(uint32_t) << 23);
+    ws->ext.kernel = crapto1_get_kernel();
+    if (ws->ext.kernel) {
+        ws->ext.scratch = malloc(sizeof(uint32_t) << 21);
+    }
+    if (!ws->odd || !ws->even || !ws->buckets || (ws->ext.kernel && !ws->ext.scratch)) {
+        crapto1_recovery_ws_free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+void crapto1_recovery_ws_free(crapto1_recovery_ws_t *ws) {
+    if (ws == NULL) {
+        return;
+    }
+    free(ws->odd);
+    free(ws->even);
+    free(ws->buckets);
+    free(ws->ext.scratch);
+    free(ws);
+}
+
+/** lfsr_recovery32_bucket
+ * second step: the statelist out of the odd and even states of all parts
+ * sharing the same top byte (feedback contribution). The statelists of the
+ * 256 top bytes together are the lfsr_recovery32() statelist.
+ */
+struct Crypto1State *lfsr_recovery32_bucket(crapto1_recovery_ws_t *ws, uint32_t ks2, uint32_t in, const uint32_t *odd, uint32_t odd_len, const uint32_t *even, uint32_t even_len) {
+    uint32_t oks = 0, eks = 0;
+    int i;
+
+    struct Crypto1State *statelist = calloc(1, sizeof(struct Crypto1State) << 18);
+    if (statelist == NULL || odd_len == 0 || even_len == 0) {
+        return statelist;
+    }
+
+    for (i = 31; i >= 0; i -= 2)
+        oks = oks << 1 | BEBIT(ks2, i);
+    for (i = 30; i >= 0; i -= 2)
+        eks = eks << 1 | BEBIT(ks2, i);
+
+    bucket_array_t bucket;
+    for (i = 0; i < 2; i++) {
+        for (uint32_t j = 0; j <= 0xff; j++) {
+            bucket[i][j].head = bucket[i][j].bp = ws->buckets + ((i << 8 | j) << 14);
+        }
+    }
+
+    memcpy(ws->odd, odd, odd_len * sizeof(uint32_t));
+    memcpy(ws->even, even, even_len * sizeof(uint32_t));
+
+    // continue recover() where lfsr_recovery32_table() stopped: 8 keystream bits and 4 input pairs consumed
+    in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00);
+    recover(ws->odd, ws->odd + odd_len - 1, oks >> 8, ws->even, ws->even + even_len - 1, eks >> 8, 7, statelist, in << 1 >> 8, bucket, &ws->ext);
     return statelist;
 }
 
@@ -506,6 +902,24 @@ static struct Crypto1State *check_pfx_parity(uint32_t prefix, uint32_t rresp, ui
 }
 
 #if !defined(__arm__) || defined(__linux__) || defined(_WIN32) || defined(__APPLE__) // bare metal ARM Proxmark lacks malloc()/free()
+/** lfsr_common_prefix_odd
+ * The states of lfsr_common_prefix() from one odd partial state of
+ * lfsr_prefix_ks(ks, 1), against the whole -1 terminated even list.
+ * sl has room for 64 states per even entry, the end of the states written is
+ * returned. Independent per odd entry, a caller may split the odd list on threads
+ */
+struct Crypto1State *lfsr_common_prefix_odd(uint32_t pfx, uint32_t rr, uint8_t par[8][8], uint32_t no_par, uint32_t odd, const uint32_t *even, struct Crypto1State *sl) {
+    for (const uint32_t *e = even; *e + 1; ++e) {
+        uint32_t o = odd, ev = *e;
+        for (uint32_t top = 0; top < 64; ++top) {
+            o += 1 << 21;
+            ev += (!(top & 7) + 1) << 21;
+            sl = check_pfx_parity(pfx, rr, par, o, ev, sl, no_par);
+        }
+    }
+    return sl;
+}
+
 /** lfsr_common_prefix
  * Implementation of the common prefix attack.
  * Requires the 28 bit constant prefix used as reader nonce (pfx)
@@ -518,7 +932,7 @@ static struct Crypto1State *check_pfx_parity(uint32_t prefix, uint32_t rresp, ui
 
 struct Crypto1State *lfsr_common_prefix(uint32_t pfx, uint32_t rr, uint8_t ks[8], uint8_t par[8][8], uint32_t no_par) {
     struct Crypto1State *statelist, *s;
-    uint32_t *odd, *even, *o, *e, top;
+    uint32_t *odd, *even, *o;
 
     odd = lfsr_prefix_ks(ks, 1);
     even = lfsr_prefix_ks(ks, 0);
@@ -531,12 +945,7 @@ struct Crypto1State *lfsr_common_prefix(uint32_t pfx, uint32_t rr, uint8_t ks[8]
     }
 
     for (o = odd; *o + 1; ++o)
-        for (e = even; *e + 1; ++e)
-            for (top = 0; top < 64; ++top) {
-                *o += 1 << 21;
-                *e += (!(top & 7) + 1) << 21;
-                s = check_pfx_parity(pfx, rr, par, *o, *e, s, no_par);
-            }
+        s = lfsr_common_prefix_odd(pfx, rr, par, no_par, *o, even, s);
 
     s->odd = s->even = 0;
 out:
@@ -36,9 +36,35 @@ uint32_t prng_successor(uint32_t x, uint32_t n);
 
 #if !defined(__arm__) || defined(__linux__) || defined(_WIN32) || defined(__APPLE__) // bare metal ARM Proxmark lacks malloc()/free()
 struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in);
+// lfsr_recovery32() in two steps, for callers running it on several threads
+uint32_t *lfsr_recovery32_table(uint32_t ks2, uint32_t in, int odd, uint32_t part, uint32_t parts, uint32_t *len);
+typedef struct crapto1_recovery_ws crapto1_recovery_ws_t;
+crapto1_recovery_ws_t *crapto1_recovery_ws_alloc(void);
+void crapto1_recovery_ws_free(crapto1_recovery_ws_t *ws);
+struct Crypto1State *lfsr_recovery32_bucket(crapto1_recovery_ws_t *ws, uint32_t ks2, uint32_t in, const uint32_t *odd, uint32_t odd_len, const uint32_t *even, uint32_t even_len);
+
+// lfsr_recovery32() table extension kernel, picked at run time like hardnested
+typedef enum {
+    CRAPTO1_SIMD_AUTO,
+    CRAPTO1_SIMD_AVX512,
+    CRAPTO1_SIMD_AVX2,
+    CRAPTO1_SIMD_SSE2,
+    CRAPTO1_SIMD_NEON,
+    CRAPTO1_SIMD_NONE,      // scalar reference
+} crapto1_simd_t;
+
+bool crapto1_simd_supported(crapto1_simd_t instr);
+crapto1_simd_t crapto1_get_simd_auto(void);
+crapto1_simd_t crapto1_get_simd(void);
+void crapto1_set_simd(crapto1_simd_t instr);
+
+// bitsliced crypto1, many keys fed the same words, with the instruction set above
+void crypto1_bs_words(const uint64_t *keys, uint32_t count, const uint32_t *in, uint32_t enc, uint32_t nwords, uint32_t *ks);
+uint32_t crypto1_bs_lanes(void);
 struct Crypto1State *lfsr_recovery64(uint32_t ks2, uint32_t ks3);
 struct Crypto1State *
 lfsr_common_prefix(uint32_t pfx, uint32_t rr, uint8_t ks[8], uint8_t par[8][8], uint32_t no_par);
+struct Crypto1State *lfsr_common_prefix_odd(uint32_t pfx, uint32_t rr, uint8_t par[8][8], uint32_t no_par, uint32_t odd, const uint32_t *even, struct Crypto1State *sl);
 #endif
 uint32_t *lfsr_prefix_ks(const uint8_t ks[8], int isodd);
 
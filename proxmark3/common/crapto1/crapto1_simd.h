@@ -0,0 +1,119 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// lfsr_recovery32() table extension kernel, included by crapto1.c once per
+// instruction set with
+//
+//   SIMD_NAME(x)   x suffixed with the instruction set
+//   SIMD_ATTR      function attributes (target)
+//   SIMD_LANES     32 bit lanes per vector
+//
+// The filter function is evaluated as its boolean network on whole vectors,
+// no table lookup, and the parity by folding: only shifts by constants and
+// bitwise operations, which every instruction set has.
+//-----------------------------------------------------------------------------
+
+typedef uint32_t SIMD_NAME(vec) __attribute__((vector_size(SIMD_LANES * 4)));
+
+// filter(x) in bit 0 of each lane. The nibble functions 0xf22c (nibbles 0, 2, 3)
+// and 0xd938 (nibbles 1, 4) are computed for all nibbles at once, the results
+// landing in bit 0 of their nibble, then combined by 0xEC57E80A.
+static inline SIMD_ATTR SIMD_NAME(vec) SIMD_NAME(filter)(SIMD_NAME(vec) x) {
+    SIMD_NAME(vec) a = x >> 3, b = x >> 2, c = x >> 1, d = x;
+    SIMD_NAME(vec) fa = ((a | b) ^ (a & d)) ^ (c & ((a ^ b) | d));
+    SIMD_NAME(vec) fb = ((a & b) | c) ^ ((a ^ b) & (c | d));
+    SIMD_NAME(vec) r = (fb & 0x01101) | (fa & 0x10010);
+
+    SIMD_NAME(vec) y0 = r >> 16, y1 = r >> 12, y2 = r >> 8, y3 = r >> 4, y4 = r;
+    return ((y0 | ((y1 | y4) & (y3 ^ y4))) ^ ((y0 ^ (y1 & y3)) & ((y2 ^ y3) | (y1 & y4)))) & 1;
+}
+
+static inline SIMD_ATTR SIMD_NAME(vec) SIMD_NAME(parity)(SIMD_NAME(vec) x) {
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return x & 1;
+}
+
+// update_contribution() on every lane
+static inline SIMD_ATTR SIMD_NAME(vec) SIMD_NAME(contribution)(SIMD_NAME(vec) x, uint32_t m1, uint32_t m2) {
+    return (x >> 25 << 26) | (SIMD_NAME(parity)(x & m1) << 25) | (SIMD_NAME(parity)(x & m2) << 24) | (x & 0xffffff);
+}
+
+// Out of place extend_table() / extend_table_simple(): tbl[i] << 1 and tbl[i] << 1 | 1
+// go to out when their filter gives bit, with the feedback contribution and in when
+// contrib is set. out has room for 2 * n + 1 states. Returns the states written.
+static SIMD_ATTR uint32_t SIMD_NAME(extend)(const uint32_t *tbl, uint32_t n, uint32_t *out, int bit, uint32_t m1, uint32_t m2, uint32_t in, bool contrib) {
+    uint32_t cnt = 0;
+    in <<= 24;
+
+    for (uint32_t i = 0; i < n; i += SIMD_LANES) {
+        uint32_t lanes = (n - i < SIMD_LANES) ? n - i : SIMD_LANES;
+
+        SIMD_NAME(vec) x = {0};
+        memcpy(&x, tbl + i, lanes * sizeof(uint32_t));
+
+        SIMD_NAME(vec) x0 = x << 1;
+        SIMD_NAME(vec) x1 = x0 | 1;
+        SIMD_NAME(vec) k0 = SIMD_NAME(filter)(x0) ^ bit ^ 1;
+        SIMD_NAME(vec) k1 = SIMD_NAME(filter)(x1) ^ bit ^ 1;
+        if (contrib) {
+            x0 = SIMD_NAME(contribution)(x0, m1, m2) ^ in;
+            x1 = SIMD_NAME(contribution)(x1, m1, m2) ^ in;
+        }
+
+        // branchless compaction
+        for (uint32_t l = 0; l < lanes; l++) {
+            out[cnt] = x0[l];
+            cnt += k0[l];
+            out[cnt] = x1[l];
+            cnt += k1[l];
+        }
+    }
+    return cnt;
+}
+
+// Initial statelists of lfsr_recovery32(), states 0 .. 1 << 20 which filter to the
+// first odd / even keystream bit
+static SIMD_ATTR void SIMD_NAME(init)(uint32_t *odd, uint32_t *odd_cnt, int oks, uint32_t *even, uint32_t *even_cnt, int eks) {
+    uint32_t n = (1 << 20) + 1;
+    uint32_t on = 0, en = 0;
+
+    SIMD_NAME(vec) x;
+    for (uint32_t l = 0; l < SIMD_LANES; l++) {
+        x[l] = l;
+    }
+
+    for (uint32_t i = 0; i < n; i += SIMD_LANES, x += SIMD_LANES) {
+        uint32_t lanes = (n - i < SIMD_LANES) ? n - i : SIMD_LANES;
+        SIMD_NAME(vec) f = SIMD_NAME(filter)(x);
+        SIMD_NAME(vec) ko = f ^ oks ^ 1;
+        SIMD_NAME(vec) ke = f ^ eks ^ 1;
+        for (uint32_t l = 0; l < lanes; l++) {
+            odd[on] = x[l];
+            on += ko[l];
+            even[en] = x[l];
+            en += ke[l];
+        }
+    }
+    *odd_cnt = on;
+    *even_cnt = en;
+}
+
+#undef SIMD_NAME
+#undef SIMD_ATTR
+#undef SIMD_LANES
@@ -0,0 +1,97 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced crypto1 kernel of crypto1_bs_words(), included by crapto1.c once
+// per instruction set with
+//
+//   SIMD_NAME(x)    x suffixed with the instruction set
+//   SIMD_ATTR       function attributes (target)
+//   SIMD_LANES64    64 bit words per vector, 64 keys each
+//
+// Bit k of word c of a vector belongs to key c * 64 + k. b[t] .. b[t + 47]
+// is the lfsr at step t as the stream of bits shifted in: crapto1 odd bit j
+// is b[t + 47 - 2j], even bit j is b[t + 46 - 2j].
+//-----------------------------------------------------------------------------
+
+typedef uint64_t SIMD_NAME(bsvec) __attribute__((vector_size(SIMD_LANES64 * 8)));
+
+// filter(), nibble functions 0xf22c0 / 0x3c8b0 / 0x1e458 (fb) and 0x6c9c0 / 0x0d938 (fa)
+// on the bits a b c d of each nibble (msb first), combined by 0xEC57E80A
+static inline SIMD_ATTR SIMD_NAME(bsvec) SIMD_NAME(bs_filter)(const SIMD_NAME(bsvec) *x) {
+#define BS_FB(a, b, c, d) ((((a) & (b)) | (c)) ^ (((a) ^ (b)) & ((c) | (d))))
+#define BS_FA(a, b, c, d) ((((a) | (b)) ^ ((a) & (d))) ^ ((c) & (((a) ^ (b)) | (d))))
+    SIMD_NAME(bsvec) y4 = BS_FB(x[41], x[43], x[45], x[47]);
+    SIMD_NAME(bsvec) y3 = BS_FA(x[33], x[35], x[37], x[39]);
+    SIMD_NAME(bsvec) y2 = BS_FB(x[25], x[27], x[29], x[31]);
+    SIMD_NAME(bsvec) y1 = BS_FB(x[17], x[19], x[21], x[23]);
+    SIMD_NAME(bsvec) y0 = BS_FA(x[9], x[11], x[13], x[15]);
+#undef BS_FB
+#undef BS_FA
+    return (y0 | ((y1 | y4) & (y3 ^ y4))) ^ ((y0 ^ (y1 & y3)) & ((y2 ^ y3) | (y1 & y4)));
+}
+
+static SIMD_ATTR void SIMD_NAME(bs_words)(const uint64_t *keys, uint32_t count, const uint32_t *in, uint32_t enc, uint32_t nwords, uint32_t *ks) {
+    SIMD_NAME(bsvec) b[48 + 32];
+    SIMD_NAME(bsvec) k[32];
+    uint64_t m[64];
+
+    for (uint32_t first = 0; first < count; first += SIMD_LANES64 * 64) {
+
+        // crypto1_create(): b[p] is key bit (47 - p) ^ 7
+        for (uint32_t c = 0; c < SIMD_LANES64; c++) {
+            for (uint32_t i = 0; i < 64; i++) {
+                uint32_t idx = first + c * 64 + i;
+                m[i] = (idx < count) ? keys[idx] : 0;
+            }
+            crypto1_bs_transpose(m);
+            for (uint32_t p = 0; p < 48; p++) {
+                b[p][c] = m[(47 - p) ^ 7];
+            }
+        }
+
+        for (uint32_t w = 0; w < nwords; w++) {
+            bool is_encrypted = (enc >> w) & 1;
+            for (uint32_t i = 0; i < 32; i++) {
+                const SIMD_NAME(bsvec) *x = b + i;
+                SIMD_NAME(bsvec) f = SIMD_NAME(bs_filter)(x);
+                SIMD_NAME(bsvec) feedin = (is_encrypted ? f : f ^ f) ^ (BEBIT(in[w], i) ? ~0ULL : 0);
+                // LF_POLY_ODD / LF_POLY_EVEN
+                b[i + 48] = feedin ^ x[0] ^ x[5] ^ x[9] ^ x[10] ^ x[12] ^ x[14] ^ x[15] ^ x[17] ^ x[19]
+                            ^ x[24] ^ x[25] ^ x[27] ^ x[29] ^ x[35] ^ x[39] ^ x[41] ^ x[42] ^ x[43];
+                k[24 ^ i] = f;
+            }
+            memmove(b, b + 32, 48 * sizeof(SIMD_NAME(bsvec)));
+
+            // crypto1_word() results, one word per key
+            for (uint32_t c = 0; c < SIMD_LANES64; c++) {
+                for (uint32_t q = 0; q < 32; q++) {
+                    m[q] = k[q][c];
+                    m[q + 32] = 0;
+                }
+                crypto1_bs_transpose(m);
+                for (uint32_t i = 0; i < 64; i++) {
+                    uint32_t idx = first + c * 64 + i;
+                    if (idx < count) {
+                        ks[idx * nwords + w] = (uint32_t)m[i];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#undef SIMD_NAME
+#undef SIMD_ATTR
+#undef SIMD_LANES64
@@ -0,0 +1,79 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// ISO14443-B sample level codec: tag side encoder, reader -> tag UART and
+// tag -> reader demodulator.
+// Shared by armsrc/iso14443b.c and the host simulator in tools/iso14b_sim
+//-----------------------------------------------------------------------------
+
+#ifndef __ISO14B_CODEC_H
+#define __ISO14B_CODEC_H
+
+#include "common.h"
+
+// iso14b_code_as_tag() output for a n bytes frame:
+// TR1 10 ETU, SOF 12 ETU, 10 ETU per byte, EOF 10 ETU, 4 samples per ETU
+#define ISO14B_TAG_ENC_LEN(n)   (16 + 5 * (n))
+
+// default UART buffer size, maximum allowed ISO14443 frame
+#define ISO14B_MAX_FRAME_SIZE   256
+
+// Software UART receiving the reader commands, as the simulated tag
+typedef struct {
+    enum {
+        STATE_14B_UNSYNCD,
+        STATE_14B_GOT_FALLING_EDGE_OF_SOF,
+        STATE_14B_AWAITING_START_BIT,
+        STATE_14B_RECEIVING_DATA
+    }       state;
+    uint16_t shiftReg;
+    int      bitCnt;
+    int      byteCnt;
+    int      byteCntMax;
+    int      posCnt;
+    uint8_t *output;
+} iso14b_uart_t;
+
+// Software demodulator receiving the tag answers, as the reader
+typedef struct {
+    enum {
+        DEMOD_UNSYNCD,
+        DEMOD_PHASE_REF_TRAINING,
+        WAIT_FOR_RISING_EDGE_OF_SOF,
+        DEMOD_AWAITING_START_BIT,
+        DEMOD_RECEIVING_DATA
+    }       state;
+    uint16_t bitCount;
+    int      posCount;
+    int      thisBit;
+    uint16_t shiftReg;
+    uint16_t max_len;
+    uint8_t *output;
+    uint16_t len;
+    int      sumI;
+    int      sumQ;
+} iso14b_demod_t;
+
+uint16_t iso14b_code_as_tag(const uint8_t *cmd, uint16_t len, uint8_t *out, uint16_t max);
+
+void iso14b_uart_reset(iso14b_uart_t *uart);
+void iso14b_uart_init(iso14b_uart_t *uart, uint8_t *data);
+int iso14b_uart_sample(iso14b_uart_t *uart, uint8_t bit);
+
+void iso14b_demod_reset(iso14b_demod_t *demod);
+void iso14b_demod_init(iso14b_demod_t *demod, uint8_t *data, uint16_t max_len);
+int iso14b_demod_samples(iso14b_demod_t *demod, int ci, int cq);
+
+#endif
@@ -0,0 +1,390 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// ISO7816-4 file system interpreter, see iso7816_fs.h
+//-----------------------------------------------------------------------------
+#include "iso7816_fs.h"
+
+#include <string.h>
+
+#define FS_SW_OK                0x9000
+#define FS_SW_EOF               0x6282  // end of file reached before Le bytes
+#define FS_SW_WRONG_LENGTH      0x6700
+#define FS_SW_INCOMPATIBLE      0x6981  // command incompatible with file structure
+#define FS_SW_NOT_SATISFIED     0x6985
+#define FS_SW_NO_CURRENT_EF     0x6986
+#define FS_SW_FUNC_UNSUPPORTED  0x6A81
+#define FS_SW_FILE_NOT_FOUND    0x6A82
+#define FS_SW_RECORD_NOT_FOUND  0x6A83
+#define FS_SW_WRONG_P1P2        0x6A86
+#define FS_SW_WRONG_OFFSET      0x6B00
+#define FS_SW_INS_UNSUPPORTED   0x6D00
+
+// image at data if it is one and fits in maxsize bytes, else NULL
+const iso7816_fs_hdr_t *iso7816_fs_check(const uint8_t *data, uint32_t maxsize) {
+    const iso7816_fs_hdr_t *hdr = (const iso7816_fs_hdr_t *)data;
+
+    if (maxsize < sizeof(iso7816_fs_hdr_t)) {
+        return NULL;
+    }
+    if (hdr->magic != ISO7816_FS_MAGIC || hdr->version != ISO7816_FS_VERSION) {
+        return NULL;
+    }
+    if (hdr->size > maxsize || hdr->file_count == 0 || hdr->file_count > ISO7816_FS_MAX_FILES) {
+        return NULL;
+    }
+    if (sizeof(iso7816_fs_hdr_t) + hdr->file_count * sizeof(iso7816_fs_file_t) > hdr->size) {
+        return NULL;
+    }
+
+    const iso7816_fs_file_t *files = iso7816_fs_files(hdr);
+    if (files[0].type != ISO7816_FS_DF || files[0].parent != ISO7816_FS_NO_FILE) {
+        return NULL;
+    }
+    for (uint8_t i = 0; i < hdr->file_count; i++) {
+        const iso7816_fs_file_t *f = &files[i];
+        // a DF comes before its files, which also rules out loops
+        if (i && (f->parent >= i || files[f->parent].type != ISO7816_FS_DF)) {
+            return NULL;
+        }
+        if (f->aid_len > ISO7816_FS_MAX_AID) {
+            return NULL;
+        }
+        if (f->fci_offset + f->fci_len > hdr->size || f->data_offset + f->data_len > hdr->size) {
+            return NULL;
+        }
+        if ((f->type == ISO7816_FS_EF_LINEAR || f->type == ISO7816_FS_EF_CYCLIC) && f->rec_len * f->rec_count > f->data_len) {
+            return NULL;
+        }
+    }
+    return hdr;
+}
+
+const iso7816_fs_file_t *iso7816_fs_files(const iso7816_fs_hdr_t *hdr) {
+    return (const iso7816_fs_file_t *)((const uint8_t *)hdr + sizeof(iso7816_fs_hdr_t));
+}
+
+void iso7816_fs_reset(iso7816_fs_state_t *st) {
+    st->df = 0;
+    st->ef = ISO7816_FS_NO_FILE;
+    st->rec = 0;
+    st->pending_offset = 0;
+    st->pending_len = 0;
+}
+
+static bool fs_is_records(const iso7816_fs_file_t *f) {
+    return f->type == ISO7816_FS_EF_LINEAR || f->type == ISO7816_FS_EF_CYCLIC;
+}
+
+static uint16_t fs_sw(uint8_t *resp, uint16_t len, uint16_t sw) {
+    resp[len] = sw >> 8;
+    resp[len + 1] = sw & 0xFF;
+    return len + 2;
+}
+
+// file of the DF df with this FID, or ISO7816_FS_NO_FILE
+static uint8_t fs_child(const iso7816_fs_hdr_t *hdr, uint8_t df, uint16_t fid) {
+    const iso7816_fs_file_t *files = iso7816_fs_files(hdr);
+    for (uint8_t i = df + 1; i < hdr->file_count; i++) {
+        if (files[i].parent == df && files[i].fid == fid) {
+            return i;
+        }
+    }
+    return ISO7816_FS_NO_FILE;
+}
+
+// EF of the DF df with this short file identifier, or ISO7816_FS_NO_FILE
+static uint8_t fs_sfi(const iso7816_fs_hdr_t *hdr, uint8_t df, uint8_t sfi) {
+    const iso7816_fs_file_t *files = iso7816_fs_files(hdr);
+    for (uint8_t i = df + 1; i < hdr->file_count; i++) {
+        if (files[i].parent == df && files[i].type != ISO7816_FS_DF && files[i].sfi == sfi) {
+            return i;
+        }
+    }
+    return ISO7816_FS_NO_FILE;
+}
+
+// Answer len bytes of the image, held for GET RESPONSE (61xx) when they don't fit in max
+static uint16_t fs_data(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, uint16_t offset, uint16_t len, uint16_t sw, uint8_t *resp, uint16_t max) {
+    if (len + 2 > max) {
+        st->pending_offset = offset;
+        st->pending_len = len;
+        return fs_sw(resp, 0, 0x6100 | (len > 0xFF ? 0x00 : len));
+    }
+    memcpy(resp, (const uint8_t *)hdr + offset, len);
+    return fs_sw(resp, len, sw);
+}
+
+static uint16_t fs_select(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, uint8_t p1, uint8_t p2, const uint8_t *data, uint8_t lc, uint8_t *resp, uint16_t max) {
+    const iso7816_fs_file_t *files = iso7816_fs_files(hdr);
+    uint8_t idx = ISO7816_FS_NO_FILE;
+
+    switch (p1) {
+        case 0x00:
+        case 0x01:
+        case 0x02: {
+            // by FID, in the current DF then its parent
+            if (lc == 0 && p1 == 0x00) {
+                idx = 0;
+                break;
+            }
+            if (lc != 2) {
+                return fs_sw(resp, 0, FS_SW_WRONG_LENGTH);
+            }
+            uint16_t fid = (data[0] << 8) | data[1];
+            uint8_t parent = files[st->df].parent;
+            if (fid == ISO7816_FS_MF) {
+                idx = 0;
+            } else if (fid == files[st->df].fid) {
+                idx = st->df;
+            } else {
+                idx = fs_child(hdr, st->df, fid);
+                if (idx == ISO7816_FS_NO_FILE && p1 == 0x00 && parent != ISO7816_FS_NO_FILE) {
+                    idx = (files[parent].fid == fid) ? parent : fs_child(hdr, parent, fid);
+                }
+            }
+            if (idx != ISO7816_FS_NO_FILE && ((p1 == 0x01 && files[idx].type != ISO7816_FS_DF) || (p1 == 0x02 && files[idx].type == ISO7816_FS_DF))) {
+                idx = ISO7816_FS_NO_FILE;
+            }
+            break;
+        }
+        case 0x03: {
+            idx = (st->df) ? files[st->df].parent : 0;
+            break;
+        }
+        case 0x04: {
+            // by DF name, P2 b2 set for the next occurrence
+            uint8_t from = ((p2 & 0x03) == 0x02) ? st->df + 1 : 0;
+            for (uint8_t i = from; i < hdr->file_count && lc; i++) {
+                if (files[i].type == ISO7816_FS_DF && files[i].aid_len >= lc && memcmp(files[i].aid, data, lc) == 0) {
+                    idx = i;
+                    break;
+                }
+            }
+            break;
+        }
+        case 0x08:
+        case 0x09: {
+            // by path from the MF, or from the current DF
+            if (lc < 2 || (lc & 1)) {
+                return fs_sw(resp, 0, FS_SW_WRONG_LENGTH);
+            }
+            idx = (p1 == 0x08) ? 0 : st->df;
+            for (uint8_t i = 0; i < lc && idx != ISO7816_FS_NO_FILE; i += 2) {
+                uint16_t fid = (data[i] << 8) | data[i + 1];
+                if (i == 0 && p1 == 0x08 && fid == ISO7816_FS_MF) {
+                    continue;
+                }
+                if (files[idx].type != ISO7816_FS_DF) {
+                    idx = ISO7816_FS_NO_FILE;
+                    break;
+                }
+                idx = fs_child(hdr, idx, fid);
+            }
+            break;
+        }
+        default:
+            return fs_sw(resp, 0, FS_SW_WRONG_P1P2);
+    }
+
+    if (idx == ISO7816_FS_NO_FILE) {
+        return fs_sw(resp, 0, FS_SW_FILE_NOT_FOUND);
+    }
+
+    const iso7816_fs_file_t *f = &files[idx];
+    if (f->type == ISO7816_FS_DF) {
+        st->df = idx;
+        st->ef = ISO7816_FS_NO_FILE;
+    } else {
+        st->df = f->parent;
+        st->ef = idx;
+    }
+    st->rec = 0;
+
+    // P2 b4 b3 set, no response data
+    if ((p2 & 0x0C) == 0x0C || f->fci_len == 0) {
+        return fs_sw(resp, 0, FS_SW_OK);
+    }
+    return fs_data(hdr, st, f->fci_offset, f->fci_len, FS_SW_OK, resp, max);
+}
+
+static uint16_t fs_read_record(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, uint8_t p1, uint8_t p2, uint8_t *resp, uint16_t max) {
+    const iso7816_fs_file_t *files = iso7816_fs_files(hdr);
+
+    uint8_t sfi = p2 >> 3;
+    uint8_t idx = st->ef;
+    if (sfi == 0x1F) {
+        return fs_sw(resp, 0, FS_SW_WRONG_P1P2);
+    }
+    if (sfi) {
+        idx = fs_sfi(hdr, st->df, sfi);
+        if (idx == ISO7816_FS_NO_FILE) {
+            return fs_sw(resp, 0, FS_SW_FILE_NOT_FOUND);
+        }
+    } else if (idx == ISO7816_FS_NO_FILE) {
+        return fs_sw(resp, 0, FS_SW_NO_CURRENT_EF);
+    }
+
+    const iso7816_fs_file_t *f = &files[idx];
+    if (fs_is_records(f) == false) {
+        return fs_sw(resp, 0, FS_SW_INCOMPATIBLE);
+    }
+    if (idx != st->ef) {
+        st->ef = idx;
+        st->rec = 0;
+    }
+
+    uint8_t rec = p1;
+    switch (p2 & 0x07) {
+        case 0x04:
+            // record P1, 0 for the current one
+            if (rec == 0) {
+                rec = st->rec;
+            }
+            break;
+        case 0x00:
+            rec = 1;
+            break;
+        case 0x01:
+            rec = f->rec_count;
+            break;
+        case 0x02:
+            rec = st->rec + 1;
+            if (rec > f->rec_count && f->type == ISO7816_FS_EF_CYCLIC) {
+                rec = 1;
+            }
+            break;
+        case 0x03:
+            rec = (st->rec > 1) ? st->rec - 1 : 0;
+            if (rec == 0 && f->type == ISO7816_FS_EF_CYCLIC) {
+                rec = f->rec_count;
+            }
+            break;
+        default:
+            return fs_sw(resp, 0, FS_SW_FUNC_UNSUPPORTED);
+    }
+    if ((p2 & 0x07) != 0x04 && p1 != 0) {
+        return fs_sw(resp, 0, FS_SW_WRONG_P1P2);
+    }
+    if (rec == 0 || rec > f->rec_count) {
+        return fs_sw(resp, 0, FS_SW_RECORD_NOT_FOUND);
+    }
+
+    st->rec = rec;
+    return fs_data(hdr, st, f->data_offset + (rec - 1) * f->rec_len, f->rec_len, FS_SW_OK, resp, max);
+}
+
+static uint16_t fs_read_binary(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, uint8_t p1, uint8_t p2, uint16_t le, uint8_t *resp, uint16_t max) {
+    const iso7816_fs_file_t *files = iso7816_fs_files(hdr);
+
+    uint8_t idx = st->ef;
+    uint16_t offset;
+    if (p1 & 0x80) {
+        // P1 b8 set, SFI in P1 and offset in P2
+        idx = fs_sfi(hdr, st->df, p1 & 0x1F);
+        if (idx == ISO7816_FS_NO_FILE) {
+            return fs_sw(resp, 0, FS_SW_FILE_NOT_FOUND);
+        }
+        offset = p2;
+    } else {
+        if (idx == ISO7816_FS_NO_FILE) {
+            return fs_sw(resp, 0, FS_SW_NO_CURRENT_EF);
+        }
+        offset = (p1 << 8) | p2;
+    }
+
+    const iso7816_fs_file_t *f = &files[idx];
+    if (f->type != ISO7816_FS_EF_BINARY) {
+        return fs_sw(resp, 0, FS_SW_INCOMPATIBLE);
+    }
+    st->ef = idx;
+    st->rec = 0;
+
+    if (offset >= f->data_len) {
+        return fs_sw(resp, 0, FS_SW_WRONG_OFFSET);
+    }
+
+    uint16_t n = f->data_len - offset;
+    uint16_t sw = FS_SW_OK;
+    if (le < n) {
+        n = le;
+    } else if (le > n && le != 256) {
+        sw = FS_SW_EOF;
+    }
+    return fs_data(hdr, st, f->data_offset + offset, n, sw, resp, max);
+}
+
+static uint16_t fs_get_response(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, uint16_t le, uint8_t *resp, uint16_t max) {
+    if (st->pending_len == 0) {
+        return fs_sw(resp, 0, FS_SW_NOT_SATISFIED);
+    }
+
+    uint16_t n = MIN(MIN(le, st->pending_len), max - 2);
+    memcpy(resp, (const uint8_t *)hdr + st->pending_offset, n);
+    st->pending_offset += n;
+    st->pending_len -= n;
+
+    if (st->pending_len) {
+        return fs_sw(resp, n, 0x6100 | (st->pending_len > 0xFF ? 0x00 : st->pending_len));
+    }
+    return fs_sw(resp, n, FS_SW_OK);
+}
+
+// Answer a short APDU (CLA INS P1 P2 [Lc data] [Le]) from the image, response data + SW
+// in resp, at most max bytes. Returns the response length.
+uint16_t iso7816_fs_apdu(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, const uint8_t *apdu, uint16_t len, uint8_t *resp, uint16_t max) {
+    if (max < 2) {
+        return 0;
+    }
+    if (len < 4) {
+        return fs_sw(resp, 0, FS_SW_WRONG_LENGTH);
+    }
+
+    uint8_t ins = apdu[1];
+    uint8_t p1 = apdu[2];
+    uint8_t p2 = apdu[3];
+
+    // case 1 and 2 have no data, case 3 and 4 have Lc data
+    uint8_t lc = 0;
+    uint16_t le = 256;
+    if (len == 5) {
+        le = apdu[4] ? apdu[4] : 256;
+    } else if (len > 5) {
+        lc = apdu[4];
+        if (len == 5 + lc + 1) {
+            le = apdu[5 + lc] ? apdu[5 + lc] : 256;
+        } else if (len != 5 + lc) {
+            return fs_sw(resp, 0, FS_SW_WRONG_LENGTH);
+        }
+    }
+
+    // data not read back is lost by any other command
+    if (ins != ISO7816_INS_GET_RESPONSE) {
+        st->pending_len = 0;
+    }
+
+    switch (ins) {
+        case ISO7816_INS_SELECT:
+            return fs_select(hdr, st, p1, p2, apdu + 5, lc, resp, max);
+        case ISO7816_INS_READ_RECORD:
+            return fs_read_record(hdr, st, p1, p2, resp, max);
+        case ISO7816_INS_READ_BINARY:
+            return fs_read_binary(hdr, st, p1, p2, le, resp, max);
+        case ISO7816_INS_GET_RESPONSE:
+            return fs_get_response(hdr, st, le, resp, max);
+        default:
+            return fs_sw(resp, 0, FS_SW_INS_UNSUPPORTED);
+    }
+}
@@ -0,0 +1,127 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Calypso card profile, built by the client and answered by calypsosim
+//
+// The profile lives in emulator memory:
+//
+//   calypso_profile_hdr_t
+//   uint16_t buckets[bucket_count]           first entry of each hash chain
+//   calypso_profile_entry_t entries[entry_count]
+//   uint8_t  responses[]                     response data + SW, no PCB / CRC
+//
+// An entry matches an APDU on (file, INS, P1, P2, arg) where file is the
+// current DF, or the current EF for READ RECORD with SFI 0, or
+// CALYPSO_ANY_FILE for entries valid whatever is selected.
+//-----------------------------------------------------------------------------
+
+#ifndef _CALYPSO_PROFILE_H_
+#define _CALYPSO_PROFILE_H_
+
+#include "common.h"
+
+#define CALYPSO_PROFILE_MAGIC       0x50594C43  // "CLYP"
+#define CALYPSO_PROFILE_VERSION     1
+
+// must fit in the emulator memory
+#define CALYPSO_PROFILE_MAX_SIZE    4096
+#define CALYPSO_PROFILE_MAX_RESP    250         // data + SW, leaves room for PCB and CRC in a frame
+
+#define CALYPSO_MF                  0x3F00
+#define CALYPSO_ANY_FILE            0xFFFF
+#define CALYPSO_NO_FILE             0x0000
+#define CALYPSO_ENTRY_END           0xFFFF
+
+// entry flags, what the card selects when the entry is answered
+#define CALYPSO_ENTRY_SELECT_DF     0x01        // current DF = target, no current EF
+#define CALYPSO_ENTRY_SELECT_EF     0x02        // current EF = target, current DF = file
+
+#define CALYPSO_INS_SELECT          0xA4
+#define CALYPSO_INS_READ_RECORD     0xB2
+#define CALYPSO_INS_GET_DATA        0xCA
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;          // total bytes, header included
+    uint16_t entry_count;
+    uint16_t bucket_count;  // power of two
+} PACKED calypso_profile_hdr_t;
+
+typedef struct {
+    uint16_t file;
+    uint16_t arg;           // see calypso_profile_arg()
+    uint16_t target;        // file selected by this entry, see flags
+    uint8_t ins;
+    uint8_t p1;
+    uint8_t p2;
+    uint8_t flags;
+    uint16_t resp_offset;   // from the start of the profile
+    uint8_t resp_len;
+    uint8_t pad;
+    uint16_t next;          // next entry in the same bucket or CALYPSO_ENTRY_END
+} PACKED calypso_profile_entry_t;
+
+static inline uint32_t calypso_profile_hash(uint16_t file, uint8_t ins, uint8_t p1, uint8_t p2, uint16_t arg) {
+    uint32_t h = ((uint32_t)ins << 24) | ((uint32_t)p1 << 16) | ((uint32_t)p2 << 8);
+    h ^= (((uint32_t)file << 16) | arg) * 0x9E3779B1;
+    h ^= h >> 15;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    return h;
+}
+
+// Match argument of an APDU (CLA INS P1 P2 [Lc data]):
+// the last FID of a SELECT by FID / path, a digest of the name of a SELECT by name, else 0
+static inline uint16_t calypso_profile_arg(const uint8_t *apdu, uint16_t len) {
+    if (len < 7 || apdu[1] != CALYPSO_INS_SELECT || apdu[4] == 0 || apdu[4] > len - 5) {
+        return 0;
+    }
+    const uint8_t *data = apdu + 5;
+    uint8_t lc = apdu[4];
+    if (apdu[2] == 0x04) {
+        uint32_t h = 0x811C9DC5;
+        for (uint8_t i = 0; i < lc; i++) {
+            h = (h ^ data[i]) * 0x01000193;
+        }
+        return (uint16_t)(h ^ (h >> 16));
+    }
+    if (lc < 2) {
+        return 0;
+    }
+    return (data[lc - 2] << 8) | data[lc - 1];
+}
+
+// Current selection of the simulated card, follows the profile entries answered
+typedef struct {
+    uint16_t df;
+    uint16_t ef;
+} calypso_sel_t;
+
+// status words answered when the profile has no entry, see calypso_profile_sw_index()
+#define CALYPSO_SW_COUNT            4
+extern const uint16_t calypso_profile_sw[CALYPSO_SW_COUNT];
+
+// common/calypso_profile.c, used by armsrc/calypsosim.c and tools/iso14b_sim
+const calypso_profile_hdr_t *calypso_profile_check(const uint8_t *data, uint32_t maxsize);
+const calypso_profile_entry_t *calypso_profile_entries(const calypso_profile_hdr_t *hdr);
+const calypso_profile_entry_t *calypso_profile_lookup(const calypso_profile_hdr_t *hdr, uint16_t file, uint8_t ins, uint8_t p1, uint8_t p2, uint16_t arg);
+const calypso_profile_entry_t *calypso_profile_resolve(const calypso_profile_hdr_t *hdr, const calypso_sel_t *sel, const uint8_t *apdu, uint16_t apdu_len);
+void calypso_profile_select(calypso_sel_t *sel, const calypso_profile_entry_t *e);
+uint8_t calypso_profile_sw_index(uint8_t ins);
+uint16_t calypso_profile_build(const calypso_profile_hdr_t *hdr, const calypso_profile_entry_t *e, const uint8_t *cmd, uint8_t hlen, uint8_t *resp);
+uint16_t calypso_profile_answer(const calypso_profile_hdr_t *hdr, const calypso_sel_t *sel, const uint8_t *cmd, uint16_t len, uint8_t *resp, const calypso_profile_entry_t **entry);
+
+#endif // _CALYPSO_PROFILE_H_
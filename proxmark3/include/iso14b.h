@@ -65,6 +65,24 @@ typedef struct {
     uint8_t raw[];
 } PACKED iso14b_raw_cmd_t;
 
+// hf 14b sim
+typedef struct {
+    uint8_t pupi[4];
+    uint8_t flags;
+} PACKED iso14b_sim_t;
+
+#define ISO14B_SIM_FS   0x01    // answer I-blocks from the ISO7816 file system in emulator memory
+
+// hf 14b sniff
+#define ISO14B_SNIFF_STREAM 0x01    // send the trace records while sniffing
+#define ISO14B_SNIFF_CHUNK  256
+
+typedef struct {
+    uint32_t dropped;   // frames not logged so far, the trace was full
+    uint16_t len;
+    uint8_t data[];     // trace records, split anywhere
+} PACKED iso14b_sniff_chunk_t;
+
 typedef struct {
     uint8_t response_byte;
     uint16_t datalen;
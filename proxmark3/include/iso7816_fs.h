@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// ISO7816-4 file system image, built by the client (`hf 14b eload`) and
+// answered by the 14443-B simulator (`hf 14b sim --fs`)
+//
+// The image lives in emulator memory:
+//
+//   iso7816_fs_hdr_t
+//   iso7816_fs_file_t files[file_count]      files[0] is the MF
+//   uint8_t  data[]                          FCI, records and binary contents
+//
+// A file refers to its DF by index in files[]. Records of a linear or cyclic
+// EF are rec_count slots of rec_len bytes, record 1 first. The interpreter
+// answers SELECT, READ RECORD, READ BINARY and GET RESPONSE, any CLA.
+//-----------------------------------------------------------------------------
+
+#ifndef _ISO7816_FS_H_
+#define _ISO7816_FS_H_
+
+#include "common.h"
+
+#define ISO7816_FS_MAGIC            0x53463738  // "87FS"
+#define ISO7816_FS_VERSION          1
+
+// must fit in the emulator memory
+#define ISO7816_FS_MAX_SIZE         4096
+#define ISO7816_FS_MAX_FILES        64
+#define ISO7816_FS_MAX_AID          16
+
+#define ISO7816_FS_MF               0x3F00
+#define ISO7816_FS_NO_FILE          0xFF        // file index
+
+// file types
+#define ISO7816_FS_DF               0x38
+#define ISO7816_FS_EF_BINARY        0x01
+#define ISO7816_FS_EF_LINEAR        0x02        // fixed size records
+#define ISO7816_FS_EF_CYCLIC        0x06
+
+#define ISO7816_INS_SELECT          0xA4
+#define ISO7816_INS_READ_BINARY     0xB0
+#define ISO7816_INS_READ_RECORD     0xB2
+#define ISO7816_INS_GET_RESPONSE    0xC0
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;          // total bytes, header included
+    uint8_t file_count;
+    uint8_t flags;          // ISO7816_FS_ATQB when atqb is set
+    uint8_t atqb[11];       // PUPI, application data, protocol info
+    uint8_t pad;
+} PACKED iso7816_fs_hdr_t;
+
+#define ISO7816_FS_ATQB             0x01
+
+typedef struct {
+    uint16_t fid;
+    uint8_t parent;         // index of the DF, ISO7816_FS_NO_FILE for the MF
+    uint8_t type;
+    uint8_t sfi;            // 0 when none
+    uint8_t rec_len;
+    uint8_t rec_count;
+    uint8_t aid_len;        // DF name, selected by SELECT P1=04
+    uint8_t aid[ISO7816_FS_MAX_AID];
+    uint16_t fci_offset;    // from the start of the image, answered to SELECT
+    uint16_t fci_len;
+    uint16_t data_offset;   // records or binary content
+    uint16_t data_len;
+} PACKED iso7816_fs_file_t;
+
+// Selection and pending GET RESPONSE data of the simulated card
+typedef struct {
+    uint8_t df;
+    uint8_t ef;
+    uint8_t rec;            // current record, 0 when none
+    uint16_t pending_offset;
+    uint16_t pending_len;
+} iso7816_fs_state_t;
+
+// common/iso7816_fs.c, used by armsrc/iso14443b.c
+const iso7816_fs_hdr_t *iso7816_fs_check(const uint8_t *data, uint32_t maxsize);
+const iso7816_fs_file_t *iso7816_fs_files(const iso7816_fs_hdr_t *hdr);
+void iso7816_fs_reset(iso7816_fs_state_t *st);
+uint16_t iso7816_fs_apdu(const iso7816_fs_hdr_t *hdr, iso7816_fs_state_t *st, const uint8_t *apdu, uint16_t len, uint8_t *resp, uint16_t max);
+
+#endif // _ISO7816_FS_H_
@@ -401,6 +401,21 @@ typedef struct {
 #define CMD_PY                                                            0x0A05
 #define CMD_PY_CLIENT_SIM                                                 0x0A06
 #define CMD_PY_CLIENT_DATA                                                0x0A07
+#define CMD_PY_CLIENT_FRAME                                               0x0A08
+#define CMD_HF_CALYPSO_EML_MEMSET                                         0x0A09
+
+// CMD_PY_CLIENT_FRAME, RF frames relayed to the python client during CMD_PY_CLIENT_SIM
+#define PY_CLIENT_FRAME_READER  0x01    // command received from the reader
+#define PY_CLIENT_FRAME_CARD    0x02    // response sent to the reader
+#define PY_CLIENT_FRAME_WTX_MISS 0x04   // with CARD, S(WTX) sent again, the python answer missed the extended FWT
+
+typedef struct {
+    uint32_t sof;       // us, start of frame
+    uint32_t eof;       // us, end of frame
+    uint8_t flags;      // PY_CLIENT_FRAME_xxx
+    uint16_t len;
+    uint8_t data[];
+} PACKED py_client_frame_t;
 // Pour le client Python
 #define TX_COMMANDNG_PREAMBLE_MAGIC_PY 0x50796D33 // b"Pym3"
 #define TX_COMMANDNG_POSTAMBLE_MAGIC_PY 0x7933 // b"y3"  
@@ -513,6 +528,7 @@ typedef struct {
 #define CMD_LF_MOD_THEN_ACQ_RAW_ADC                                       0x0206
 #define CMD_DOWNLOAD_BIGBUF                                               0x0207
 #define CMD_DOWNLOADED_BIGBUF                                             0x0208
+#define CMD_DOWNLOADED_BIGBUF_LZ4                                         0x1208
 #define CMD_LF_UPLOAD_SIM_SAMPLES                                         0x0209
 #define CMD_LF_SIMULATE                                                   0x020A
 #define CMD_LF_HID_WATCH                                                  0x020B
@@ -580,6 +596,7 @@ typedef struct {
 #define CMD_HF_ACQ_RAW_ADC                                                0x0301
 #define CMD_HF_SRI_READ                                                   0x0303
 #define CMD_HF_ISO14443B_COMMAND                                          0x0305
+#define CMD_HF_ISO14443B_EML_SETMEM                                       0x0306
 #define CMD_HF_ISO15693_READER                                            0x0310
 #define CMD_HF_ISO15693_SIMULATE                                          0x0311
 #define CMD_HF_ISO15693_SNIFF                                             0x0312
@@ -956,6 +973,11 @@ typedef struct {
 /* CMD_READ_MEM_DOWNLOAD flags */
 #define READ_MEM_DOWNLOAD_FLAG_RAW                   (1<<0)
 
+/* CMD_DOWNLOAD_BIGBUF flags, in arg2 */
+/* Send LZ4 compressed blocks as CMD_DOWNLOADED_BIGBUF_LZ4 MIX frames,
+   arg0 = offset, arg1 = uncompressed length, arg2 = tracelen */
+#define DOWNLOAD_BIGBUF_FLAG_LZ4                     (1<<0)
+
 /* CMD_START_FLASH may have three arguments: start of area to flash,
    end of area to flash, optional magic.
    The bootrom will not allow to overwrite itself unless this magic
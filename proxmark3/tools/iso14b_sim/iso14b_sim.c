@@ -0,0 +1,927 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Offline ISO14443-B session simulator.
+//
+// Runs the firmware codec (common/iso14b_codec.c) on the host:
+//  - reader frames of a trace are turned into the sample stream the simulated
+//    tag receives and decoded by the tag side UART
+//  - tag frames are encoded as the tag sends them, turned into the I/Q samples
+//    the reader gets and decoded by the reader side demodulator
+//  - with a Calypso card profile, the reader I-blocks are answered as
+//    `scard simcalypso` does and compared to the recorded answers
+// Every frame must come out of the decoders as it went in, the encode / decode
+// time per frame and the decoder state transitions are reported.
+//
+// Replay: the reader frames are played in the recorded order, either against
+// the host Calypso layer or against a tcp: device acting as the reader, and
+// the response time per APDU and the whole transaction time are checked
+// against the validator pacing and an optional budget.
+//-----------------------------------------------------------------------------
+
+#define __STDC_FORMAT_MACROS
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "pm3_cmd.h"
+#include "crc16.h"
+#include "iso14b.h"
+#include "iso14b_codec.h"
+#include "calypso_profile.h"
+
+#define AEND  "\x1b[0m"
+#define _RED_(s) "\x1b[31m" s AEND
+#define _GREEN_(s) "\x1b[32m" s AEND
+#define _YELLOW_(s) "\x1b[33m" s AEND
+
+#define SIM_MAX_FRAMES      4096
+#define SIM_MAX_FRAME_SIZE  ISO14B_MAX_FRAME_SIZE
+#define SIM_IDLE_ETU        8       // unmodulated ETU around each frame
+#define SIM_IQ_AMPLITUDE    40      // well above the subcarrier detect threshold
+#define SIM_PROFILE_SIZE    4096    // emulator memory of the device
+
+#define SIM_ATTRIB          0x1D
+#define SIM_WUPB            0x05    // REQB / WUPB, a transaction starts here
+
+#define SIM_SSP_TO_US(x)    ((double)(x) / 3.39)        // trace timestamps are in SSP_CLK
+#define SIM_ETU_TO_US(x)    ((double)(x) * 9.4395)
+#define SIM_TR0_ETU         16      // tag waits at least this long before answering
+#define SIM_TCP_TIMEOUT_MS  2000
+
+// dummy, pm3_cmd.h declares it extern
+capabilities_t g_pm3_capabilities;
+
+typedef struct {
+    bool reader;
+    uint32_t start;         // SSP_CLK
+    uint32_t end;
+    uint16_t len;
+    uint8_t data[SIM_MAX_FRAME_SIZE];
+} sim_frame_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t samples;
+    uint64_t ns;
+    uint64_t transitions;
+    uint64_t errors;
+} sim_stats_t;
+
+typedef struct {
+    sim_frame_t *frames;
+    size_t count;
+    uint32_t loops;
+    bool verbose;
+    sim_stats_t encode;     // tag frames, iso14b_code_as_tag()
+    sim_stats_t uart;       // reader frames, iso14b_uart_sample()
+    sim_stats_t demod;      // tag frames, iso14b_demod_samples()
+} sim_ctx_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void print_hex(const char *prefix, const uint8_t *d, size_t n) {
+    printf("%s", prefix);
+    for (size_t i = 0; i < n; i++) {
+        printf("%02X ", d[i]);
+    }
+    printf("\n");
+}
+
+//-----------------------------------------------------------------------------
+// trace, as printed by `trace list -t 14b`
+//-----------------------------------------------------------------------------
+static int parse_hex_bytes(const char *s, sim_frame_t *f) {
+    while (*s) {
+        while (*s == ' ' || *s == '!') {
+            s++;
+        }
+        if (isxdigit((unsigned char)s[0]) == 0 || isxdigit((unsigned char)s[1]) == 0) {
+            break;
+        }
+        if (f->len >= sizeof(f->data)) {
+            return PM3_EOVFLOW;
+        }
+        unsigned int b;
+        sscanf(s, "%2x", &b);
+        f->data[f->len++] = b;
+        s += 2;
+    }
+    return PM3_SUCCESS;
+}
+
+static int load_trace(const char *fn, sim_ctx_t *ctx) {
+    FILE *f = fopen(fn, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return PM3_EFILE;
+    }
+
+    ctx->frames = calloc(SIM_MAX_FRAMES, sizeof(sim_frame_t));
+    if (ctx->frames == NULL) {
+        fclose(f);
+        return PM3_EMALLOC;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        // start | end | src | data | crc | annotation
+        char *col[4] = { line, NULL, NULL, NULL };
+        for (int i = 1; i < 4; i++) {
+            col[i] = strchr(col[i - 1], '|');
+            if (col[i] == NULL) {
+                break;
+            }
+            *col[i]++ = '\0';
+        }
+        if (col[3] == NULL) {
+            continue;
+        }
+
+        sim_frame_t *fr;
+        if (strstr(col[2], "Rdr") || strstr(col[2], "Tag")) {
+            if (ctx->count >= SIM_MAX_FRAMES) {
+                break;
+            }
+            fr = &ctx->frames[ctx->count++];
+            fr->reader = (strstr(col[2], "Rdr") != NULL);
+            fr->start = strtoul(col[0], NULL, 10);
+            fr->end = strtoul(col[1], NULL, 10);
+        } else if (ctx->count && strspn(col[2], " ") == strlen(col[2])) {
+            // continuation of a long frame
+            fr = &ctx->frames[ctx->count - 1];
+        } else {
+            continue;
+        }
+
+        char *end = strchr(col[3], '|');
+        if (end) {
+            *end = '\0';
+        }
+        if (parse_hex_bytes(col[3], fr) != PM3_SUCCESS) {
+            fprintf(stderr, "Frame too long in %s\n", fn);
+            fclose(f);
+            return PM3_EOVFLOW;
+        }
+    }
+    fclose(f);
+
+    // drop empty frames
+    size_t n = 0;
+    for (size_t i = 0; i < ctx->count; i++) {
+        if (ctx->frames[i].len) {
+            ctx->frames[n++] = ctx->frames[i];
+        }
+    }
+    ctx->count = n;
+    return PM3_SUCCESS;
+}
+
+// binary trace, as written by `trace save`: tracelog_hdr_t records
+static int load_trace_bin(const char *fn, sim_ctx_t *ctx) {
+    FILE *f = fopen(fn, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return PM3_EFILE;
+    }
+
+    ctx->frames = calloc(SIM_MAX_FRAMES, sizeof(sim_frame_t));
+    if (ctx->frames == NULL) {
+        fclose(f);
+        return PM3_EMALLOC;
+    }
+
+    tracelog_hdr_t hdr;
+    while (ctx->count < SIM_MAX_FRAMES && fread(&hdr, TRACELOG_HDR_LEN, 1, f) == 1) {
+        if (hdr.data_len == 0) {
+            continue;
+        }
+        if (hdr.data_len > SIM_MAX_FRAME_SIZE) {
+            fprintf(stderr, "Frame too long in %s\n", fn);
+            fclose(f);
+            return PM3_EOVFLOW;
+        }
+        sim_frame_t *fr = &ctx->frames[ctx->count];
+        fr->reader = (hdr.isResponse == false);
+        fr->start = hdr.timestamp;
+        fr->end = hdr.timestamp + hdr.duration;
+        fr->len = hdr.data_len;
+        uint8_t parity[SIM_MAX_FRAME_SIZE / 8];
+        if (fread(fr->data, fr->len, 1, f) != 1 || fread(parity, TRACELOG_PARITY_LEN(&hdr), 1, f) != 1) {
+            break;
+        }
+        ctx->count++;
+    }
+    fclose(f);
+    return PM3_SUCCESS;
+}
+
+static int load_file(const char *fn, uint8_t **data, size_t *len, size_t maxlen) {
+    FILE *f = fopen(fn, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return PM3_EFILE;
+    }
+    *data = calloc(maxlen, sizeof(uint8_t));
+    if (*data == NULL) {
+        fclose(f);
+        return PM3_EMALLOC;
+    }
+    *len = fread(*data, 1, maxlen, f);
+    fclose(f);
+    return PM3_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// sample streams
+//-----------------------------------------------------------------------------
+
+// Reader -> tag, as the SSC delivers it in simulator mode:
+// 4 samples per ETU, MSB first, modulated = 0
+static size_t reader_samples(const uint8_t *cmd, uint16_t len, uint8_t *out) {
+    uint8_t etu[SIM_IDLE_ETU + 12 + SIM_MAX_FRAME_SIZE * 10 + 10 + SIM_IDLE_ETU];
+    size_t n = 0;
+
+    memset(etu + n, 1, SIM_IDLE_ETU);
+    n += SIM_IDLE_ETU;
+    // SOF
+    memset(etu + n, 0, 10);
+    n += 10;
+    etu[n++] = 1;
+    etu[n++] = 1;
+    for (uint16_t i = 0; i < len; i++) {
+        etu[n++] = 0;
+        for (uint8_t j = 0; j < 8; j++) {
+            etu[n++] = (cmd[i] >> j) & 1;
+        }
+        etu[n++] = 1;
+    }
+    // EOF
+    memset(etu + n, 0, 10);
+    n += 10;
+    memset(etu + n, 1, SIM_IDLE_ETU);
+    n += SIM_IDLE_ETU;
+
+    // two ETU per byte, n is even
+    for (size_t i = 0; i < n; i += 2) {
+        out[i / 2] = (etu[i] ? 0xF0 : 0x00) | (etu[i + 1] ? 0x0F : 0x00);
+    }
+    return n / 2;
+}
+
+// Tag -> reader, BPSK seen by the reader demodulator: 2 I/Q pairs per ETU,
+// taken from the tag encoder output (one nibble per ETU), silence around
+static size_t tag_iq(const uint8_t *enc, size_t enclen, int8_t *ci, int8_t *cq) {
+    size_t n = 0;
+    for (int i = 0; i < 2 * SIM_IDLE_ETU; i++, n++) {
+        ci[n] = 0;
+        cq[n] = 0;
+    }
+    for (size_t i = 0; i < enclen * 2; i++) {
+        uint8_t nibble = (i & 1) ? (enc[i / 2] & 0x0F) : (enc[i / 2] >> 4);
+        int8_t v = nibble ? SIM_IQ_AMPLITUDE : -SIM_IQ_AMPLITUDE;
+        for (int j = 0; j < 2; j++, n++) {
+            ci[n] = v;
+            cq[n] = v / 2;
+        }
+    }
+    for (int i = 0; i < 2 * SIM_IDLE_ETU; i++, n++) {
+        ci[n] = 0;
+        cq[n] = 0;
+    }
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// codec runs
+//-----------------------------------------------------------------------------
+
+// Feed a sample stream to the UART, as GetIso14443bCommandFromReader() does.
+// Returns the decoded length, 0 if no frame came out
+static uint16_t run_uart(iso14b_uart_t *uart, uint8_t *buf, const uint8_t *s, size_t n, uint64_t *transitions) {
+    iso14b_uart_init(uart, buf);
+    int state = (int)uart->state;
+    for (size_t i = 0; i < n; i++) {
+        for (uint8_t mask = 0x80; mask != 0x00; mask >>= 1) {
+            if (iso14b_uart_sample(uart, s[i] & mask)) {
+                return uart->byteCnt;
+            }
+            if (transitions && (int)uart->state != state) {
+                state = uart->state;
+                (*transitions)++;
+            }
+        }
+    }
+    return 0;
+}
+
+static uint16_t run_demod(iso14b_demod_t *demod, uint8_t *buf, const int8_t *ci, const int8_t *cq, size_t n, uint64_t *transitions) {
+    iso14b_demod_init(demod, buf, SIM_MAX_FRAME_SIZE);
+    int state = (int)demod->state;
+    for (size_t i = 0; i < n; i++) {
+        if (iso14b_demod_samples(demod, ci[i], cq[i])) {
+            return demod->len;
+        }
+        if (transitions && (int)demod->state != state) {
+            state = demod->state;
+            (*transitions)++;
+        }
+    }
+    return 0;
+}
+
+static void sim_reader_frame(sim_ctx_t *ctx, const sim_frame_t *f) {
+    static uint8_t samples[(SIM_IDLE_ETU * 2 + 22 + SIM_MAX_FRAME_SIZE * 10) / 2];
+    uint8_t out[SIM_MAX_FRAME_SIZE];
+    iso14b_uart_t uart;
+
+    size_t n = reader_samples(f->data, f->len, samples);
+
+    // checked pass, counts the state transitions
+    uint64_t transitions = 0;
+    uint16_t len = run_uart(&uart, out, samples, n, &transitions);
+    bool ok = (len == f->len && memcmp(out, f->data, len) == 0);
+
+    uint64_t t0 = now_ns();
+    for (uint32_t l = 0; l < ctx->loops; l++) {
+        run_uart(&uart, out, samples, n, NULL);
+    }
+    uint64_t dt = now_ns() - t0;
+
+    ctx->uart.frames++;
+    ctx->uart.bytes += f->len;
+    ctx->uart.samples += n * 8;
+    ctx->uart.ns += dt;
+    ctx->uart.transitions += transitions;
+    if (ok == false) {
+        ctx->uart.errors++;
+        print_hex(_RED_("UART  failed ") "sent    ", f->data, f->len);
+        print_hex("                     decoded ", out, len);
+    } else if (ctx->verbose) {
+        printf("Rdr %4u bytes, uart %6" PRIu64 " ns, %2" PRIu64 " transitions | ", f->len, dt / ctx->loops, transitions);
+        print_hex("", f->data, f->len);
+    }
+}
+
+static void sim_tag_frame(sim_ctx_t *ctx, const sim_frame_t *f) {
+    static uint8_t enc[ISO14B_TAG_ENC_LEN(SIM_MAX_FRAME_SIZE)];
+    static int8_t ci[(ISO14B_TAG_ENC_LEN(SIM_MAX_FRAME_SIZE) + 4 * SIM_IDLE_ETU) * 4];
+    static int8_t cq[sizeof(ci)];
+    uint8_t out[SIM_MAX_FRAME_SIZE];
+    iso14b_demod_t demod;
+
+    uint64_t t0 = now_ns();
+    uint16_t enclen = 0;
+    for (uint32_t l = 0; l < ctx->loops; l++) {
+        enclen = iso14b_code_as_tag(f->data, f->len, enc, sizeof(enc));
+    }
+    uint64_t dt_enc = now_ns() - t0;
+
+    ctx->encode.frames++;
+    ctx->encode.bytes += f->len;
+    ctx->encode.samples += enclen * 8;
+    ctx->encode.ns += dt_enc;
+    if (enclen != ISO14B_TAG_ENC_LEN(f->len)) {
+        ctx->encode.errors++;
+        printf(_RED_("Encode failed") " %u bytes gave %u samples bytes\n", f->len, enclen);
+        return;
+    }
+
+    size_t n = tag_iq(enc, enclen, ci, cq);
+
+    uint64_t transitions = 0;
+    uint16_t len = run_demod(&demod, out, ci, cq, n, &transitions);
+    bool ok = (len == f->len && memcmp(out, f->data, len) == 0);
+
+    t0 = now_ns();
+    for (uint32_t l = 0; l < ctx->loops; l++) {
+        run_demod(&demod, out, ci, cq, n, NULL);
+    }
+    uint64_t dt = now_ns() - t0;
+
+    ctx->demod.frames++;
+    ctx->demod.bytes += f->len;
+    ctx->demod.samples += n;
+    ctx->demod.ns += dt;
+    ctx->demod.transitions += transitions;
+    if (ok == false) {
+        ctx->demod.errors++;
+        print_hex(_RED_("Demod failed ") "sent    ", f->data, f->len);
+        print_hex("                     decoded ", out, len);
+    } else if (ctx->verbose) {
+        printf("Tag %4u bytes, code %6" PRIu64 " ns, demod %6" PRIu64 " ns, %2" PRIu64 " transitions | ", f->len, dt_enc / ctx->loops, dt / ctx->loops, transitions);
+        print_hex("", f->data, f->len);
+    }
+}
+
+static void print_stats(const char *name, const sim_stats_t *s, uint32_t loops) {
+    if (s->frames == 0) {
+        return;
+    }
+    uint64_t runs = s->frames * loops;
+    printf("  %-8s %5" PRIu64 " frames %6" PRIu64 " bytes | %8.1f ns/frame %6.2f ns/byte %6.2f ns/sample | %4" PRIu64 " transitions | %s\n"
+           , name
+           , s->frames
+           , s->bytes
+           , (double)s->ns / runs
+           , (double)s->ns / (s->bytes * loops)
+           , s->samples ? (double)s->ns / (s->samples * loops) : 0.0
+           , s->transitions
+           , s->errors ? _RED_("FAIL") : _GREEN_("ok")
+          );
+}
+
+//-----------------------------------------------------------------------------
+// replay, answered by the host Calypso layer (as armsrc/calypsosim.c) or by a
+// tcp: device acting as the reader
+//-----------------------------------------------------------------------------
+typedef struct {
+    const calypso_profile_hdr_t *hdr;   // host backend
+    calypso_sel_t sel;
+    int fd;                             // tcp backend, -1 when unused
+    bool connected;
+} sim_replay_t;
+
+// Answer a reader I-block from the profile, as calypso_answer_apdu() does.
+// Returns the tag frame length, 0 when the card does not answer here
+static uint16_t host_answer(const calypso_profile_hdr_t *hdr, calypso_sel_t *sel, const sim_frame_t *f, uint8_t *resp) {
+    const calypso_profile_entry_t *e;
+    uint16_t n = calypso_profile_answer(hdr, sel, f->data, f->len, resp, &e);
+    if (n) {
+        calypso_profile_select(sel, e);
+    }
+    return n;
+}
+
+// Reader frame in, tag frame out, as the simulation loop runs it: UART decode,
+// profile lookup and tag encoding, their host time goes to proc_us.
+// Returns the reader EOF -> tag EOF time in µs
+static double host_exchange(const sim_ctx_t *ctx, sim_replay_t *r, const sim_frame_t *f, uint8_t *resp, uint16_t *n, double *proc_us) {
+    static uint8_t samples[(SIM_IDLE_ETU * 2 + 22 + SIM_MAX_FRAME_SIZE * 10) / 2];
+    static uint8_t enc[ISO14B_TAG_ENC_LEN(SIM_MAX_FRAME_SIZE)];
+    uint8_t cmd[SIM_MAX_FRAME_SIZE];
+    iso14b_uart_t uart;
+
+    if (f->data[0] == SIM_ATTRIB && f->len == 11) {
+        r->sel.df = CALYPSO_MF;
+        r->sel.ef = CALYPSO_NO_FILE;
+    }
+
+    size_t ns = reader_samples(f->data, f->len, samples);
+
+    uint64_t t0 = now_ns();
+    for (uint32_t l = 0; l < ctx->loops; l++) {
+        calypso_sel_t sel = r->sel;
+        uint16_t len = run_uart(&uart, cmd, samples, ns, NULL);
+        sim_frame_t rx = { .reader = true, .len = len };
+        memcpy(rx.data, cmd, len);
+        uint16_t rlen = host_answer(r->hdr, &sel, &rx, resp);
+        if (rlen) {
+            iso14b_code_as_tag(resp, rlen, enc, sizeof(enc));
+        }
+    }
+    *proc_us = (double)(now_ns() - t0) / ctx->loops / 1000;
+
+    *n = host_answer(r->hdr, &r->sel, f, resp);
+    if (*n == 0) {
+        return 0;
+    }
+    // the tag answers after TR0 at the earliest, TR1 + SOF + data + EOF on air
+    double tr0_us = SIM_ETU_TO_US(SIM_TR0_ETU);
+    return (*proc_us > tr0_us ? *proc_us : tr0_us) + SIM_ETU_TO_US(ISO14B_TAG_ENC_LEN(*n) * 2);
+}
+
+static int tcp_connect(const char *target) {
+    char host[256];
+    const char *port = strrchr(target, ':');
+    if (strncmp(target, "tcp:", 4) == 0) {
+        target += 4;
+    }
+    if (port == NULL || port < target || (size_t)(port - target) >= sizeof(host)) {
+        fprintf(stderr, "Expected tcp:<host>:<port>, got %s\n", target);
+        return -1;
+    }
+    memcpy(host, target, port - target);
+    host[port - target] = '\0';
+    port++;
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        fprintf(stderr, "Can't resolve %s\n", host);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = res; a; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "Can't connect to %s:%s\n", host, port);
+    }
+    return fd;
+}
+
+static int tcp_read_exact(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, SIM_TCP_TIMEOUT_MS) <= 0) {
+            return PM3_ETIMEOUT;
+        }
+        ssize_t res = read(fd, p, len);
+        if (res <= 0) {
+            return PM3_EIO;
+        }
+        p += res;
+        len -= res;
+    }
+    return PM3_SUCCESS;
+}
+
+// CMD_HF_ISO14443B_COMMAND as NG frame, without CRC as on USB
+static int tcp_send(int fd, const iso14b_raw_cmd_t *cmd, uint16_t len) {
+    uint8_t frame[sizeof(PacketCommandNGPreamble) + PM3_CMD_DATA_SIZE + sizeof(PacketCommandNGPostamble)];
+    PacketCommandNGPreamble *pre = (PacketCommandNGPreamble *)frame;
+    pre->magic = COMMANDNG_PREAMBLE_MAGIC;
+    pre->length = len;
+    pre->ng = true;
+    pre->cmd = CMD_HF_ISO14443B_COMMAND;
+    memcpy(frame + sizeof(*pre), cmd, len);
+    PacketCommandNGPostamble *post = (PacketCommandNGPostamble *)(frame + sizeof(*pre) + len);
+    post->crc = COMMANDNG_POSTAMBLE_MAGIC;
+
+    size_t total = sizeof(*pre) + len + sizeof(*post);
+    return (write(fd, frame, total) == (ssize_t)total) ? PM3_SUCCESS : PM3_EIO;
+}
+
+// Wait for the CMD_HF_ISO14443B_COMMAND reply, debug prints are skipped
+static int tcp_wait(int fd, int16_t *status, uint8_t *data, uint16_t *datalen) {
+    for (;;) {
+        PacketResponseNGRaw rx;
+        int res = tcp_read_exact(fd, &rx.pre, sizeof(rx.pre));
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+        if (rx.pre.magic != RESPONSENG_PREAMBLE_MAGIC || rx.pre.length > PM3_CMD_DATA_SIZE) {
+            return PM3_EIO;
+        }
+        res = tcp_read_exact(fd, rx.data, rx.pre.length + sizeof(PacketResponseNGPostamble));
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+        if (rx.pre.cmd == CMD_HF_ISO14443B_COMMAND) {
+            *status = rx.pre.status;
+            *datalen = rx.pre.length;
+            memcpy(data, rx.data, rx.pre.length);
+            return PM3_SUCCESS;
+        }
+    }
+}
+
+// Send the recorded reader frame (CRC included) raw and wait for the tag answer.
+// Returns the round trip in µs, link and device included, negative on error
+static double tcp_exchange(sim_replay_t *r, const sim_frame_t *f, uint8_t *resp, uint16_t *n) {
+    uint8_t buf[sizeof(iso14b_raw_cmd_t) + SIM_MAX_FRAME_SIZE];
+    iso14b_raw_cmd_t *cmd = (iso14b_raw_cmd_t *)buf;
+    cmd->flags = ISO14B_RAW | (r->connected ? 0 : ISO14B_CONNECT | ISO14B_CLEARTRACE);
+    cmd->timeout = 0;
+    cmd->rawlen = f->len;
+    memcpy(cmd->raw, f->data, f->len);
+    r->connected = true;
+
+    uint8_t data[PM3_CMD_DATA_SIZE];
+    uint16_t datalen = 0;
+    int16_t status = 0;
+    uint64_t t0 = now_ns();
+    if (tcp_send(r->fd, cmd, sizeof(iso14b_raw_cmd_t) + f->len) != PM3_SUCCESS ||
+            tcp_wait(r->fd, &status, data, &datalen) != PM3_SUCCESS) {
+        return -1;
+    }
+    double us = (double)(now_ns() - t0) / 1000;
+
+    *n = (status == PM3_SUCCESS) ? MIN(datalen, SIM_MAX_FRAME_SIZE) : 0;
+    memcpy(resp, data, *n);
+    return us;
+}
+
+// Play the reader frames from the first REQB / WUPB on. A reader frame is sent
+// at its recorded time, or later when an answer came after the recorded gap to
+// the next reader frame: the validator would have waited that much longer.
+// Returns PM3_SUCCESS, PM3_EOUTOFBOUND when the transaction is over budget
+static int sim_replay(const sim_ctx_t *ctx, sim_replay_t *r, double budget_ms) {
+    size_t first = 0;
+    for (size_t i = 0; i < ctx->count; i++) {
+        if (ctx->frames[i].reader && ctx->frames[i].data[0] == SIM_WUPB) {
+            first = i;
+            break;
+        }
+    }
+
+    uint32_t apdus = 0, answered = 0, recorded = 0, matched = 0, late = 0;
+    double sum_us = 0, max_us = 0, shift_us = 0, proc_sum_us = 0;
+
+    printf("  replay on %s\n", (r->fd < 0) ? "host calypso layer" : "tcp device");
+    printf("      # | INS |  host us | response us |    gap us |\n");
+    for (size_t i = first; i < ctx->count; i++) {
+        const sim_frame_t *f = &ctx->frames[i];
+        if (f->reader == false) {
+            continue;
+        }
+        const sim_frame_t *rec = (i + 1 < ctx->count && ctx->frames[i + 1].reader == false) ? &ctx->frames[i + 1] : NULL;
+
+        uint8_t resp[SIM_MAX_FRAME_SIZE];
+        uint16_t n = 0;
+        double us, proc_us = 0;
+        if (r->fd < 0) {
+            us = host_exchange(ctx, r, f, resp, &n, &proc_us);
+            if (n == 0 && rec) {
+                // not an APDU, answered from the pre-encoded pool
+                us = SIM_ETU_TO_US(SIM_TR0_ETU) + SIM_ETU_TO_US(ISO14B_TAG_ENC_LEN(rec->len) * 2);
+            }
+        } else {
+            us = tcp_exchange(r, f, resp, &n);
+            if (us < 0) {
+                fprintf(stderr, "Device connection lost\n");
+                return PM3_EIO;
+            }
+        }
+
+        // time the validator left until its next frame
+        double gap_us = 0;
+        for (size_t j = i + 1; j < ctx->count; j++) {
+            if (ctx->frames[j].reader) {
+                gap_us = SIM_SSP_TO_US((int64_t)ctx->frames[j].start - (int64_t)f->end);
+                break;
+            }
+        }
+        bool is_late = (gap_us > 0 && us > gap_us);
+        if (is_late) {
+            shift_us += us - gap_us;
+            late++;
+        }
+
+        bool is_apdu = ((f->data[0] & 0xEE) == 0x02 && f->len >= 1 + 4 + 2);
+        if (is_apdu == false) {
+            continue;
+        }
+        apdus++;
+        sum_us += us;
+        proc_sum_us += proc_us;
+        if (us > max_us) {
+            max_us = us;
+        }
+
+        bool same = false;
+        if (n) {
+            answered++;
+            same = rec && rec->len == n && memcmp(rec->data, resp, n) == 0;
+            recorded += (rec != NULL);
+            matched += same;
+        }
+
+        char proc[16] = "-";
+        if (r->fd < 0) {
+            snprintf(proc, sizeof(proc), "%.2f", proc_us);
+        }
+        printf("   %4zu |  %02X | %8s | %11.1f | %9.1f | %s%s\n"
+               , i
+               , f->data[2]
+               , proc
+               , us
+               , gap_us
+               , is_late ? _RED_("late ") : ""
+               , (rec && n && same == false) ? _YELLOW_("differs from recorded") : ""
+              );
+        if (ctx->verbose || (rec && n && same == false)) {
+            print_hex("          reader    ", f->data, f->len);
+            if (rec) {
+                print_hex("          recorded  ", rec->data, rec->len);
+            }
+            if (n) {
+                print_hex("          answered  ", resp, n);
+            }
+        }
+    }
+
+    if (r->fd >= 0) {
+        iso14b_raw_cmd_t cmd = { .flags = ISO14B_DISCONNECT, .timeout = 0, .rawlen = 0 };
+        tcp_send(r->fd, &cmd, sizeof(cmd));
+    }
+
+    double rec_ms = (ctx->count > first) ? SIM_SSP_TO_US(ctx->frames[ctx->count - 1].end - ctx->frames[first].start) / 1000 : 0;
+    double total_ms = rec_ms + shift_us / 1000;
+    bool over = (budget_ms > 0 && total_ms > budget_ms);
+
+    printf("  %u APDUs", apdus);
+    if (r->fd < 0) {
+        printf(", host avg %.2f us", apdus ? proc_sum_us / apdus : 0.0);
+    }
+    printf(", response avg %.1f us max %.1f us, %u frames late\n"
+           , apdus ? sum_us / apdus : 0.0
+           , max_us
+           , late
+          );
+    printf("  %u answered, %u with a recorded answer, %u as recorded\n", answered, recorded, matched);
+    printf("  transaction %.1f ms, recorded %.1f ms", total_ms, rec_ms);
+    if (budget_ms > 0) {
+        printf(", budget %.1f ms | %s", budget_ms, over ? _RED_("OVER") : _GREEN_("ok"));
+    }
+    printf("\n");
+    return over ? PM3_EOUTOFBOUND : PM3_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// raw reader -> tag samples, e.g. a BigBuf dump of a simulation
+//-----------------------------------------------------------------------------
+static int sim_raw(const char *fn) {
+    uint8_t *s = NULL;
+    size_t n = 0;
+    if (load_file(fn, &s, &n, 1 << 24) != PM3_SUCCESS) {
+        return PM3_EFILE;
+    }
+
+    uint8_t out[SIM_MAX_FRAME_SIZE];
+    iso14b_uart_t uart;
+    iso14b_uart_init(&uart, out);
+
+    uint32_t frames = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        for (uint8_t mask = 0x80; mask != 0x00; mask >>= 1) {
+            if (iso14b_uart_sample(&uart, s[i] & mask)) {
+                printf("%10zu | %s | ", i * 8, check_crc(CRC_14443_B, out, uart.byteCnt) ? " ok" : "!crc");
+                print_hex("", out, uart.byteCnt);
+                frames++;
+                iso14b_uart_reset(&uart);
+            }
+        }
+    }
+    uint64_t dt = now_ns() - t0;
+    printf("%u frames in %zu samples, %.2f ns/sample\n", frames, n * 8, n ? (double)dt / (n * 8) : 0.0);
+    free(s);
+    return PM3_SUCCESS;
+}
+
+static void usage(const char *prog) {
+    printf("Offline ISO14443-B session simulator, runs the firmware codec on the host\n\n");
+    printf("Usage: %s [options] <trace.txt | trace.trace>\n", prog);
+    printf("       %s -r <samples.bin>\n", prog);
+    printf("  -p, --profile <file>    Calypso card profile (`scard eload --save`), replay on the host calypso layer\n");
+    printf("  -c, --connect <target>  replay through a device acting as the reader, tcp:<host>:<port>\n");
+    printf("  -b, --budget <ms>       transaction time budget, exit status 1 when over\n");
+    printf("  -n, --loops <n>         timed runs per frame (default 1000)\n");
+    printf("  -r, --raw <file>        decode raw reader -> tag samples, 4 per ETU, MSB first\n");
+    printf("  -v, --verbose           print every frame\n");
+    printf("\nThe trace is the output of `trace list -t 14b` or a `trace save` file. Exit status\n");
+    printf("is 1 when a frame does not come out of the decoders as it went in.\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    sim_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.loops = 1000;
+    const char *profile_fn = NULL;
+    const char *raw_fn = NULL;
+    const char *target = NULL;
+    double budget_ms = 0;
+
+    static const struct option long_options[] = {
+        {"profile",   required_argument, NULL, 'p'},
+        {"connect",   required_argument, NULL, 'c'},
+        {"budget",    required_argument, NULL, 'b'},
+        {"loops",     required_argument, NULL, 'n'},
+        {"raw",       required_argument, NULL, 'r'},
+        {"verbose",   no_argument,       NULL, 'v'},
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "p:c:b:n:r:vh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'p':
+                profile_fn = optarg;
+                break;
+            case 'c':
+                target = optarg;
+                break;
+            case 'b':
+                budget_ms = strtod(optarg, NULL);
+                break;
+            case 'n':
+                ctx.loops = strtoul(optarg, NULL, 0);
+                if (ctx.loops == 0) {
+                    ctx.loops = 1;
+                }
+                break;
+            case 'r':
+                raw_fn = optarg;
+                break;
+            case 'v':
+                ctx.verbose = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (raw_fn) {
+        return (sim_raw(raw_fn) == PM3_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *ext = strrchr(argv[optind], '.');
+    int res = (ext && strcmp(ext, ".trace") == 0) ? load_trace_bin(argv[optind], &ctx) : load_trace(argv[optind], &ctx);
+    if (res != PM3_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < ctx.count; i++) {
+        if (ctx.frames[i].reader) {
+            sim_reader_frame(&ctx, &ctx.frames[i]);
+        } else {
+            sim_tag_frame(&ctx, &ctx.frames[i]);
+        }
+    }
+
+    printf("%zu frames, %u runs each\n", ctx.count, ctx.loops);
+    print_stats("encode", &ctx.encode, ctx.loops);
+    print_stats("uart", &ctx.uart, ctx.loops);
+    print_stats("demod", &ctx.demod, ctx.loops);
+
+    sim_replay_t replay = { .hdr = NULL, .sel = { CALYPSO_MF, CALYPSO_NO_FILE }, .fd = -1, .connected = false };
+    uint8_t *profile = NULL;
+    res = PM3_SUCCESS;
+    if (target) {
+        replay.fd = tcp_connect(target);
+        res = (replay.fd < 0) ? PM3_EIO : sim_replay(&ctx, &replay, budget_ms);
+    } else if (profile_fn) {
+        size_t size = 0;
+        res = load_file(profile_fn, &profile, &size, SIM_PROFILE_SIZE);
+        if (res == PM3_SUCCESS) {
+            replay.hdr = calypso_profile_check(profile, size);
+            if (replay.hdr == NULL) {
+                fprintf(stderr, "%s is not a Calypso card profile\n", profile_fn);
+                res = PM3_EFILE;
+            } else {
+                res = sim_replay(&ctx, &replay, budget_ms);
+            }
+        }
+    }
+    if (replay.fd >= 0) {
+        close(replay.fd);
+    }
+    free(profile);
+
+    uint64_t errors = ctx.encode.errors + ctx.uart.errors + ctx.demod.errors;
+    free(ctx.frames);
+    return (errors || res != PM3_SUCCESS) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -56,6 +56,9 @@ typedef struct thread_key_args {
     uint8_t enc[ENC_LEN];  // next encrypted command + a full read/write
 } targs_key;
 
+#define BS_WORDS  (4 + (ENC_LEN + 3) / 4)   // nt, nr, ar, at and the keystream of enc
+#define BS_BATCH  (1024)                    // keys per crypto1_bs_words() call
+
 //------------------------------------------------------------------
 
 uint8_t cmds[8][2] = {
@@ -439,30 +442,38 @@ static bool checkCRC(uint32_t decrypted) {
     return CheckCrc14443(CRC_14443_A, data, sizeof(data));
 }
 
+// Keystream of the NESTED authentication of count keys, bitsliced. Words 0 .. 3 of key i
+// at ks[i * BS_WORDS] are nt, nr, ar and at, the bytes decrypting enc follow.
+static void auth_keystream(const struct thread_key_args *args, const uint64_t *keys, uint32_t count, uint32_t *ks) {
+    uint32_t in[BS_WORDS] = { args->nt_enc ^ args->uid, args->nr_enc };
+    crypto1_bs_words(keys, count, in, 0x3, BS_WORDS, ks);
+}
+
+static void decrypt_bytes(const uint32_t *ks, const uint8_t *enc, uint16_t enc_len, uint8_t *dec) {
+    for (int j = 0; j < enc_len; j++) {
+        dec[j] = ((ks[4 + j / 4] >> (24 - 8 * (j % 4))) & 0xFF) ^ enc[j];
+    }
+}
+
 static void *check_default_keys(void *arguments) {
     struct thread_key_args *args = (struct thread_key_args *) arguments;
     uint8_t local_enc[args->enc_len];
     memcpy(local_enc, args->enc, args->enc_len);
 
+    uint32_t *ks = calloc(ARRAYLEN(g_mifare_default_keys) * BS_WORDS, sizeof(uint32_t));
+    if (ks == NULL) {
+        free(args);
+        return NULL;
+    }
+    auth_keystream(args, g_mifare_default_keys, ARRAYLEN(g_mifare_default_keys), ks);
+
     for (uint8_t i = 0; i < ARRAYLEN(g_mifare_default_keys); i++) {
 
         uint64_t key = g_mifare_default_keys[i];
 
-        // Init cipher with key
-        struct Crypto1State *pcs = crypto1_create(key);
-
-        // NESTED decrypt nt with help of new key
-        crypto1_word(pcs, args->nt_enc ^ args->uid, 1);
-        crypto1_word(pcs, args->nr_enc, 1);
-        crypto1_word(pcs, 0, 0);
-        crypto1_word(pcs, 0, 0);
-
         // decrypt bytes
         uint8_t dec[args->enc_len];
-        for (int j = 0; j < args->enc_len; j++) {
-            dec[j] = crypto1_byte(pcs, 0x00, 0) ^ local_enc[j];
-        }
-        crypto1_destroy(pcs);
+        decrypt_bytes(ks + i * BS_WORDS, local_enc, args->enc_len, dec);
 
         // check if cmd exists
         bool res = checkValidCmdByte(dec, args->enc_len);
@@ -484,6 +495,7 @@ static void *check_default_keys(void *arguments) {
         pthread_mutex_unlock(&print_lock);
         break;
     }
+    free(ks);
     free(args);
     return NULL;
 }
@@ -594,50 +606,55 @@ static void *brute_thread(void *arguments) {
 static void *brute_key_thread(void *arguments) {
 
     struct thread_key_args *args = (struct thread_key_args *) arguments;
-    uint64_t key;
+    uint64_t keys[BS_BATCH];
     uint8_t local_enc[args->enc_len];
     memcpy(local_enc, args->enc, args->enc_len);
 
-    for (uint64_t count = args->idx; count <= 0xFFFF; count += thread_count) {
+    uint32_t *ks = calloc(BS_BATCH * BS_WORDS, sizeof(uint32_t));
+    if (ks == NULL) {
+        free(args);
+        return NULL;
+    }
+
+    bool found = false;
+    uint64_t count = args->idx;
+    while (count <= 0xFFFF && found == false) {
 
         if (__atomic_load_n(&global_found, __ATOMIC_ACQUIRE) == 1) {
             break;
         }
 
-        key = args->part_key | (count << 32);
+        // this thread's upper 16 bits, a batch at a time
+        uint32_t n = 0;
+        for (; n < BS_BATCH && count <= 0xFFFF; n++, count += thread_count) {
+            keys[n] = args->part_key | (count << 32);
+        }
+        auth_keystream(args, keys, n, ks);
 
-        // Init cipher with key
-        struct Crypto1State *pcs = crypto1_create(key);
+        for (uint32_t i = 0; i < n; i++) {
 
-        // NESTED decrypt nt with help of new key
-        crypto1_word(pcs, args->nt_enc ^ args->uid, 1);
-        crypto1_word(pcs, args->nr_enc, 1);
-        crypto1_word(pcs, 0, 0);
-        crypto1_word(pcs, 0, 0);
+            // decrypt 22 bytes
+            uint8_t dec[args->enc_len];
+            decrypt_bytes(ks + i * BS_WORDS, local_enc, args->enc_len, dec);
 
-        // decrypt 22 bytes
-        uint8_t dec[args->enc_len];
-        for (int i = 0; i < args->enc_len; i++) {
-            dec[i] = crypto1_byte(pcs, 0x00, 0) ^ local_enc[i];
-        }
+            // check if cmd exists
+            if (checkValidCmdByte(dec, args->enc_len) == false) {
+                continue;
+            }
 
-        crypto1_destroy(pcs);
+            __sync_fetch_and_add(&global_found, 1);
 
-        // check if cmd exists
-        if (checkValidCmdByte(dec, args->enc_len) == false) {
-            continue;
+            // lock this section to avoid interlacing prints from different threats
+            pthread_mutex_lock(&print_lock);
+            printf("\nenc:  %s\n", sprint_hex_inrow_ex(local_enc, args->enc_len, 0));
+            printf("dec:  %s\n", sprint_hex_inrow_ex(dec, args->enc_len, 0));
+            printf("\nValid Key found [ " _GREEN_("%012" PRIx64) " ]\n\n", keys[i]);
+            pthread_mutex_unlock(&print_lock);
+            found = true;
+            break;
         }
-
-        __sync_fetch_and_add(&global_found, 1);
-
-        // lock this section to avoid interlacing prints from different threats
-        pthread_mutex_lock(&print_lock);
-        printf("\nenc:  %s\n", sprint_hex_inrow_ex(local_enc, args->enc_len, 0));
-        printf("dec:  %s\n", sprint_hex_inrow_ex(dec, args->enc_len, 0));
-        printf("\nValid Key found [ " _GREEN_("%012" PRIx64) " ]\n\n", key);
-        pthread_mutex_unlock(&print_lock);
-        break;
     }
+    free(ks);
     free(args);
     return NULL;
 }
@@ -0,0 +1,267 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// lfsr_recovery32() states/s and crypto1_bs_words() keys/s per SIMD kernel,
+// checked against the scalar tables and crypto1_word()
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "crapto1/crapto1.h"
+
+#define AEND  "\x1b[0m"
+#define _RED_(s) "\x1b[31m" s AEND
+#define _GREEN_(s) "\x1b[32m" s AEND
+#define _YELLOW_(s) "\x1b[33m" s AEND
+
+#define BENCH_DEFAULT_RUNS  16
+#define BENCH_BS_KEYS       (1 << 14)   // per run
+#define BENCH_BS_WORDS      4           // as an authentication: uid ^ nt, nr, ar, at
+
+static const struct {
+    crapto1_simd_t instr;
+    const char *name;
+} bench_kernels[] = {
+    { CRAPTO1_SIMD_NONE,   "scalar" },
+    { CRAPTO1_SIMD_SSE2,   "SSE2" },
+    { CRAPTO1_SIMD_AVX2,   "AVX2" },
+    { CRAPTO1_SIMD_AVX512, "AVX512" },
+    { CRAPTO1_SIMD_NEON,   "NEON" },
+};
+
+typedef struct {
+    uint64_t states;
+    uint64_t digest;    // order independent, the kernels list the states in another order
+} bench_result_t;
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint32_t xorshift32(uint32_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int bench_run(const uint32_t *ks, const uint32_t *in, int runs, bench_result_t *res, double *ms) {
+    memset(res, 0, sizeof(bench_result_t));
+    double start = now_ms();
+    for (int r = 0; r < runs; r++) {
+        struct Crypto1State *sl = lfsr_recovery32(ks[r], in[r]);
+        if (sl == NULL) {
+            return 1;
+        }
+        for (struct Crypto1State *s = sl; s->odd | s->even; s++) {
+            res->states++;
+            res->digest += mix64(((uint64_t)s->odd << 32 | s->even) ^ r);
+        }
+        free(sl);
+    }
+    *ms = now_ms() - start;
+    return 0;
+}
+
+// crypto1_word() of every key, the reference of crypto1_bs_words()
+static void bench_bs_scalar(const uint64_t *keys, uint32_t count, const uint32_t *in, uint32_t enc, uint32_t *ks) {
+    for (uint32_t i = 0; i < count; i++) {
+        struct Crypto1State s;
+        crypto1_init(&s, keys[i]);
+        for (uint32_t w = 0; w < BENCH_BS_WORDS; w++) {
+            ks[i * BENCH_BS_WORDS + w] = crypto1_word(&s, in[w], (enc >> w) & 1);
+        }
+    }
+}
+
+// bitsliced crypto1 of all kernels against crypto1_word(), keys with any of the
+// encrypted flags and a count which is no multiple of the lanes
+static int bench_bs(int runs, uint32_t seed, crapto1_simd_t auto_instr) {
+    uint32_t count = BENCH_BS_KEYS - 3;
+    uint64_t *keys = calloc(count, sizeof(uint64_t));
+    uint32_t *ref = calloc(count * BENCH_BS_WORDS, sizeof(uint32_t));
+    uint32_t *ks = calloc(count * BENCH_BS_WORDS, sizeof(uint32_t));
+    if (keys == NULL || ref == NULL || ks == NULL) {
+        free(keys);
+        free(ref);
+        free(ks);
+        printf("out of memory\n");
+        return 1;
+    }
+
+    uint32_t s = seed;
+    for (uint32_t i = 0; i < count; i++) {
+        keys[i] = ((uint64_t)xorshift32(&s) << 16 ^ xorshift32(&s)) & 0xFFFFFFFFFFFFULL;
+    }
+
+    printf("\ncrypto1_bs_words benchmark, " _YELLOW_("%d") " runs of %u keys\n\n", runs, count);
+    printf(" kernel  | lanes |  time ms |     keys/s | speedup | check\n");
+    printf("---------+-------+----------+------------+---------+------\n");
+
+    double ref_ms = 0;
+    int fails = 0;
+
+    for (size_t k = 0; k < sizeof(bench_kernels) / sizeof(bench_kernels[0]); k++) {
+        if (crapto1_simd_supported(bench_kernels[k].instr) == false) {
+            continue;
+        }
+        crapto1_set_simd(bench_kernels[k].instr);
+
+        bool ok = true;
+        uint32_t r2 = seed;
+        double ms = 0;
+        for (int r = 0; r < runs; r++) {
+            uint32_t in[BENCH_BS_WORDS];
+            for (uint32_t w = 0; w < BENCH_BS_WORDS; w++) {
+                in[w] = (w < 2) ? xorshift32(&r2) : 0;
+            }
+            uint32_t enc = r & ((1 << BENCH_BS_WORDS) - 1);
+
+            double start = now_ms();
+            crypto1_bs_words(keys, count, in, enc, BENCH_BS_WORDS, ks);
+            ms += now_ms() - start;
+
+            bench_bs_scalar(keys, count, in, enc, ref);
+            ok &= (memcmp(ks, ref, count * BENCH_BS_WORDS * sizeof(uint32_t)) == 0);
+        }
+        if (bench_kernels[k].instr == CRAPTO1_SIMD_NONE) {
+            ref_ms = ms;
+        }
+
+        fails += (ok == false);
+        printf(" %-7s | %5u | %8.1f | %10.0f | %6.2fx | %s%s\n"
+               , bench_kernels[k].name
+               , crypto1_bs_lanes()
+               , ms
+               , (double)count * runs * 1000.0 / ms
+               , ref_ms / ms
+               , ok ? _GREEN_("ok") : _RED_("fail")
+               , (bench_kernels[k].instr == auto_instr) ? "  (auto)" : ""
+              );
+    }
+
+    // the crypto1_word() loop itself, what the tools ran before
+    double start = now_ms();
+    for (int r = 0; r < runs; r++) {
+        uint32_t in[BENCH_BS_WORDS] = { (uint32_t)r, 0, 0, 0 };
+        bench_bs_scalar(keys, count, in, 0, ref);
+    }
+    double ms = now_ms() - start;
+    printf(" %-7s |     1 | %8.1f | %10.0f | %6.2fx |\n", "crypto1", ms, (double)count * runs * 1000.0 / ms, ref_ms / ms);
+
+    free(keys);
+    free(ref);
+    free(ks);
+    return fails;
+}
+
+int main(int argc, char *argv[]) {
+
+    int runs = BENCH_DEFAULT_RUNS;
+    uint32_t seed = 0x1234ABCD;
+
+    if (argc > 3 || (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))) {
+        printf("syntax: %s [<runs> [<seed>]]\n", argv[0]);
+        printf("  runs   lfsr_recovery32() / crypto1_bs_words() calls per kernel, default %d\n", BENCH_DEFAULT_RUNS);
+        printf("  seed   hex seed of the keystreams\n");
+        return 1;
+    }
+    if (argc > 1) {
+        runs = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        sscanf(argv[2], "%x", &seed);
+    }
+    if (runs <= 0 || seed == 0) {
+        printf("invalid runs / seed\n");
+        return 1;
+    }
+
+    uint32_t *ks = calloc(runs, sizeof(uint32_t));
+    uint32_t *in = calloc(runs, sizeof(uint32_t));
+    if (ks == NULL || in == NULL) {
+        free(ks);
+        free(in);
+        return 1;
+    }
+    // half of the calls with an input, as mfkey32 (nr) and staticnested (uid ^ nt)
+    uint32_t s = seed;
+    for (int r = 0; r < runs; r++) {
+        ks[r] = xorshift32(&s);
+        in[r] = (r & 1) ? xorshift32(&s) : 0;
+    }
+
+    crapto1_simd_t auto_instr = crapto1_get_simd_auto();
+    printf("lfsr_recovery32 benchmark, " _YELLOW_("%d") " runs, seed %08x\n\n", runs, seed);
+    printf(" kernel  |   states |  time ms |   states/s | speedup | check\n");
+    printf("---------+----------+----------+------------+---------+------\n");
+
+    bench_result_t ref = {0};
+    double ref_ms = 0;
+    int fails = 0;
+
+    for (size_t k = 0; k < sizeof(bench_kernels) / sizeof(bench_kernels[0]); k++) {
+        if (crapto1_simd_supported(bench_kernels[k].instr) == false) {
+            continue;
+        }
+        crapto1_set_simd(bench_kernels[k].instr);
+
+        bench_result_t res;
+        double ms;
+        if (bench_run(ks, in, runs, &res, &ms)) {
+            printf("%-8s | out of memory\n", bench_kernels[k].name);
+            fails++;
+            continue;
+        }
+        if (bench_kernels[k].instr == CRAPTO1_SIMD_NONE) {
+            ref = res;
+            ref_ms = ms;
+        }
+
+        bool ok = (res.states == ref.states && res.digest == ref.digest);
+        fails += (ok == false);
+        printf(" %-7s | %8" PRIu64 " | %8.1f | %10.0f | %6.2fx | %s%s\n"
+               , bench_kernels[k].name
+               , res.states
+               , ms
+               , res.states * 1000.0 / ms
+               , ref_ms / ms
+               , ok ? _GREEN_("ok") : _RED_("fail")
+               , (bench_kernels[k].instr == auto_instr) ? "  (auto)" : ""
+              );
+    }
+
+    free(ks);
+    free(in);
+
+    fails += bench_bs(runs, seed, auto_instr);
+    crapto1_set_simd(CRAPTO1_SIMD_AUTO);
+
+    printf("\n%s\n", fails ? _RED_("kernels differ from the scalar code") : _GREEN_("all kernels match the scalar code"));
+    return fails ? 1 : 0;
+}
@@ -16,6 +16,8 @@ TESTMFDAESBRUTE=false
 TESTHITAG2CRACK=false
 TESTCRYPTORF=false
 TESTFPGACOMPRESS=false
+TESTPM3VIRTUAL=false
+TESTISO14BSIM=false
 TESTBOOTROM=false
 TESTARMSRC=false
 TESTCLIENT=false
@@ -28,7 +30,7 @@ while (( "$#" )); do
   case "$1" in
     -h|--help)
       echo """
-Usage: $0 [--long] [--opencl] [--clientbin /path/to/proxmark3] [mfkey|nonce2key|mf_nonce_brute|mfd_aes_brute|cryptorf|fpga_compress|bootrom|armsrc|client|recovery|common]
+Usage: $0 [--long] [--opencl] [--clientbin /path/to/proxmark3] [mfkey|nonce2key|mf_nonce_brute|mfd_aes_brute|cryptorf|fpga_compress|pm3_virtual|iso14b_sim|bootrom|armsrc|client|recovery|common]
     --long:          Enable slow tests
     --opencl:        Enable tests requiring OpenCL (preferably a Nvidia GPU)
     --clientbin ...: Specify path to proxmark3 binary to test
@@ -78,6 +80,16 @@ Usage: $0 [--long] [--opencl] [--clientbin /path/to/proxmark3] [mfkey|nonce2key|
       TESTMFDAESBRUTE=true
       shift
       ;;
+    pm3_virtual)
+      TESTALL=false
+      TESTPM3VIRTUAL=true
+      shift
+      ;;
+    iso14b_sim)
+      TESTALL=false
+      TESTISO14BSIM=true
+      shift
+      ;;
     fpga_compress)
       TESTALL=false
       TESTFPGACOMPRESS=true
@@ -284,15 +296,17 @@ while true; do
       if ! CheckFileExist "fpgacompress exists"            "$FPGACPMPRESSBIN"; then break; fi
     fi
     if $TESTALL || $TESTMFKEY; then
-      echo -e "\n${C_BLUE}Testing mfkey:${C_NC} ${MFKEY32V2BIN:=./tools/mfkey/mfkey32v2} ${MFKEY64BIN:=./tools/mfkey/mfkey64}  ${STATICNESTEDBIN:=./tools/mfkey/staticnested}"
+      echo -e "\n${C_BLUE}Testing mfkey:${C_NC} ${MFKEY32V2BIN:=./tools/mfkey/mfkey32v2} ${MFKEY64BIN:=./tools/mfkey/mfkey64}  ${STATICNESTEDBIN:=./tools/mfkey/staticnested}  ${CRAPTO1BENCHBIN:=./tools/mfkey/crapto1_bench}"
       if ! CheckFileExist "mfkey32v2 exists"               "$MFKEY32V2BIN"; then break; fi
       if ! CheckFileExist "mfkey64 exists"                 "$MFKEY64BIN"; then break; fi
       if ! CheckFileExist "staticnested exists"            "$STATICNESTEDBIN"; then break; fi
+      if ! CheckFileExist "crapto1_bench exists"           "$CRAPTO1BENCHBIN"; then break; fi
       # Need a decent example for mfkey32...
       if ! CheckExecute "mfkey32v2 test"                   "$MFKEY32V2BIN 12345678 1AD8DF2B 1D316024 620EF048 30D6CB07 C52077E2 837AC61A" "Found Key: \[a0a1a2a3a4a5\]"; then break; fi
       if ! CheckExecute "mfkey64 test"                     "$MFKEY64BIN 9c599b32 82a4166c a1e458ce 6eea41e0 5cadf439" "Found Key: \[ffffffffffff\]"; then break; fi
       if ! CheckExecute "mfkey64 long trace test"          "$MFKEY64BIN 14579f69 ce844261 f8049ccb 0525c84f 9431cc40 7093df99 9972428ce2e8523f456b99c831e769dced09 8ca6827b ab797fd369e8b93a86776b40dae3ef686efd c3c381ba 49e2c9def4868d1777670e584c27230286f4 fbdcd7c1 4abd964b07d3563aa066ed0a2eac7f6312bf 9f9149ea" "Found Key: \[091e639cb715\]"; then break; fi
       if ! CheckExecute "staticnested test"                "$STATICNESTEDBIN 461dce03 7eef3586 7fa28c7e 322bc14d 7f62b3d6" "\[ 2 \].*ffffffffff40.*"; then break; fi
+      if ! CheckExecute "crapto1 simd kernels test"        "$CRAPTO1BENCHBIN 4" "all kernels match"; then break; fi
     fi
     if $TESTALL || $TESTNONCE2KEY; then
       echo -e "\n${C_BLUE}Testing nonce2key:${C_NC} ${NONCE2KEYBIN:=./tools/nonce2key/nonce2key}"
@@ -312,6 +326,21 @@ while true; do
       if ! CheckExecute slow "mfd_aes_brute test 2/2"         "$MFDASEBRUTEBIN 1546300800 3fda933e2953ca5e6cfbbf95d1b51ddf 97fe4b5de24188458d102959b888938c988e96fb98469ce7426f50f108eaa583" "key.................... .*E757178E13516A4F3171BC6EA85E165A"; then break; fi
     fi
 
+    if $TESTALL || $TESTPM3VIRTUAL; then
+      echo -e "\n${C_BLUE}Testing pm3_virtual:${C_NC} ${PM3VIRTUALBIN:=./tools/pm3_virtual/pm3_virtual}"
+      if ! CheckFileExist "pm3_virtual exists"             "$PM3VIRTUALBIN"; then break; fi
+      if ! CheckExecute "pm3_virtual ping test"            "$PM3VIRTUALBIN -p 4399 -1 >/dev/null & sleep 0.5; exec 3<>/dev/tcp/127.0.0.1/4399; printf 'PM3a\\x04\\x80\\x09\\x01\\xde\\xad\\xbe\\xef\\x61\\x33' >&3; timeout 2 head -c 16 <&3 | od -An -tx1 | tr -d ' \\n'; exec 3>&-" "deadbeef"; then break; fi
+      if ! CheckFileExist "comms_flood exists"             "${COMMSFLOODBIN:=./tools/pm3_virtual/comms_flood}"; then break; fi
+      if ! CheckExecute "client reply queue flood test"    "$PM3VIRTUALBIN -p 4397 -1 -s ./tools/pm3_virtual/flood_script.txt >/dev/null & sleep 0.5; $COMMSFLOODBIN tcp:localhost:4397" "replies.* ok"; then break; fi
+    fi
+    if $TESTALL || $TESTISO14BSIM; then
+      echo -e "\n${C_BLUE}Testing iso14b_sim:${C_NC} ${ISO14BSIMBIN:=./tools/iso14b_sim/iso14b_sim}"
+      if ! CheckFileExist "iso14b_sim exists"              "$ISO14BSIMBIN"; then break; fi
+      if ! CheckExecute "iso14b_sim codec round trip test" "$ISO14BSIMBIN -n 10 ./tools/iso14b_sim/example_trace.txt" "demod .*ok"; then break; fi
+      if [ -x "${PM3VIRTUALBIN:=./tools/pm3_virtual/pm3_virtual}" ]; then
+        if ! CheckExecute "iso14b_sim tcp replay test"     "$PM3VIRTUALBIN -p 4398 -1 -s ./tools/iso14b_sim/example_script.txt >/dev/null & sleep 0.5; $ISO14BSIMBIN -n 1 -b 3000 -c tcp:localhost:4398 ./tools/iso14b_sim/example_trace.txt" "budget .*ok"; then break; fi
+      fi
+    fi
     if $TESTALL || $TESTCRYPTORF; then
       echo -e "\n${C_BLUE}Testing CryptoRF sma:${C_NC} ${CRYPTRFBRUTEBIN:=./tools/cryptorf/sma} ${CRYPTRF_MULTI_BRUTEBIN:=./tools/cryptorf/sma_multi}"
       if ! CheckFileExist "sma exists"               "$CRYPTRFBRUTEBIN"; then break; fi
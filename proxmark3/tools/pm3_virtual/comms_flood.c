@@ -0,0 +1,130 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Stress test of the client communication layer against pm3_virtual.
+//
+// Fills the client reply queue with floods of replies (see flood_script.txt), then
+// sends more commands than the transmit queue holds while nobody drains the replies.
+// The communication thread has to keep sending while it waits for room in the
+// reply queue, otherwise the sender blocks and replies get dropped.
+//-----------------------------------------------------------------------------
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "comms.h"
+#include "ui.h"
+#include "util.h"
+#include "util_posix.h"
+
+#define FLOOD_REPLIES        128    // replies to each CMD_PING, see flood_script.txt
+#define FLOOD_FILL           4      // requests sent to fill the reply queue
+#define FLOOD_PENDING        (TX_QUEUE_SIZE * 2)
+
+// the bits of the client comms.c depends on
+session_arg_t g_session;
+bool g_pendingPrompt = false;
+
+void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
+    if (level == DEBUG || level == INPLACE) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+int kbd_enter_pressed(void) {
+    return 0;
+}
+
+char *str_dup(const char *src) {
+    char *dst = calloc(strlen(src) + 1, sizeof(uint8_t));
+    if (dst) {
+        strcpy(dst, src);
+    }
+    return dst;
+}
+
+void str_lower(char *s) {
+    for (size_t i = 0; i < strlen(s); i++) {
+        s[i] = tolower(s[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Usage: %s tcp:localhost:<port>\n", argv[0]);
+        printf("  with  pm3_virtual -p <port> -s flood_script.txt\n");
+        return EXIT_FAILURE;
+    }
+
+    pm3_device_t *dev = NULL;
+    if (OpenProxmark(&dev, argv[1], false, 0, false, 0) == false) {
+        return EXIT_FAILURE;
+    }
+
+    // nobody reads, until the communication thread waits for room in the reply queue
+    for (int i = 0; i < FLOOD_FILL; i++) {
+        SendCommandNG(CMD_PING, NULL, 0);
+    }
+
+    comm_rx_stats_t rx;
+    uint64_t start = msclock();
+    do {
+        msleep(10);
+        GetCommunicationRxStats(&rx);
+    } while (rx.stalls == 0 && msclock() - start < 5000);
+
+    if (rx.stalls == 0) {
+        printf("reply queue never filled up\n");
+        CloseProxmark(dev);
+        return EXIT_FAILURE;
+    }
+
+    // more commands than the transmit queue holds, while the reply queue is full
+    start = msclock();
+    for (int i = 0; i < FLOOD_PENDING; i++) {
+        SendCommandNG(CMD_PING, NULL, 0);
+    }
+    uint64_t send_ms = msclock() - start;
+
+    uint32_t count = 0;
+    while (WaitForResponseTimeout(CMD_PING, NULL, 1000)) {
+        count++;
+    }
+    GetCommunicationRxStats(&rx);
+
+    uint32_t expected = (FLOOD_FILL + FLOOD_PENDING) * FLOOD_REPLIES;
+    bool ok = (count == expected) && (rx.dropped == 0) && (send_ms < RX_QUEUE_BACKPRESSURE_MS);
+    printf("sent %d commands in %" PRIu64 " ms, got %u / %u replies, %u stalls, %u dropped ... %s\n"
+           , FLOOD_PENDING
+           , send_ms
+           , count
+           , expected
+           , rx.stalls
+           , rx.dropped
+           , ok ? "ok" : "failed"
+          );
+
+    CloseProxmark(dev);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
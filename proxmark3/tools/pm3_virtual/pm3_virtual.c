@@ -0,0 +1,771 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Virtual Proxmark3 device.
+//
+// Listens on a TCP port and speaks the NG / MIX / OLD frame protocol, so the
+// client can connect to it with  `proxmark3 tcp:localhost:<port>`
+// Replies come from a script, a recorded trace / emulator dump and a few
+// built-in handlers (ping, capabilities, plain or LZ4 compressed bigbuf download).
+// Latency and bandwidth of the link can be emulated, which makes it usable for
+// benchmarking and regression testing the client without hardware.
+//-----------------------------------------------------------------------------
+
+#define __STDC_FORMAT_MACROS
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "common.h"
+#include "pm3_cmd.h"
+#include "crc16.h"
+#include "lz4.h"
+
+#define AEND  "\x1b[0m"
+#define _RED_(s) "\x1b[31m" s AEND
+#define _GREEN_(s) "\x1b[32m" s AEND
+#define _YELLOW_(s) "\x1b[33m" s AEND
+
+#define VPM3_DEFAULT_PORT     4321
+#define VPM3_BIGBUF_SIZE      40000
+#define VPM3_MAX_REPLIES      128
+#define VPM3_MAX_LINE         (PM3_CMD_DATA_SIZE * 2 + 256)
+
+// dummy, pm3_cmd.h declares it extern
+capabilities_t g_pm3_capabilities;
+
+typedef struct {
+    uint16_t cmd;
+    bool ng;
+    int16_t status;
+    uint64_t arg[3];
+    uint16_t len;
+    uint8_t data[PM3_CMD_DATA_SIZE];
+} vpm3_reply_t;
+
+typedef struct {
+    uint16_t req_cmd;
+    bool used;
+    uint16_t count;
+    vpm3_reply_t *replies;
+} vpm3_entry_t;
+
+typedef struct {
+    vpm3_entry_t *entries;
+    size_t count;
+} vpm3_script_t;
+
+typedef struct {
+    int fd;
+    uint32_t latency_ms;
+    uint32_t bandwidth;   // bytes per second, 0 = unlimited
+    bool verbose;
+    uint8_t *bigbuf;
+    uint32_t bigbuf_len;
+    uint32_t tracelen;
+    uint8_t *eml;
+    uint32_t eml_len;
+    vpm3_script_t script;
+    // statistics
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+} vpm3_ctx_t;
+
+static void msleep_(uint32_t ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {};
+}
+
+static void usleep_(uint64_t us) {
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {};
+}
+
+static int read_exact(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n == 0) {
+            return PM3_EIO;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return PM3_EIO;
+        }
+        p += n;
+        len -= n;
+    }
+    return PM3_SUCCESS;
+}
+
+static int write_exact(vpm3_ctx_t *ctx, const void *buf, size_t len) {
+
+    // emulate a slow link
+    if (ctx->bandwidth) {
+        usleep_((uint64_t)len * 1000000 / ctx->bandwidth);
+    }
+
+    const uint8_t *p = buf;
+    size_t left = len;
+    while (left) {
+        ssize_t n = send(ctx->fd, p, left, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return PM3_EIO;
+        }
+        p += n;
+        left -= n;
+    }
+    ctx->tx_frames++;
+    ctx->tx_bytes += len;
+    return PM3_SUCCESS;
+}
+
+static int reply_ng_internal(vpm3_ctx_t *ctx, uint16_t cmd, int16_t status, const uint8_t *data, size_t len, bool ng) {
+    PacketResponseNGRaw tx;
+    if (len > PM3_CMD_DATA_SIZE) {
+        len = PM3_CMD_DATA_SIZE;
+        status = PM3_EOVFLOW;
+    }
+    tx.pre.magic = RESPONSENG_PREAMBLE_MAGIC;
+    tx.pre.cmd = cmd;
+    tx.pre.status = status;
+    tx.pre.ng = ng;
+    tx.pre.length = len & 0x7FFF;
+    if (data && len) {
+        memcpy(tx.data, data, len);
+    }
+    PacketResponseNGPostamble *tx_post = (PacketResponseNGPostamble *)((uint8_t *)&tx + sizeof(PacketResponseNGPreamble) + len);
+    uint8_t first, second;
+    compute_crc(CRC_14443_A, (uint8_t *)&tx, sizeof(PacketResponseNGPreamble) + len, &first, &second);
+    tx_post->crc = (first << 8) | second;
+    return write_exact(ctx, &tx, sizeof(PacketResponseNGPreamble) + len + sizeof(PacketResponseNGPostamble));
+}
+
+static int reply_ng(vpm3_ctx_t *ctx, uint16_t cmd, int16_t status, const uint8_t *data, size_t len) {
+    return reply_ng_internal(ctx, cmd, status, data, len, true);
+}
+
+static int reply_mix(vpm3_ctx_t *ctx, uint16_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, const uint8_t *data, size_t len) {
+    uint64_t arg[3] = {arg0, arg1, arg2};
+    int16_t status = PM3_SUCCESS;
+    if (len > PM3_CMD_DATA_SIZE_MIX) {
+        len = PM3_CMD_DATA_SIZE_MIX;
+        status = PM3_EOVFLOW;
+    }
+    uint8_t buf[PM3_CMD_DATA_SIZE];
+    memcpy(buf, arg, sizeof(arg));
+    if (data && len) {
+        memcpy(buf + sizeof(arg), data, len);
+    }
+    return reply_ng_internal(ctx, cmd, status, buf, len + sizeof(arg), false);
+}
+
+static int reply_old(vpm3_ctx_t *ctx, uint16_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, const uint8_t *data, size_t len) {
+    PacketResponseOLD tx;
+    memset(&tx, 0, sizeof(tx));
+    tx.cmd = cmd;
+    tx.arg[0] = arg0;
+    tx.arg[1] = arg1;
+    tx.arg[2] = arg2;
+    if (data && len) {
+        memcpy(tx.d.asBytes, data, MIN(len, PM3_CMD_DATA_SIZE));
+    }
+    return write_exact(ctx, &tx, sizeof(tx));
+}
+
+//-----------------------------------------------------------------------------
+// script handling
+//
+//  # comment
+//  <request cmd> <reply cmd> ng  <status> <hex payload | ->
+//  <request cmd> <reply cmd> mix <arg0> <arg1> <arg2> <hex payload | ->
+//  <request cmd> none
+//  + <reply cmd> ...       adds one more reply to the previous request
+//
+//  Entries for the same request command are consumed in order, the last one repeats.
+//-----------------------------------------------------------------------------
+static int parse_hex(const char *s, uint8_t *out, uint16_t *outlen) {
+    *outlen = 0;
+    if (s == NULL || strcmp(s, "-") == 0) {
+        return PM3_SUCCESS;
+    }
+    size_t n = strlen(s);
+    if (n & 1) {
+        return PM3_EINVARG;
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        if (*outlen >= PM3_CMD_DATA_SIZE || !isxdigit((int)s[i]) || !isxdigit((int)s[i + 1])) {
+            return PM3_EINVARG;
+        }
+        unsigned int b;
+        sscanf(s + i, "%2x", &b);
+        out[(*outlen)++] = b & 0xFF;
+    }
+    return PM3_SUCCESS;
+}
+
+static int parse_reply(char **tok, int ntok, vpm3_reply_t *r) {
+    memset(r, 0, sizeof(vpm3_reply_t));
+    if (ntok < 3) {
+        return PM3_EINVARG;
+    }
+
+    r->cmd = strtoul(tok[0], NULL, 0) & 0xFFFF;
+
+    if (strcmp(tok[1], "ng") == 0) {
+        r->ng = true;
+        r->status = (int16_t)strtol(tok[2], NULL, 0);
+        return parse_hex(ntok > 3 ? tok[3] : NULL, r->data, &r->len);
+    }
+
+    if (strcmp(tok[1], "mix") == 0) {
+        if (ntok < 5) {
+            return PM3_EINVARG;
+        }
+        r->ng = false;
+        r->arg[0] = strtoull(tok[2], NULL, 0);
+        r->arg[1] = strtoull(tok[3], NULL, 0);
+        r->arg[2] = strtoull(tok[4], NULL, 0);
+        int res = parse_hex(ntok > 5 ? tok[5] : NULL, r->data, &r->len);
+        if (r->len > PM3_CMD_DATA_SIZE_MIX) {
+            return PM3_EOVFLOW;
+        }
+        return res;
+    }
+    return PM3_EINVARG;
+}
+
+static int load_script(const char *fn, vpm3_script_t *script) {
+    FILE *f = fopen(fn, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Can't open script %s\n", fn);
+        return PM3_EFILE;
+    }
+
+    char line[VPM3_MAX_LINE];
+    int lineno = 0;
+    int res = PM3_SUCCESS;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+
+        char *tok[8];
+        int ntok = 0;
+        for (char *p = strtok(line, " \t\r\n"); p && ntok < 8; p = strtok(NULL, " \t\r\n")) {
+            tok[ntok++] = p;
+        }
+
+        if (ntok == 0 || tok[0][0] == '#') {
+            continue;
+        }
+
+        vpm3_entry_t *e;
+        char **rtok;
+        int nrtok;
+
+        if (strcmp(tok[0], "+") == 0) {
+            if (script->count == 0) {
+                res = PM3_EINVARG;
+                break;
+            }
+            e = &script->entries[script->count - 1];
+            rtok = tok + 1;
+            nrtok = ntok - 1;
+        } else {
+            if (ntok < 2) {
+                res = PM3_EINVARG;
+                break;
+            }
+            vpm3_entry_t *tmp = realloc(script->entries, (script->count + 1) * sizeof(vpm3_entry_t));
+            if (tmp == NULL) {
+                res = PM3_EMALLOC;
+                break;
+            }
+            script->entries = tmp;
+            e = &script->entries[script->count++];
+            memset(e, 0, sizeof(vpm3_entry_t));
+            e->req_cmd = strtoul(tok[0], NULL, 0) & 0xFFFF;
+
+            if (strcmp(tok[1], "none") == 0) {
+                continue;
+            }
+            rtok = tok + 1;
+            nrtok = ntok - 1;
+        }
+
+        if (e->count >= VPM3_MAX_REPLIES) {
+            res = PM3_EOVFLOW;
+            break;
+        }
+
+        vpm3_reply_t *tmp = realloc(e->replies, (e->count + 1) * sizeof(vpm3_reply_t));
+        if (tmp == NULL) {
+            res = PM3_EMALLOC;
+            break;
+        }
+        e->replies = tmp;
+
+        res = parse_reply(rtok, nrtok, &e->replies[e->count]);
+        if (res != PM3_SUCCESS) {
+            break;
+        }
+        e->count++;
+    }
+
+    fclose(f);
+
+    if (res != PM3_SUCCESS) {
+        fprintf(stderr, "Script %s, error on line %d\n", fn, lineno);
+    }
+    return res;
+}
+
+static void reset_script(vpm3_script_t *script) {
+    for (size_t i = 0; i < script->count; i++) {
+        script->entries[i].used = false;
+    }
+}
+
+static void free_script(vpm3_script_t *script) {
+    for (size_t i = 0; i < script->count; i++) {
+        free(script->entries[i].replies);
+    }
+    free(script->entries);
+    script->entries = NULL;
+    script->count = 0;
+}
+
+static vpm3_entry_t *find_entry(vpm3_script_t *script, uint16_t cmd) {
+    vpm3_entry_t *first = NULL;
+    size_t left = 0;
+    for (size_t i = 0; i < script->count; i++) {
+        vpm3_entry_t *e = &script->entries[i];
+        if (e->req_cmd == cmd && e->used == false) {
+            if (first == NULL) {
+                first = e;
+            }
+            left++;
+        }
+    }
+    // the last entry for a command keeps on answering
+    if (first && left > 1) {
+        first->used = true;
+    }
+    return first;
+}
+
+static int load_file(const char *fn, uint8_t **data, uint32_t *len, uint32_t maxlen) {
+    FILE *f = fopen(fn, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return PM3_EFILE;
+    }
+    *data = calloc(maxlen, sizeof(uint8_t));
+    if (*data == NULL) {
+        fclose(f);
+        return PM3_EMALLOC;
+    }
+    *len = fread(*data, 1, maxlen, f);
+    fclose(f);
+    return PM3_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// built-in handlers, mimics armsrc/appmain.c
+//-----------------------------------------------------------------------------
+static int send_capabilities(vpm3_ctx_t *ctx) {
+    capabilities_t cap;
+    memset(&cap, 0, sizeof(cap));
+    cap.version = CAPABILITIES_VERSION;
+    cap.baudrate = 115200;
+    cap.bigbuf_size = VPM3_BIGBUF_SIZE;
+    cap.via_usb = true;
+    cap.compiled_with_lf = true;
+    cap.compiled_with_hfsniff = true;
+    cap.compiled_with_iso14443a = true;
+    cap.compiled_with_iso14443b = true;
+    cap.compiled_with_iso15693 = true;
+    return reply_ng(ctx, CMD_CAPABILITIES, PM3_SUCCESS, (uint8_t *)&cap, sizeof(cap));
+}
+
+static int send_download(vpm3_ctx_t *ctx, const uint8_t *mem, uint32_t memlen, uint32_t start, uint32_t numofbytes, uint16_t rec_cmd, uint32_t tracelen) {
+    for (uint32_t i = 0; i < numofbytes; i += PM3_CMD_DATA_SIZE) {
+        uint32_t len = MIN(numofbytes - i, PM3_CMD_DATA_SIZE);
+        uint8_t chunk[PM3_CMD_DATA_SIZE] = {0};
+        if (mem && start + i < memlen) {
+            memcpy(chunk, mem + start + i, MIN(len, memlen - (start + i)));
+        }
+        int res = reply_old(ctx, rec_cmd, i, len, tracelen, chunk, len);
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+    }
+    sample_config sc = { 1, 8, 1, 95, 0, 0, false };
+    return reply_mix(ctx, CMD_ACK, 1, 0, tracelen, (uint8_t *)&sc, sizeof(sc));
+}
+
+// same as DownloadBigBufLZ4() in armsrc/appmain.c
+static int send_download_lz4(vpm3_ctx_t *ctx, const uint8_t *mem, uint32_t memlen, uint32_t start, uint32_t numofbytes, uint32_t tracelen) {
+    uint8_t *src = calloc(numofbytes, sizeof(uint8_t));
+    if (src == NULL) {
+        return PM3_EMALLOC;
+    }
+    if (mem && start < memlen) {
+        memcpy(src, mem + start, MIN(numofbytes, memlen - start));
+    }
+
+    int res = PM3_SUCCESS;
+    uint8_t out[PM3_CMD_DATA_SIZE_MIX];
+    uint32_t i = 0;
+    while (i < numofbytes) {
+        int srclen = numofbytes - i;
+        int complen = LZ4_compress_destSize((const char *)src + i, (char *)out, &srclen, sizeof(out));
+        if (complen <= 0 || srclen <= 0) {
+            res = PM3_ESOFT;
+            break;
+        }
+        res = reply_mix(ctx, CMD_DOWNLOADED_BIGBUF_LZ4, i, srclen, tracelen, out, complen);
+        if (res != PM3_SUCCESS) {
+            break;
+        }
+        i += srclen;
+    }
+    free(src);
+
+    if (res != PM3_SUCCESS) {
+        return res;
+    }
+    sample_config sc = { 1, 8, 1, 95, 0, 0, false };
+    return reply_mix(ctx, CMD_ACK, 1, 0, tracelen, (uint8_t *)&sc, sizeof(sc));
+}
+
+static int handle_builtin(vpm3_ctx_t *ctx, const PacketCommandNG *packet) {
+    switch (packet->cmd) {
+        case CMD_PING:
+            return reply_ng(ctx, CMD_PING, PM3_SUCCESS, packet->data.asBytes, packet->length);
+        case CMD_CAPABILITIES:
+            return send_capabilities(ctx);
+        case CMD_BUFF_CLEAR:
+            return PM3_SUCCESS;
+        case CMD_DOWNLOAD_BIGBUF:
+            if (packet->oldarg[2] & DOWNLOAD_BIGBUF_FLAG_LZ4) {
+                return send_download_lz4(ctx, ctx->bigbuf, ctx->bigbuf_len, packet->oldarg[0], packet->oldarg[1], ctx->tracelen);
+            }
+            return send_download(ctx, ctx->bigbuf, ctx->bigbuf_len, packet->oldarg[0], packet->oldarg[1], CMD_DOWNLOADED_BIGBUF, ctx->tracelen);
+        case CMD_DOWNLOAD_EML_BIGBUF:
+            return send_download(ctx, ctx->eml, ctx->eml_len, packet->oldarg[0], packet->oldarg[1], CMD_DOWNLOADED_EML_BIGBUF, 0);
+        default:
+            if (ctx->verbose) {
+                printf("  no reply for " _YELLOW_("0x%04x") "\n", packet->cmd);
+            }
+            return PM3_SUCCESS;
+    }
+}
+
+static int handle_packet(vpm3_ctx_t *ctx, const PacketCommandNG *packet) {
+
+    ctx->rx_frames++;
+
+    if (ctx->verbose) {
+        printf("RX %s cmd " _GREEN_("0x%04x") " len %u\n", packet->ng ? "NG " : "MIX", packet->cmd, packet->length);
+    }
+
+    if (ctx->latency_ms) {
+        msleep_(ctx->latency_ms);
+    }
+
+    vpm3_entry_t *e = find_entry(&ctx->script, packet->cmd);
+    if (e == NULL) {
+        return handle_builtin(ctx, packet);
+    }
+
+    for (uint16_t i = 0; i < e->count; i++) {
+        const vpm3_reply_t *r = &e->replies[i];
+        int res;
+        if (r->ng) {
+            res = reply_ng(ctx, r->cmd, r->status, r->data, r->len);
+        } else {
+            res = reply_mix(ctx, r->cmd, r->arg[0], r->arg[1], r->arg[2], r->data, r->len);
+        }
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+    }
+    return PM3_SUCCESS;
+}
+
+// read one frame from the client, mimics receive_ng_internal() in armsrc/cmd.c
+static int receive_packet(vpm3_ctx_t *ctx, PacketCommandNG *rx) {
+    PacketCommandNGRaw rx_raw;
+
+    int res = read_exact(ctx->fd, &rx_raw.pre, sizeof(PacketCommandNGPreamble));
+    if (res != PM3_SUCCESS) {
+        return res;
+    }
+
+    memset(rx, 0, sizeof(PacketCommandNG));
+    rx->magic = rx_raw.pre.magic;
+
+    if (rx->magic == COMMANDNG_PREAMBLE_MAGIC) {
+        uint16_t length = rx_raw.pre.length;
+        rx->ng = rx_raw.pre.ng;
+        rx->cmd = rx_raw.pre.cmd;
+
+        if (length > PM3_CMD_DATA_SIZE) {
+            return PM3_EOVFLOW;
+        }
+
+        if (length) {
+            res = read_exact(ctx->fd, rx_raw.data, length);
+            if (res != PM3_SUCCESS) {
+                return res;
+            }
+        }
+
+        res = read_exact(ctx->fd, &rx_raw.foopost, sizeof(PacketCommandNGPostamble));
+        if (res != PM3_SUCCESS) {
+            return res;
+        }
+
+        rx->crc = rx_raw.foopost.crc;
+        if (rx->crc != COMMANDNG_POSTAMBLE_MAGIC) {
+            uint8_t first, second;
+            compute_crc(CRC_14443_A, (uint8_t *)&rx_raw, sizeof(PacketCommandNGPreamble) + length, &first, &second);
+            if ((first << 8) + second != rx->crc) {
+                return PM3_EIO;
+            }
+        }
+
+        if (rx->ng) {
+            memcpy(rx->data.asBytes, rx_raw.data, length);
+            rx->length = length;
+        } else {
+            uint64_t arg[3];
+            if (length < sizeof(arg)) {
+                return PM3_EIO;
+            }
+            memcpy(arg, rx_raw.data, sizeof(arg));
+            rx->oldarg[0] = arg[0];
+            rx->oldarg[1] = arg[1];
+            rx->oldarg[2] = arg[2];
+            memcpy(rx->data.asBytes, rx_raw.data + sizeof(arg), length - sizeof(arg));
+            rx->length = length - sizeof(arg);
+        }
+        return PM3_SUCCESS;
+    }
+
+    // Old style command
+    PacketCommandOLD rx_old;
+    memcpy(&rx_old, &rx_raw.pre, sizeof(PacketCommandNGPreamble));
+    res = read_exact(ctx->fd, ((uint8_t *)&rx_old) + sizeof(PacketCommandNGPreamble), sizeof(PacketCommandOLD) - sizeof(PacketCommandNGPreamble));
+    if (res != PM3_SUCCESS) {
+        return res;
+    }
+    rx->ng = false;
+    rx->magic = 0;
+    rx->crc = 0;
+    rx->cmd = rx_old.cmd;
+    rx->oldarg[0] = rx_old.arg[0];
+    rx->oldarg[1] = rx_old.arg[1];
+    rx->oldarg[2] = rx_old.arg[2];
+    rx->length = PM3_CMD_DATA_SIZE;
+    memcpy(rx->data.asBytes, rx_old.d.asBytes, rx->length);
+    return PM3_SUCCESS;
+}
+
+static void serve(vpm3_ctx_t *ctx) {
+    PacketCommandNG rx;
+
+    reset_script(&ctx->script);
+    ctx->rx_frames = 0;
+    ctx->tx_frames = 0;
+    ctx->tx_bytes = 0;
+
+    int res;
+    while ((res = receive_packet(ctx, &rx)) == PM3_SUCCESS) {
+        if (handle_packet(ctx, &rx) != PM3_SUCCESS) {
+            break;
+        }
+    }
+
+    printf("Client disconnected, rx " _YELLOW_("%" PRIu64) " frames, tx " _YELLOW_("%" PRIu64) " frames / " _YELLOW_("%" PRIu64) " bytes\n"
+           , ctx->rx_frames
+           , ctx->tx_frames
+           , ctx->tx_bytes
+          );
+}
+
+static void usage(const char *prog) {
+    printf("Virtual Proxmark3 device, connect with  `proxmark3 tcp:localhost:<port>`\n\n");
+    printf("Usage: %s [options]\n", prog);
+    printf("  -p, --port <n>          TCP port to listen on (default %d)\n", VPM3_DEFAULT_PORT);
+    printf("  -s, --script <file>     scripted replies\n");
+    printf("  -t, --trace <file>      serve this file as BigBuf, tracelen = file size\n");
+    printf("  -b, --bigbuf <file>     serve this file as BigBuf, e.g. LF samples, tracelen = 0\n");
+    printf("  -e, --eml <file>        serve this file as emulator memory\n");
+    printf("  -l, --latency <ms>      delay before answering each command\n");
+    printf("  -w, --bandwidth <B/s>   limit the link bandwidth\n");
+    printf("  -1, --once              exit after the first client disconnects\n");
+    printf("  -v, --verbose           log every frame\n");
+    printf("\nScript format:\n");
+    printf("  <request cmd> <reply cmd> ng  <status> <hex payload | ->\n");
+    printf("  <request cmd> <reply cmd> mix <arg0> <arg1> <arg2> <hex payload | ->\n");
+    printf("  <request cmd> none\n");
+    printf("  + <reply cmd> ...        more replies to the previous request\n");
+    printf("  Entries for the same request are consumed in order, the last one repeats.\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    vpm3_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    uint16_t port = VPM3_DEFAULT_PORT;
+    bool once = false;
+
+    static const struct option long_options[] = {
+        {"port",      required_argument, NULL, 'p'},
+        {"script",    required_argument, NULL, 's'},
+        {"trace",     required_argument, NULL, 't'},
+        {"bigbuf",    required_argument, NULL, 'b'},
+        {"eml",       required_argument, NULL, 'e'},
+        {"latency",   required_argument, NULL, 'l'},
+        {"bandwidth", required_argument, NULL, 'w'},
+        {"once",      no_argument,       NULL, '1'},
+        {"verbose",   no_argument,       NULL, 'v'},
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "p:s:t:b:e:l:w:1vh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'p':
+                port = strtoul(optarg, NULL, 0) & 0xFFFF;
+                break;
+            case 's':
+                if (load_script(optarg, &ctx.script) != PM3_SUCCESS) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+            case 'b':
+                free(ctx.bigbuf);
+                if (load_file(optarg, &ctx.bigbuf, &ctx.bigbuf_len, VPM3_BIGBUF_SIZE) != PM3_SUCCESS) {
+                    return EXIT_FAILURE;
+                }
+                ctx.tracelen = (c == 't') ? ctx.bigbuf_len : 0;
+                break;
+            case 'e':
+                free(ctx.eml);
+                if (load_file(optarg, &ctx.eml, &ctx.eml_len, VPM3_BIGBUF_SIZE) != PM3_SUCCESS) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                ctx.latency_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                ctx.bandwidth = strtoul(optarg, NULL, 0);
+                break;
+            case '1':
+                once = true;
+                break;
+            case 'v':
+                ctx.verbose = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sfd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    int one = 1;
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sfd, 1) < 0) {
+        perror("bind");
+        close(sfd);
+        return EXIT_FAILURE;
+    }
+
+    printf("Virtual Proxmark3 listening on " _GREEN_("tcp:localhost:%u") "\n", port);
+    printf("  script entries %zu, bigbuf %u bytes, eml %u bytes, latency %u ms, bandwidth %u B/s\n"
+           , ctx.script.count
+           , ctx.bigbuf_len
+           , ctx.eml_len
+           , ctx.latency_ms
+           , ctx.bandwidth
+          );
+    fflush(stdout);
+
+    do {
+        ctx.fd = accept(sfd, NULL, NULL);
+        if (ctx.fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        setsockopt(ctx.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        printf("Client connected\n");
+        fflush(stdout);
+        serve(&ctx);
+        close(ctx.fd);
+        fflush(stdout);
+    } while (once == false);
+
+    close(sfd);
+    free_script(&ctx.script);
+    free(ctx.bigbuf);
+    free(ctx.eml);
+    return EXIT_SUCCESS;
+}
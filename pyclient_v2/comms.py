@@ -4,6 +4,12 @@ import crcmod.predefined
 import threading
 import time
 
+# Codec NG natif (client/experimental_lib, pm3_pywrap) quand il est disponible
+try:
+    import _pm3 as native
+except ImportError:
+    native = None
+
 
 # Définir les constantes
 CMD_PING = 0x0109
@@ -40,10 +46,19 @@ def serial_reader(port):
         buffer = b''  # Buffer pour accumuler les données reçues
 
         while True:
-            data = ser.read(1)  # Lire un octet à la fois
+            # tout ce qui est disponible, sinon attente bloquante d'un octet (timeout du port)
+            data = ser.read(ser.in_waiting or 1)
             if data:
                 buffer += data
 
+                if native:
+                    frames, buffer = native.frame_decode(buffer)
+                    for cmd, status, received_data in frames:
+                        print("Received cmd:", hex(cmd), "status:", status, "len:", len(received_data))
+                        print("Received Data:", received_data.hex(), " | ", received_data.decode('ascii', errors='ignore'))
+                        print ("___________________________________________________________________________________________________________")
+                    continue
+
                 # Vérifier si nous avons un postambule complet  
                 if len(buffer) >= 4 and buffer[-2:] == COMMANDNG_POSTAMBLE_MAGIC :
                     response = buffer
@@ -63,8 +78,6 @@ def serial_reader(port):
                             
             else:
                 print(".")
-            
-            time.sleep(0.1)  # Attente courte pour éviter une utilisation excessive du CPU
         
         ser.close()
     except Exception as e:
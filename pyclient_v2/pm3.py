@@ -17,5 +17,12 @@ CMD_HF_CHECK = 0x0A04
 CMD_PY = 0x0A05
 CMD_PY_CLIENT_SIM = 0x0A06
 CMD_PY_CLIENT_DATA = 0x0A07
+CMD_PY_CLIENT_FRAME = 0x0A08
+CMD_DEBUG_PRINT_STRING = 0x0100
+
+# CMD_PY_CLIENT_FRAME flags
+PY_CLIENT_FRAME_READER = 0x01
+PY_CLIENT_FRAME_CARD = 0x02
+PY_CLIENT_FRAME_WTX_MISS = 0x04
 CMD_BREAK_LOOP = 0x0118
     
@@ -20,7 +20,7 @@ from re import T
 import serial
 import threading
 import argparse
-from utils import Debug, pmfw_print, stylized_banner, bytes_to_hex_string, only_apdu
+from utils import Debug, pmfw_print, stylized_banner, bytes_to_hex_string
 from colorama import init, Fore, Style
 import struct
 import sys
@@ -30,12 +30,24 @@ from apdu import RAPDU
 from pm3 import *
 from Cardlet_Calypso import CalypsoCard
 
+# Codec NG et lecture natifs : module _pm3 de client/experimental_lib (pm3_pywrap)
+# Sans lui on reste sur pyserial et le codec python
+try:
+    import _pm3 as native
+except ImportError:
+    native = None
+
 # Constants PM3 
 TX_COMMANDNG_PREAMBLE_MAGIC = b"PM3a"  # 0x504d3361 PM3a 61334D50 a3MP  # But 
 TX_COMMANDNG_POSTAMBLE_MAGIC = b"a3"   # 0x6133
 RX_COMMANDNG_PREAMBLE_MAGIC = b"PM3b"  # 0x504d3362
 RX_COMMANDNG_POSTAMBLE_MAGIC = b"b3"   # 0x6233
 PM3_CMD_DATA_SIZE = 512
+RX_COMMANDNG_PREAMBLE_SIZE = 10  # magic(4) length:15|ng:1(2) status(2) cmd(2)
+RX_COMMANDNG_POSTAMBLE_SIZE = 2  # crc or b"b3"
+
+# CMD_PY_CLIENT_FRAME payload, see py_client_frame_t in pm3_cmd.h
+PY_CLIENT_FRAME_HEADER = struct.Struct('<IIBH')  # sof, eof, flags, len
 
 # Constant PYPM3
 
@@ -57,6 +69,7 @@ debug = Debug()
 class ProxmarkDevice:
     def __init__(self):
         self.serial_port = None
+        self.native = None      # pm3 du client C quand _pm3 est disponible
         self.run = False
         self.communication_thread = None
 
@@ -67,38 +80,79 @@ def uart_open(port, speed):
         debug.error(f"SerialException: {e}")
         return None
 
+# Découpe les réponses NG complètes du buffer
+# Retourne la liste des (cmd, status, payload) et le reste du buffer
+def parse_frames(buffer):
+    if native:
+        return native.frame_decode(buffer)
+    frames = []
+    while True:
+        start = buffer.find(RX_COMMANDNG_PREAMBLE_MAGIC)
+        if start == -1:
+            # garder un début de preambule éventuel
+            return frames, buffer[-(len(RX_COMMANDNG_PREAMBLE_MAGIC) - 1):]
+        buffer = buffer[start:]
+        if len(buffer) < RX_COMMANDNG_PREAMBLE_SIZE:
+            return frames, buffer
+
+        length_ng, status, cmd = struct.unpack_from('<HhH', buffer, 4)
+        length = length_ng & 0x7FFF
+        if length > PM3_CMD_DATA_SIZE:
+            # faux preambule, resynchronisation
+            buffer = buffer[1:]
+            continue
+
+        total = RX_COMMANDNG_PREAMBLE_SIZE + length + RX_COMMANDNG_POSTAMBLE_SIZE
+        if len(buffer) < total:
+            return frames, buffer
+
+        frames.append((cmd, status, buffer[RX_COMMANDNG_PREAMBLE_SIZE:RX_COMMANDNG_PREAMBLE_SIZE + length]))
+        buffer = buffer[total:]
+
+
+def handle_frame(cmd, status, payload, show_out):
+    if cmd == CMD_PY_CLIENT_FRAME:
+        if len(payload) < PY_CLIENT_FRAME_HEADER.size:
+            debug.error(f"Short relay frame: {payload.hex()}")
+            return
+        sof, eof, flags, length = PY_CLIENT_FRAME_HEADER.unpack_from(payload)
+        data = payload[PY_CLIENT_FRAME_HEADER.size:PY_CLIENT_FRAME_HEADER.size + length]
+        debug.warning(f"Relay frame: flags {flags:#x} sof {sof} eof {eof} | {data.hex()}")
+        # Seuls les Iblocks du lecteur sont traités par la carte python
+        if (flags & PY_CLIENT_FRAME_READER) and data[:1] in Iblock:
+            received_queue.put(data)
+        if flags & PY_CLIENT_FRAME_WTX_MISS:
+            # la réponse python est arrivée trop tard, le PM3 a renvoyé un S(WTX)
+            debug.warning(f"WTX miss at {sof}: answer later than the granted waiting time")
+        if show_out:
+            direction = "RDR" if flags & PY_CLIENT_FRAME_READER else "TAG"
+            with display_lock:
+                pmfw_print(f"{direction} {sof:>10} {eof - sof:>6}us | {bytes_to_hex_string(data)}")
+    elif cmd == CMD_DEBUG_PRINT_STRING:
+        # flag(2) + texte
+        if show_out:
+            with display_lock:
+                pmfw_print(payload[2:].decode('ascii', errors='ignore'))
+    else:
+        debug.warning(f"Received response: cmd {cmd:#06x} status {status} | {payload.hex()}")
+
+
 # Serial Reader Task
-# Fonction de lecture série
+# Lecture des trames NG : on lit ce qui est disponible et on découpe par longueur
 def serial_reader_task(dev, show_out):
     try:
         buffer = b''
         while dev.run:
             try:
-                data = dev.serial_port.read(64)  # Lecture par blocs de 64 octets
+                data = dev.serial_port.read(dev.serial_port.in_waiting or 1)
                 if data:
                     buffer += data
-
-                    # Vérification de la présence du postambule complet
-                    while buffer.find(RX_COMMANDNG_POSTAMBLE_MAGIC) != -1:
-                        end_index = buffer.find(RX_COMMANDNG_POSTAMBLE_MAGIC) + len(RX_COMMANDNG_POSTAMBLE_MAGIC)
-                        response = buffer[:end_index]
-                        buffer = buffer[end_index:]
-
-                        # Décomposition de la réponse en parties spécifiques
-                        if len(response) >= 4:
-                            received_data_len = response[4]
-                            received_data = response[12:12 + received_data_len - 2]
-                            debug.warning(f"Received response: {response.hex()} | {response.decode('ascii', errors='ignore')}")
-                            debug.warning(f"Received Data len: {hex(received_data_len)} | {str(received_data_len)}")
-                            debug.warning(f"Received Data: {received_data.hex()} | {received_data.decode('ascii', errors='ignore')}")
-                            received_queue.put(received_data.decode('ascii', errors='ignore'))  # Ajouter la commande reçue à la queue. Format cmd : XXXXXXXX
-                            if show_out:
-                                with display_lock:
-                                    pmfw_print(received_data.decode('ascii', errors='ignore')) # Format cmd : XX XX XX XX
+                    frames, buffer = parse_frames(buffer)
+                    for cmd, status, payload in frames:
+                        handle_frame(cmd, status, payload, show_out)
             except serial.SerialException as e:
                 debug.error(f"Communication error: {e}")
                 dev.run = False
-            time.sleep(0.01)  # Attente courte pour éviter de bloquer le thread
     except Exception as e:
         debug.error(f"Unexpected error in communication thread: {e}")
     finally:
@@ -106,7 +160,27 @@ def serial_reader_task(dev, show_out):
             dev.serial_port.close()
 
 
+# Native Reader Task
+# Le thread de communication du client C lit les trames, on ne fait que les récupérer
+def native_reader_task(dev, show_out):
+    try:
+        while dev.run:
+            frame = native.recv(dev.native, 100)
+            if frame is not None:
+                handle_frame(*frame, show_out)
+    except Exception as e:
+        debug.error(f"Unexpected error in communication thread: {e}")
+
+
 def open_proxmark(dev, port, wait_for_port, timeout, flash_mode, speed, print_out):
+    if native:
+        debug.print(f"Using native client on {port}")
+        dev.native = native.new_pm3(port)
+        dev.run = True
+        dev.communication_thread = threading.Thread(target=native_reader_task, args=(dev, print_out))
+        dev.communication_thread.start()
+        return True
+
     if wait_for_port:
         debug.print(f"Waiting for Proxmark3 to appear on {port}")
         open_count = 0
@@ -131,30 +205,31 @@ def open_proxmark(dev, port, wait_for_port, timeout, flash_mode, speed, print_ou
     dev.communication_thread.start()
     return True
 
-def send_command(serial_port, cmd, data):
+def send_command(dev, cmd, data):
     if cmd == CMD_PY_CLIENT_DATA :
-        print(f"Envoi d'une donnée : {data}")  # Afficher en hexadécimal
+        debug.print(f"Envoi d'une donnée : {data}")
     else:
-        print(f"Envoi d'une commande : {cmd}")
-
-    # Préparation des données
-    cmd_bytes = struct.pack('<H', cmd)
-    preamble = struct.pack('<4sB', TX_COMMANDNG_PREAMBLE_MAGIC, len(data))
-    ng_flag = struct.pack('<B', 0x80)
-    command = struct.pack('<H', cmd_bytes[1] << 8 | cmd_bytes[0])
-    data_packet = data
-    command_packet = preamble + ng_flag + command + data_packet + TX_COMMANDNG_POSTAMBLE_MAGIC
-
-    # Envoyer la commande
-    serial_port.write(command_packet)
+        debug.print(f"Envoi d'une commande : {cmd}")
+
+    if dev.native:
+        native.send(dev.native, cmd, data)
+        return
+
+    if native:
+        command_packet = native.frame_encode(cmd, data)
+    else:
+        # preambule : magic, longueur (15 bits) + ng (bit 15), commande
+        preamble = struct.pack('<4sHH', TX_COMMANDNG_PREAMBLE_MAGIC, len(data) | 0x8000, cmd)
+        command_packet = preamble + data + TX_COMMANDNG_POSTAMBLE_MAGIC
+
+    dev.serial_port.write(command_packet)
     debug.warning(f"Commande envoyée: {command_packet.hex()}")
-    time.sleep(0.2)
     
     
 # Pour envoyer des données au proxmark. Le FW le reçoit via usb et le transmet au lecteur via RF.. 
 # Idéé: Pond PC/SC coté Carte ?
-def send_data(serial_port, data):
-    send_command(serial_port, CMD_PY_CLIENT_DATA, data)
+def send_data(dev, data):
+    send_command(dev, CMD_PY_CLIENT_DATA, data)
     
 
 
@@ -196,40 +271,36 @@ def main():
             print("Proxmark3 ouvert et communication démarrée.")
             print("Envoi de la commande CMD_PY_CLIENT_SIM...")
             uid = b'\xDD\xCC\xBB\xAA'
-            send_command(proxmark_device.serial_port, CMD_PY_CLIENT_SIM, uid)
+            send_command(proxmark_device, CMD_PY_CLIENT_SIM, uid)
             # Emulation loop
             while proxmark_device.run:
                 try:
-                    receivedCmd = received_queue.get_nowait()
-                    capdu = only_apdu(receivedCmd)
-                    print(f"C-APDU: {capdu}")
-                    if (capdu[0] == b'\x94') and (capdu[1] == b'\xA4'):
+                    # attente bloquante : la réponse part dès que la TPDU arrive
+                    receivedCmd = received_queue.get(timeout=0.1)  # TPDU brute : PCB CLA INS P1 P2 ...
+                    print(f"C-TPDU: {bytes_to_hex_string(receivedCmd)}")
+                    if receivedCmd[1:3] == b'\x94\xA4':
                         print(f"Command SELECT")
-                        response = CalypsoCard.process_tpdu(card, receivedCmd)
-                        time.sleep(0.1)
-                        print(response)
-                        send_data(proxmark_device.serial_port, response)
-                    time.sleep(0.1)
                     response = CalypsoCard.process_tpdu(card, receivedCmd)
-                    time.sleep(0.1)
                     print(response)
                     #response = bytes.fromhex("85 17 04 04 02 10 01 1F 12 00 00 01 01 01 01 00 00 00 00 00 00 00 00 00 00 90 00")
-                    send_data(proxmark_device.serial_port, response)
+                    send_data(proxmark_device, response)
                     received_queue.task_done()
                 except queue.Empty:
                     pass  # Do nothing if the queue is empty
-                time.sleep(0.1)
         else:
             debug.error("Échec de l'ouverture de Proxmark3.")
             
     except KeyboardInterrupt:
-        send_command(proxmark_device.serial_port, CMD_BREAK_LOOP, b'')
+        send_command(proxmark_device, CMD_BREAK_LOOP, b'')
         print("CTRL+C. Fermeture...")
         proxmark_device.run = False
         # stop the communication thread
         proxmark_device.communication_thread.join()
         time.sleep(0.1)
-        proxmark_device.serial_port.close()
+        if proxmark_device.native:
+            native.delete_pm3(proxmark_device.native)
+        elif proxmark_device.serial_port:
+            proxmark_device.serial_port.close()
         sys.exit(0)  # Exit cleanly after closing the serial port
     except Exception as e:
         debug.error(f"An error occurred: {e}")